@@ -6,7 +6,6 @@
 
 #include <algorithm>
 #include <iterator>
-#include <list>
 
 #include "base/i18n/case_conversion.h"
 #include "base/string16.h"
@@ -19,39 +18,15 @@
 #include "chrome/browser/profiles/profile.h"
 #include "ui/base/l10n/l10n_util.h"
 
-// Used when finding the set of bookmarks that match a query. Each match
-// represents a set of terms (as an interator into the Index) matching the
-// query as well as the set of nodes that contain those terms in their titles.
-struct BookmarkIndex::Match {
-  // List of terms matching the query.
-  std::list<Index::const_iterator> terms;
+namespace {
 
-  // The set of nodes matching the terms. As an optimization this is empty
-  // when we match only one term, and is filled in when we get more than one
-  // term. We can do this as when we have only one matching term we know
-  // the set of matching nodes is terms.front()->second.
-  //
-  // Use nodes_begin() and nodes_end() to get an iterator over the set as
-  // it handles the necessary switching between nodes and terms.front().
-  NodeSet nodes;
-
-  // Returns an iterator to the beginning of the matching nodes. See
-  // description of nodes for why this should be used over nodes.begin().
-  NodeSet::const_iterator nodes_begin() const;
-
-  // Returns an iterator to the beginning of the matching nodes. See
-  // description of nodes for why this should be used over nodes.end().
-  NodeSet::const_iterator nodes_end() const;
-};
-
-BookmarkIndex::NodeSet::const_iterator
-    BookmarkIndex::Match::nodes_begin() const {
-  return nodes.empty() ? terms.front()->second.begin() : nodes.begin();
+// Returns true if |word| starts with |prefix|.
+bool StartsWithPrefix(const string16& word, const string16& prefix) {
+  return word.size() >= prefix.size() &&
+      prefix.compare(0, prefix.size(), word, 0, prefix.size()) == 0;
 }
 
-BookmarkIndex::NodeSet::const_iterator BookmarkIndex::Match::nodes_end() const {
-  return nodes.empty() ? terms.front()->second.end() : nodes.end();
-}
+}  // namespace
 
 BookmarkIndex::BookmarkIndex(content::BrowserContext* browser_context)
     : browser_context_(browser_context) {
@@ -64,8 +39,12 @@ void BookmarkIndex::Add(const BookmarkNode* node) {
   if (!node->is_url())
     return;
   std::vector<string16> terms = ExtractQueryWords(node->GetTitle());
+  // A title may contain a word more than once.
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
   for (size_t i = 0; i < terms.size(); ++i)
     RegisterNode(terms[i], node);
+  ResetLastQuery();
 }
 
 void BookmarkIndex::Remove(const BookmarkNode* node) {
@@ -75,6 +54,7 @@ void BookmarkIndex::Remove(const BookmarkNode* node) {
   std::vector<string16> terms = ExtractQueryWords(node->GetTitle());
   for (size_t i = 0; i < terms.size(); ++i)
     UnregisterNode(terms[i], node);
+  ResetLastQuery();
 }
 
 void BookmarkIndex::GetBookmarksWithTitlesMatching(
@@ -85,14 +65,31 @@ void BookmarkIndex::GetBookmarksWithTitlesMatching(
   if (terms.empty())
     return;
 
-  Matches matches;
+  // When the user types on, only the words that changed since the last query
+  // need to be matched against the nodes that matched it.
+  NodeVector nodes;
+  bool have_nodes = false;
+  if (ExtendsLastQuery(terms)) {
+    nodes.swap(last_matches_);
+    have_nodes = true;
+  } else {
+    last_query_terms_.clear();
+    typed_counts_.clear();
+  }
   for (size_t i = 0; i < terms.size(); ++i) {
-    if (!GetBookmarksWithTitleMatchingTerm(terms[i], i == 0, &matches))
-      return;
+    if (i < last_query_terms_.size() && terms[i] == last_query_terms_[i])
+      continue;
+    if (!GetBookmarksWithTitleMatchingTerm(terms[i], !have_nodes, &nodes))
+      break;
+    have_nodes = true;
   }
+  last_query_terms_ = terms;
+  last_matches_ = nodes;
+  if (nodes.empty())
+    return;
 
   NodeTypedCountPairs node_typed_counts;
-  SortMatches(matches, &node_typed_counts);
+  SortMatches(nodes, &node_typed_counts);
 
   // We use a QueryParser to fill in match positions for us. It's not the most
   // efficient way to go about this, but by the time we get here we know what
@@ -111,8 +108,8 @@ void BookmarkIndex::GetBookmarksWithTitlesMatching(
     AddMatchToResults(i->first, &parser, query_nodes.get(), results);
 }
 
-void BookmarkIndex::SortMatches(const Matches& matches,
-                                NodeTypedCountPairs* node_typed_counts) const {
+void BookmarkIndex::SortMatches(const NodeVector& nodes,
+                                NodeTypedCountPairs* node_typed_counts) {
   HistoryService* const history_service = browser_context_ ?
       HistoryServiceFactory::GetForProfile(
           Profile::FromBrowserContext(browser_context_),
@@ -121,30 +118,26 @@ void BookmarkIndex::SortMatches(const Matches& matches,
   history::URLDatabase* url_db = history_service ?
       history_service->InMemoryDatabase() : NULL;
 
-  for (Matches::const_iterator i = matches.begin(); i != matches.end(); ++i)
-    ExtractBookmarkNodePairs(url_db, *i, node_typed_counts);
-
-  std::sort(node_typed_counts->begin(), node_typed_counts->end(),
-            &NodeTypedCountPairSortFunc);
-  // Eliminate duplicates.
-  node_typed_counts->erase(std::unique(node_typed_counts->begin(),
-                                       node_typed_counts->end()),
-                           node_typed_counts->end());
-}
-
-void BookmarkIndex::ExtractBookmarkNodePairs(
-    history::URLDatabase* url_db,
-    const Match& match,
-    NodeTypedCountPairs* node_typed_counts) const {
-
-  for (NodeSet::const_iterator i = match.nodes_begin();
-       i != match.nodes_end(); ++i) {
+  node_typed_counts->reserve(nodes.size());
+  for (NodeVector::const_iterator i = nodes.begin(); i != nodes.end(); ++i) {
+    TypedCounts::const_iterator cached = typed_counts_.find(*i);
+    if (cached != typed_counts_.end()) {
+      node_typed_counts->push_back(*cached);
+      continue;
+    }
     history::URLRow url;
     if (url_db)
       url_db->GetRowForURL((*i)->url(), &url);
     NodeTypedCountPair pair(*i, url.typed_count());
+    // Until the in-memory database is loaded every typed count is zero, so
+    // only cache the ones read from it.
+    if (url_db)
+      typed_counts_.insert(pair);
     node_typed_counts->push_back(pair);
   }
+
+  std::sort(node_typed_counts->begin(), node_typed_counts->end(),
+            &NodeTypedCountPairSortFunc);
 }
 
 void BookmarkIndex::AddMatchToResults(
@@ -167,84 +160,67 @@ void BookmarkIndex::AddMatchToResults(
 
 bool BookmarkIndex::GetBookmarksWithTitleMatchingTerm(const string16& term,
                                                       bool first_term,
-                                                      Matches* matches) {
-  Index::const_iterator i = index_.lower_bound(term);
-  if (i == index_.end())
-    return false;
-
-  if (!QueryParser::IsWordLongEnoughForPrefixSearch(term)) {
-    // Term is too short for prefix match, compare using exact match.
-    if (i->first != term)
-      return false;  // No bookmarks with this term.
-
+                                                      NodeVector* nodes) {
+  // Terms too short for a prefix match only match themselves.
+  const bool prefix_match = QueryParser::IsWordLongEnoughForPrefixSearch(term);
+  NodeVector result;
+  size_t list_count = 0;
+  for (Index::iterator i = index_.lower_bound(term);
+       i != index_.end() && StartsWithPrefix(i->first, term); ++i) {
+    if (!prefix_match && i->first != term)
+      break;
+    const NodeVector& list = GetSortedNodes(&i->second);
     if (first_term) {
-      Match match;
-      match.terms.push_back(i);
-      matches->push_back(match);
-      return true;
-    }
-    CombineMatchesInPlace(i, matches);
-  } else if (first_term) {
-    // This is the first term and we're doing a prefix match. Loop through
-    // index adding all entries that start with term to matches.
-    while (i != index_.end() &&
-           i->first.size() >= term.size() &&
-           term.compare(0, term.size(), i->first, 0, term.size()) == 0) {
-      Match match;
-      match.terms.push_back(i);
-      matches->push_back(match);
-      ++i;
-    }
-  } else {
-    // Prefix match and not the first term. Loop through index combining
-    // current matches in matches with term, placing result in result.
-    Matches result;
-    while (i != index_.end() &&
-           i->first.size() >= term.size() &&
-           term.compare(0, term.size(), i->first, 0, term.size()) == 0) {
-      CombineMatches(i, *matches, &result);
-      ++i;
+      result.insert(result.end(), list.begin(), list.end());
+    } else {
+      std::set_intersection(nodes->begin(), nodes->end(),
+                            list.begin(), list.end(),
+                            std::back_inserter(result));
     }
-    matches->swap(result);
+    ++list_count;
+    if (!prefix_match)
+      break;
   }
-  return !matches->empty();
+  // A node whose title has several words starting with |term| is in several
+  // of the lists.
+  if (list_count > 1) {
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+  }
+  nodes->swap(result);
+  return !nodes->empty();
 }
 
-void BookmarkIndex::CombineMatchesInPlace(const Index::const_iterator& index_i,
-                                          Matches* matches) {
-  for (size_t i = 0; i < matches->size(); ) {
-    Match* match = &((*matches)[i]);
-    NodeSet intersection;
-    std::set_intersection(match->nodes_begin(), match->nodes_end(),
-                          index_i->second.begin(), index_i->second.end(),
-                          std::inserter(intersection, intersection.begin()));
-    if (intersection.empty()) {
-      matches->erase(matches->begin() + i);
-    } else {
-      match->terms.push_back(index_i);
-      match->nodes.swap(intersection);
-      ++i;
+bool BookmarkIndex::ExtendsLastQuery(const std::vector<string16>& terms) const {
+  if (last_query_terms_.empty() || terms.size() < last_query_terms_.size())
+    return false;
+  for (size_t i = 0; i < last_query_terms_.size(); ++i) {
+    const string16& last_term = last_query_terms_[i];
+    if (terms[i] == last_term)
+      continue;
+    // Only a prefix match of the last term covers every lengthened term.
+    if (!QueryParser::IsWordLongEnoughForPrefixSearch(last_term) ||
+        !StartsWithPrefix(terms[i], last_term)) {
+      return false;
     }
   }
+  return true;
 }
 
-void BookmarkIndex::CombineMatches(const Index::const_iterator& index_i,
-                                   const Matches& current_matches,
-                                   Matches* result) {
-  for (size_t i = 0; i < current_matches.size(); ++i) {
-    const Match& match = current_matches[i];
-    NodeSet intersection;
-    std::set_intersection(match.nodes_begin(), match.nodes_end(),
-                          index_i->second.begin(), index_i->second.end(),
-                          std::inserter(intersection, intersection.begin()));
-    if (!intersection.empty()) {
-      result->push_back(Match());
-      Match& combined_match = result->back();
-      combined_match.terms = match.terms;
-      combined_match.terms.push_back(index_i);
-      combined_match.nodes.swap(intersection);
-    }
+void BookmarkIndex::ResetLastQuery() {
+  last_query_terms_.clear();
+  last_matches_.clear();
+  typed_counts_.clear();
+}
+
+// static
+const BookmarkIndex::NodeVector& BookmarkIndex::GetSortedNodes(
+    PostingList* list) {
+  if (!list->sorted) {
+    std::sort(list->nodes.begin(), list->nodes.end());
+    list->sorted = true;
   }
+  return list->nodes;
 }
 
 std::vector<string16> BookmarkIndex::ExtractQueryWords(const string16& query) {
@@ -260,12 +236,12 @@ std::vector<string16> BookmarkIndex::ExtractQueryWords(const string16& query) {
 
 void BookmarkIndex::RegisterNode(const string16& term,
                                  const BookmarkNode* node) {
-  if (std::find(index_[term].begin(), index_[term].end(), node) !=
-      index_[term].end()) {
-    // We've already added node for term.
-    return;
-  }
-  index_[term].insert(node);
+  // Nodes are mostly added while loading, so only sort the list when it is
+  // queried.
+  PostingList& list = index_[term];
+  if (!list.nodes.empty() && !(list.nodes.back() < node))
+    list.sorted = false;
+  list.nodes.push_back(node);
 }
 
 void BookmarkIndex::UnregisterNode(const string16& term,
@@ -276,7 +252,8 @@ void BookmarkIndex::UnregisterNode(const string16& term,
     // example, a bookmark with the title 'foo foo' would end up here.
     return;
   }
-  i->second.erase(node);
-  if (i->second.empty())
+  NodeVector& nodes = i->second.nodes;
+  nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
+  if (nodes.empty())
     index_.erase(i);
 }
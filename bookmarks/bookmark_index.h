@@ -6,7 +6,6 @@
 #define CHROME_BROWSER_BOOKMARKS_BOOKMARK_INDEX_H_
 
 #include <map>
-#include <set>
 #include <vector>
 
 #include "base/basictypes.h"
@@ -32,9 +31,17 @@ class URLDatabase;
 // look up. BookmarkIndex is owned and maintained by BookmarkModel, you
 // shouldn't need to interact directly with BookmarkIndex.
 //
-// BookmarkIndex maintains the index (index_) as a map of sets. The map (type
-// Index) maps from a lower case string to the set (type NodeSet) of
-// BookmarkNodes that contain that string in their title.
+// BookmarkIndex maintains the index (index_) as a map of posting lists. The
+// map (type Index) maps from a lower case string to the BookmarkNodes that
+// contain that string in their title. The map is ordered, so the strings
+// starting with a prefix are adjacent. Each posting list is a flat vector of
+// nodes, sorted on the first query after nodes were added to it.
+//
+// The omnibox queries the index on every keystroke. To make that cheap the
+// index remembers the nodes matching the last query; if the next query only
+// extends its words, those nodes are narrowed down instead of searching the
+// index again. Typed counts are looked up once per node for such a sequence
+// of queries.
 class BookmarkIndex {
  public:
   explicit BookmarkIndex(content::BrowserContext* browser_context);
@@ -53,29 +60,31 @@ class BookmarkIndex {
       std::vector<bookmark_utils::TitleMatch>* results);
 
  private:
-  typedef std::set<const BookmarkNode*> NodeSet;
-  typedef std::map<string16, NodeSet> Index;
+  typedef std::vector<const BookmarkNode*> NodeVector;
+
+  // The nodes containing a string in their title.
+  struct PostingList {
+    PostingList() : sorted(true) {}
 
-  struct Match;
-  typedef std::vector<Match> Matches;
+    NodeVector nodes;
+
+    // False if nodes were appended since |nodes| was last sorted.
+    bool sorted;
+  };
+  typedef std::map<string16, PostingList> Index;
 
   // Pairs BookmarkNodes and the number of times the nodes' URLs were typed.
-  // Used to sort Matches in decreasing order of typed count.
+  // Used to sort matches in decreasing order of typed count.
   typedef std::pair<const BookmarkNode*, int> NodeTypedCountPair;
   typedef std::vector<NodeTypedCountPair> NodeTypedCountPairs;
 
-  // Extracts |matches.nodes| into NodeTypedCountPairs, sorts the pairs in
-  // decreasing order of typed count, and then de-dupes the matches.
-  void SortMatches(const Matches& matches,
-                   NodeTypedCountPairs* node_typed_counts) const;
+  typedef std::map<const BookmarkNode*, int> TypedCounts;
 
-  // Extracts BookmarkNodes from |match| and retrieves typed counts for each
-  // node from the in-memory database. Inserts pairs containing the node and
-  // typed count into the vector |node_typed_counts|. |node_typed_counts| is
-  // sorted in decreasing order of typed count.
-  void ExtractBookmarkNodePairs(history::URLDatabase* url_db,
-                                const Match& match,
-                                NodeTypedCountPairs* node_typed_counts) const;
+  // Retrieves the typed count of each of |nodes| and inserts pairs containing
+  // the node and typed count into |node_typed_counts|, sorted in decreasing
+  // order of typed count.
+  void SortMatches(const NodeVector& nodes,
+                   NodeTypedCountPairs* node_typed_counts);
 
   // Sort function for NodeTypedCountPairs. We sort in decreasing order of typed
   // count so that the best matches will always be added to the results.
@@ -90,33 +99,23 @@ class BookmarkIndex {
                          const std::vector<QueryNode*>& query_nodes,
                          std::vector<bookmark_utils::TitleMatch>* results);
 
-  // Populates |matches| for the specified term. If |first_term| is true, this
-  // is the first term in the query. Returns true if there is at least one node
-  // matching the term.
+  // Sets |nodes| to the nodes matching |term|. If |first_term| is false,
+  // |nodes| holds the nodes matching the previous terms of the query and is
+  // intersected with the nodes matching |term| instead. Returns true if there
+  // is at least one node left.
   bool GetBookmarksWithTitleMatchingTerm(const string16& term,
                                          bool first_term,
-                                         Matches* matches);
-
-  // Iterates over |matches| updating each Match's nodes to contain the
-  // intersection of the Match's current nodes and the nodes at |index_i|.
-  // If the intersection is empty, the Match is removed.
-  //
-  // This is invoked from GetBookmarksWithTitleMatchingTerm.
-  void CombineMatchesInPlace(const Index::const_iterator& index_i,
-                             Matches* matches);
-
-  // Iterates over |current_matches| calculating the intersection between the
-  // Match's nodes and the nodes at |index_i|. If the intersection between the
-  // two is non-empty, a new match is added to |result|.
-  //
-  // This differs from CombineMatchesInPlace in that if the intersection is
-  // non-empty the result is added to result, not combined in place. This
-  // variant is used for prefix matching.
-  //
-  // This is invoked from GetBookmarksWithTitleMatchingTerm.
-  void CombineMatches(const Index::const_iterator& index_i,
-                      const Matches& current_matches,
-                      Matches* result);
+                                         NodeVector* nodes);
+
+  // Returns true if every word of |terms| that the last query had too only
+  // lengthens it, so that |terms| match a subset of |last_matches_|.
+  bool ExtendsLastQuery(const std::vector<string16>& terms) const;
+
+  // Forgets the last query, as the index or typed counts changed.
+  void ResetLastQuery();
+
+  // Returns the sorted nodes of |list|.
+  static const NodeVector& GetSortedNodes(PostingList* list);
 
   // Returns the set of query words from |query|.
   std::vector<string16> ExtractQueryWords(const string16& query);
@@ -129,6 +128,13 @@ class BookmarkIndex {
 
   Index index_;
 
+  // The words of the last query and the nodes matching all of them, sorted.
+  std::vector<string16> last_query_terms_;
+  NodeVector last_matches_;
+
+  // Typed counts of the nodes matching the queries since ResetLastQuery().
+  TypedCounts typed_counts_;
+
   content::BrowserContext* browser_context_;
 
   DISALLOW_COPY_AND_ASSIGN(BookmarkIndex);
@@ -0,0 +1,95 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string>
+#include <vector>
+
+#include "base/memory/scoped_vector.h"
+#include "base/perftimer.h"
+#include "base/stringprintf.h"
+#include "base/utf_string_conversions.h"
+#include "chrome/browser/bookmarks/bookmark_index.h"
+#include "chrome/browser/bookmarks/bookmark_model.h"
+#include "chrome/browser/bookmarks/bookmark_utils.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+// The number of bookmarks in the index.
+const int kBookmarkCount = 100000;
+
+// The maximum number of results the omnibox asks for.
+const size_t kMaxMatches = 3;
+
+const char* const kWords[] = {
+  "google", "maps", "mail", "news", "weather", "recipes", "chromium", "code",
+  "review", "issues", "wikipedia", "article", "history", "travel", "flights",
+  "hotels", "shopping", "books", "music", "video", "photos", "calendar",
+  "docs", "reader", "finance", "sports", "science", "health", "jobs", "blog",
+};
+
+// Queries as the user types them into the omnibox, one per keystroke.
+const char* const kTypedQueries[] = {
+  "g", "go", "goo", "goog", "googl", "google", "google ", "google m",
+  "google ma", "google map", "google maps", "c", "ch", "chr", "chro",
+  "chrom", "chromium", "chromium ", "chromium i", "chromium is",
+  "chromium iss", "chromium issu", "chromium issues", "w", "we", "wea",
+  "weat", "weath", "weathe", "weather",
+};
+
+// Returns a title of two to four words, with a number to make most titles
+// unique, e.g. "maps travel 1234".
+string16 MakeTitle(int i) {
+  const size_t word_count = arraysize(kWords);
+  std::string title = kWords[i % word_count];
+  title += " ";
+  title += kWords[(i / word_count) % word_count];
+  if (i % 3 == 0) {
+    title += " ";
+    title += kWords[(i / 7) % word_count];
+  }
+  title += base::StringPrintf(" %d", i % 5000);
+  return UTF8ToUTF16(title);
+}
+
+}  // namespace
+
+// Indexes 100k bookmarks and replays queries typed into the omnibox.
+TEST(BookmarkIndexPerfTest, TypedQueries) {
+  ScopedVector<BookmarkNode> nodes;
+  for (int i = 0; i < kBookmarkCount; ++i) {
+    BookmarkNode* node = new BookmarkNode(
+        i + 1, GURL(base::StringPrintf("http://www.site%d.com/", i)));
+    node->SetTitle(MakeTitle(i));
+    nodes.push_back(node);
+  }
+
+  BookmarkIndex index(NULL);
+  {
+    PerfTimeLogger timer("BookmarkIndex_add_100k");
+    for (size_t i = 0; i < nodes.size(); ++i)
+      index.Add(nodes[i]);
+  }
+
+  size_t match_count = 0;
+  PerfTimer timer;
+  for (size_t i = 0; i < arraysize(kTypedQueries); ++i) {
+    std::vector<bookmark_utils::TitleMatch> matches;
+    index.GetBookmarksWithTitlesMatching(ASCIIToUTF16(kTypedQueries[i]),
+                                         kMaxMatches, &matches);
+    match_count += matches.size();
+  }
+  LogPerfResult("BookmarkIndex_typed_query_100k",
+                timer.Elapsed().InMicroseconds() /
+                    static_cast<double>(arraysize(kTypedQueries)),
+                "us/query");
+  EXPECT_GT(match_count, 0u);
+
+  {
+    PerfTimeLogger timer("BookmarkIndex_remove_1k");
+    for (size_t i = 0; i < 1000; ++i)
+      index.Remove(nodes[i * 100]);
+  }
+}
@@ -230,6 +230,39 @@ TEST_F(BookmarkIndexTest, EmptyMatchOnMultiwideLowercaseString) {
   EXPECT_TRUE(matches[0].match_positions.empty());
 }
 
+// Makes sure queries that extend the previous query, as when the user types
+// into the omnibox, return the same matches as a new query.
+TEST_F(BookmarkIndexTest, ExtendedQueries) {
+  const char* input[] = { "abcd efgh", "abce", "abcd", "xyz", "ab", "abxy" };
+  AddBookmarksWithTitles(input, ARRAYSIZE_UNSAFE(input));
+
+  const char* abc[] = { "abcd efgh", "abce", "abcd" };
+  ExpectMatches("abc", abc, ARRAYSIZE_UNSAFE(abc));
+  const char* abcd[] = { "abcd efgh", "abcd" };
+  ExpectMatches("abcd", abcd, ARRAYSIZE_UNSAFE(abcd));
+  const char* abcd_efg[] = { "abcd efgh" };
+  ExpectMatches("abcd efg", abcd_efg, ARRAYSIZE_UNSAFE(abcd_efg));
+  ExpectMatches("abcd efgx", NULL, 0U);
+  const char* xyz[] = { "xyz" };
+  ExpectMatches("xyz", xyz, ARRAYSIZE_UNSAFE(xyz));
+
+  // A term too short for a prefix match only matches itself, so the matches
+  // of a longer term aren't a subset of its matches.
+  const char* ab[] = { "ab" };
+  ExpectMatches("ab", ab, ARRAYSIZE_UNSAFE(ab));
+  const char* abx[] = { "abxy" };
+  ExpectMatches("abx", abx, ARRAYSIZE_UNSAFE(abx));
+
+  // Changes to the index are seen by the next query.
+  ExpectMatches("abc", abc, ARRAYSIZE_UNSAFE(abc));
+  model_->AddURL(model_->other_node(), 0, ASCIIToUTF16("abcd ijk"),
+                 GURL("about:blank"));
+  const char* abcd_added[] = { "abcd efgh", "abcd", "abcd ijk" };
+  ExpectMatches("abcd", abcd_added, ARRAYSIZE_UNSAFE(abcd_added));
+  model_->Remove(model_->other_node(), 0);
+  ExpectMatches("abcd", abcd, ARRAYSIZE_UNSAFE(abcd));
+}
+
 TEST_F(BookmarkIndexTest, GetResultsSortedByTypedCount) {
   // This ensures MessageLoop::current() will exist, which is needed by
   // TestingProfile::BlockUntilHistoryProcessesPendingRequests().
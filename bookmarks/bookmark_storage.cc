@@ -5,12 +5,15 @@
 #include "chrome/browser/bookmarks/bookmark_storage.h"
 
 #include "base/bind.h"
+#include "base/bind_helpers.h"
 #include "base/compiler_specific.h"
 #include "base/file_path.h"
 #include "base/file_util.h"
+#include "base/files/important_file_writer.h"
 #include "base/json/json_file_value_serializer.h"
 #include "base/json/json_string_value_serializer.h"
 #include "base/metrics/histogram.h"
+#include "base/sequenced_task_runner.h"
 #include "base/time.h"
 #include "chrome/browser/bookmarks/bookmark_codec.h"
 #include "chrome/browser/bookmarks/bookmark_model.h"
@@ -46,6 +49,49 @@ void AddBookmarksToIndex(BookmarkLoadDetails* details,
   }
 }
 
+// A copy of the persisted state of the bookmark model, encoded and written on
+// the sequenced task runner.
+struct BookmarkSnapshot {
+  scoped_ptr<BookmarkNode> bb_node;
+  scoped_ptr<BookmarkNode> other_folder_node;
+  scoped_ptr<BookmarkNode> mobile_folder_node;
+  std::string model_meta_info;
+};
+
+// Returns a copy of |node| and its children with the fields BookmarkCodec
+// encodes.
+BookmarkNode* CopyNode(const BookmarkNode* node) {
+  BookmarkNode* copy = new BookmarkNode(node->id(), node->url());
+  copy->set_type(node->type());
+  copy->SetTitle(node->GetTitle());
+  copy->set_date_added(node->date_added());
+  copy->set_date_folder_modified(node->date_folder_modified());
+  copy->set_meta_info_str(node->meta_info_str());
+  for (int i = 0; i < node->child_count(); ++i)
+    copy->Add(CopyNode(node->GetChild(i)), i);
+  return copy;
+}
+
+bool SerializeValue(const Value& value, std::string* output) {
+  JSONStringValueSerializer serializer(output);
+  serializer.set_pretty_print(true);
+  return serializer.Serialize(value);
+}
+
+void SaveCallback(const FilePath& path, const BookmarkSnapshot* snapshot) {
+  TimeTicks start_time = TimeTicks::Now();
+  BookmarkCodec codec;
+  scoped_ptr<Value> value(codec.Encode(snapshot->bb_node.get(),
+                                       snapshot->other_folder_node.get(),
+                                       snapshot->mobile_folder_node.get(),
+                                       snapshot->model_meta_info));
+  std::string data;
+  if (!SerializeValue(*value, &data))
+    return;
+  UMA_HISTOGRAM_TIMES("Bookmarks.EncodeTime", TimeTicks::Now() - start_time);
+  base::ImportantFileWriter::WriteFileAtomically(path, data);
+}
+
 void LoadCallback(const FilePath& path,
                   BookmarkStorage* storage,
                   BookmarkLoadDetails* details) {
@@ -112,17 +158,13 @@ BookmarkStorage::BookmarkStorage(
     BookmarkModel* model,
     base::SequencedTaskRunner* sequenced_task_runner)
     : model_(model),
-      writer_(context->GetPath().Append(chrome::kBookmarksFileName),
-              sequenced_task_runner) {
+      path_(context->GetPath().Append(chrome::kBookmarksFileName)) {
   sequenced_task_runner_ = sequenced_task_runner;
-  writer_.set_commit_interval(base::TimeDelta::FromMilliseconds(kSaveDelayMS));
   sequenced_task_runner_->PostTask(FROM_HERE,
-                                   base::Bind(&BackupCallback, writer_.path()));
+                                   base::Bind(&BackupCallback, path_));
 }
 
 BookmarkStorage::~BookmarkStorage() {
-  if (writer_.HasPendingWrite())
-    writer_.DoScheduledWrite();
 }
 
 void BookmarkStorage::LoadBookmarks(BookmarkLoadDetails* details) {
@@ -131,28 +173,33 @@ void BookmarkStorage::LoadBookmarks(BookmarkLoadDetails* details) {
   details_.reset(details);
   sequenced_task_runner_->PostTask(
       FROM_HERE,
-      base::Bind(&LoadCallback, writer_.path(), make_scoped_refptr(this),
+      base::Bind(&LoadCallback, path_, make_scoped_refptr(this),
                  details_.get()));
 }
 
 void BookmarkStorage::ScheduleSave() {
-  writer_.ScheduleWrite(this);
+  if (!save_timer_.IsRunning()) {
+    save_timer_.Start(FROM_HERE,
+                      base::TimeDelta::FromMilliseconds(kSaveDelayMS),
+                      base::Bind(base::IgnoreResult(&BookmarkStorage::SaveNow),
+                                 base::Unretained(this)));
+  }
 }
 
 void BookmarkStorage::BookmarkModelDeleted() {
   // We need to save now as otherwise by the time SaveNow is invoked
   // the model is gone.
-  if (writer_.HasPendingWrite())
+  if (save_timer_.IsRunning()) {
+    save_timer_.Stop();
     SaveNow();
+  }
   model_ = NULL;
 }
 
 bool BookmarkStorage::SerializeData(std::string* output) {
   BookmarkCodec codec;
   scoped_ptr<Value> value(codec.Encode(model_));
-  JSONStringValueSerializer serializer(output);
-  serializer.set_pretty_print(true);
-  return serializer.Serialize(*(value.get()));
+  return SerializeValue(*value, output);
 }
 
 void BookmarkStorage::OnLoadFinished() {
@@ -170,9 +217,17 @@ bool BookmarkStorage::SaveNow() {
     return false;
   }
 
-  std::string data;
-  if (!SerializeData(&data))
-    return false;
-  writer_.WriteNow(data);
-  return true;
+  TimeTicks start_time = TimeTicks::Now();
+  BookmarkSnapshot* snapshot = new BookmarkSnapshot;
+  snapshot->bb_node.reset(CopyNode(model_->bookmark_bar_node()));
+  snapshot->other_folder_node.reset(CopyNode(model_->other_node()));
+  snapshot->mobile_folder_node.reset(CopyNode(model_->mobile_node()));
+  snapshot->model_meta_info = model_->root_node()->meta_info_str();
+  UMA_HISTOGRAM_TIMES("Bookmarks.SnapshotTime", TimeTicks::Now() - start_time);
+
+  // Tasks on |sequenced_task_runner_| run in order, so an earlier snapshot is
+  // never written over a later one.
+  return sequenced_task_runner_->PostTask(
+      FROM_HERE,
+      base::Bind(&SaveCallback, path_, base::Owned(snapshot)));
 }
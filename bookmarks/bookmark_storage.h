@@ -5,9 +5,12 @@
 #ifndef CHROME_BROWSER_BOOKMARKS_BOOKMARK_STORAGE_H_
 #define CHROME_BROWSER_BOOKMARKS_BOOKMARK_STORAGE_H_
 
-#include "base/files/important_file_writer.h"
+#include <string>
+
+#include "base/file_path.h"
 #include "base/memory/ref_counted.h"
 #include "base/memory/scoped_ptr.h"
+#include "base/timer.h"
 #include "chrome/browser/bookmarks/bookmark_index.h"
 
 class BookmarkModel;
@@ -102,8 +105,10 @@ class BookmarkLoadDetails {
 // as notifying the BookmarkStorage every time the model changes.
 //
 // Internally BookmarkStorage uses BookmarkCodec to do the actual read/write.
-class BookmarkStorage : public base::ImportantFileWriter::DataSerializer,
-                        public base::RefCountedThreadSafe<BookmarkStorage> {
+// To save, BookmarkStorage copies the nodes of the model on the main thread
+// and encodes and writes the copy on the sequenced task runner, so that the
+// main thread doesn't build the JSON of a large model.
+class BookmarkStorage : public base::RefCountedThreadSafe<BookmarkStorage> {
  public:
   // Creates a BookmarkStorage for the specified model
   BookmarkStorage(content::BrowserContext* context,
@@ -124,23 +129,28 @@ class BookmarkStorage : public base::ImportantFileWriter::DataSerializer,
   // Callback from backend after loading the bookmark file.
   void OnLoadFinished();
 
-  // ImportantFileWriter::DataSerializer implementation.
-  virtual bool SerializeData(std::string* output) OVERRIDE;
+  // Serializes the model to JSON on the calling thread. Returns true on
+  // success.
+  bool SerializeData(std::string* output);
 
  private:
   friend class base::RefCountedThreadSafe<BookmarkStorage>;
 
   virtual ~BookmarkStorage();
 
-  // Serializes the data and schedules save using ImportantFileWriter.
-  // Returns true on successful serialization.
+  // Copies the model and posts a task that serializes and writes the copy.
+  // Returns true if the write was scheduled.
   bool SaveNow();
 
   // The model. The model is NULL once BookmarkModelDeleted has been invoked.
   BookmarkModel* model_;
 
-  // Helper to write bookmark data safely.
-  base::ImportantFileWriter writer_;
+  // Path of the bookmarks file.
+  const FilePath path_;
+
+  // Runs SaveNow() a few seconds after the first change, so that changes made
+  // in quick succession are written together.
+  base::OneShotTimer<BookmarkStorage> save_timer_;
 
   // See class description of BookmarkLoadDetails for details on this.
   scoped_ptr<BookmarkLoadDetails> details_;
@@ -0,0 +1,122 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/content_settings/content_settings_rule_index.h"
+
+#include "base/logging.h"
+#include "chrome/common/content_settings_pattern.h"
+#include "chrome/common/url_constants.h"
+#include "googleurl/src/gurl.h"
+
+namespace {
+
+const char kSchemeSeparator[] = "://";
+const char kDomainWildcard[] = "[*.]";
+
+// Extracts the host that |pattern| restricts the primary URL to from its
+// string form, "[scheme://][[*.]]host[:port]", and sets |is_domain| if
+// subdomains of the host match as well. Returns false for patterns that
+// don't name a host, like wildcards and file: patterns, and for IPv6
+// literals; those rules are tested against every URL.
+bool GetPatternHost(const ContentSettingsPattern& pattern,
+                    std::string* host,
+                    bool* is_domain) {
+  const std::string spec = pattern.ToString();
+  size_t start = spec.find(kSchemeSeparator);
+  if (start == std::string::npos) {
+    start = 0;
+  } else {
+    if (spec.compare(0, start, chrome::kFileScheme) == 0)
+      return false;
+    start += arraysize(kSchemeSeparator) - 1;
+  }
+  *is_domain = spec.compare(start, arraysize(kDomainWildcard) - 1,
+                            kDomainWildcard) == 0;
+  if (*is_domain)
+    start += arraysize(kDomainWildcard) - 1;
+  if (start >= spec.size() || spec[start] == '*' || spec[start] == '[')
+    return false;
+  size_t end = spec.find_first_of(":/", start);
+  host->assign(spec, start,
+               end == std::string::npos ? std::string::npos : end - start);
+  return !host->empty();
+}
+
+}  // namespace
+
+namespace content_settings {
+
+RuleIndex::RuleIndex() {}
+
+RuleIndex::~RuleIndex() {}
+
+void RuleIndex::AddRule(const Rule& rule, int source) {
+  DCHECK(rule.value.get());
+  size_t position = rules_.size();
+  rules_.push_back(rule);
+  sources_.push_back(source);
+
+  std::string host;
+  bool is_domain = false;
+  if (!GetPatternHost(rule.primary_pattern, &host, &is_domain))
+    other_rules_.push_back(position);
+  else if (is_domain)
+    domains_[host].push_back(position);
+  else
+    exact_hosts_[host].push_back(position);
+}
+
+const Rule* RuleIndex::FindRule(const GURL& primary_url,
+                                const GURL& secondary_url,
+                                int* source) const {
+  size_t best = FindFirstMatch(other_rules_, primary_url, secondary_url,
+                               rules_.size());
+
+  // Patterns never include the trailing dot of a fully qualified host name.
+  std::string host = primary_url.host();
+  if (!host.empty() && host[host.size() - 1] == '.')
+    host.resize(host.size() - 1);
+  FindInMap(exact_hosts_, host, primary_url, secondary_url, &best);
+
+  // A domain pattern matches the domain itself and all of its subdomains, so
+  // look up the host and each of its parent domains.
+  for (size_t pos = 0; ; ++pos) {
+    FindInMap(domains_, host.substr(pos), primary_url, secondary_url, &best);
+    pos = host.find('.', pos);
+    if (pos == std::string::npos)
+      break;
+  }
+
+  if (best == rules_.size())
+    return NULL;
+  *source = sources_[best];
+  return &rules_[best];
+}
+
+size_t RuleIndex::FindFirstMatch(const RuleList& list,
+                                 const GURL& primary_url,
+                                 const GURL& secondary_url,
+                                 size_t limit) const {
+  for (RuleList::const_iterator it = list.begin();
+       it != list.end() && *it < limit; ++it) {
+    const Rule& rule = rules_[*it];
+    if (rule.primary_pattern.Matches(primary_url) &&
+        rule.secondary_pattern.Matches(secondary_url)) {
+      return *it;
+    }
+  }
+  return limit;
+}
+
+void RuleIndex::FindInMap(const HostMap& map,
+                          const std::string& host,
+                          const GURL& primary_url,
+                          const GURL& secondary_url,
+                          size_t* best) const {
+  HostMap::const_iterator it = map.find(host);
+  if (it != map.end())
+    *best = FindFirstMatch(it->second, primary_url, secondary_url, *best);
+}
+
+}  // namespace content_settings
@@ -0,0 +1,88 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_BROWSER_CONTENT_SETTINGS_CONTENT_SETTINGS_RULE_INDEX_H_
+#define CHROME_BROWSER_CONTENT_SETTINGS_CONTENT_SETTINGS_RULE_INDEX_H_
+
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/hash_tables.h"
+#include "base/memory/ref_counted.h"
+#include "chrome/browser/content_settings/content_settings_rule.h"
+
+class GURL;
+
+namespace content_settings {
+
+// A precompiled list of content setting rules, kept in precedence order and
+// bucketed by the host of their primary pattern. Finding the rule that
+// applies to a pair of URLs only tests the rules whose primary pattern can
+// match the host of the primary URL, plus the rules whose pattern does not
+// name a host, rather than every rule.
+//
+// A RuleIndex is filled in on one thread and is not modified once it has
+// been handed out; after that it may be read on any thread without locking.
+class RuleIndex : public base::RefCountedThreadSafe<RuleIndex> {
+ public:
+  RuleIndex();
+
+  // Appends |rule|, which has a lower precedence than every rule added
+  // before it. |source| is returned by |FindRule| along with the rule.
+  void AddRule(const Rule& rule, int source);
+
+  // Returns the first rule, in the order the rules were added, whose primary
+  // pattern matches |primary_url| and whose secondary pattern matches
+  // |secondary_url|, and sets |source| to the source it was added with.
+  // Returns NULL if no rule matches.
+  const Rule* FindRule(const GURL& primary_url,
+                       const GURL& secondary_url,
+                       int* source) const;
+
+  size_t size() const { return rules_.size(); }
+
+ private:
+  friend class base::RefCountedThreadSafe<RuleIndex>;
+
+  // Positions in |rules_|, in increasing order.
+  typedef std::vector<size_t> RuleList;
+  typedef base::hash_map<std::string, RuleList> HostMap;
+
+  ~RuleIndex();
+
+  // Returns the position of the first rule in |list| which comes before
+  // |limit| and matches the URLs, or |limit| if there is none.
+  size_t FindFirstMatch(const RuleList& list,
+                        const GURL& primary_url,
+                        const GURL& secondary_url,
+                        size_t limit) const;
+
+  // Looks up |host| in |map| and narrows |best| down to the first matching
+  // rule listed for it.
+  void FindInMap(const HostMap& map,
+                 const std::string& host,
+                 const GURL& primary_url,
+                 const GURL& secondary_url,
+                 size_t* best) const;
+
+  std::vector<Rule> rules_;
+  std::vector<int> sources_;
+
+  // Rules whose primary pattern matches exactly one host.
+  HostMap exact_hosts_;
+
+  // Rules whose primary pattern matches a domain and all of its subdomains,
+  // keyed by the domain.
+  HostMap domains_;
+
+  // All other rules, e.g. those for any host or for file: URLs.
+  RuleList other_rules_;
+
+  DISALLOW_COPY_AND_ASSIGN(RuleIndex);
+};
+
+}  // namespace content_settings
+
+#endif  // CHROME_BROWSER_CONTENT_SETTINGS_CONTENT_SETTINGS_RULE_INDEX_H_
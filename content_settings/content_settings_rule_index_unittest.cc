@@ -0,0 +1,112 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/content_settings/content_settings_rule_index.h"
+
+#include "base/memory/ref_counted.h"
+#include "base/values.h"
+#include "chrome/common/content_settings_pattern.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace content_settings {
+
+namespace {
+
+const char kTopLevelURL[] = "http://www.top-level.com/";
+
+Rule MakeRule(const std::string& primary_pattern,
+              const std::string& secondary_pattern,
+              int value) {
+  return Rule(ContentSettingsPattern::FromString(primary_pattern),
+              ContentSettingsPattern::FromString(secondary_pattern),
+              base::Value::CreateIntegerValue(value));
+}
+
+// Returns the integer value of the rule matching the URLs, or -1 if there is
+// none.
+int FindValue(const RuleIndex& index,
+              const std::string& primary_url,
+              const std::string& secondary_url) {
+  int source = -1;
+  const Rule* rule =
+      index.FindRule(GURL(primary_url), GURL(secondary_url), &source);
+  if (!rule)
+    return -1;
+  int value = -1;
+  EXPECT_TRUE(rule->value->GetAsInteger(&value));
+  EXPECT_EQ(value, source);
+  return value;
+}
+
+}  // namespace
+
+TEST(RuleIndexTest, Empty) {
+  scoped_refptr<RuleIndex> index(new RuleIndex);
+  EXPECT_EQ(0u, index->size());
+  EXPECT_EQ(-1, FindValue(*index, "http://www.google.com/",
+                          "http://www.google.com/"));
+}
+
+TEST(RuleIndexTest, HostPatterns) {
+  scoped_refptr<RuleIndex> index(new RuleIndex);
+  index->AddRule(MakeRule("www.google.com", "*", 1), 1);
+  index->AddRule(MakeRule("[*.]example.com", "*", 2), 2);
+  index->AddRule(MakeRule("https://[*.]secure.net:443", "*", 3), 3);
+  index->AddRule(MakeRule("http://[::1]", "*", 4), 4);
+  index->AddRule(MakeRule("file:///tmp/test.html", "*", 5), 5);
+  EXPECT_EQ(5u, index->size());
+
+  EXPECT_EQ(1, FindValue(*index, "http://www.google.com/", kTopLevelURL));
+  EXPECT_EQ(1, FindValue(*index, "https://www.google.com:8080/x",
+                         kTopLevelURL));
+  EXPECT_EQ(-1, FindValue(*index, "http://mail.google.com/", kTopLevelURL));
+  EXPECT_EQ(-1, FindValue(*index, "http://google.com/", kTopLevelURL));
+
+  EXPECT_EQ(2, FindValue(*index, "http://example.com/", kTopLevelURL));
+  EXPECT_EQ(2, FindValue(*index, "http://a.b.example.com/", kTopLevelURL));
+  EXPECT_EQ(2, FindValue(*index, "http://example.com./", kTopLevelURL));
+  EXPECT_EQ(-1, FindValue(*index, "http://notexample.com/", kTopLevelURL));
+  EXPECT_EQ(-1, FindValue(*index, "http://example.com.au/", kTopLevelURL));
+
+  EXPECT_EQ(3, FindValue(*index, "https://www.secure.net/", kTopLevelURL));
+  EXPECT_EQ(-1, FindValue(*index, "http://www.secure.net/", kTopLevelURL));
+  EXPECT_EQ(-1, FindValue(*index, "https://www.secure.net:8443/",
+                          kTopLevelURL));
+
+  EXPECT_EQ(4, FindValue(*index, "http://[::1]/", kTopLevelURL));
+  EXPECT_EQ(5, FindValue(*index, "file:///tmp/test.html", kTopLevelURL));
+  EXPECT_EQ(-1, FindValue(*index, "file:///tmp/other.html", kTopLevelURL));
+}
+
+TEST(RuleIndexTest, SecondaryPattern) {
+  scoped_refptr<RuleIndex> index(new RuleIndex);
+  index->AddRule(MakeRule("[*.]google.com", "[*.]example.com", 1), 1);
+  index->AddRule(MakeRule("[*.]google.com", "*", 2), 2);
+
+  EXPECT_EQ(1, FindValue(*index, "http://www.google.com/",
+                         "http://www.example.com/"));
+  EXPECT_EQ(2, FindValue(*index, "http://www.google.com/",
+                         "http://www.other.com/"));
+}
+
+// The first matching rule wins, no matter which bucket it was indexed in.
+TEST(RuleIndexTest, Precedence) {
+  scoped_refptr<RuleIndex> index(new RuleIndex);
+  index->AddRule(MakeRule("[*.]mail.google.com", "*", 0), 0);
+  index->AddRule(MakeRule("www.google.com", "*", 1), 1);
+  index->AddRule(MakeRule("[*.]google.com", "*", 2), 2);
+  index->AddRule(MakeRule("http://*", "*", 3), 3);
+  index->AddRule(MakeRule("news.google.com", "*", 4), 4);
+  index->AddRule(MakeRule("*", "*", 5), 5);
+
+  EXPECT_EQ(0, FindValue(*index, "http://a.mail.google.com/", kTopLevelURL));
+  EXPECT_EQ(1, FindValue(*index, "http://www.google.com/", kTopLevelURL));
+  EXPECT_EQ(2, FindValue(*index, "https://news.google.com/", kTopLevelURL));
+  EXPECT_EQ(2, FindValue(*index, "http://news.google.com/", kTopLevelURL));
+  EXPECT_EQ(3, FindValue(*index, "http://www.example.com/", kTopLevelURL));
+  EXPECT_EQ(5, FindValue(*index, "https://www.example.com/", kTopLevelURL));
+}
+
+}  // namespace content_settings
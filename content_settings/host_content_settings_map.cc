@@ -20,6 +20,7 @@
 #include "chrome/browser/content_settings/content_settings_pref_provider.h"
 #include "chrome/browser/content_settings/content_settings_provider.h"
 #include "chrome/browser/content_settings/content_settings_rule.h"
+#include "chrome/browser/content_settings/content_settings_rule_index.h"
 #include "chrome/browser/content_settings/content_settings_utils.h"
 #include "chrome/browser/extensions/extension_service.h"
 #include "chrome/browser/intents/web_intents_util.h"
@@ -73,13 +74,30 @@ bool SupportsResourceIdentifier(ContentSettingsType content_type) {
   return content_type == CONTENT_SETTINGS_TYPE_PLUGINS;
 }
 
+// Appends the rules of |provider| for |content_type| and
+// |resource_identifier| to |rule_index|. If |incognito| is true, only the
+// rules specific to incognito mode are added.
+void AddRulesToIndex(const content_settings::ProviderInterface* provider,
+                     int provider_type,
+                     ContentSettingsType content_type,
+                     const std::string& resource_identifier,
+                     bool incognito,
+                     content_settings::RuleIndex* rule_index) {
+  scoped_ptr<content_settings::RuleIterator> rule_iterator(
+      provider->GetRuleIterator(content_type, resource_identifier,
+                                incognito));
+  while (rule_iterator->HasNext())
+    rule_index->AddRule(rule_iterator->Next(), provider_type);
+}
+
 }  // namespace
 
 HostContentSettingsMap::HostContentSettingsMap(
     PrefService* prefs,
     bool incognito)
     : prefs_(prefs),
-      is_off_the_record_(incognito) {
+      is_off_the_record_(incognito),
+      rule_generation_(0) {
   content_settings::ObservableProvider* policy_provider =
       new content_settings::PolicyProvider(prefs_);
   policy_provider->AddObserver(this);
@@ -393,6 +411,20 @@ void HostContentSettingsMap::OnContentSettingChanged(
     const ContentSettingsPattern& secondary_pattern,
     ContentSettingsType content_type,
     std::string resource_identifier) {
+  {
+    base::AutoLock auto_lock(lock_);
+    ++rule_generation_;
+    if (content_type == CONTENT_SETTINGS_TYPE_DEFAULT) {
+      // All content types may have changed.
+      rule_indices_.clear();
+    } else {
+      RuleIndexMap::iterator it =
+          rule_indices_.lower_bound(RuleIndexKey(content_type, ""));
+      while (it != rule_indices_.end() && it->first.first == content_type)
+        rule_indices_.erase(it++);
+    }
+  }
+
   const ContentSettingsDetails details(primary_pattern,
                                        secondary_pattern,
                                        content_type,
@@ -544,35 +576,61 @@ base::Value* HostContentSettingsMap::GetWebsiteSetting(
     return Value::CreateIntegerValue(CONTENT_SETTING_ALLOW);
   }
 
-  ContentSettingsPattern* primary_pattern = NULL;
-  ContentSettingsPattern* secondary_pattern = NULL;
+  scoped_refptr<content_settings::RuleIndex> rule_index =
+      GetRuleIndex(content_type, resource_identifier);
+  int provider_type = DEFAULT_PROVIDER;
+  const content_settings::Rule* rule =
+      rule_index->FindRule(primary_url, secondary_url, &provider_type);
+  if (rule) {
+    if (info) {
+      info->source = kProviderSourceMap[provider_type];
+      info->primary_pattern = rule->primary_pattern;
+      info->secondary_pattern = rule->secondary_pattern;
+    }
+    return rule->value->DeepCopy();
+  }
+
   if (info) {
-    primary_pattern = &info->primary_pattern;
-    secondary_pattern = &info->secondary_pattern;
+    info->source = content_settings::SETTING_SOURCE_NONE;
+    info->primary_pattern = ContentSettingsPattern();
+    info->secondary_pattern = ContentSettingsPattern();
+  }
+  return NULL;
+}
+
+scoped_refptr<content_settings::RuleIndex>
+    HostContentSettingsMap::GetRuleIndex(
+        ContentSettingsType content_type,
+        const std::string& resource_identifier) const {
+  const RuleIndexKey key(content_type, resource_identifier);
+  int generation = 0;
+  {
+    base::AutoLock auto_lock(lock_);
+    RuleIndexMap::const_iterator it = rule_indices_.find(key);
+    if (it != rule_indices_.end())
+      return it->second;
+    generation = rule_generation_;
   }
 
   // The list of |content_settings_providers_| is ordered according to their
-  // precedence.
+  // precedence. Within a provider, incognito-only settings come first.
+  scoped_refptr<content_settings::RuleIndex> rule_index(
+      new content_settings::RuleIndex);
   for (ConstProviderIterator provider = content_settings_providers_.begin();
        provider != content_settings_providers_.end();
        ++provider) {
-    base::Value* value = content_settings::GetContentSettingValueAndPatterns(
-        provider->second, primary_url, secondary_url, content_type,
-        resource_identifier, is_off_the_record_,
-        primary_pattern, secondary_pattern);
-    if (value) {
-      if (info)
-        info->source = kProviderSourceMap[provider->first];
-      return value;
+    if (is_off_the_record_) {
+      AddRulesToIndex(provider->second, provider->first, content_type,
+                      resource_identifier, true, rule_index.get());
     }
+    AddRulesToIndex(provider->second, provider->first, content_type,
+                    resource_identifier, false, rule_index.get());
   }
 
-  if (info) {
-    info->source = content_settings::SETTING_SOURCE_NONE;
-    info->primary_pattern = ContentSettingsPattern();
-    info->secondary_pattern = ContentSettingsPattern();
-  }
-  return NULL;
+  base::AutoLock auto_lock(lock_);
+  if (generation == rule_generation_)
+    rule_indices_[key] = rule_index;
+  return rule_index;
 }
 
 // static
@@ -28,6 +28,7 @@ class Value;
 
 namespace content_settings {
 class ProviderInterface;
+class RuleIndex;
 }  // namespace content_settings
 
 class ExtensionService;
@@ -208,6 +209,10 @@ class HostContentSettingsMap
   typedef ProviderMap::iterator ProviderIterator;
   typedef ProviderMap::const_iterator ConstProviderIterator;
 
+  typedef std::pair<ContentSettingsType, std::string> RuleIndexKey;
+  typedef std::map<RuleIndexKey, scoped_refptr<content_settings::RuleIndex> >
+      RuleIndexMap;
+
   virtual ~HostContentSettingsMap();
 
   ContentSetting GetDefaultContentSettingFromProvider(
@@ -230,6 +235,15 @@ class HostContentSettingsMap
       ContentSettingsForOneType* settings,
       bool incognito) const;
 
+  // Returns the rules of all providers for |content_type| and
+  // |resource_identifier|, in precedence order. The index is built from the
+  // providers on the first lookup after a change and shared by all lookups
+  // until the next change; the providers' locks are only taken while it is
+  // being built.
+  scoped_refptr<content_settings::RuleIndex> GetRuleIndex(
+      ContentSettingsType content_type,
+      const std::string& resource_identifier) const;
+
   // Weak; owned by the Profile.
   PrefService* prefs_;
 
@@ -240,8 +254,17 @@ class HostContentSettingsMap
   ProviderMap content_settings_providers_;
 
   // Used around accesses to the following objects to guarantee thread safety.
+  // It is only held to look up or replace an index, never while matching
+  // URLs against one.
   mutable base::Lock lock_;
 
+  // The rule indices built since the last change to their content type.
+  mutable RuleIndexMap rule_indices_;
+
+  // Incremented on every change, so that an index which was being built
+  // while its rules changed is not kept.
+  int rule_generation_;
+
   DISALLOW_COPY_AND_ASSIGN(HostContentSettingsMap);
 };
 
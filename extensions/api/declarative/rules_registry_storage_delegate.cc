@@ -77,10 +77,13 @@ class RulesRegistryStorageDelegate::Inner
       const content::NotificationSource& source,
       const content::NotificationDetails& details) OVERRIDE;
 
-  // Read/write a list of rules serialized to Values.
+  // Read/write a list of rules serialized to Values. |from_legacy_store| is
+  // true if the rules were read from the state store, from which they are
+  // migrated to the rules store.
   void ReadFromStorage(const std::string& extension_id);
   void ReadFromStorageCallback(const std::string& extension_id,
-                       scoped_ptr<base::Value> value);
+                               bool from_legacy_store,
+                               scoped_ptr<base::Value> value);
   void WriteToStorage(const std::string& extension_id,
                       scoped_ptr<base::Value> value);
 
@@ -90,8 +93,9 @@ class RulesRegistryStorageDelegate::Inner
   void CheckIfReady();
 
   // Deserialize the rules from the given Value object and add them to the
-  // RulesRegistry.
+  // RulesRegistry. Unless they are migrated, the rules are not written back.
   void ReadFromStorageOnRegistryThread(const std::string& extension_id,
+                                       bool from_legacy_store,
                                        scoped_ptr<base::Value> value);
 
   // Notify the RulesRegistry that we are now ready.
@@ -237,7 +241,8 @@ void RulesRegistryStorageDelegate::Inner::ReadFromStorage(
   if (store) {
     waiting_for_extensions_.insert(extension_id);
     store->GetExtensionValue(extension_id, storage_key_,
-        base::Bind(&Inner::ReadFromStorageCallback, this, extension_id));
+        base::Bind(&Inner::ReadFromStorageCallback, this, extension_id,
+                   false));
   }
 
   // TODO(mpcomplete): Migration code. Remove when declarativeWebRequest goes
@@ -247,18 +252,22 @@ void RulesRegistryStorageDelegate::Inner::ReadFromStorage(
   if (store) {
     waiting_for_extensions_.insert(extension_id);
     store->GetExtensionValue(extension_id, storage_key_,
-        base::Bind(&Inner::ReadFromStorageCallback, this, extension_id));
+        base::Bind(&Inner::ReadFromStorageCallback, this, extension_id,
+                   true));
     store->RemoveExtensionValue(extension_id, storage_key_);
   }
 }
 
 void RulesRegistryStorageDelegate::Inner::ReadFromStorageCallback(
-    const std::string& extension_id, scoped_ptr<base::Value> value) {
+    const std::string& extension_id,
+    bool from_legacy_store,
+    scoped_ptr<base::Value> value) {
   DCHECK(content::BrowserThread::CurrentlyOn(content::BrowserThread::UI));
   content::BrowserThread::PostTask(
       rules_registry_thread_, FROM_HERE,
       base::Bind(&Inner::ReadFromStorageOnRegistryThread, this,
-                 extension_id, base::Passed(value.Pass())));
+                 extension_id, from_legacy_store,
+                 base::Passed(value.Pass())));
 
   waiting_for_extensions_.erase(extension_id);
   CheckIfReady();
@@ -286,12 +295,19 @@ void RulesRegistryStorageDelegate::Inner::CheckIfReady() {
 }
 
 void RulesRegistryStorageDelegate::Inner::ReadFromStorageOnRegistryThread(
-    const std::string& extension_id, scoped_ptr<base::Value> value) {
+    const std::string& extension_id,
+    bool from_legacy_store,
+    scoped_ptr<base::Value> value) {
   DCHECK(content::BrowserThread::CurrentlyOn(rules_registry_thread_));
   if (!rules_registry_)
     return;  // registry went away
 
-  rules_registry_->AddRules(extension_id, RulesFromValue(value.get()));
+  // Rules read from the rules store are already stored as they are, so
+  // writing them back on every startup would only cost time.
+  if (from_legacy_store)
+    rules_registry_->AddRules(extension_id, RulesFromValue(value.get()));
+  else
+    rules_registry_->AddStoredRules(extension_id, RulesFromValue(value.get()));
 }
 
 void RulesRegistryStorageDelegate::Inner::NotifyReadyOnRegistryThread() {
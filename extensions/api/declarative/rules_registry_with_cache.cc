@@ -30,11 +30,29 @@ void RulesRegistryWithCache::OnReady() {
   ready_callbacks_.clear();
 }
 
+std::string RulesRegistryWithCache::AddStoredRules(
+    const std::string& extension_id,
+    const std::vector<linked_ptr<Rule> >& rules) {
+  DCHECK(content::BrowserThread::CurrentlyOn(GetOwnerThread()));
+  return AddRulesInternal(extension_id, rules);
+}
+
 std::string RulesRegistryWithCache::AddRules(
     const std::string& extension_id,
     const std::vector<linked_ptr<Rule> >& rules) {
   DCHECK(content::BrowserThread::CurrentlyOn(GetOwnerThread()));
 
+  std::string error = AddRulesInternal(extension_id, rules);
+  if (!error.empty())
+    return error;
+
+  NotifyRulesChanged(extension_id);
+  return kSuccess;
+}
+
+std::string RulesRegistryWithCache::AddRulesInternal(
+    const std::string& extension_id,
+    const std::vector<linked_ptr<Rule> >& rules) {
   // Verify that all rule IDs are new.
   for (std::vector<linked_ptr<Rule> >::const_iterator i =
       rules.begin(); i != rules.end(); ++i) {
@@ -57,7 +75,6 @@ std::string RulesRegistryWithCache::AddRules(
     rules_[key] = *i;
   }
 
-  NotifyRulesChanged(extension_id);
   return kSuccess;
 }
 
@@ -48,6 +48,13 @@ class RulesRegistryWithCache : public RulesRegistry {
   // if we have a delegate.
   void OnReady();
 
+  // Adds rules that the delegate read back from its storage. Behaves like
+  // AddRules(), except that the delegate is not notified, since the stored
+  // rules did not change.
+  std::string AddStoredRules(
+      const std::string& extension_id,
+      const std::vector<linked_ptr<RulesRegistry::Rule> >& rules);
+
   // RulesRegistry implementation:
   virtual std::string AddRules(
       const std::string& extension_id,
@@ -88,6 +95,12 @@ class RulesRegistryWithCache : public RulesRegistry {
   typedef std::map<RulesDictionaryKey, linked_ptr<RulesRegistry::Rule> >
       RulesDictionary;
 
+  // Adds |rules| via AddRulesImpl() and to |rules_|, without notifying the
+  // delegate.
+  std::string AddRulesInternal(
+      const std::string& extension_id,
+      const std::vector<linked_ptr<RulesRegistry::Rule> >& rules);
+
   // Notify our delegate that the given extension's rules have changed.
   void NotifyRulesChanged(const std::string& extension_id);
 
@@ -17,6 +17,23 @@ const char extension_id[] = "ext";
 const char extension2_id[] = "ext2";
 const char rule_id[] = "rule";
 const char rule2_id[] = "rule2";
+
+// A delegate that counts how often it is notified of changed rules.
+class CountingDelegate : public extensions::RulesRegistryWithCache::Delegate {
+ public:
+  explicit CountingDelegate(int* notifications)
+      : notifications_(notifications) {}
+
+  virtual bool IsReady() OVERRIDE { return true; }
+  virtual void OnRulesChanged(
+      extensions::RulesRegistryWithCache* rules_registry,
+      const std::string& extension_id) OVERRIDE {
+    ++*notifications_;
+  }
+
+ private:
+  int* notifications_;
+};
 }
 
 namespace extensions {
@@ -176,4 +193,28 @@ TEST_F(RulesRegistryWithCacheTest, OnExtensionUnloaded) {
   EXPECT_EQ(1, GetNumberOfRules(extension2_id));
 }
 
+TEST_F(RulesRegistryWithCacheTest, AddStoredRules) {
+  int notifications = 0;
+  registry_ = new TestRulesRegistry(new CountingDelegate(&notifications));
+
+  std::vector<linked_ptr<extensions::RulesRegistry::Rule> > stored_rules;
+  stored_rules.push_back(
+      make_linked_ptr(new extensions::RulesRegistry::Rule));
+  stored_rules[0]->id.reset(new std::string(rule_id));
+
+  // Check that stored rules are added without notifying the delegate.
+  EXPECT_EQ("", registry_->AddStoredRules(extension_id, stored_rules));
+  EXPECT_EQ(1, GetNumberOfRules(extension_id));
+  EXPECT_EQ(0, notifications);
+
+  // Check that stored rules are checked like new rules.
+  EXPECT_NE("", registry_->AddStoredRules(extension_id, stored_rules));
+  EXPECT_EQ(1, GetNumberOfRules(extension_id));
+
+  // Check that the delegate is notified of new rules.
+  EXPECT_EQ("", AddRule(extension_id, rule2_id));
+  EXPECT_EQ(2, GetNumberOfRules(extension_id));
+  EXPECT_EQ(1, notifications);
+}
+
 }  //  namespace extensions
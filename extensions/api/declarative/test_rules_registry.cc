@@ -10,6 +10,10 @@ TestRulesRegistry::TestRulesRegistry()
     : RulesRegistryWithCache(NULL),
       owner_thread_(content::BrowserThread::UI) {}
 
+TestRulesRegistry::TestRulesRegistry(Delegate* delegate)
+    : RulesRegistryWithCache(delegate),
+      owner_thread_(content::BrowserThread::UI) {}
+
 void TestRulesRegistry::SetOwnerThread(
     content::BrowserThread::ID owner_thread) {
   owner_thread_ = owner_thread;
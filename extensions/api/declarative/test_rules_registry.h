@@ -13,6 +13,7 @@ namespace extensions {
 class TestRulesRegistry : public RulesRegistryWithCache {
  public:
   TestRulesRegistry();
+  explicit TestRulesRegistry(Delegate* delegate);
 
   void SetOwnerThread(content::BrowserThread::ID owner_thread);
 
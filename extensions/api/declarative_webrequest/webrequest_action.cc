@@ -472,13 +472,13 @@ scoped_ptr<WebRequestActionSet> WebRequestActionSet::Create(
   return scoped_ptr<WebRequestActionSet>(new WebRequestActionSet(result));
 }
 
-std::list<LinkedPtrEventResponseDelta> WebRequestActionSet::CreateDeltas(
+void WebRequestActionSet::CreateDeltas(
     const ExtensionInfoMap* extension_info_map,
     const std::string& extension_id,
     const WebRequestRule::RequestData& request_data,
     bool crosses_incognito,
-    const base::Time& extension_install_time) const {
-  std::list<LinkedPtrEventResponseDelta> result;
+    const base::Time& extension_install_time,
+    std::vector<LinkedPtrEventResponseDelta>* deltas) const {
   for (Actions::const_iterator i = actions_.begin(); i != actions_.end(); ++i) {
     if (!(*i)->HasPermission(extension_info_map, extension_id,
                              request_data.request, crosses_incognito))
@@ -490,11 +490,10 @@ std::list<LinkedPtrEventResponseDelta> WebRequestActionSet::CreateDeltas(
         if ((*i)->DeltaHasPermission(extension_info_map, extension_id,
                                      request_data.request, crosses_incognito,
                                      delta))
-          result.push_back(delta);
+          deltas->push_back(delta);
       }
     }
   }
-  return result;
 }
 
 int WebRequestActionSet::GetMinimumPriority() const {
@@ -5,7 +5,6 @@
 #ifndef CHROME_BROWSER_EXTENSIONS_API_DECLARATIVE_WEBREQUEST_WEBREQUEST_ACTION_H_
 #define CHROME_BROWSER_EXTENSIONS_API_DECLARATIVE_WEBREQUEST_WEBREQUEST_ACTION_H_
 
-#include <list>
 #include <string>
 #include <vector>
 
@@ -160,15 +159,17 @@ class WebRequestActionSet {
                                                 std::string* error,
                                                 bool* bad_message);
 
-  // Returns a description of the modifications to |request_data.request| caused
-  // by the |actions_| that can be executed at |request.stage|. If |extension|
-  // is not NULL, permissions of extensions are checked.
-  std::list<LinkedPtrEventResponseDelta> CreateDeltas(
+  // Appends to |deltas| a description of the modifications to
+  // |request_data.request| caused by the |actions_| that can be executed at
+  // |request.stage|. If |extension| is not NULL, permissions of extensions are
+  // checked.
+  void CreateDeltas(
       const ExtensionInfoMap* extension_info_map,
       const std::string& extension_id,
       const WebRequestRule::RequestData& request_data,
       bool crosses_incognito,
-      const base::Time& extension_install_time) const;
+      const base::Time& extension_install_time,
+      std::vector<LinkedPtrEventResponseDelta>* deltas) const;
 
   // Returns the minimum priority of rules that may be evaluated after
   // this rule. Defaults to MIN_INT.
@@ -147,19 +147,20 @@ TEST(WebRequestActionTest, TestPermissions) {
 
   // Check that redirect works on regular URLs but not on protected URLs.
   net::TestURLRequest regular_request(GURL("http://test.com"), NULL, &context);
-  std::list<LinkedPtrEventResponseDelta> deltas =
-      action_set->CreateDeltas(
-          NULL, "ext1",
-          WebRequestRule::RequestData(&regular_request, ON_BEFORE_REQUEST),
-          false, base::Time());
+  std::vector<LinkedPtrEventResponseDelta> deltas;
+  action_set->CreateDeltas(
+      NULL, "ext1",
+      WebRequestRule::RequestData(&regular_request, ON_BEFORE_REQUEST),
+      false, base::Time(), &deltas);
   EXPECT_EQ(1u, deltas.size());
 
   net::TestURLRequest protected_request(GURL("http://clients1.google.com"),
                                         NULL, &context);
-  deltas = action_set->CreateDeltas(
+  deltas.clear();
+  action_set->CreateDeltas(
       NULL, "ext1",
       WebRequestRule::RequestData(&protected_request, ON_BEFORE_REQUEST),
-      false, base::Time());
+      false, base::Time(), &deltas);
   EXPECT_EQ(0u, deltas.size());
 }
 
@@ -112,13 +112,14 @@ scoped_ptr<WebRequestRule> WebRequestRule::Create(
                          conditions.Pass(), actions.Pass(), priority));
 }
 
-std::list<LinkedPtrEventResponseDelta> WebRequestRule::CreateDeltas(
+void WebRequestRule::CreateDeltas(
     const ExtensionInfoMap* extension_info_map,
     const RequestData& request_data,
-    bool crosses_incognito) const {
-  return actions_->CreateDeltas(extension_info_map, extension_id(),
-                                request_data, crosses_incognito,
-                                extension_installation_time_);
+    bool crosses_incognito,
+    std::vector<LinkedPtrEventResponseDelta>* deltas) const {
+  actions_->CreateDeltas(extension_info_map, extension_id(), request_data,
+                         crosses_incognito, extension_installation_time_,
+                         deltas);
 }
 
 int WebRequestRule::GetMinimumPriority() const {
@@ -5,7 +5,6 @@
 #ifndef CHROME_BROWSER_EXTENSIONS_API_DECLARATIVE_WEBREQUEST_WEBREQUEST_RULE_H_
 #define CHROME_BROWSER_EXTENSIONS_API_DECLARATIVE_WEBREQUEST_WEBREQUEST_RULE_H_
 
-#include <list>
 #include <vector>
 
 #include "base/compiler_specific.h"
@@ -87,12 +86,13 @@ class WebRequestRule {
   // of view; no harm is done if this function is called at other times for
   // testing purposes).
   // If |extension| is set, deltas are suppressed if the |extension| does not
-  // have have sufficient permissions to modify the request. The returned list
-  // may be empty in this case.
-  std::list<LinkedPtrEventResponseDelta> CreateDeltas(
+  // have have sufficient permissions to modify the request. The deltas are
+  // appended to |deltas|, which may be left unchanged in this case.
+  void CreateDeltas(
       const ExtensionInfoMap* extension_info_map,
       const RequestData& request_data,
-      bool crosses_incognito) const;
+      bool crosses_incognito,
+      std::vector<LinkedPtrEventResponseDelta>* deltas) const;
 
   // Returns the minimum priority of rules that may be evaluated after
   // this rule. Defaults to MAX_INT. Only valid if the conditions of this rule
@@ -4,6 +4,7 @@
 
 #include "chrome/browser/extensions/api/declarative_webrequest/webrequest_rules_registry.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "chrome/browser/extensions/api/declarative_webrequest/webrequest_condition.h"
@@ -14,9 +15,22 @@
 
 namespace extensions {
 
+namespace {
+
+// Orders rules by decreasing priority. Ties are broken by decreasing rule id
+// so that the order does not depend on the order in which rules were added.
+bool EvaluatedBefore(const WebRequestRule* a, const WebRequestRule* b) {
+  if (a->priority() != b->priority())
+    return a->priority() > b->priority();
+  return a->id() > b->id();
+}
+
+}  // namespace
+
 WebRequestRulesRegistry::WebRequestRulesRegistry(Profile* profile,
                                                  Delegate* delegate)
-    : RulesRegistryWithCache(delegate) {
+    : RulesRegistryWithCache(delegate),
+      has_uncommitted_rules_(false) {
   if (profile)
     extension_info_map_ = ExtensionSystem::Get(profile)->info_map();
 }
@@ -24,6 +38,7 @@ WebRequestRulesRegistry::WebRequestRulesRegistry(Profile* profile,
 std::set<WebRequestRule::GlobalRuleId>
 WebRequestRulesRegistry::GetMatches(
     const WebRequestRule::RequestData& request_data) {
+  CommitAddedRules();
   std::set<WebRequestRule::GlobalRuleId> result;
 
   // Figure out for which rules the URL match conditions were fulfilled.
@@ -37,75 +52,104 @@ WebRequestRulesRegistry::GetMatches(
     RuleTriggers::iterator rule_trigger = rule_triggers_.find(*url_match);
     CHECK(rule_trigger != rule_triggers_.end());
 
-    WebRequestRule* rule = rule_trigger->second;
+    WebRequestRule* rule = rule_trigger->second.rule;
     if (rule->conditions().IsFulfilled(*url_match, request_data))
       result.insert(rule->id());
   }
   return result;
 }
 
-std::list<LinkedPtrEventResponseDelta> WebRequestRulesRegistry::CreateDeltas(
+std::vector<LinkedPtrEventResponseDelta>
+WebRequestRulesRegistry::CreateDeltas(
     const ExtensionInfoMap* extension_info_map,
     const WebRequestRule::RequestData& request_data,
     bool crosses_incognito) {
   if (webrequest_rules_.empty())
-    return std::list<LinkedPtrEventResponseDelta>();
-
-  std::set<WebRequestRule::GlobalRuleId> matches =
-      GetMatches(request_data);
-
-  // Sort all matching rules by their priority so that they can be processed
-  // in decreasing order.
-  typedef std::pair<WebRequestRule::Priority, WebRequestRule::GlobalRuleId>
-      PriorityRuleIdPair;
-  std::vector<PriorityRuleIdPair> ordered_matches;
-  ordered_matches.reserve(matches.size());
-  for (std::set<WebRequestRule::GlobalRuleId>::iterator i = matches.begin();
-       i != matches.end(); ++i) {
-    RulesMap::const_iterator rule = webrequest_rules_.find(*i);
-    CHECK(rule != webrequest_rules_.end());
-    ordered_matches.push_back(make_pair(rule->second->priority(), *i));
+    return std::vector<LinkedPtrEventResponseDelta>();
+  CommitAddedRules();
+
+  // Figure out for which rules the URL match conditions were fulfilled, and
+  // order them the way the rules are evaluated.
+  typedef std::set<URLMatcherConditionSet::ID> URLMatches;
+  URLMatches url_matches = url_matcher_.MatchURL(request_data.request->url());
+  candidates_.clear();
+  for (URLMatches::iterator url_match = url_matches.begin();
+       url_match != url_matches.end(); ++url_match) {
+    RuleTriggers::const_iterator rule_trigger =
+        rule_triggers_.find(*url_match);
+    CHECK(rule_trigger != rule_triggers_.end());
+    candidates_.push_back(Candidate(rule_trigger->second.rank, *url_match));
   }
-  // Sort from rbegin to rend in order to get descending priority order.
-  std::sort(ordered_matches.rbegin(), ordered_matches.rend());
+  std::sort(candidates_.begin(), candidates_.end());
 
-  // Build a map that maps each extension id to the minimum required priority
-  // for rules of that extension. Initially, this priority is -infinite and
-  // will be increased when the rules are processed and raise the bar via
+  // Each extension starts without a minimum priority for its rules. It is
+  // raised when the rules are processed and raise the bar via
   // WebRequestIgnoreRulesActions.
-  typedef std::string ExtensionId;
-  typedef std::map<ExtensionId, WebRequestRule::Priority> MinPriorities;
-  MinPriorities min_priorities;
-  for (std::vector<PriorityRuleIdPair>::iterator i = ordered_matches.begin();
-       i != ordered_matches.end(); ++i) {
-    const WebRequestRule::GlobalRuleId& rule_id = i->second;
-    const ExtensionId& extension_id = rule_id.first;
-    min_priorities[extension_id] = std::numeric_limits<int>::min();
+  min_priorities_.clear();
+  for (std::vector<Candidate>::const_iterator i = candidates_.begin();
+       i != candidates_.end(); ++i) {
+    const WebRequestRule::ExtensionId& extension_id =
+        rules_by_priority_[i->first]->extension_id();
+    if (!FindMinPriority(&min_priorities_, extension_id)) {
+      min_priorities_.push_back(
+          MinPriority(&extension_id, std::numeric_limits<int>::min()));
+    }
   }
+  WebRequestRule::Priority lowest_min_priority =
+      std::numeric_limits<int>::min();
+
+  // Create deltas in one pass over the rules, by decreasing priority.
+  deltas_.clear();
+  rule_delta_ends_.clear();
+  size_t last_matched_rank = rules_by_priority_.size();
+  for (std::vector<Candidate>::const_iterator i = candidates_.begin();
+       i != candidates_.end(); ++i) {
+    // A rule with several condition sets only applies once.
+    if (i->first == last_matched_rank)
+      continue;
+    const WebRequestRule* rule = rules_by_priority_[i->first];
 
-  // Create deltas until we have passed the minimum priority.
-  std::list<LinkedPtrEventResponseDelta> result;
-  for (std::vector<PriorityRuleIdPair>::iterator i = ordered_matches.begin();
-       i != ordered_matches.end(); ++i) {
-    const WebRequestRule::Priority priority_of_rule = i->first;
-    const WebRequestRule::GlobalRuleId& rule_id = i->second;
-    const ExtensionId& extension_id = rule_id.first;
-    const WebRequestRule* rule = webrequest_rules_[rule_id].get();
-    CHECK(rule);
+    // Once every extension with a candidate rule has asked to ignore rules
+    // below some priority, none of the remaining rules can apply.
+    if (rule->priority() < lowest_min_priority)
+      break;
 
     // Skip rule if a previous rule of this extension instructed to ignore
-    // all rules with a lower priority than min_priorities[extension_id].
-    int current_min_priority = min_priorities[extension_id];
-    if (priority_of_rule < current_min_priority)
+    // all rules with a lower priority than |min_priority|.
+    WebRequestRule::Priority* min_priority =
+        FindMinPriority(&min_priorities_, rule->extension_id());
+    if (rule->priority() < *min_priority)
       continue;
 
-    std::list<LinkedPtrEventResponseDelta> rule_result =
-        rule->CreateDeltas(extension_info_map, request_data, crosses_incognito);
-    result.splice(result.begin(), rule_result);
+    if (!rule->conditions().IsFulfilled(i->second, request_data))
+      continue;
+    last_matched_rank = i->first;
+
+    rule->CreateDeltas(extension_info_map, request_data, crosses_incognito,
+                       &deltas_);
+    rule_delta_ends_.push_back(deltas_.size());
+
+    WebRequestRule::Priority rule_min_priority = rule->GetMinimumPriority();
+    if (rule_min_priority > *min_priority) {
+      *min_priority = rule_min_priority;
+      lowest_min_priority = std::numeric_limits<int>::max();
+      for (std::vector<MinPriority>::const_iterator j =
+               min_priorities_.begin(); j != min_priorities_.end(); ++j) {
+        lowest_min_priority = std::min(lowest_min_priority, j->second);
+      }
+    }
+  }
 
-    min_priorities[extension_id] = std::max(current_min_priority,
-                                            rule->GetMinimumPriority());
+  // Return the deltas of lower priority rules first, keeping the order of
+  // the deltas of each rule.
+  std::vector<LinkedPtrEventResponseDelta> result;
+  result.reserve(deltas_.size());
+  for (size_t end = rule_delta_ends_.size(); end > 0; --end) {
+    size_t begin = end > 1 ? rule_delta_ends_[end - 2] : 0;
+    result.insert(result.end(), deltas_.begin() + begin,
+                  deltas_.begin() + rule_delta_ends_[end - 1]);
   }
+  deltas_.clear();
   return result;
 }
 
@@ -136,6 +180,9 @@ std::string WebRequestRulesRegistry::AddRulesImpl(
   }
 
   if (!error.empty()) {
+    // The patterns of rules that were added before but are not registered in
+    // url_matcher_ yet would look unused, so register them first.
+    CommitAddedRules();
     // Clean up temporary condition sets created during rule creation.
     url_matcher_.ClearUnusedConditionSets();
     return error;
@@ -145,25 +192,16 @@ std::string WebRequestRulesRegistry::AddRulesImpl(
   webrequest_rules_.insert(new_webrequest_rules.begin(),
                            new_webrequest_rules.end());
 
-  // Create the triggers.
+  // Registering the url patterns in url_matcher_ and placing the new rules in
+  // the evaluation order involves all rules, so it is deferred until the
+  // rules are needed. When the rules of many extensions are loaded on
+  // startup, this is done once instead of once per extension.
   for (RulesMap::iterator i = new_webrequest_rules.begin();
        i != new_webrequest_rules.end(); ++i) {
-    URLMatcherConditionSet::Vector url_condition_sets;
-    const WebRequestConditionSet& conditions = i->second->conditions();
-    conditions.GetURLMatcherConditionSets(&url_condition_sets);
-    for (URLMatcherConditionSet::Vector::iterator j =
-         url_condition_sets.begin(); j != url_condition_sets.end(); ++j) {
-      rule_triggers_[(*j)->id()] = i->second.get();
-    }
+    i->second->conditions().GetURLMatcherConditionSets(
+        &uncommitted_condition_sets_);
   }
-
-  // Register url patterns in url_matcher_.
-  URLMatcherConditionSet::Vector all_new_condition_sets;
-  for (RulesMap::iterator i = new_webrequest_rules.begin();
-       i != new_webrequest_rules.end(); ++i) {
-    i->second->conditions().GetURLMatcherConditionSets(&all_new_condition_sets);
-  }
-  url_matcher_.AddConditionSets(all_new_condition_sets);
+  has_uncommitted_rules_ = true;
 
   ClearCacheOnNavigation();
 
@@ -173,6 +211,8 @@ std::string WebRequestRulesRegistry::AddRulesImpl(
 std::string WebRequestRulesRegistry::RemoveRulesImpl(
     const std::string& extension_id,
     const std::vector<std::string>& rule_identifiers) {
+  CommitAddedRules();
+
   // URLMatcherConditionSet IDs that can be removed from URLMatcher.
   std::vector<URLMatcherConditionSet::ID> remove_from_url_matcher;
 
@@ -202,6 +242,8 @@ std::string WebRequestRulesRegistry::RemoveRulesImpl(
   // Clear URLMatcher based on condition_set_ids that are not needed any more.
   url_matcher_.RemoveConditionSets(remove_from_url_matcher);
 
+  UpdatePriorityOrder();
+
   ClearCacheOnNavigation();
 
   return "";
@@ -229,7 +271,8 @@ content::BrowserThread::ID WebRequestRulesRegistry::GetOwnerThread() const {
 
 bool WebRequestRulesRegistry::IsEmpty() const {
   return rule_triggers_.empty() && webrequest_rules_.empty() &&
-      url_matcher_.IsEmpty();
+      rules_by_priority_.empty() && url_matcher_.IsEmpty() &&
+      uncommitted_condition_sets_.empty();
 }
 
 WebRequestRulesRegistry::~WebRequestRulesRegistry() {}
@@ -246,4 +289,52 @@ void WebRequestRulesRegistry::ClearCacheOnNavigation() {
   extension_web_request_api_helpers::ClearCacheOnNavigation();
 }
 
+void WebRequestRulesRegistry::CommitAddedRules() {
+  if (!has_uncommitted_rules_)
+    return;
+  has_uncommitted_rules_ = false;
+
+  // Create the triggers and place the new rules in the evaluation order.
+  UpdatePriorityOrder();
+
+  // Register url patterns in url_matcher_.
+  url_matcher_.AddConditionSets(uncommitted_condition_sets_);
+  uncommitted_condition_sets_.clear();
+}
+
+void WebRequestRulesRegistry::UpdatePriorityOrder() {
+  rules_by_priority_.clear();
+  rules_by_priority_.reserve(webrequest_rules_.size());
+  for (RulesMap::const_iterator i = webrequest_rules_.begin();
+       i != webrequest_rules_.end(); ++i) {
+    rules_by_priority_.push_back(i->second.get());
+  }
+  std::sort(rules_by_priority_.begin(), rules_by_priority_.end(),
+            &EvaluatedBefore);
+
+  for (size_t rank = 0; rank < rules_by_priority_.size(); ++rank) {
+    WebRequestRule* rule = rules_by_priority_[rank];
+    URLMatcherConditionSet::Vector url_condition_sets;
+    rule->conditions().GetURLMatcherConditionSets(&url_condition_sets);
+    for (URLMatcherConditionSet::Vector::iterator j =
+         url_condition_sets.begin(); j != url_condition_sets.end(); ++j) {
+      RuleTrigger& rule_trigger = rule_triggers_[(*j)->id()];
+      rule_trigger.rule = rule;
+      rule_trigger.rank = rank;
+    }
+  }
+}
+
+// static
+WebRequestRule::Priority* WebRequestRulesRegistry::FindMinPriority(
+    std::vector<MinPriority>* min_priorities,
+    const WebRequestRule::ExtensionId& extension_id) {
+  for (std::vector<MinPriority>::iterator i = min_priorities->begin();
+       i != min_priorities->end(); ++i) {
+    if (*i->first == extension_id)
+      return &i->second;
+  }
+  return NULL;
+}
+
 }  // namespace extensions
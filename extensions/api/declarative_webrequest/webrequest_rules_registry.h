@@ -5,7 +5,6 @@
 #ifndef CHROME_BROWSER_EXTENSIONS_API_DECLARATIVE_WEBREQUEST_WEBREQUEST_RULES_REGISTRY_H_
 #define CHROME_BROWSER_EXTENSIONS_API_DECLARATIVE_WEBREQUEST_WEBREQUEST_RULES_REGISTRY_H_
 
-#include <list>
 #include <map>
 #include <set>
 #include <vector>
@@ -72,8 +71,9 @@ class WebRequestRulesRegistry : public RulesRegistryWithCache {
       const WebRequestRule::RequestData& request_data);
 
   // Returns which modifications should be executed on the network request
-  // according to the rules registered in this registry.
-  std::list<LinkedPtrEventResponseDelta> CreateDeltas(
+  // according to the rules registered in this registry. The deltas of rules
+  // with a lower priority come first.
+  std::vector<LinkedPtrEventResponseDelta> CreateDeltas(
       const ExtensionInfoMap* extension_info_map,
       const WebRequestRule::RequestData& request_data,
       bool crosses_incognito);
@@ -101,16 +101,64 @@ class WebRequestRulesRegistry : public RulesRegistryWithCache {
   virtual void ClearCacheOnNavigation();
 
  private:
-  typedef std::map<URLMatcherConditionSet::ID, WebRequestRule*> RuleTriggers;
+  struct RuleTrigger {
+    RuleTrigger() : rule(NULL), rank(0) {}
+
+    WebRequestRule* rule;
+    // The position of |rule| in |rules_by_priority_|.
+    size_t rank;
+  };
+
+  typedef std::map<URLMatcherConditionSet::ID, RuleTrigger> RuleTriggers;
   typedef std::map<WebRequestRule::GlobalRuleId, linked_ptr<WebRequestRule> >
       RulesMap;
 
+  // A condition set reported by |url_matcher_|, ordered by the rank of its
+  // rule.
+  typedef std::pair<size_t, URLMatcherConditionSet::ID> Candidate;
+
+  // The minimum priority that the remaining rules of an extension need to be
+  // evaluated.
+  typedef std::pair<const WebRequestRule::ExtensionId*,
+                    WebRequestRule::Priority> MinPriority;
+
+  // Registers the rules added since the last call in |url_matcher_| and the
+  // evaluation order. Called before the rules are used or removed.
+  void CommitAddedRules();
+
+  // Sorts |rules_by_priority_| and updates the ranks in |rule_triggers_|.
+  // Called whenever rules are committed or removed.
+  void UpdatePriorityOrder();
+
+  // Returns the minimum priority of |extension_id| in |min_priorities|, or
+  // NULL if it is not listed.
+  static WebRequestRule::Priority* FindMinPriority(
+      std::vector<MinPriority>* min_priorities,
+      const WebRequestRule::ExtensionId& extension_id);
+
   // Map that tells us which WebRequestRule may match under the condition that
   // the URLMatcherConditionSet::ID was returned by the |url_matcher_|.
   RuleTriggers rule_triggers_;
 
   RulesMap webrequest_rules_;
 
+  // All rules in the order in which they are evaluated: by decreasing
+  // priority, ties broken by decreasing rule id.
+  std::vector<WebRequestRule*> rules_by_priority_;
+
+  // Scratch space of CreateDeltas, kept between calls so that evaluating the
+  // rules for a request does not need to allocate once the vectors have
+  // grown to fit.
+  std::vector<Candidate> candidates_;
+  std::vector<MinPriority> min_priorities_;
+  std::vector<LinkedPtrEventResponseDelta> deltas_;
+  std::vector<size_t> rule_delta_ends_;
+
+  // The condition sets of the rules in |webrequest_rules_| that are not
+  // registered in |url_matcher_| yet. See CommitAddedRules().
+  URLMatcherConditionSet::Vector uncommitted_condition_sets_;
+  bool has_uncommitted_rules_;
+
   URLMatcher url_matcher_;
 
   scoped_refptr<ExtensionInfoMap> extension_info_map_;
@@ -0,0 +1,192 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/extensions/api/declarative_webrequest/webrequest_rules_registry.h"
+
+#include <string>
+#include <vector>
+
+#include "base/memory/linked_ptr.h"
+#include "base/memory/scoped_vector.h"
+#include "base/message_loop.h"
+#include "base/perftimer.h"
+#include "base/stringprintf.h"
+#include "base/values.h"
+#include "chrome/browser/extensions/api/declarative_webrequest/webrequest_constants.h"
+#include "chrome/browser/extensions/api/declarative_webrequest/webrequest_rule.h"
+#include "chrome/browser/extensions/api/web_request/web_request_api_helpers.h"
+#include "chrome/common/extensions/matcher/url_matcher_constants.h"
+#include "content/public/test/test_browser_thread.h"
+#include "net/url_request/url_request_test_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace extensions {
+
+namespace keys = declarative_webrequest_constants;
+namespace keys2 = url_matcher_constants;
+
+namespace {
+
+// The number of rules, spread over |kExtensionCount| extensions.
+const int kRuleCount = 10000;
+const int kExtensionCount = 20;
+
+// The number of distinct hosts the rules and requests refer to.
+const int kHostCount = 2000;
+
+// The number of requests in the stream.
+const int kRequestCount = 20000;
+
+class PerfTestWebRequestRulesRegistry : public WebRequestRulesRegistry {
+ public:
+  PerfTestWebRequestRulesRegistry() : WebRequestRulesRegistry(NULL, NULL) {}
+
+ protected:
+  virtual ~PerfTestWebRequestRulesRegistry() {}
+
+  virtual void ClearCacheOnNavigation() OVERRIDE {}
+};
+
+linked_ptr<json_schema_compiler::any::Any> ToAny(const DictionaryValue& dict) {
+  linked_ptr<json_schema_compiler::any::Any> any =
+      make_linked_ptr(new json_schema_compiler::any::Any);
+  any->Init(dict);
+  return any;
+}
+
+// Returns the |i|th rule. Most rules cancel or redirect requests to one host,
+// some only below a path, and every tenth rule tells the extension to ignore
+// its lower priority rules for the host.
+linked_ptr<RulesRegistry::Rule> CreateRule(int i) {
+  DictionaryValue* url_dict = new DictionaryValue();
+  url_dict->SetString(keys2::kHostSuffixKey,
+                      base::StringPrintf("site%d.com", i % kHostCount));
+  if (i % 3 == 0) {
+    url_dict->SetString(keys2::kPathContainsKey,
+                        base::StringPrintf("/ads/%d/", i % 7));
+  }
+  DictionaryValue condition_dict;
+  condition_dict.SetString(keys::kInstanceTypeKey, keys::kRequestMatcherType);
+  condition_dict.Set(keys::kUrlKey, url_dict);
+
+  DictionaryValue action_dict;
+  if (i % 10 == 0) {
+    action_dict.SetString(keys::kInstanceTypeKey, keys::kIgnoreRulesType);
+    action_dict.SetInteger(keys::kLowerPriorityThanKey, 500);
+  } else if (i % 2 == 0) {
+    action_dict.SetString(keys::kInstanceTypeKey, keys::kCancelRequestType);
+  } else {
+    action_dict.SetString(keys::kInstanceTypeKey,
+                          keys::kRedirectRequestType);
+    action_dict.SetString(keys::kRedirectUrlKey,
+                          "http://blocked.example.com/");
+  }
+
+  linked_ptr<RulesRegistry::Rule> rule =
+      make_linked_ptr(new RulesRegistry::Rule);
+  rule->id.reset(new std::string(base::StringPrintf("rule%d", i)));
+  rule->priority.reset(new int((i * 7919) % 1000));
+  rule->conditions.push_back(ToAny(condition_dict));
+  rule->actions.push_back(ToAny(action_dict));
+  return rule;
+}
+
+// Returns the URLs of a stream of requests, as recorded from page loads: a
+// page followed by its scripts, images and ads, about a third of which hit
+// some rule.
+std::vector<GURL> CreateRequestStream() {
+  std::vector<GURL> urls;
+  urls.reserve(kRequestCount);
+  for (int i = 0; i < kRequestCount; ++i) {
+    const int host = (i * 31) % (3 * kHostCount);
+    switch (i % 4) {
+      case 0:
+        urls.push_back(GURL(base::StringPrintf(
+            "http://www.site%d.com/index.html", host)));
+        break;
+      case 1:
+        urls.push_back(GURL(base::StringPrintf(
+            "http://static.site%d.com/ads/%d/banner.js", host, i % 7)));
+        break;
+      case 2:
+        urls.push_back(GURL(base::StringPrintf(
+            "https://cdn.site%d.com/images/%d.png", host, i)));
+        break;
+      default:
+        urls.push_back(GURL(base::StringPrintf(
+            "http://www.other%d.org/page/%d", host, i)));
+        break;
+    }
+  }
+  return urls;
+}
+
+}  // namespace
+
+class WebRequestRulesRegistryPerfTest : public testing::Test {
+ public:
+  WebRequestRulesRegistryPerfTest()
+      : message_loop_(MessageLoop::TYPE_IO),
+        ui_(content::BrowserThread::UI, &message_loop_),
+        io_(content::BrowserThread::IO, &message_loop_) {}
+
+  virtual void TearDown() OVERRIDE {
+    // Make sure that deletion traits of all registries are executed.
+    message_loop_.RunUntilIdle();
+  }
+
+ protected:
+  MessageLoop message_loop_;
+  content::TestBrowserThread ui_;
+  content::TestBrowserThread io_;
+};
+
+// Adds 10k declarative rules and replays a stream of requests through the
+// OnBeforeRequest stage.
+TEST_F(WebRequestRulesRegistryPerfTest, ManyRules) {
+  scoped_refptr<PerfTestWebRequestRulesRegistry> registry(
+      new PerfTestWebRequestRulesRegistry);
+
+  std::vector<std::vector<linked_ptr<RulesRegistry::Rule> > > rules(
+      kExtensionCount);
+  for (int i = 0; i < kRuleCount; ++i)
+    rules[i % kExtensionCount].push_back(CreateRule(i));
+  {
+    PerfTimeLogger timer("WebRequestRulesRegistry_add_10k");
+    for (int i = 0; i < kExtensionCount; ++i) {
+      EXPECT_EQ("", registry->AddRules(base::StringPrintf("ext%d", i),
+                                       rules[i]));
+    }
+  }
+
+  const std::vector<GURL> urls = CreateRequestStream();
+  net::TestURLRequestContext context;
+  ScopedVector<net::TestURLRequest> requests;
+  for (size_t i = 0; i < urls.size(); ++i)
+    requests.push_back(new net::TestURLRequest(urls[i], NULL, &context));
+
+  // The first request also registers the added rules in the URL matcher.
+  size_t delta_count = 0;
+  {
+    PerfTimeLogger timer("WebRequestRulesRegistry_first_request_10k");
+    delta_count += registry->CreateDeltas(
+        NULL, WebRequestRule::RequestData(requests[0], ON_BEFORE_REQUEST),
+        false).size();
+  }
+
+  PerfTimer timer;
+  for (size_t i = 1; i < requests.size(); ++i) {
+    std::vector<LinkedPtrEventResponseDelta> deltas = registry->CreateDeltas(
+        NULL, WebRequestRule::RequestData(requests[i], ON_BEFORE_REQUEST),
+        false);
+    delta_count += deltas.size();
+  }
+  LogPerfResult("WebRequestRulesRegistry_create_deltas_10k",
+                timer.Elapsed().InMicroseconds() /
+                    static_cast<double>(requests.size() - 1),
+                "us/request");
+  EXPECT_GT(delta_count, 0u);
+}
+
+}  // namespace extensions
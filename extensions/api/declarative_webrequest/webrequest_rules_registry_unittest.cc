@@ -4,6 +4,7 @@
 
 #include "chrome/browser/extensions/api/declarative_webrequest/webrequest_rules_registry.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "base/memory/linked_ptr.h"
@@ -246,6 +247,68 @@ TEST_F(WebRequestRulesRegistryTest, AddRulesImpl) {
       matches.end());
 }
 
+// Each matching rule creates its deltas once, even if several of its
+// conditions match.
+TEST_F(WebRequestRulesRegistryTest, CreateDeltasOncePerRule) {
+  scoped_refptr<TestWebRequestRulesRegistry> registry(
+      new TestWebRequestRulesRegistry());
+  std::vector<linked_ptr<RulesRegistry::Rule> > rules;
+  rules.push_back(CreateRule1());
+  rules.push_back(CreateRule2());
+  EXPECT_EQ("", registry->AddRules(kExtensionId, rules));
+
+  net::TestURLRequestContext context;
+  net::TestURLRequest http_request(GURL("http://www.example.com"), NULL,
+                                   &context);
+  std::vector<LinkedPtrEventResponseDelta> deltas = registry->CreateDeltas(
+      NULL, WebRequestRule::RequestData(&http_request, ON_BEFORE_REQUEST),
+      false);
+  ASSERT_EQ(2u, deltas.size());
+  EXPECT_TRUE(deltas[0]->cancel);
+  EXPECT_TRUE(deltas[1]->cancel);
+
+  net::TestURLRequest foobar_request(GURL("http://www.foobar.com"), NULL,
+                                     &context);
+  deltas = registry->CreateDeltas(
+      NULL, WebRequestRule::RequestData(&foobar_request, ON_BEFORE_REQUEST),
+      false);
+  EXPECT_EQ(1u, deltas.size());
+}
+
+// Rules added by several calls are all found when the registry is first used,
+// also if a later call failed.
+TEST_F(WebRequestRulesRegistryTest, AddRulesOfSeveralExtensions) {
+  scoped_refptr<TestWebRequestRulesRegistry> registry(
+      new TestWebRequestRulesRegistry());
+  std::vector<linked_ptr<RulesRegistry::Rule> > rules;
+  rules.push_back(CreateRule1());
+  EXPECT_EQ("", registry->AddRules(kExtensionId, rules));
+  rules[0] = CreateRule2();
+  EXPECT_EQ("", registry->AddRules(kExtensionId2, rules));
+
+  DictionaryValue action_dict;
+  action_dict.SetString(keys::kInstanceTypeKey, "unknown");
+  rules[0] = CreateRule1();
+  rules[0]->actions[0] = make_linked_ptr(new json_schema_compiler::any::Any);
+  rules[0]->actions[0]->Init(action_dict);
+  EXPECT_NE("", registry->AddRules(kExtensionId2, rules));
+
+  net::TestURLRequestContext context;
+  net::TestURLRequest http_request(GURL("http://www.example.com"), NULL,
+                                   &context);
+  std::set<WebRequestRule::GlobalRuleId> matches = registry->GetMatches(
+      WebRequestRule::RequestData(&http_request, ON_BEFORE_REQUEST));
+  EXPECT_EQ(2u, matches.size());
+  EXPECT_TRUE(matches.find(std::make_pair(kExtensionId, kRuleId1)) !=
+      matches.end());
+  EXPECT_TRUE(matches.find(std::make_pair(kExtensionId2, kRuleId2)) !=
+      matches.end());
+
+  EXPECT_EQ("", registry->RemoveAllRules(kExtensionId));
+  EXPECT_EQ("", registry->RemoveAllRules(kExtensionId2));
+  EXPECT_TRUE(registry->IsEmpty());
+}
+
 TEST_F(WebRequestRulesRegistryTest, RemoveRulesImpl) {
   scoped_refptr<TestWebRequestRulesRegistry> registry(
       new TestWebRequestRulesRegistry());
@@ -361,7 +424,7 @@ TEST_F(WebRequestRulesRegistryTest, Precedences) {
   GURL url("http://www.google.com");
   net::TestURLRequestContext context;
   net::TestURLRequest request(url, NULL, &context);
-  std::list<LinkedPtrEventResponseDelta> deltas =
+  std::vector<LinkedPtrEventResponseDelta> deltas =
       registry->CreateDeltas(
           NULL,
           WebRequestRule::RequestData(&request, ON_BEFORE_REQUEST),
@@ -370,9 +433,10 @@ TEST_F(WebRequestRulesRegistryTest, Precedences) {
   // The second extension is installed later and will win for this reason
   // in conflict resolution.
   ASSERT_EQ(2u, deltas.size());
-  deltas.sort(&helpers::InDecreasingExtensionInstallationTimeOrder);
+  std::sort(deltas.begin(), deltas.end(),
+            &helpers::InDecreasingExtensionInstallationTimeOrder);
 
-  std::list<LinkedPtrEventResponseDelta>::iterator i = deltas.begin();
+  std::vector<LinkedPtrEventResponseDelta>::iterator i = deltas.begin();
   LinkedPtrEventResponseDelta winner = *i++;
   LinkedPtrEventResponseDelta loser = *i;
 
@@ -411,7 +475,7 @@ TEST_F(WebRequestRulesRegistryTest, Priorities) {
   GURL url("http://www.google.com/index.html");
   net::TestURLRequestContext context;
   net::TestURLRequest request(url, NULL, &context);
-  std::list<LinkedPtrEventResponseDelta> deltas =
+  std::vector<LinkedPtrEventResponseDelta> deltas =
       registry->CreateDeltas(
           NULL,
           WebRequestRule::RequestData(&request, ON_BEFORE_REQUEST),
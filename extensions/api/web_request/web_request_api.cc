@@ -25,6 +25,7 @@
 #include "chrome/browser/extensions/api/web_request/upload_data_presenter.h"
 #include "chrome/browser/extensions/api/web_request/web_request_api_constants.h"
 #include "chrome/browser/extensions/api/web_request/web_request_api_helpers.h"
+#include "chrome/browser/extensions/api/web_request/web_request_filter_index.h"
 #include "chrome/browser/extensions/api/web_request/web_request_time_tracker.h"
 #include "chrome/browser/extensions/event_router.h"
 #include "chrome/browser/extensions/extension_info_map.h"
@@ -391,6 +392,14 @@ struct ExtensionWebRequestEventRouter::EventListener {
   EventListener() : extra_info_spec(0) {}
 };
 
+// The listeners to one event of one profile, in the order of |listeners_|,
+// and the index of their filters. |listeners[i]| owns the filter at position
+// |i| of |filters|.
+struct ExtensionWebRequestEventRouter::ListenerIndex {
+  std::vector<const EventListener*> listeners;
+  WebRequestFilterIndex filters;
+};
+
 // Contains info about requests that are blocked waiting for a response from
 // an extension.
 struct ExtensionWebRequestEventRouter::BlockedRequest {
@@ -629,13 +638,14 @@ int ExtensionWebRequestEventRouter::OnBeforeRequest(
   if (!initialize_blocked_requests)
     return net::OK;  // Nobody saw a reason for modifying the request.
 
-  blocked_requests_[request->identifier()].event = kOnBeforeRequest;
-  blocked_requests_[request->identifier()].request = request;
-  blocked_requests_[request->identifier()].callback = callback;
-  blocked_requests_[request->identifier()].new_url = new_url;
-  blocked_requests_[request->identifier()].net_log = &request->net_log();
+  BlockedRequest& blocked_request = blocked_requests_[request->identifier()];
+  blocked_request.event = kOnBeforeRequest;
+  blocked_request.request = request;
+  blocked_request.callback = callback;
+  blocked_request.new_url = new_url;
+  blocked_request.net_log = &request->net_log();
 
-  if (blocked_requests_[request->identifier()].num_handlers_blocking == 0) {
+  if (blocked_request.num_handlers_blocking == 0) {
     // If there are no blocking handlers, only the declarative rules tried
     // to modify the request and we can respond synchronously.
     return ExecuteDeltas(profile, request->identifier(),
@@ -684,13 +694,14 @@ int ExtensionWebRequestEventRouter::OnBeforeSendHeaders(
   if (!initialize_blocked_requests)
     return net::OK;  // Nobody saw a reason for modifying the request.
 
-  blocked_requests_[request->identifier()].event = kOnBeforeSendHeaders;
-  blocked_requests_[request->identifier()].request = request;
-  blocked_requests_[request->identifier()].callback = callback;
-  blocked_requests_[request->identifier()].request_headers = headers;
-  blocked_requests_[request->identifier()].net_log = &request->net_log();
+  BlockedRequest& blocked_request = blocked_requests_[request->identifier()];
+  blocked_request.event = kOnBeforeSendHeaders;
+  blocked_request.request = request;
+  blocked_request.callback = callback;
+  blocked_request.request_headers = headers;
+  blocked_request.net_log = &request->net_log();
 
-  if (blocked_requests_[request->identifier()].num_handlers_blocking == 0) {
+  if (blocked_request.num_handlers_blocking == 0) {
     // If there are no blocking handlers, only the declarative rules tried
     // to modify the request and we can respond synchronously.
     return ExecuteDeltas(profile, request->identifier(),
@@ -779,16 +790,15 @@ int ExtensionWebRequestEventRouter::OnHeadersReceived(
   if (!initialize_blocked_requests)
     return net::OK;  // Nobody saw a reason for modifying the request.
 
-  blocked_requests_[request->identifier()].event = kOnHeadersReceived;
-  blocked_requests_[request->identifier()].request = request;
-  blocked_requests_[request->identifier()].callback = callback;
-  blocked_requests_[request->identifier()].net_log = &request->net_log();
-  blocked_requests_[request->identifier()].override_response_headers =
-      override_response_headers;
-  blocked_requests_[request->identifier()].original_response_headers =
-      original_response_headers;
+  BlockedRequest& blocked_request = blocked_requests_[request->identifier()];
+  blocked_request.event = kOnHeadersReceived;
+  blocked_request.request = request;
+  blocked_request.callback = callback;
+  blocked_request.net_log = &request->net_log();
+  blocked_request.override_response_headers = override_response_headers;
+  blocked_request.original_response_headers = original_response_headers;
 
-  if (blocked_requests_[request->identifier()].num_handlers_blocking == 0) {
+  if (blocked_request.num_handlers_blocking == 0) {
     // If there are no blocking handlers, only the declarative rules tried
     // to modify the request and we can respond synchronously.
     return ExecuteDeltas(profile, request->identifier(),
@@ -840,11 +850,12 @@ ExtensionWebRequestEventRouter::OnAuthRequired(
   args.Append(dict);
 
   if (DispatchEvent(profile, request, listeners, args)) {
-    blocked_requests_[request->identifier()].event = kOnAuthRequired;
-    blocked_requests_[request->identifier()].request = request;
-    blocked_requests_[request->identifier()].auth_callback = callback;
-    blocked_requests_[request->identifier()].auth_credentials = credentials;
-    blocked_requests_[request->identifier()].net_log = &request->net_log();
+    BlockedRequest& blocked_request = blocked_requests_[request->identifier()];
+    blocked_request.event = kOnAuthRequired;
+    blocked_request.request = request;
+    blocked_request.auth_callback = callback;
+    blocked_request.auth_credentials = credentials;
+    blocked_request.net_log = &request->net_log();
     return net::NetworkDelegate::AUTH_REQUIRED_RESPONSE_IO_PENDING;
   }
   return net::NetworkDelegate::AUTH_REQUIRED_RESPONSE_NO_ACTION;
@@ -1095,10 +1106,10 @@ bool ExtensionWebRequestEventRouter::DispatchEvent(
   }
 
   if (num_handlers_blocking > 0) {
-    blocked_requests_[request->identifier()].request = request;
-    blocked_requests_[request->identifier()].num_handlers_blocking +=
-        num_handlers_blocking;
-    blocked_requests_[request->identifier()].blocking_time = base::Time::Now();
+    BlockedRequest& blocked_request = blocked_requests_[request->identifier()];
+    blocked_request.request = request;
+    blocked_request.num_handlers_blocking += num_handlers_blocking;
+    blocked_request.blocking_time = base::Time::Now();
 
     return true;
   }
@@ -1152,6 +1163,7 @@ bool ExtensionWebRequestEventRouter::AddEventListener(
     return false;
   }
   listeners_[profile][event_name].insert(listener);
+  listener_indices_[profile].erase(event_name);
   return true;
 }
 
@@ -1187,6 +1199,7 @@ void ExtensionWebRequestEventRouter::RemoveEventListener(
   }
 
   listeners_[profile][event_name].erase(listener);
+  listener_indices_[profile].erase(event_name);
 
   helpers::ClearCacheOnNavigation();
 }
@@ -1263,32 +1276,26 @@ void ExtensionWebRequestEventRouter::GetMatchingListenersImpl(
     int* extra_info_spec,
     std::vector<const ExtensionWebRequestEventRouter::EventListener*>*
         matching_listeners) {
-  std::set<EventListener>& listeners = listeners_[profile][event_name];
-  for (std::set<EventListener>::iterator it = listeners.begin();
-       it != listeners.end(); ++it) {
-    if (!it->ipc_sender.get()) {
+  const ListenerIndex& index = GetListenerIndex(profile, event_name);
+  std::vector<size_t> positions;
+  index.filters.GetMatchingFilters(url, tab_id, window_id, resource_type,
+                                   &positions);
+  for (std::vector<size_t>::const_iterator position = positions.begin();
+       position != positions.end(); ++position) {
+    const EventListener* listener = index.listeners[*position];
+    if (!listener->ipc_sender.get()) {
       // The IPC sender has been deleted. This listener will be removed soon
       // via a call to RemoveEventListener. For now, just skip it.
       continue;
     }
 
-    if (!it->filter.urls.is_empty() && !it->filter.urls.MatchesURL(url))
-      continue;
-    if (it->filter.tab_id != -1 && tab_id != it->filter.tab_id)
-      continue;
-    if (it->filter.window_id != -1 && window_id != it->filter.window_id)
-      continue;
-    if (!it->filter.types.empty() &&
-        std::find(it->filter.types.begin(), it->filter.types.end(),
-                  resource_type) == it->filter.types.end())
-      continue;
-
     if (!WebRequestPermissions::CanExtensionAccessURL(
-            extension_info_map, it->extension_id, url, crosses_incognito, true))
+            extension_info_map, listener->extension_id, url, crosses_incognito,
+            true))
       continue;
 
     bool blocking_listener =
-        (it->extra_info_spec &
+        (listener->extra_info_spec &
             (ExtraInfoSpec::BLOCKING | ExtraInfoSpec::ASYNC_BLOCKING)) != 0;
 
     // We do not want to notify extensions about XHR requests that are
@@ -1304,9 +1311,26 @@ void ExtensionWebRequestEventRouter::GetMatchingListenersImpl(
     if (blocking_listener && synchronous_xhr_from_extension)
       continue;
 
-    matching_listeners->push_back(&(*it));
-    *extra_info_spec |= it->extra_info_spec;
+    matching_listeners->push_back(listener);
+    *extra_info_spec |= listener->extra_info_spec;
+  }
+}
+
+const ExtensionWebRequestEventRouter::ListenerIndex&
+ExtensionWebRequestEventRouter::GetListenerIndex(
+    void* profile,
+    const std::string& event_name) {
+  linked_ptr<ListenerIndex>& index = listener_indices_[profile][event_name];
+  if (!index.get()) {
+    index = make_linked_ptr(new ListenerIndex);
+    std::set<EventListener>& listeners = listeners_[profile][event_name];
+    for (std::set<EventListener>::iterator it = listeners.begin();
+         it != listeners.end(); ++it) {
+      index->listeners.push_back(&(*it));
+      index->filters.AddFilter(&it->filter);
+    }
   }
+  return *index;
 }
 
 std::vector<const ExtensionWebRequestEventRouter::EventListener*>
@@ -1407,10 +1431,11 @@ void ExtensionWebRequestEventRouter::DecrementBlockCount(
 
   // It's possible that this request was deleted, or cancelled by a previous
   // event handler. If so, ignore this response.
-  if (blocked_requests_.find(request_id) == blocked_requests_.end())
+  BlockedRequestMap::iterator found = blocked_requests_.find(request_id);
+  if (found == blocked_requests_.end())
     return;
 
-  BlockedRequest& blocked_request = blocked_requests_[request_id];
+  BlockedRequest& blocked_request = found->second;
   int num_handlers_blocking = --blocked_request.num_handlers_blocking;
   CHECK_GE(num_handlers_blocking, 0);
 
@@ -1625,14 +1650,13 @@ bool ExtensionWebRequestEventRouter::ProcessDeclarativeRules(
           base::Bind(&ExtensionWebRequestEventRouter::OnRulesRegistryReady,
                      AsWeakPtr(), profile, event_name, request->identifier(),
                      request_stage));
-      blocked_requests_[request->identifier()].num_handlers_blocking++;
-      blocked_requests_[request->identifier()].request = request;
-      blocked_requests_[request->identifier()].blocking_time =
-          base::Time::Now();
-      blocked_requests_[request->identifier()].original_response_headers =
-          original_response_headers;
-      blocked_requests_[request->identifier()].extension_info_map =
-          extension_info_map;
+      BlockedRequest& blocked_request =
+          blocked_requests_[request->identifier()];
+      blocked_request.num_handlers_blocking++;
+      blocked_request.request = request;
+      blocked_request.blocking_time = base::Time::Now();
+      blocked_request.original_response_headers = original_response_headers;
+      blocked_request.extension_info_map = extension_info_map;
       return true;
     }
   }
@@ -1645,7 +1669,7 @@ bool ExtensionWebRequestEventRouter::ProcessDeclarativeRules(
        i != relevant_registries.end(); ++i) {
     extensions::WebRequestRulesRegistry* rules_registry =
         i->first;
-    helpers::EventResponseDeltas result =
+    std::vector<extensions::LinkedPtrEventResponseDelta> result =
         rules_registry->CreateDeltas(
             extension_info_map,
             extensions::WebRequestRule::RequestData(
@@ -1674,10 +1698,11 @@ void ExtensionWebRequestEventRouter::OnRulesRegistryReady(
     extensions::RequestStage request_stage) {
   // It's possible that this request was deleted, or cancelled by a previous
   // event handler. If so, ignore this response.
-  if (blocked_requests_.find(request_id) == blocked_requests_.end())
+  BlockedRequestMap::iterator found = blocked_requests_.find(request_id);
+  if (found == blocked_requests_.end())
     return;
 
-  BlockedRequest& blocked_request = blocked_requests_[request_id];
+  BlockedRequest& blocked_request = found->second;
   ProcessDeclarativeRules(profile, blocked_request.extension_info_map,
                           event_name, blocked_request.request, request_stage,
                           blocked_request.original_response_headers);
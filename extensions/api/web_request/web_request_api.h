@@ -11,6 +11,8 @@
 #include <string>
 #include <vector>
 
+#include "base/hash_tables.h"
+#include "base/memory/linked_ptr.h"
 #include "base/memory/singleton.h"
 #include "base/memory/weak_ptr.h"
 #include "base/time.h"
@@ -267,11 +269,16 @@ class ExtensionWebRequestEventRouter
   friend struct DefaultSingletonTraits<ExtensionWebRequestEventRouter>;
 
   struct EventListener;
+  struct ListenerIndex;
   typedef std::map<std::string, std::set<EventListener> > ListenerMapForProfile;
   typedef std::map<void*, ListenerMapForProfile> ListenerMap;
-  typedef std::map<uint64, BlockedRequest> BlockedRequestMap;
+  typedef std::map<std::string, linked_ptr<ListenerIndex> >
+      ListenerIndexMapForProfile;
+  typedef std::map<void*, ListenerIndexMapForProfile> ListenerIndexMap;
+  // Every stage of every request looks up these maps, so they are hashed.
+  typedef base::hash_map<uint64, BlockedRequest> BlockedRequestMap;
   // Map of request_id -> bit vector of EventTypes already signaled
-  typedef std::map<uint64, int> SignaledRequestMap;
+  typedef base::hash_map<uint64, int> SignaledRequestMap;
   typedef std::map<void*, void*> CrossProfileMap;
   typedef std::list<base::Closure> CallbacksForPageLoad;
 
@@ -316,6 +323,11 @@ class ExtensionWebRequestEventRouter
       std::vector<const ExtensionWebRequestEventRouter::EventListener*>*
           matching_listeners);
 
+  // Returns the index of the listeners to |event_name| in |profile|, building
+  // it if the listeners changed since it was last used.
+  const ListenerIndex& GetListenerIndex(void* profile,
+                                        const std::string& event_name);
+
   // Decrements the count of event handlers blocking the given request. When the
   // count reaches 0, we stop blocking the request and proceed it using the
   // method requested by the extension with the highest precedence. Precedence
@@ -386,6 +398,11 @@ class ExtensionWebRequestEventRouter
   // are listening to that event.
   ListenerMap listeners_;
 
+  // The compiled filters of the listeners in |listeners_|. An entry is
+  // dropped whenever the listeners to its event change and is rebuilt on the
+  // next event.
+  ListenerIndexMap listener_indices_;
+
   // A map of network requests that are waiting for at least one event handler
   // to respond.
   BlockedRequestMap blocked_requests_;
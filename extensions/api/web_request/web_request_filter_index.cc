@@ -0,0 +1,140 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/extensions/api/web_request/web_request_filter_index.h"
+
+#include <algorithm>
+
+#include "chrome/common/url_constants.h"
+#include "extensions/common/url_pattern.h"
+#include "extensions/common/url_pattern_set.h"
+#include "googleurl/src/gurl.h"
+
+using extensions::URLPatternSet;
+
+COMPILE_ASSERT(ResourceType::LAST_TYPE < 32,
+               resource_types_do_not_fit_in_an_int_mask);
+
+WebRequestFilterIndex::WebRequestFilterIndex() {}
+
+WebRequestFilterIndex::~WebRequestFilterIndex() {}
+
+size_t WebRequestFilterIndex::AddFilter(const RequestFilter* filter) {
+  size_t position = entries_.size();
+  Entry entry;
+  entry.filter = filter;
+  entry.resource_types = 0;
+  for (std::vector<ResourceType::Type>::const_iterator type =
+           filter->types.begin(); type != filter->types.end(); ++type) {
+    entry.resource_types |= 1 << *type;
+  }
+  if (filter->types.empty())
+    entry.resource_types = ~0;
+  entries_.push_back(entry);
+
+  const URLPatternSet& urls = filter->urls;
+  bool matches_any_host = urls.is_empty();
+  for (URLPatternSet::const_iterator pattern = urls.begin();
+       pattern != urls.end() && !matches_any_host; ++pattern) {
+    matches_any_host = pattern->match_all_urls() ||
+        (pattern->match_subdomains() && pattern->host().empty());
+  }
+  if (matches_any_host) {
+    any_host_.push_back(position);
+    return position;
+  }
+
+  for (URLPatternSet::const_iterator pattern = urls.begin();
+       pattern != urls.end(); ++pattern) {
+    if (pattern->match_subdomains())
+      AddToMap(&domains_, pattern->host(), position);
+    else
+      AddToMap(&hosts_, pattern->host(), position);
+  }
+  return position;
+}
+
+void WebRequestFilterIndex::GetMatchingFilters(
+    const GURL& url,
+    int tab_id,
+    int window_id,
+    ResourceType::Type resource_type,
+    std::vector<size_t>* matches) const {
+  matches->clear();
+  const int resource_type_bit = 1 << resource_type;
+
+  // URL patterns match filesystem: URLs by their inner URL, so don't try to
+  // narrow those down by host.
+  if (url.SchemeIs(chrome::kFileSystemScheme)) {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if (Matches(i, url, tab_id, window_id, resource_type_bit))
+        matches->push_back(i);
+    }
+    return;
+  }
+
+  AddMatches(any_host_, url, tab_id, window_id, resource_type_bit, matches);
+
+  const std::string& host = url.host();
+  HostMap::const_iterator it = hosts_.find(host);
+  if (it != hosts_.end())
+    AddMatches(it->second, url, tab_id, window_id, resource_type_bit, matches);
+
+  // A subdomain pattern matches its domain and everything below it, so look
+  // up the host and each of its parent domains.
+  if (!domains_.empty()) {
+    for (size_t pos = 0; ; ++pos) {
+      it = domains_.find(host.substr(pos));
+      if (it != domains_.end()) {
+        AddMatches(it->second, url, tab_id, window_id, resource_type_bit,
+                   matches);
+      }
+      pos = host.find('.', pos);
+      if (pos == std::string::npos)
+        break;
+    }
+  }
+
+  // A filter with several patterns may have been found in several lists.
+  std::sort(matches->begin(), matches->end());
+  matches->erase(std::unique(matches->begin(), matches->end()),
+                 matches->end());
+}
+
+bool WebRequestFilterIndex::Matches(size_t position,
+                                    const GURL& url,
+                                    int tab_id,
+                                    int window_id,
+                                    int resource_type_bit) const {
+  const Entry& entry = entries_[position];
+  if (!(entry.resource_types & resource_type_bit))
+    return false;
+  const RequestFilter* filter = entry.filter;
+  if (filter->tab_id != -1 && tab_id != filter->tab_id)
+    return false;
+  if (filter->window_id != -1 && window_id != filter->window_id)
+    return false;
+  return filter->urls.is_empty() || filter->urls.MatchesURL(url);
+}
+
+void WebRequestFilterIndex::AddMatches(const EntryList& list,
+                                       const GURL& url,
+                                       int tab_id,
+                                       int window_id,
+                                       int resource_type_bit,
+                                       std::vector<size_t>* matches) const {
+  for (EntryList::const_iterator it = list.begin(); it != list.end(); ++it) {
+    if (Matches(*it, url, tab_id, window_id, resource_type_bit))
+      matches->push_back(*it);
+  }
+}
+
+// static
+void WebRequestFilterIndex::AddToMap(HostMap* map,
+                                     const std::string& host,
+                                     size_t position) {
+  EntryList& list = (*map)[host];
+  if (list.empty() || list.back() != position)
+    list.push_back(position);
+}
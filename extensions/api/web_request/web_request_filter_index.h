@@ -0,0 +1,93 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHROME_BROWSER_EXTENSIONS_API_WEB_REQUEST_WEB_REQUEST_FILTER_INDEX_H_
+#define CHROME_BROWSER_EXTENSIONS_API_WEB_REQUEST_WEB_REQUEST_FILTER_INDEX_H_
+
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/hash_tables.h"
+#include "chrome/browser/extensions/api/web_request/web_request_api.h"
+#include "webkit/glue/resource_type.h"
+
+class GURL;
+
+// Finds the webRequest event filters that match a request without testing
+// every filter. Filters are bucketed by the hosts named in their URL patterns
+// and carry a bit mask of the resource types they accept, so a lookup only
+// fully tests the filters that listen to the request's host or to any host,
+// and only if they accept its resource type.
+//
+// The index is built once for the listeners of an event and must be rebuilt
+// when they change. It holds pointers to the filters, which must outlive it.
+class WebRequestFilterIndex {
+ public:
+  typedef ExtensionWebRequestEventRouter::RequestFilter RequestFilter;
+
+  WebRequestFilterIndex();
+  ~WebRequestFilterIndex();
+
+  // Adds |filter| and returns its position, which is the number of filters
+  // added before it.
+  size_t AddFilter(const RequestFilter* filter);
+
+  // Sets |matches| to the positions of the filters, in increasing order, that
+  // match a request for |url| of type |resource_type| made by tab |tab_id| in
+  // window |window_id|.
+  void GetMatchingFilters(const GURL& url,
+                          int tab_id,
+                          int window_id,
+                          ResourceType::Type resource_type,
+                          std::vector<size_t>* matches) const;
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    const RequestFilter* filter;
+    // Bit |1 << type| is set for each ResourceType::Type the filter accepts.
+    int resource_types;
+  };
+
+  // Positions in |entries_|, in increasing order.
+  typedef std::vector<size_t> EntryList;
+  typedef base::hash_map<std::string, EntryList> HostMap;
+
+  // Returns true if the filter at |position| matches the request.
+  bool Matches(size_t position,
+               const GURL& url,
+               int tab_id,
+               int window_id,
+               int resource_type_bit) const;
+
+  // Appends the positions in |list| whose filters match the request.
+  void AddMatches(const EntryList& list,
+                  const GURL& url,
+                  int tab_id,
+                  int window_id,
+                  int resource_type_bit,
+                  std::vector<size_t>* matches) const;
+
+  // Appends |position| to the list for |host| in |map|, once.
+  static void AddToMap(HostMap* map, const std::string& host, size_t position);
+
+  std::vector<Entry> entries_;
+
+  // Filters with a pattern for exactly one host, keyed by the host.
+  HostMap hosts_;
+
+  // Filters with a pattern for a domain and its subdomains, keyed by the
+  // domain.
+  HostMap domains_;
+
+  // Filters which match any host, because they have no URL patterns or a
+  // pattern with a wildcard host.
+  EntryList any_host_;
+
+  DISALLOW_COPY_AND_ASSIGN(WebRequestFilterIndex);
+};
+
+#endif  // CHROME_BROWSER_EXTENSIONS_API_WEB_REQUEST_WEB_REQUEST_FILTER_INDEX_H_
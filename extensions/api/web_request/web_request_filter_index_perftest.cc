@@ -0,0 +1,193 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/extensions/api/web_request/web_request_filter_index.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "base/perftimer.h"
+#include "base/stringprintf.h"
+#include "extensions/common/url_pattern.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+typedef ExtensionWebRequestEventRouter::RequestFilter RequestFilter;
+
+const int kValidSchemes = URLPattern::SCHEME_HTTP | URLPattern::SCHEME_HTTPS |
+    URLPattern::SCHEME_FTP | URLPattern::SCHEME_FILE |
+    URLPattern::SCHEME_EXTENSION;
+
+// The number of page loads in the trace, and the number of subresources each
+// page load requests.
+const int kPageLoads = 200;
+const int kSubresourcesPerPage = 80;
+
+// The number of times the trace is replayed for each measurement.
+const int kReplays = 5;
+
+struct TracedRequest {
+  GURL url;
+  ResourceType::Type type;
+  int tab_id;
+};
+
+// Returns a trace of page loads, each a main frame followed by images,
+// scripts, style sheets, XHRs and frames from the site itself, its CDN, and
+// a few shared ad and analytics hosts.
+std::vector<TracedRequest> MakeTrace() {
+  static const ResourceType::Type kTypes[] = {
+    ResourceType::IMAGE, ResourceType::IMAGE, ResourceType::IMAGE,
+    ResourceType::SCRIPT, ResourceType::SCRIPT, ResourceType::STYLESHEET,
+    ResourceType::XHR, ResourceType::SUB_FRAME,
+  };
+  std::vector<TracedRequest> trace;
+  for (int page = 0; page < kPageLoads; ++page) {
+    TracedRequest request;
+    request.tab_id = page % 7;
+    request.url = GURL(base::StringPrintf("http://www.site%d.com/", page));
+    request.type = ResourceType::MAIN_FRAME;
+    trace.push_back(request);
+    for (int i = 0; i < kSubresourcesPerPage; ++i) {
+      request.type = kTypes[i % arraysize(kTypes)];
+      switch (i % 4) {
+        case 0:
+          request.url = GURL(base::StringPrintf(
+              "http://www.site%d.com/res/%d", page, i));
+          break;
+        case 1:
+          request.url = GURL(base::StringPrintf(
+              "https://static%d.cdn%d.net/res/%d", i % 3, page % 10, i));
+          break;
+        case 2:
+          request.url = GURL(base::StringPrintf(
+              "http://pixel.ads%d.com/track?p=%d", i % 25, page));
+          break;
+        default:
+          request.url = GURL(base::StringPrintf(
+              "https://www.analytics%d.org/collect/%d", i % 15, page));
+          break;
+      }
+      trace.push_back(request);
+    }
+  }
+  return trace;
+}
+
+void AddPattern(RequestFilter* filter, const std::string& pattern_string) {
+  URLPattern pattern(kValidSchemes);
+  ASSERT_EQ(URLPattern::PARSE_SUCCESS, pattern.Parse(pattern_string));
+  filter->urls.AddPattern(pattern);
+}
+
+// Returns the filters of |count| listeners. Most block lists of ad and
+// analytics domains, some watch all scripts and frames, and a few watch
+// every request.
+std::vector<RequestFilter> MakeFilters(int count) {
+  std::vector<RequestFilter> filters(count);
+  for (int i = 0; i < count; ++i) {
+    RequestFilter* filter = &filters[i];
+    switch (i % 5) {
+      case 0:
+        AddPattern(filter, "<all_urls>");
+        break;
+      case 1:
+        AddPattern(filter, "<all_urls>");
+        filter->types.push_back(ResourceType::SCRIPT);
+        filter->types.push_back(ResourceType::SUB_FRAME);
+        break;
+      default:
+        for (int j = 0; j < 20; ++j) {
+          AddPattern(filter, base::StringPrintf("*://*.ads%d.com/*",
+                                                (i * 7 + j) % 40));
+          AddPattern(filter, base::StringPrintf("*://*.analytics%d.org/*",
+                                                (i * 3 + j) % 30));
+        }
+        break;
+    }
+  }
+  return filters;
+}
+
+// Tests every filter, as the event router did before it indexed them.
+void GetMatchingFiltersLinear(const std::vector<RequestFilter>& filters,
+                              const TracedRequest& request,
+                              std::vector<size_t>* matches) {
+  matches->clear();
+  for (size_t i = 0; i < filters.size(); ++i) {
+    const RequestFilter& filter = filters[i];
+    if (!filter.urls.is_empty() && !filter.urls.MatchesURL(request.url))
+      continue;
+    if (filter.tab_id != -1 && request.tab_id != filter.tab_id)
+      continue;
+    if (!filter.types.empty() &&
+        std::find(filter.types.begin(), filter.types.end(), request.type) ==
+            filter.types.end())
+      continue;
+    matches->push_back(i);
+  }
+}
+
+}  // namespace
+
+// Replays a trace of page loads against a growing number of listeners, once
+// testing every filter and once with WebRequestFilterIndex, and checks that
+// both find the same listeners.
+TEST(WebRequestFilterIndexPerfTest, PageLoadTrace) {
+  const std::vector<TracedRequest> trace = MakeTrace();
+  const int kListenerCounts[] = { 5, 20, 50, 100 };
+  for (size_t c = 0; c < arraysize(kListenerCounts); ++c) {
+    const int listeners = kListenerCounts[c];
+    const std::vector<RequestFilter> filters = MakeFilters(listeners);
+
+    std::vector<std::vector<size_t> > expected(trace.size());
+    {
+      PerfTimer timer;
+      for (int replay = 0; replay < kReplays; ++replay) {
+        for (size_t i = 0; i < trace.size(); ++i)
+          GetMatchingFiltersLinear(filters, trace[i], &expected[i]);
+      }
+      LogPerfResult(
+          base::StringPrintf("WebRequestListeners_linear_%d", listeners)
+              .c_str(),
+          timer.Elapsed().InMicroseconds() /
+              static_cast<double>(kReplays * trace.size()),
+          "us/request");
+    }
+
+    WebRequestFilterIndex index;
+    {
+      PerfTimeLogger timer(base::StringPrintf(
+          "WebRequestListeners_build_index_%d", listeners).c_str());
+      for (size_t i = 0; i < filters.size(); ++i)
+        index.AddFilter(&filters[i]);
+    }
+
+    std::vector<size_t> actual;
+    PerfTimer timer;
+    for (int replay = 0; replay < kReplays; ++replay) {
+      for (size_t i = 0; i < trace.size(); ++i) {
+        index.GetMatchingFilters(trace[i].url, trace[i].tab_id, -1,
+                                 trace[i].type, &actual);
+      }
+    }
+    LogPerfResult(
+        base::StringPrintf("WebRequestListeners_index_%d", listeners).c_str(),
+        timer.Elapsed().InMicroseconds() /
+            static_cast<double>(kReplays * trace.size()),
+        "us/request");
+
+    size_t matched = 0;
+    for (size_t i = 0; i < trace.size(); ++i) {
+      index.GetMatchingFilters(trace[i].url, trace[i].tab_id, -1,
+                               trace[i].type, &actual);
+      EXPECT_EQ(expected[i], actual) << trace[i].url.spec();
+      matched += actual.size();
+    }
+    EXPECT_GT(matched, trace.size());
+  }
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/extensions/api/web_request/web_request_filter_index.h"
+
+#include <string>
+#include <vector>
+
+#include "extensions/common/url_pattern.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+typedef ExtensionWebRequestEventRouter::RequestFilter RequestFilter;
+
+const int kValidSchemes = URLPattern::SCHEME_HTTP | URLPattern::SCHEME_HTTPS |
+    URLPattern::SCHEME_FTP | URLPattern::SCHEME_FILE |
+    URLPattern::SCHEME_EXTENSION;
+
+void AddPattern(RequestFilter* filter, const std::string& pattern_string) {
+  URLPattern pattern(kValidSchemes);
+  ASSERT_EQ(URLPattern::PARSE_SUCCESS, pattern.Parse(pattern_string));
+  filter->urls.AddPattern(pattern);
+}
+
+std::vector<size_t> Match(const WebRequestFilterIndex& index,
+                          const std::string& url,
+                          ResourceType::Type type) {
+  std::vector<size_t> matches;
+  index.GetMatchingFilters(GURL(url), 1, 2, type, &matches);
+  return matches;
+}
+
+std::vector<size_t> Positions(size_t a, size_t b) {
+  std::vector<size_t> positions;
+  positions.push_back(a);
+  positions.push_back(b);
+  return positions;
+}
+
+}  // namespace
+
+TEST(WebRequestFilterIndexTest, URLPatterns) {
+  RequestFilter all_urls;
+  AddPattern(&all_urls, "<all_urls>");
+  RequestFilter exact;
+  AddPattern(&exact, "http://www.example.com/*");
+  RequestFilter subdomains;
+  AddPattern(&subdomains, "*://*.ads.net/banner/*");
+  RequestFilter several;
+  AddPattern(&several, "https://secure.org/*");
+  AddPattern(&several, "*://*.secure.org/*");
+  AddPattern(&several, "file:///*");
+  RequestFilter no_urls;
+
+  WebRequestFilterIndex index;
+  EXPECT_EQ(0u, index.AddFilter(&all_urls));
+  EXPECT_EQ(1u, index.AddFilter(&exact));
+  EXPECT_EQ(2u, index.AddFilter(&subdomains));
+  EXPECT_EQ(3u, index.AddFilter(&several));
+  EXPECT_EQ(4u, index.AddFilter(&no_urls));
+  EXPECT_EQ(5u, index.size());
+
+  const ResourceType::Type image = ResourceType::IMAGE;
+  EXPECT_EQ(Positions(0, 4), Match(index, "http://www.other.com/", image));
+
+  std::vector<size_t> expected;
+  expected.push_back(0);
+  expected.push_back(1);
+  expected.push_back(4);
+  EXPECT_EQ(expected, Match(index, "http://www.example.com/x", image));
+  EXPECT_EQ(Positions(0, 4), Match(index, "https://www.example.com/", image));
+  EXPECT_EQ(Positions(0, 4), Match(index, "http://example.com/", image));
+
+  expected[1] = 2;
+  EXPECT_EQ(expected, Match(index, "http://ads.net/banner/1", image));
+  EXPECT_EQ(expected, Match(index, "http://a.b.ads.net/banner/1", image));
+  EXPECT_EQ(Positions(0, 4), Match(index, "http://a.ads.net/other", image));
+  EXPECT_EQ(Positions(0, 4), Match(index, "http://notads.net/banner/", image));
+
+  // The filter with several patterns is only returned once.
+  expected[1] = 3;
+  EXPECT_EQ(expected, Match(index, "https://secure.org/", image));
+  EXPECT_EQ(expected, Match(index, "http://www.secure.org/", image));
+  EXPECT_EQ(expected, Match(index, "file:///tmp/test.html", image));
+}
+
+TEST(WebRequestFilterIndexTest, TypesTabAndWindow) {
+  RequestFilter images;
+  images.types.push_back(ResourceType::IMAGE);
+  RequestFilter scripts_and_frames;
+  scripts_and_frames.types.push_back(ResourceType::SCRIPT);
+  scripts_and_frames.types.push_back(ResourceType::MAIN_FRAME);
+  RequestFilter tab;
+  tab.tab_id = 1;
+  RequestFilter other_tab;
+  other_tab.tab_id = 3;
+  RequestFilter other_window;
+  other_window.window_id = 3;
+
+  WebRequestFilterIndex index;
+  index.AddFilter(&images);
+  index.AddFilter(&scripts_and_frames);
+  index.AddFilter(&tab);
+  index.AddFilter(&other_tab);
+  index.AddFilter(&other_window);
+
+  const std::string url("http://www.example.com/");
+  EXPECT_EQ(Positions(0, 2), Match(index, url, ResourceType::IMAGE));
+  EXPECT_EQ(Positions(1, 2), Match(index, url, ResourceType::SCRIPT));
+  EXPECT_EQ(Positions(1, 2), Match(index, url, ResourceType::MAIN_FRAME));
+  EXPECT_EQ(std::vector<size_t>(1, 2),
+            Match(index, url, ResourceType::STYLESHEET));
+  EXPECT_EQ(std::vector<size_t>(1, 2),
+            Match(index, url, ResourceType::LAST_TYPE));
+}
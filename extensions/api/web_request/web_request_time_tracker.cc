@@ -35,6 +35,10 @@ const double kThresholdExcessiveDelay = 0.50;
 const size_t kNumModerateDelaysBeforeWarning = 50u;
 const size_t kNumExcessiveDelaysBeforeWarning = 10u;
 
+// Prefix of the names of the histograms of delays caused by each extension.
+const char kExtensionBlockTimeHistogramPrefix[] =
+    "Extensions.NetworkDelayByExtension.";
+
 // Default implementation for ExtensionWebRequestTimeTrackerDelegate
 // that sets a warning in the extension service of |profile|.
 class DefaultDelegate : public ExtensionWebRequestTimeTrackerDelegate {
@@ -216,6 +220,16 @@ void ExtensionWebRequestTimeTracker::IncrementExtensionBlockTime(
     const std::string& extension_id,
     int64 request_id,
     const base::TimeDelta& block_time) {
+  base::Histogram*& histogram = extension_block_time_histograms_[extension_id];
+  if (!histogram) {
+    // Not flagged for UMA, as the name contains the extension ID.
+    histogram = base::Histogram::FactoryTimeGet(
+        GetExtensionBlockTimeHistogramName(extension_id),
+        base::TimeDelta::FromMilliseconds(1), base::TimeDelta::FromSeconds(10),
+        50, base::Histogram::kNoFlags);
+  }
+  histogram->AddTime(block_time);
+
   if (request_time_logs_.find(request_id) == request_time_logs_.end())
     return;
   RequestTimeLog& log = request_time_logs_[request_id];
@@ -248,6 +262,12 @@ void ExtensionWebRequestTimeTracker::SetRequestRedirected(int64 request_id) {
   request_time_logs_.erase(request_id);
 }
 
+// static
+std::string ExtensionWebRequestTimeTracker::GetExtensionBlockTimeHistogramName(
+    const std::string& extension_id) {
+  return kExtensionBlockTimeHistogramPrefix + extension_id;
+}
+
 void ExtensionWebRequestTimeTracker::SetDelegate(
     ExtensionWebRequestTimeTrackerDelegate* delegate) {
   delegate_.reset(delegate);
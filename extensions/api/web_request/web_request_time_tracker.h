@@ -16,6 +16,7 @@
 #include "googleurl/src/gurl.h"
 
 namespace base {
+class Histogram;
 class Time;
 }
 
@@ -55,7 +56,9 @@ class ExtensionWebRequestTimeTracker {
   void LogRequestEndTime(int64 request_id, const base::Time& end_time);
 
   // Records an additional delay for the given request caused by the given
-  // extension.
+  // extension. The delay is also recorded in a histogram of the extension's
+  // delays, named by GetExtensionBlockTimeHistogramName(), which is shown in
+  // about:histograms but never uploaded.
   void IncrementExtensionBlockTime(
       const std::string& extension_id,
       int64 request_id,
@@ -76,6 +79,10 @@ class ExtensionWebRequestTimeTracker {
   // Takes ownership of |delegate|.
   void SetDelegate(ExtensionWebRequestTimeTrackerDelegate* delegate);
 
+  // Returns the name of the histogram of delays caused by |extension_id|.
+  static std::string GetExtensionBlockTimeHistogramName(
+      const std::string& extension_id);
+
  private:
   // Timing information for a single request.
   struct RequestTimeLog {
@@ -109,6 +116,10 @@ class ExtensionWebRequestTimeTracker {
   std::set<int64> excessive_delays_;
   std::set<int64> moderate_delays_;
 
+  // The histograms of delays caused by each extension, by extension ID. The
+  // histograms are owned by the base::StatisticsRecorder.
+  std::map<std::string, base::Histogram*> extension_block_time_histograms_;
+
   // Defaults to a delegate that sets warnings in the extension service.
   scoped_ptr<ExtensionWebRequestTimeTrackerDelegate> delegate_;
 
@@ -118,6 +129,8 @@ class ExtensionWebRequestTimeTracker {
   FRIEND_TEST_ALL_PREFIXES(ExtensionWebRequestTimeTrackerTest,
                            CancelOrRedirect);
   FRIEND_TEST_ALL_PREFIXES(ExtensionWebRequestTimeTrackerTest, Delays);
+  FRIEND_TEST_ALL_PREFIXES(ExtensionWebRequestTimeTrackerTest,
+                           ExtensionBlockTimeHistograms);
 
   DISALLOW_COPY_AND_ASSIGN(ExtensionWebRequestTimeTracker);
 };
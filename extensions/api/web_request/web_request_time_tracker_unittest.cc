@@ -4,6 +4,9 @@
 
 #include "chrome/browser/extensions/api/web_request/web_request_time_tracker.h"
 
+#include "base/metrics/histogram.h"
+#include "base/metrics/histogram_samples.h"
+#include "base/metrics/statistics_recorder.h"
 #include "testing/gmock/include/gmock/gmock.h"
 #include "testing/gtest/include/gtest/gtest.h"
 
@@ -146,3 +149,30 @@ TEST(ExtensionWebRequestTimeTrackerTest, Delegate) {
     Mock::VerifyAndClearExpectations(delegate);
   }
 }
+
+TEST(ExtensionWebRequestTimeTrackerTest, ExtensionBlockTimeHistograms) {
+  base::StatisticsRecorder::Initialize();
+  ExtensionWebRequestTimeTracker tracker;
+  base::Time start;
+  void* profile = NULL;
+  const std::string extension1_id("1");
+  const std::string extension2_id("2");
+
+  // Delays are recorded by extension, also for requests that are not logged.
+  tracker.LogRequestStartTime(42, start, GURL(), profile);
+  tracker.IncrementExtensionBlockTime(extension1_id, 42, kModerateDelay);
+  tracker.IncrementExtensionBlockTime(extension2_id, 42, kTinyDelay);
+  tracker.IncrementExtensionBlockTime(extension1_id, 43, kExcessiveDelay);
+  EXPECT_EQ(2u, tracker.extension_block_time_histograms_.size());
+
+  base::Histogram* histogram = base::StatisticsRecorder::FindHistogram(
+      ExtensionWebRequestTimeTracker::GetExtensionBlockTimeHistogramName(
+          extension1_id));
+  ASSERT_TRUE(histogram);
+  EXPECT_EQ(2, histogram->SnapshotSamples()->TotalCount());
+  histogram = base::StatisticsRecorder::FindHistogram(
+      ExtensionWebRequestTimeTracker::GetExtensionBlockTimeHistogramName(
+          extension2_id));
+  ASSERT_TRUE(histogram);
+  EXPECT_EQ(1, histogram->SnapshotSamples()->TotalCount());
+}
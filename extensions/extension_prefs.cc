@@ -5,6 +5,7 @@
 #include "chrome/browser/extensions/extension_prefs.h"
 
 #include "base/command_line.h"
+#include "base/metrics/histogram.h"
 #include "base/prefs/pref_notifier.h"
 #include "base/string_number_conversions.h"
 #include "base/string_util.h"
@@ -1579,6 +1580,21 @@ void ExtensionPrefs::UpdateExtensionPref(const std::string& extension_id,
     NOTREACHED() << "Invalid extension_id " << extension_id;
     return;
   }
+  // Every update of kExtensionsPref rewrites the whole Preferences file, of
+  // which the extension settings are usually the biggest part, so skip
+  // updates that don't change anything.
+  const DictionaryValue* extension = GetExtensionPref(extension_id);
+  if (extension) {
+    const Value* old_value = NULL;
+    bool unchanged = data_value ?
+        extension->Get(key, &old_value) && data_value->Equals(old_value) :
+        !extension->Get(key, &old_value);
+    UMA_HISTOGRAM_BOOLEAN("Extensions.PrefUpdateSkipped", unchanged);
+    if (unchanged) {
+      delete data_value;
+      return;
+    }
+  }
   ScopedExtensionPrefUpdate update(prefs_, extension_id);
   if (data_value)
     update->Set(key, data_value);
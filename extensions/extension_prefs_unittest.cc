@@ -1082,6 +1082,56 @@ class ExtensionPrefsNotifyWhenNeeded : public ExtensionPrefsPrepopulatedTest {
 TEST_F(ExtensionPrefsNotifyWhenNeeded,
     ExtensionPrefsNotifyWhenNeeded) {}
 
+// Tests that updates of an extension's prefs that don't change the value don't
+// notify the observers of the extension settings, so they don't cause writes.
+class ExtensionPrefsSkipUnchangedUpdate : public ExtensionPrefsTest {
+ public:
+  virtual void Initialize() {
+    using testing::_;
+    using testing::Mock;
+
+    extension_id_ = prefs_.AddExtensionAndReturnId("skip_unchanged_update");
+    ExtensionScopedPrefs* scoped_prefs = prefs();
+
+    MockPrefChangeCallback observer(prefs()->pref_service());
+    PrefChangeRegistrar registrar;
+    registrar.Init(prefs()->pref_service());
+    registrar.Add(ExtensionPrefs::kExtensionsPref, observer.GetCallback());
+
+    EXPECT_CALL(observer, OnPreferenceChanged(_));
+    scoped_prefs->UpdateExtensionPref(extension_id_, "test.key",
+                                      Value::CreateStringValue("value"));
+    Mock::VerifyAndClearExpectations(&observer);
+
+    // Same value, and removal of a key that isn't set.
+    EXPECT_CALL(observer, OnPreferenceChanged(_)).Times(0);
+    scoped_prefs->UpdateExtensionPref(extension_id_, "test.key",
+                                      Value::CreateStringValue("value"));
+    scoped_prefs->UpdateExtensionPref(extension_id_, "test.other_key", NULL);
+    Mock::VerifyAndClearExpectations(&observer);
+
+    EXPECT_CALL(observer, OnPreferenceChanged(_));
+    scoped_prefs->UpdateExtensionPref(extension_id_, "test.key",
+                                      Value::CreateStringValue("changed"));
+    Mock::VerifyAndClearExpectations(&observer);
+
+    registrar.Remove(ExtensionPrefs::kExtensionsPref);
+  }
+
+  virtual void Verify() {
+    const DictionaryValue* extension =
+        prefs()->GetExtensionPref(extension_id_);
+    ASSERT_TRUE(extension);
+    std::string value;
+    EXPECT_TRUE(extension->GetString("test.key", &value));
+    EXPECT_EQ("changed", value);
+  }
+
+ private:
+  std::string extension_id_;
+};
+TEST_F(ExtensionPrefsSkipUnchangedUpdate, SkipUnchangedUpdate) {}
+
 // Tests disabling an extension.
 class ExtensionPrefsDisableExt : public ExtensionPrefsPrepopulatedTest {
   virtual void Initialize() {
@@ -7,12 +7,24 @@
 #include <algorithm>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <numeric>
 #include <set>
 
 #include "base/i18n/break_iterator.h"
 #include "base/i18n/case_conversion.h"
+#include "base/logging.h"
 #include "base/string_util.h"
+#include "build/build_config.h"
+
+// SSE2 is always available on x86-64. 32-bit x86 builds use it only when the
+// compiler has been told to target it.
+#if defined(ARCH_CPU_X86_64) || \
+    (defined(ARCH_CPU_X86) && (defined(__SSE2__) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2)))
+#define HISTORY_USE_SSE2_TERM_MATCHING
+#include <emmintrin.h>
+#endif
 
 namespace history {
 
@@ -29,16 +41,94 @@ const int kScoreRank[] = { 1450, 1200, 900, 400 };
 
 // Matches within URL and Title Strings ----------------------------------------
 
+namespace {
+
+// Only the first this-many characters of a string are searched for terms.
+const size_t kMaxCompareLength = 2048;
+
+// Appends a TermMatch for every position in |string| at which |term| occurs,
+// starting the scan at |start|. Candidate positions are found by comparing
+// the first and last characters of |term| and are then confirmed with a full
+// comparison. |term_length| must be at least 1.
+void FindTermMatchesScalar(const char16* term,
+                           size_t term_length,
+                           const char16* string,
+                           size_t string_length,
+                           size_t start,
+                           int term_num,
+                           TermMatches* matches) {
+  if (string_length < term_length)
+    return;
+  const char16 first = term[0];
+  const char16 last = term[term_length - 1];
+  const size_t end = string_length - term_length + 1;
+  for (size_t i = start; i < end; ++i) {
+    if (string[i] == first && string[i + term_length - 1] == last &&
+        std::equal(term + 1, term + term_length, string + i + 1))
+      matches->push_back(TermMatch(term_num, i, term_length));
+  }
+}
+
+#if defined(HISTORY_USE_SSE2_TERM_MATCHING)
+
+// Same as FindTermMatchesScalar() but checks eight candidate positions at a
+// time by comparing the first and last characters of |term| against two
+// unaligned 128-bit loads of |string|.
+void FindTermMatchesSSE2(const char16* term,
+                         size_t term_length,
+                         const char16* string,
+                         size_t string_length,
+                         int term_num,
+                         TermMatches* matches) {
+  const size_t kLanes = sizeof(__m128i) / sizeof(char16);
+  if (string_length < term_length)
+    return;
+  const __m128i first = _mm_set1_epi16(static_cast<short>(term[0]));
+  const __m128i last =
+      _mm_set1_epi16(static_cast<short>(term[term_length - 1]));
+  const size_t end = string_length - term_length + 1;
+  size_t i = 0;
+  for (; i + kLanes <= end; i += kLanes) {
+    const __m128i block_first = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(string + i));
+    const __m128i block_last = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(string + i + term_length - 1));
+    // Each matching 16-bit lane sets two adjacent bits in the mask.
+    int mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi16(block_first, first),
+        _mm_cmpeq_epi16(block_last, last)));
+    for (size_t lane = 0; mask; ++lane, mask >>= 2) {
+      if ((mask & 1) && std::equal(term + 1, term + term_length,
+                                   string + i + lane + 1))
+        matches->push_back(TermMatch(term_num, i + lane, term_length));
+    }
+  }
+  FindTermMatchesScalar(term, term_length, string, string_length, i, term_num,
+                        matches);
+}
+
+#endif  // defined(HISTORY_USE_SSE2_TERM_MATCHING)
+
+}  // namespace
+
 TermMatches MatchTermInString(const string16& term,
                               const string16& string,
                               int term_num) {
-  const size_t kMaxCompareLength = 2048;
-  const string16& short_string = (string.length() > kMaxCompareLength) ?
-      string.substr(0, kMaxCompareLength) : string;
   TermMatches matches;
-  for (size_t location = short_string.find(term); location != string16::npos;
-       location = short_string.find(term, location + 1))
-    matches.push_back(TermMatch(term_num, location, term.length()));
+  const size_t string_length = std::min(string.length(), kMaxCompareLength);
+  if (term.empty()) {
+    // An empty term matches at every position, including the end.
+    for (size_t location = 0; location <= string_length; ++location)
+      matches.push_back(TermMatch(term_num, location, 0));
+    return matches;
+  }
+#if defined(HISTORY_USE_SSE2_TERM_MATCHING)
+  FindTermMatchesSSE2(term.data(), term.length(), string.data(),
+                      string_length, term_num, &matches);
+#else
+  FindTermMatchesScalar(term.data(), term.length(), string.data(),
+                        string_length, 0, term_num, &matches);
+#endif
   return matches;
 }
 
@@ -141,6 +231,405 @@ Char16Set Char16SetFromString16(const string16& term) {
   return characters;
 }
 
+// HistoryIDPostingList --------------------------------------------------------
+
+namespace {
+
+// Every this-many IDs in a posting list's buffer are recorded in its skip
+// list, which bounds the decoding needed to test membership.
+const size_t kPostingListSkipInterval = 64;
+
+// Pending changes are merged into a posting list's buffer once there are more
+// than this many of them, or more than one per this-many IDs in the buffer,
+// whichever is larger. Merging re-encodes the buffer, so this keeps the cost
+// of each change to a few decoded IDs on average.
+const size_t kMinPendingPostingListChanges = 64;
+const size_t kPostingListIDsPerPendingChange = 16;
+
+}  // namespace
+
+HistoryIDPostingList::const_iterator::const_iterator()
+    : data_(NULL),
+      pos_(0),
+      next_(0),
+      end_(0),
+      value_(0) {
+}
+
+HistoryIDPostingList::const_iterator::const_iterator(const uint8* data,
+                                                     size_t pos,
+                                                     size_t end,
+                                                     HistoryID base)
+    : data_(data),
+      pos_(pos),
+      next_(pos),
+      end_(end),
+      value_(base) {
+  if (pos_ < end_)
+    DecodeCurrent();
+}
+
+HistoryIDPostingList::const_iterator&
+    HistoryIDPostingList::const_iterator::operator++() {
+  DCHECK_LT(pos_, end_);
+  pos_ = next_;
+  if (pos_ < end_)
+    DecodeCurrent();
+  return *this;
+}
+
+void HistoryIDPostingList::const_iterator::DecodeCurrent() {
+  uint64 delta = 0;
+  int shift = 0;
+  size_t i = pos_;
+  for (; i < end_; ++i) {
+    delta |= static_cast<uint64>(data_[i] & 0x7F) << shift;
+    shift += 7;
+    if (!(data_[i] & 0x80))
+      break;
+  }
+  // A truncated encoding can only come from a corrupt buffer, which
+  // IsValidEncoding() should have rejected. Stop at the end regardless, so
+  // that iteration can neither overrun the buffer nor miss end().
+  next_ = std::min(i + 1, end_);
+  value_ += static_cast<HistoryID>(delta);
+}
+
+HistoryIDPostingList::HistoryIDPostingList()
+    : external_data_(NULL),
+      external_length_(0),
+      buffer_size_(0),
+      buffer_last_(0),
+      size_(0) {
+}
+
+HistoryIDPostingList::HistoryIDPostingList(const HistoryIDVector& sorted_ids)
+    : external_data_(NULL),
+      external_length_(0),
+      buffer_size_(0),
+      buffer_last_(0),
+      size_(0) {
+  Encode(sorted_ids);
+}
+
+HistoryIDPostingList::HistoryIDPostingList(const uint8* data,
+                                           size_t length,
+                                           size_t count,
+                                           HistoryID last_history_id)
+    : external_data_(length ? data : NULL),
+      external_length_(length),
+      buffer_size_(length ? count : 0),
+      buffer_last_(length ? last_history_id : 0),
+      size_(buffer_size_) {
+}
+
+HistoryIDPostingList::~HistoryIDPostingList() {}
+
+HistoryIDPostingList::const_iterator HistoryIDPostingList::begin() const {
+  MergePendingChanges();
+  return buffer_begin();
+}
+
+HistoryIDPostingList::const_iterator HistoryIDPostingList::end() const {
+  MergePendingChanges();
+  return buffer_end();
+}
+
+size_t HistoryIDPostingList::count(HistoryID history_id) const {
+  if (std::binary_search(pending_inserts_.begin(), pending_inserts_.end(),
+                         history_id))
+    return 1;
+  if (std::binary_search(pending_erasures_.begin(), pending_erasures_.end(),
+                         history_id))
+    return 0;
+  return BufferContains(history_id) ? 1 : 0;
+}
+
+bool HistoryIDPostingList::insert(HistoryID history_id) {
+  DCHECK_GE(history_id, 0);
+  EnsureOwned();
+  // The common case: IDs arrive in ascending order.
+  if (!buffer_size_ || history_id > buffer_last_) {
+    AppendToBuffer(history_id);
+    ++size_;
+    return true;
+  }
+  HistoryIDVector::iterator erasure = std::lower_bound(
+      pending_erasures_.begin(), pending_erasures_.end(), history_id);
+  if (erasure != pending_erasures_.end() && *erasure == history_id) {
+    pending_erasures_.erase(erasure);
+    ++size_;
+    return true;
+  }
+  if (BufferContains(history_id))
+    return false;
+  HistoryIDVector::iterator pos = std::lower_bound(
+      pending_inserts_.begin(), pending_inserts_.end(), history_id);
+  if (pos != pending_inserts_.end() && *pos == history_id)
+    return false;
+  pending_inserts_.insert(pos, history_id);
+  ++size_;
+  MergePendingChangesIfLarge();
+  return true;
+}
+
+size_t HistoryIDPostingList::erase(HistoryID history_id) {
+  EnsureOwned();
+  HistoryIDVector::iterator pos = std::lower_bound(
+      pending_inserts_.begin(), pending_inserts_.end(), history_id);
+  if (pos != pending_inserts_.end() && *pos == history_id) {
+    pending_inserts_.erase(pos);
+    --size_;
+    return 1;
+  }
+  if (!BufferContains(history_id))
+    return 0;
+  pos = std::lower_bound(pending_erasures_.begin(), pending_erasures_.end(),
+                         history_id);
+  if (pos != pending_erasures_.end() && *pos == history_id)
+    return 0;
+  pending_erasures_.insert(pos, history_id);
+  --size_;
+  MergePendingChangesIfLarge();
+  return 1;
+}
+
+void HistoryIDPostingList::clear() {
+  encoded_.clear();
+  external_data_ = NULL;
+  external_length_ = 0;
+  buffer_size_ = 0;
+  buffer_last_ = 0;
+  skips_.clear();
+  pending_inserts_.clear();
+  pending_erasures_.clear();
+  size_ = 0;
+}
+
+const uint8* HistoryIDPostingList::encoded_data() const {
+  MergePendingChanges();
+  return buffer_data();
+}
+
+size_t HistoryIDPostingList::ByteSize() const {
+  MergePendingChanges();
+  return buffer_length();
+}
+
+HistoryID HistoryIDPostingList::last_history_id() const {
+  DCHECK(!empty());
+  MergePendingChanges();
+  return buffer_last_;
+}
+
+void HistoryIDPostingList::AppendTo(HistoryIDVector* history_ids) const {
+  DCHECK(history_ids);
+  MergePendingChanges();
+  history_ids->reserve(history_ids->size() + size_);
+  for (const_iterator iter = buffer_begin(); iter != buffer_end(); ++iter)
+    history_ids->push_back(*iter);
+}
+
+// static
+bool HistoryIDPostingList::IsValidEncoding(const uint8* data,
+                                           size_t length,
+                                           size_t count,
+                                           HistoryID last_history_id) {
+  if (!length)
+    return count == 0;
+  size_t decoded = 0;
+  HistoryID value = 0;
+  size_t i = 0;
+  while (i < length) {
+    uint64 delta = 0;
+    int shift = 0;
+    for (;; ++i) {
+      if (i == length || shift > 63)
+        return false;  // Truncated or overlong varint.
+      delta |= static_cast<uint64>(data[i] & 0x7F) << shift;
+      shift += 7;
+      if (!(data[i] & 0x80))
+        break;
+    }
+    ++i;
+    // Only the first ID may be zero; the others must be strictly ascending.
+    if (decoded && delta == 0)
+      return false;
+    if (delta > static_cast<uint64>(kint64max - value))
+      return false;
+    value += static_cast<HistoryID>(delta);
+    ++decoded;
+  }
+  return decoded == count && value == last_history_id;
+}
+
+const uint8* HistoryIDPostingList::buffer_data() const {
+  if (external_data_)
+    return external_data_;
+  return encoded_.empty() ? NULL : &encoded_[0];
+}
+
+size_t HistoryIDPostingList::buffer_length() const {
+  return external_data_ ? external_length_ : encoded_.size();
+}
+
+HistoryIDPostingList::const_iterator
+    HistoryIDPostingList::buffer_begin() const {
+  if (!buffer_length())
+    return buffer_end();
+  return const_iterator(buffer_data(), 0, buffer_length(), 0);
+}
+
+HistoryIDPostingList::const_iterator HistoryIDPostingList::buffer_end() const {
+  return const_iterator(NULL, buffer_length(), buffer_length(), 0);
+}
+
+bool HistoryIDPostingList::BufferContains(HistoryID history_id) const {
+  if (!buffer_size_ || history_id > buffer_last_)
+    return false;
+  // Resume decoding after the last recorded ID not above |history_id|.
+  const_iterator iter = buffer_begin();
+  SkipList::const_iterator skip = std::upper_bound(
+      skips_.begin(), skips_.end(),
+      std::make_pair(history_id, std::numeric_limits<size_t>::max()));
+  if (skip != skips_.begin()) {
+    --skip;
+    if (skip->first == history_id)
+      return true;
+    iter = const_iterator(buffer_data(), skip->second, buffer_length(),
+                          skip->first);
+  }
+  for (const_iterator end = buffer_end(); iter != end; ++iter) {
+    if (*iter >= history_id)
+      return *iter == history_id;
+  }
+  return false;
+}
+
+void HistoryIDPostingList::Encode(const HistoryIDVector& sorted_ids) {
+  DCHECK(pending_inserts_.empty() && pending_erasures_.empty());
+  clear();
+  encoded_.reserve(sorted_ids.size() * 2);
+  skips_.reserve(sorted_ids.size() / kPostingListSkipInterval);
+  for (HistoryIDVector::const_iterator iter = sorted_ids.begin();
+       iter != sorted_ids.end(); ++iter)
+    AppendToBuffer(*iter);
+  size_ = buffer_size_;
+  // Trim any slack left over from the reservation or a previous encoding.
+  std::vector<uint8>(encoded_).swap(encoded_);
+}
+
+void HistoryIDPostingList::EnsureOwned() {
+  if (!external_data_)
+    return;
+  encoded_.assign(external_data_, external_data_ + external_length_);
+  external_data_ = NULL;
+  external_length_ = 0;
+  RebuildSkips();
+}
+
+void HistoryIDPostingList::AppendToBuffer(HistoryID history_id) {
+  DCHECK(!external_data_);
+  DCHECK(!buffer_size_ || history_id > buffer_last_);
+  uint64 delta =
+      static_cast<uint64>(history_id - (buffer_size_ ? buffer_last_ : 0));
+  while (delta >= 0x80) {
+    encoded_.push_back(static_cast<uint8>(delta | 0x80));
+    delta >>= 7;
+  }
+  encoded_.push_back(static_cast<uint8>(delta));
+  buffer_last_ = history_id;
+  if (++buffer_size_ % kPostingListSkipInterval == 0)
+    skips_.push_back(std::make_pair(history_id, encoded_.size()));
+}
+
+void HistoryIDPostingList::RebuildSkips() {
+  skips_.clear();
+  size_t count = 0;
+  for (const_iterator iter = buffer_begin(); iter != buffer_end(); ++iter) {
+    if (++count % kPostingListSkipInterval == 0)
+      skips_.push_back(std::make_pair(*iter, iter.next_));
+  }
+}
+
+void HistoryIDPostingList::MergePendingChanges() const {
+  if (pending_inserts_.empty() && pending_erasures_.empty())
+    return;
+  HistoryIDVector merged;
+  merged.reserve(size_);
+  HistoryIDVector::const_iterator insert_iter = pending_inserts_.begin();
+  HistoryIDVector::const_iterator erase_iter = pending_erasures_.begin();
+  for (const_iterator iter = buffer_begin(); iter != buffer_end(); ++iter) {
+    for (; insert_iter != pending_inserts_.end() && *insert_iter < *iter;
+         ++insert_iter)
+      merged.push_back(*insert_iter);
+    if (erase_iter != pending_erasures_.end() && *erase_iter == *iter) {
+      ++erase_iter;
+      continue;
+    }
+    merged.push_back(*iter);
+  }
+  merged.insert(merged.end(), insert_iter, pending_inserts_.end());
+  DCHECK_EQ(size_, merged.size());
+
+  // Only the representation changes, never the IDs the list holds, so this
+  // is safe to do on behalf of a const reader.
+  HistoryIDPostingList* self = const_cast<HistoryIDPostingList*>(this);
+  self->pending_inserts_.clear();
+  self->pending_erasures_.clear();
+  self->Encode(merged);
+}
+
+void HistoryIDPostingList::MergePendingChangesIfLarge() {
+  size_t limit = std::max(kMinPendingPostingListChanges,
+                          buffer_size_ / kPostingListIDsPerPendingChange);
+  if (pending_inserts_.size() + pending_erasures_.size() > limit)
+    MergePendingChanges();
+}
+
+// Gallops forward through [|first|, |last|) from |first| looking for the first
+// element not less than |value|.
+static HistoryIDVector::const_iterator GallopLowerBound(
+    HistoryIDVector::const_iterator first,
+    HistoryIDVector::const_iterator last,
+    HistoryID value) {
+  size_t step = 1;
+  HistoryIDVector::const_iterator low = first;
+  while (static_cast<size_t>(last - low) > step && *(low + step) < value) {
+    low += step;
+    step *= 2;
+  }
+  HistoryIDVector::const_iterator high =
+      (static_cast<size_t>(last - low) > step) ? low + step + 1 : last;
+  return std::lower_bound(low, high, value);
+}
+
+void IntersectHistoryIDs(const HistoryIDVector& a,
+                         const HistoryIDVector& b,
+                         HistoryIDVector* result) {
+  DCHECK(result);
+  result->clear();
+  const HistoryIDVector& small = (a.size() <= b.size()) ? a : b;
+  const HistoryIDVector& large = (a.size() <= b.size()) ? b : a;
+  if (small.empty())
+    return;
+  // For inputs of similar size a linear merge is the cheapest approach.
+  const size_t kGallopRatio = 8;
+  if (large.size() < small.size() * kGallopRatio) {
+    std::set_intersection(small.begin(), small.end(),
+                          large.begin(), large.end(),
+                          std::back_inserter(*result));
+    return;
+  }
+  HistoryIDVector::const_iterator large_iter = large.begin();
+  for (HistoryIDVector::const_iterator small_iter = small.begin();
+       small_iter != small.end() && large_iter != large.end(); ++small_iter) {
+    large_iter = GallopLowerBound(large_iter, large.end(), *small_iter);
+    if (large_iter != large.end() && *large_iter == *small_iter)
+      result->push_back(*small_iter);
+  }
+}
+
 // RowWordStarts ---------------------------------------------------------------
 
 RowWordStarts::RowWordStarts() {}
@@ -5,10 +5,12 @@
 #ifndef CHROME_BROWSER_HISTORY_IN_MEMORY_URL_INDEX_TYPES_H_
 #define CHROME_BROWSER_HISTORY_IN_MEMORY_URL_INDEX_TYPES_H_
 
+#include <iterator>
 #include <map>
 #include <set>
 #include <vector>
 
+#include "base/basictypes.h"
 #include "base/string16.h"
 #include "chrome/browser/history/history_types.h"
 #include "chrome/browser/autocomplete/history_provider_util.h"
@@ -41,7 +43,8 @@ typedef std::vector<TermMatch> TermMatches;
 // |term| found in the string |string|. Mark each match with |term_num| so
 // that the resulting TermMatches can be merged with other TermMatches for
 // other terms. Note that only the first 2,048 characters of |string| are
-// considered during the match operation.
+// considered during the match operation. Where SSE2 is available candidate
+// positions are found eight characters at a time.
 TermMatches MatchTermInString(const string16& term,
                               const string16& string,
                               int term_num);
@@ -123,9 +126,166 @@ typedef std::map<char16, WordIDSet> CharWordIDMap;
 typedef history::URLID HistoryID;
 typedef std::set<HistoryID> HistoryIDSet;
 typedef std::vector<HistoryID> HistoryIDVector;
-typedef std::map<WordID, HistoryIDSet> WordIDHistoryMap;
+
+// A compact, sorted set of HistoryIDs used as the posting list for a single
+// word. Rather than one tree node per HistoryID the IDs are kept in a single
+// flat buffer as varint-encoded deltas from the preceding ID, which typically
+// costs one or two bytes per ID. Since history IDs are handed out in
+// increasing order, inserting a new row is nearly always an append. Inserting
+// out of order and erasing are instead recorded in small sorted side lists,
+// and every so many IDs in the buffer are recorded in a skip list so that
+// membership can be tested without decoding the whole buffer. The side lists
+// are merged into the buffer once they grow large relative to it, or when the
+// encoded IDs are next read, so removing a row from every list it appears in
+// costs little more than a lookup per list. Since reading may merge pending
+// changes, a list must not be read on several threads at once. The
+// container-style member names mirror those of std::set so that callers can
+// treat the two alike.
+//
+// A posting list may also refer to an encoded buffer it does not own, such as
+// the block of posting lists read from a cache file, in which case the buffer
+// is copied only when the list is first modified. The owner of such a buffer
+// must keep it alive for as long as any posting list (or copy thereof) refers
+// to it, and should check it with IsValidEncoding() first.
+class HistoryIDPostingList {
+ public:
+  // A forward iterator which decodes the HistoryIDs in ascending order.
+  class const_iterator
+      : public std::iterator<std::forward_iterator_tag, HistoryID> {
+   public:
+    const_iterator();
+
+    HistoryID operator*() const { return value_; }
+    const_iterator& operator++();
+    bool operator==(const const_iterator& other) const {
+      return pos_ == other.pos_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return pos_ != other.pos_;
+    }
+
+   private:
+    friend class HistoryIDPostingList;
+
+    // Starts decoding at |pos|, where the preceding ID was |base|.
+    const_iterator(const uint8* data, size_t pos, size_t end, HistoryID base);
+
+    // Decodes the delta starting at |pos_| and adds it to |value_|. An
+    // encoding which runs past |end_| ends the iteration there.
+    void DecodeCurrent();
+
+    const uint8* data_;
+    size_t pos_;   // Offset of the current element's encoding.
+    size_t next_;  // Offset of the following element's encoding.
+    size_t end_;
+    HistoryID value_;
+  };
+
+  HistoryIDPostingList();
+  // Builds a posting list from |sorted_ids|, which must be sorted and free of
+  // duplicates.
+  explicit HistoryIDPostingList(const HistoryIDVector& sorted_ids);
+  // Refers to the |length| bytes at |data| as previously produced by
+  // encoded_data(). |count| and |last_history_id| must describe that buffer.
+  HistoryIDPostingList(const uint8* data,
+                       size_t length,
+                       size_t count,
+                       HistoryID last_history_id);
+  ~HistoryIDPostingList();
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns 1 if |history_id| is in the list, otherwise 0.
+  size_t count(HistoryID history_id) const;
+
+  // Adds |history_id| to the list. Returns false if it was already present.
+  bool insert(HistoryID history_id);
+
+  // Removes |history_id| from the list. Returns the number of IDs removed.
+  size_t erase(HistoryID history_id);
+
+  void clear();
+
+  // Appends the decoded IDs, in ascending order, to |history_ids|.
+  void AppendTo(HistoryIDVector* history_ids) const;
+
+  // Returns the encoded IDs and the number of bytes they occupy.
+  const uint8* encoded_data() const;
+  size_t ByteSize() const;
+
+  // Returns the largest ID in the list. The list must not be empty.
+  HistoryID last_history_id() const;
+
+  // Returns true if the |length| bytes at |data| hold exactly |count| well
+  // formed, ascending IDs, the largest of which is |last_history_id|.
+  static bool IsValidEncoding(const uint8* data,
+                              size_t length,
+                              size_t count,
+                              HistoryID last_history_id);
+
+ private:
+  // Pairs of an ID in the buffer and the offset of the encoding following it,
+  // for every so many IDs, from which decoding can resume.
+  typedef std::vector<std::pair<HistoryID, size_t> > SkipList;
+
+  // The encoded buffer, without any pending changes.
+  const uint8* buffer_data() const;
+  size_t buffer_length() const;
+  const_iterator buffer_begin() const;
+  const_iterator buffer_end() const;
+
+  // Returns true if the encoded buffer holds |history_id|, regardless of any
+  // pending erasure.
+  bool BufferContains(HistoryID history_id) const;
+
+  // Copies any external buffer into |encoded_| prior to a modification.
+  void EnsureOwned();
+
+  // Replaces the contents of the list with |sorted_ids|. There must be no
+  // pending changes.
+  void Encode(const HistoryIDVector& sorted_ids);
+
+  // Appends |history_id|, which must exceed |buffer_last_|, to |encoded_|.
+  void AppendToBuffer(HistoryID history_id);
+
+  // Rebuilds |skips_| by decoding the whole buffer.
+  void RebuildSkips();
+
+  // Merges |pending_inserts_| and |pending_erasures_| into the buffer. The
+  // IDs in the list are unchanged, only their representation, so this may be
+  // done by const readers.
+  void MergePendingChanges() const;
+  void MergePendingChangesIfLarge();
+
+  std::vector<uint8> encoded_;
+  const uint8* external_data_;  // If non-NULL, used in place of |encoded_|.
+  size_t external_length_;
+  size_t buffer_size_;  // The number of IDs in the buffer.
+  HistoryID buffer_last_;  // The largest ID in the buffer, if any.
+  SkipList skips_;  // Empty until an external buffer is first modified.
+  // Sorted IDs to be added to, or removed from, the buffer. Pending inserts
+  // are all below |buffer_last_| and are not in the buffer, while pending
+  // erasures are all in the buffer.
+  HistoryIDVector pending_inserts_;
+  HistoryIDVector pending_erasures_;
+  size_t size_;  // The number of IDs in the list, counting pending changes.
+};
+
+typedef std::map<WordID, HistoryIDPostingList> WordIDHistoryMap;
 typedef std::map<HistoryID, WordIDSet> HistoryIDWordMap;
 
+// Intersects the sorted HistoryID vectors |a| and |b|, putting the result into
+// |result|. When one input is much smaller than the other the larger one is
+// probed with a galloping (exponential) search rather than walked element by
+// element, so the cost is proportional to the size of the smaller input.
+void IntersectHistoryIDs(const HistoryIDVector& a,
+                         const HistoryIDVector& b,
+                         HistoryIDVector* result);
+
 // A map from history_id to the history's URL and title.
 typedef std::map<HistoryID, URLRow> HistoryInfoMap;
 
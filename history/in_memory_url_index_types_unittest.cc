@@ -120,6 +120,36 @@ TEST_F(InMemoryURLIndexTypesTest, StaticFunctions) {
     EXPECT_EQ(expected_offsets[i], matches_g[i].offset);
 }
 
+TEST_F(InMemoryURLIndexTypesTest, MatchTermInStringBlockBoundaries) {
+  // Place matches on either side of, and straddling, the eight character
+  // blocks scanned by the vectorized matcher.
+  string16 string(ASCIIToUTF16("abcdefgxabcdefgxyabcdefxyz-xyz.xyz/xyzxyz"));
+  TermMatches matches = MatchTermInString(ASCIIToUTF16("xyz"), string, 2);
+  const size_t expected_offsets[] = { 23, 27, 31, 35, 38 };
+  ASSERT_EQ(arraysize(expected_offsets), matches.size());
+  for (size_t i = 0; i < arraysize(expected_offsets); ++i) {
+    EXPECT_EQ(expected_offsets[i], matches[i].offset);
+    EXPECT_EQ(3U, matches[i].length);
+    EXPECT_EQ(2, matches[i].term_num);
+  }
+
+  // Overlapping occurrences are all reported.
+  matches = MatchTermInString(ASCIIToUTF16("aa"), ASCIIToUTF16("aaaaaaaaaa"),
+                              0);
+  EXPECT_EQ(9U, matches.size());
+
+  // A term longer than the string never matches.
+  EXPECT_TRUE(MatchTermInString(ASCIIToUTF16("abcdefghijk"),
+                                ASCIIToUTF16("abcdefghij"), 0).empty());
+
+  // Only the first 2,048 characters are considered.
+  string16 long_string(2045, 'a');
+  long_string.append(ASCIIToUTF16("xyzxyz"));
+  matches = MatchTermInString(ASCIIToUTF16("xyz"), long_string, 0);
+  ASSERT_EQ(1U, matches.size());
+  EXPECT_EQ(2045U, matches[0].offset);
+}
+
 TEST_F(InMemoryURLIndexTypesTest, OffsetsAndTermMatches) {
   // Test OffsetsFromTermMatches
   history::TermMatches matches_a;
@@ -144,4 +174,145 @@ TEST_F(InMemoryURLIndexTypesTest, OffsetsAndTermMatches) {
     EXPECT_EQ(expected_offsets_b[i], matches_b[i].offset);
 }
 
+TEST_F(InMemoryURLIndexTypesTest, HistoryIDPostingList) {
+  HistoryIDPostingList list;
+  EXPECT_TRUE(list.empty());
+  EXPECT_TRUE(list.begin() == list.end());
+
+  // In-order inserts, including a delta which needs a multi-byte varint.
+  EXPECT_TRUE(list.insert(3));
+  EXPECT_TRUE(list.insert(7));
+  EXPECT_TRUE(list.insert(100000));
+  EXPECT_FALSE(list.insert(7));
+  // Out-of-order inserts.
+  EXPECT_TRUE(list.insert(1));
+  EXPECT_TRUE(list.insert(500));
+  const HistoryID expected_a[] = { 1, 3, 7, 500, 100000 };
+  ASSERT_EQ(arraysize(expected_a), list.size());
+  HistoryIDVector decoded;
+  list.AppendTo(&decoded);
+  EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), expected_a));
+  EXPECT_EQ(1U, list.count(500));
+  EXPECT_EQ(0U, list.count(499));
+  EXPECT_EQ(0U, list.count(100001));
+
+  EXPECT_EQ(1U, list.erase(3));
+  EXPECT_EQ(0U, list.erase(3));
+  EXPECT_EQ(1U, list.erase(100000));
+  const HistoryID expected_b[] = { 1, 7, 500 };
+  ASSERT_EQ(arraysize(expected_b), list.size());
+  EXPECT_TRUE(std::equal(list.begin(), list.end(), expected_b));
+  // Appending after erasing the largest ID must still encode correctly.
+  EXPECT_TRUE(list.insert(600));
+  EXPECT_EQ(1U, list.count(600));
+  EXPECT_EQ(4U, list.size());
+
+  HistoryIDVector sorted_ids(expected_a, expected_a + arraysize(expected_a));
+  HistoryIDPostingList from_vector(sorted_ids);
+  EXPECT_EQ(sorted_ids.size(), from_vector.size());
+  EXPECT_TRUE(std::equal(from_vector.begin(), from_vector.end(),
+                         sorted_ids.begin()));
+  // Small deltas should take a single byte each.
+  EXPECT_LT(from_vector.ByteSize(), sorted_ids.size() * sizeof(HistoryID));
+
+  list.clear();
+  EXPECT_TRUE(list.empty());
+  EXPECT_EQ(0U, list.ByteSize());
+}
+
+// Compares a posting list against a std::set through a long series of changes,
+// enough for pending changes to be merged into the encoded buffer many times.
+TEST_F(InMemoryURLIndexTypesTest, HistoryIDPostingListManyChanges) {
+  HistoryIDPostingList list;
+  HistoryIDSet expected;
+  for (HistoryID id = 1; id <= 5000; ++id) {
+    EXPECT_TRUE(list.insert(id * 3));
+    expected.insert(id * 3);
+  }
+  uint32 seed = 1;
+  for (int i = 0; i < 20000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    HistoryID id = (seed >> 8) % 16000;
+    if (i % 3) {
+      EXPECT_EQ(expected.erase(id), list.erase(id));
+    } else {
+      EXPECT_EQ(expected.insert(id).second, list.insert(id));
+    }
+    EXPECT_EQ(expected.count(id), list.count(id));
+    ASSERT_EQ(expected.size(), list.size());
+    if (i % 1000 == 0) {
+      EXPECT_TRUE(std::equal(list.begin(), list.end(), expected.begin()));
+      EXPECT_EQ(*expected.rbegin(), list.last_history_id());
+    }
+  }
+  HistoryIDVector decoded;
+  list.AppendTo(&decoded);
+  ASSERT_EQ(expected.size(), decoded.size());
+  EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), expected.begin()));
+}
+
+TEST_F(InMemoryURLIndexTypesTest, HistoryIDPostingListValidation) {
+  const HistoryID ids[] = { 1, 3, 200 };
+  HistoryIDVector sorted_ids(ids, ids + arraysize(ids));
+  HistoryIDPostingList list(sorted_ids);
+  std::vector<uint8> data(list.encoded_data(),
+                          list.encoded_data() + list.ByteSize());
+  EXPECT_TRUE(HistoryIDPostingList::IsValidEncoding(&data[0], data.size(),
+                                                    3, 200));
+  EXPECT_TRUE(HistoryIDPostingList::IsValidEncoding(NULL, 0, 0, 0));
+
+  // The count and the last ID must agree with the encoding.
+  EXPECT_FALSE(HistoryIDPostingList::IsValidEncoding(&data[0], data.size(),
+                                                     2, 200));
+  EXPECT_FALSE(HistoryIDPostingList::IsValidEncoding(&data[0], data.size(),
+                                                     3, 199));
+
+  // A varint whose last byte has the continuation bit set is truncated.
+  std::vector<uint8> bad(data);
+  bad.back() |= 0x80;
+  EXPECT_FALSE(HistoryIDPostingList::IsValidEncoding(&bad[0], bad.size(),
+                                                     3, 200));
+  // Iterating over it anyway must stop at the end of the buffer.
+  HistoryIDPostingList bad_list(&bad[0], bad.size(), 3, 200);
+  size_t decoded = 0;
+  for (HistoryIDPostingList::const_iterator iter = bad_list.begin();
+       iter != bad_list.end() && decoded <= bad.size(); ++iter)
+    ++decoded;
+  EXPECT_LE(decoded, bad.size());
+
+  // A zero delta after the first ID would be a duplicate.
+  const uint8 duplicate[] = { 0x01, 0x00 };
+  EXPECT_FALSE(HistoryIDPostingList::IsValidEncoding(
+      duplicate, arraysize(duplicate), 2, 1));
+}
+
+TEST_F(InMemoryURLIndexTypesTest, IntersectHistoryIDs) {
+  HistoryIDVector a;
+  HistoryIDVector b;
+  HistoryIDVector result;
+  IntersectHistoryIDs(a, b, &result);
+  EXPECT_TRUE(result.empty());
+
+  // Similarly sized inputs.
+  const HistoryID a_ids[] = { 1, 4, 6, 9, 12 };
+  const HistoryID b_ids[] = { 2, 4, 9, 10, 12, 15 };
+  a.assign(a_ids, a_ids + arraysize(a_ids));
+  b.assign(b_ids, b_ids + arraysize(b_ids));
+  IntersectHistoryIDs(a, b, &result);
+  const HistoryID expected_ab[] = { 4, 9, 12 };
+  ASSERT_EQ(arraysize(expected_ab), result.size());
+  EXPECT_TRUE(std::equal(result.begin(), result.end(), expected_ab));
+
+  // Very differently sized inputs take the galloping path.
+  HistoryIDVector large;
+  for (HistoryID i = 0; i < 1000; ++i)
+    large.push_back(i * 3);
+  const HistoryID small_ids[] = { 0, 5, 300, 301, 2997, 5000 };
+  HistoryIDVector small(small_ids, small_ids + arraysize(small_ids));
+  IntersectHistoryIDs(large, small, &result);
+  const HistoryID expected_large[] = { 0, 300, 2997 };
+  ASSERT_EQ(arraysize(expected_large), result.size());
+  EXPECT_TRUE(std::equal(result.begin(), result.end(), expected_large));
+}
+
 }  // namespace history
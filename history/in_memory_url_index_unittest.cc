@@ -901,9 +901,92 @@ TEST_F(InMemoryURLIndexTest, CacheSaveRestore) {
   EXPECT_TRUE(restore_observer.succeeded());
 
   URLIndexPrivateData& new_data(*GetPrivateData());
+  EXPECT_EQ(kCurrentCacheFileVersion, new_data.restored_cache_version_);
+  // The history/word map of a flat cache is only built upon first update.
+  new_data.BuildHistoryIDWordMapIfStale();
 
   // Compare the captured and restored for equality.
   ExpectPrivateDataEqual(*old_data, new_data);
+
+  // The restored index must still be updatable while it refers to the block
+  // of posting lists read from the file.
+  URLRow row(GURL("http://www.example.com/restored"), 1000);
+  row.set_title(ASCIIToUTF16("Restored Index Update"));
+  row.set_typed_count(2);
+  EXPECT_TRUE(UpdateURL(row));
+  EXPECT_TRUE(DeleteURL(row.url()));
+}
+
+TEST_F(InMemoryURLIndexTest, CorruptCacheFile) {
+  base::ScopedTempDir temp_directory;
+  ASSERT_TRUE(temp_directory.CreateUniqueTempDir());
+  FilePath path(temp_directory.path().Append(FILE_PATH_LITERAL("Cache")));
+  URLIndexPrivateData& private_data(*GetPrivateData());
+  ASSERT_TRUE(private_data.SaveToFile(path));
+  std::string data;
+  ASSERT_TRUE(file_util::ReadFileToString(path, &data));
+
+  // A truncated file must be rejected rather than partially restored.
+  std::string truncated(data.substr(0, data.size() / 2));
+  ASSERT_EQ(static_cast<int>(truncated.size()),
+            file_util::WriteFile(path, truncated.data(), truncated.size()));
+  EXPECT_FALSE(URLIndexPrivateData::RestoreFromFile(path, "en").get());
+
+  // As must one with garbage in its counts.
+  std::string garbled(data);
+  for (size_t i = 16; i < 64 && i < garbled.size(); ++i)
+    garbled[i] = '\xff';
+  ASSERT_EQ(static_cast<int>(garbled.size()),
+            file_util::WriteFile(path, garbled.data(), garbled.size()));
+  EXPECT_FALSE(URLIndexPrivateData::RestoreFromFile(path, "en").get());
+
+  // As must one with a posting list whose last varint runs off its end. Find
+  // the first list's bytes, which follow the size of the posting block.
+  uint32 posting_bytes = 0;
+  for (WordIDHistoryMap::const_iterator iter =
+       private_data.word_id_history_map_.begin();
+       iter != private_data.word_id_history_map_.end(); ++iter)
+    posting_bytes += iter->second.ByteSize();
+  const HistoryIDPostingList& first_list(
+      private_data.word_id_history_map_.begin()->second);
+  std::string needle(reinterpret_cast<const char*>(&posting_bytes),
+                     sizeof(posting_bytes));
+  needle.append(reinterpret_cast<const char*>(first_list.encoded_data()),
+                first_list.ByteSize());
+  size_t offset = data.find(needle);
+  ASSERT_NE(std::string::npos, offset);
+  std::string bad_varint(data);
+  bad_varint[offset + needle.size() - 1] |= 0x80;
+  ASSERT_EQ(static_cast<int>(bad_varint.size()),
+            file_util::WriteFile(path, bad_varint.data(), bad_varint.size()));
+  EXPECT_FALSE(URLIndexPrivateData::RestoreFromFile(path, "en").get());
+
+  // The intact file restores, and is not held open by the restored index, so
+  // it can be replaced or deleted (which Windows forbids while mapped).
+  ASSERT_EQ(static_cast<int>(data.size()),
+            file_util::WriteFile(path, data.data(), data.size()));
+  scoped_refptr<URLIndexPrivateData> restored_data(
+      URLIndexPrivateData::RestoreFromFile(path, "en"));
+  EXPECT_TRUE(restored_data.get());
+  EXPECT_TRUE(restored_data->SaveToFile(path));
+  EXPECT_TRUE(file_util::Delete(path, false));
+}
+
+TEST_F(InMemoryURLIndexTest, ProtobufCacheUpgrade) {
+  base::ScopedTempDir temp_directory;
+  ASSERT_TRUE(temp_directory.CreateUniqueTempDir());
+  FilePath path(temp_directory.path().Append(FILE_PATH_LITERAL("Cache")));
+  URLIndexPrivateData& private_data(*GetPrivateData());
+
+  // Save the last protobuf version of the cache and ensure it still restores.
+  private_data.saved_cache_version_ = 1;
+  ASSERT_TRUE(private_data.SaveToFile(path));
+  private_data.saved_cache_version_ = kCurrentCacheFileVersion;
+  scoped_refptr<URLIndexPrivateData> restored_data(
+      URLIndexPrivateData::RestoreFromFile(path, "en"));
+  ASSERT_TRUE(restored_data.get());
+  EXPECT_EQ(1, restored_data->restored_cache_version_);
+  ExpectPrivateDataEqual(private_data, *restored_data);
 }
 
 class InMemoryURLIndexCacheTest : public testing::Test {
@@ -82,7 +82,7 @@ ScoredHistoryMatch::ScoredHistoryMatch(const URLRow& row,
   int term_num = 0;
   for (String16Vector::const_iterator iter = terms.begin(); iter != terms.end();
        ++iter, ++term_num) {
-    string16 term = *iter;
+    const string16& term = *iter;
     TermMatches url_term_matches = MatchTermInString(term, url, term_num);
     TermMatches title_term_matches = MatchTermInString(term, title, term_num);
     if (url_term_matches.empty() && title_term_matches.empty())
@@ -0,0 +1,159 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string>
+#include <vector>
+
+#include "base/i18n/case_conversion.h"
+#include "base/perftimer.h"
+#include "base/stringprintf.h"
+#include "base/time.h"
+#include "base/utf_string_conversions.h"
+#include "chrome/browser/history/history_types.h"
+#include "chrome/browser/history/in_memory_url_index_types.h"
+#include "chrome/browser/history/scored_history_match.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace history {
+
+namespace {
+
+// The number of synthetic URL and title pairs to match against.
+const int kCorpusSize = 20000;
+
+// The number of times the corpus is scanned for each term.
+const int kIterations = 10;
+
+// Terms a user might type, from a single character up to a long word.
+const char* const kTerms[] = {
+  "c", "co", "cod", "code", "review", "chromium", "issues", "q=", "%20",
+};
+
+const char* const kHosts[] = {
+  "www.google.com", "mail.google.com", "codereview.chromium.org",
+  "en.wikipedia.org", "news.ycombinator.com", "www.amazon.com",
+  "code.google.com", "stackoverflow.com", "www.nytimes.com",
+};
+
+const char* const kWords[] = {
+  "search", "issues", "detail", "questions", "article", "product", "review",
+  "chromium", "history", "omnibox", "settings", "download", "weather",
+};
+
+// Builds lower-cased URL and title strings that look like typical history.
+void BuildCorpus(std::vector<string16>* urls, std::vector<string16>* titles) {
+  for (int i = 0; i < kCorpusSize; ++i) {
+    const char* host = kHosts[i % arraysize(kHosts)];
+    const char* word = kWords[i % arraysize(kWords)];
+    const char* other_word = kWords[(i / 7) % arraysize(kWords)];
+    urls->push_back(base::i18n::ToLower(UTF8ToUTF16(base::StringPrintf(
+        "http://%s/%s/%d?q=%s%%20%s&hl=en&source=hp&aq=%d", host, word, i,
+        other_word, word, i % 10))));
+    titles->push_back(base::i18n::ToLower(UTF8ToUTF16(base::StringPrintf(
+        "%s %s - %s", other_word, word, host))));
+  }
+}
+
+// The matcher used before MatchTermInString() was vectorized.
+TermMatches MatchTermInStringWithFind(const string16& term,
+                                      const string16& string,
+                                      int term_num) {
+  const size_t kMaxCompareLength = 2048;
+  const string16& short_string = (string.length() > kMaxCompareLength) ?
+      string.substr(0, kMaxCompareLength) : string;
+  TermMatches matches;
+  for (size_t location = short_string.find(term); location != string16::npos;
+       location = short_string.find(term, location + 1))
+    matches.push_back(TermMatch(term_num, location, term.length()));
+  return matches;
+}
+
+typedef TermMatches (*MatchFunction)(const string16&, const string16&, int);
+
+// Runs |match| over the whole corpus for every term and returns the total
+// number of matches found, so the two matchers can be checked for agreement.
+size_t MatchCorpus(MatchFunction match,
+                   const std::vector<string16>& urls,
+                   const std::vector<string16>& titles) {
+  size_t match_count = 0;
+  for (int iteration = 0; iteration < kIterations; ++iteration) {
+    for (size_t t = 0; t < arraysize(kTerms); ++t) {
+      string16 term(ASCIIToUTF16(kTerms[t]));
+      for (size_t i = 0; i < urls.size(); ++i) {
+        match_count += match(term, urls[i], static_cast<int>(t)).size();
+        match_count += match(term, titles[i], static_cast<int>(t)).size();
+      }
+    }
+  }
+  return match_count;
+}
+
+}  // namespace
+
+class ScoredHistoryMatchPerfTest : public testing::Test {
+};
+
+// Compares the vectorized term matcher with the string16::find() based one.
+TEST_F(ScoredHistoryMatchPerfTest, MatchTermInString) {
+  std::vector<string16> urls;
+  std::vector<string16> titles;
+  BuildCorpus(&urls, &titles);
+
+  size_t find_matches = 0;
+  {
+    PerfTimeLogger timer("ScoredHistoryMatch_match_terms_find");
+    find_matches = MatchCorpus(&MatchTermInStringWithFind, urls, titles);
+  }
+  size_t matches = 0;
+  {
+    PerfTimeLogger timer("ScoredHistoryMatch_match_terms");
+    matches = MatchCorpus(&MatchTermInString, urls, titles);
+  }
+  EXPECT_EQ(find_matches, matches);
+}
+
+// Measures the cost of fully scoring every row in the corpus, of which term
+// matching is only one part.
+TEST_F(ScoredHistoryMatchPerfTest, ScoreRows) {
+  std::vector<URLRow> rows;
+  std::vector<RowWordStarts> row_word_starts;
+  for (int i = 0; i < kCorpusSize; ++i) {
+    URLRow row(GURL(base::StringPrintf(
+        "http://%s/%s/%d", kHosts[i % arraysize(kHosts)],
+        kWords[i % arraysize(kWords)], i)), i + 1);
+    row.set_title(UTF8ToUTF16(kWords[(i / 7) % arraysize(kWords)]));
+    row.set_visit_count(1 + i % 20);
+    row.set_typed_count(i % 3);
+    row.set_last_visit(base::Time::Now() - base::TimeDelta::FromDays(i % 30));
+    rows.push_back(row);
+    RowWordStarts word_starts;
+    String16SetFromString16(UTF8ToUTF16(row.url().spec()),
+                            &word_starts.url_word_starts_);
+    String16SetFromString16(row.title(), &word_starts.title_word_starts_);
+    row_word_starts.push_back(word_starts);
+  }
+
+  String16Vector terms;
+  terms.push_back(ASCIIToUTF16("code"));
+  terms.push_back(ASCIIToUTF16("review"));
+  string16 lower_string(ASCIIToUTF16("code review"));
+  base::Time now(base::Time::Now());
+  // The first match fills in the static score tables; keep that out of the
+  // timing.
+  ScoredHistoryMatch warm_up(rows[0], lower_string, terms, row_word_starts[0],
+                             now, NULL);
+  int scored = 0;
+  PerfTimeLogger timer("ScoredHistoryMatch_score_rows");
+  for (size_t i = 0; i < rows.size(); ++i) {
+    ScoredHistoryMatch match(rows[i], lower_string, terms, row_word_starts[i],
+                             now, NULL);
+    if (match.raw_score > 0)
+      ++scored;
+  }
+  timer.Done();
+  EXPECT_GT(scored, 0);
+}
+
+}  // namespace history
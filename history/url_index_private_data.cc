@@ -13,6 +13,7 @@
 
 #include "base/basictypes.h"
 #include "base/file_util.h"
+#include "base/files/important_file_writer.h"
 #include "base/i18n/case_conversion.h"
 #include "base/metrics/histogram.h"
 #include "base/string_util.h"
@@ -58,6 +59,135 @@ typedef imui::InMemoryURLIndexCacheItem_WordStartsMapItem WordStartsMapItem;
 typedef imui::InMemoryURLIndexCacheItem_WordStartsMapItem_WordStartsMapEntry
     WordStartsMapEntry;
 
+// The flat cache file layout --------------------------------------------------
+//
+// Cache files of version kFlatCacheFileVersion and later are not protobufs but
+// a flat sequence of native-endian fields which can be restored with very
+// little decoding:
+//
+//   header:           uint32 magic, uint32 version, int64 timestamp
+//   word list:        uint32 count, count x string16
+//   char/word map:    uint32 count, count x (uint32 char, uint32 n,
+//                     n x uint32 word_id)
+//   word/history map: uint32 count, count x (uint32 word_id, uint32 id_count,
+//                     int64 last_history_id, uint32 byte_length), followed by
+//                     uint32 total_length and the encoded posting lists
+//   history info map: uint32 count, count x (int64 history_id,
+//                     int32 visit_count, int32 typed_count, int64 last_visit,
+//                     string url, string16 title)
+//   word starts map:  uint32 count, count x (int64 history_id, uint32 n,
+//                     n x uint32 url_word_start, uint32 m,
+//                     m x uint32 title_word_start)
+//   trailer:          uint32 magic
+//
+// Strings are a uint32 length followed by that many UTF-8 bytes or char16s.
+// The posting lists make up the bulk of the index. Rather than being decoded
+// they are copied out of the file as one block, and each list's encoding is
+// checked when the index is restored. A file written on a machine of
+// different endianness fails the magic check and is treated as corrupt.
+
+namespace {
+
+const uint32 kFlatCacheFileMagic = 0x43554D49;  // "IMUC"
+
+void AppendUInt32(uint32 value, std::string* data) {
+  data->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendInt64(int64 value, std::string* data) {
+  data->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendString(const std::string& value, std::string* data) {
+  AppendUInt32(value.length(), data);
+  data->append(value);
+}
+
+void AppendString16(const string16& value, std::string* data) {
+  AppendUInt32(value.length(), data);
+  data->append(reinterpret_cast<const char*>(value.data()),
+               value.length() * sizeof(char16));
+}
+
+// Reads fields from a flat cache file, failing rather than reading past the
+// end of the data. Values are copied out so no alignment is required.
+class FlatCacheReader {
+ public:
+  FlatCacheReader(const uint8* data, size_t length)
+      : data_(data),
+        length_(length),
+        offset_(0) {
+  }
+
+  bool ReadUInt32(uint32* value) { return ReadValue(value); }
+  bool ReadInt64(int64* value) { return ReadValue(value); }
+
+  bool ReadInt32(int32* value) { return ReadValue(value); }
+
+  // Sets |bytes| to point at the next |length| bytes without copying them.
+  bool ReadBytes(size_t length, const uint8** bytes) {
+    if (length > length_ - offset_)
+      return false;
+    *bytes = data_ + offset_;
+    offset_ += length;
+    return true;
+  }
+
+  bool ReadString(std::string* value) {
+    uint32 length;
+    const uint8* bytes;
+    if (!ReadUInt32(&length) || !ReadBytes(length, &bytes))
+      return false;
+    value->assign(reinterpret_cast<const char*>(bytes), length);
+    return true;
+  }
+
+  bool ReadString16(string16* value) {
+    uint32 length;
+    const uint8* bytes;
+    if (!ReadUInt32(&length) || length > (length_ - offset_) / sizeof(char16) ||
+        !ReadBytes(length * sizeof(char16), &bytes))
+      return false;
+    value->resize(length);
+    if (length)
+      memcpy(&(*value)[0], bytes, length * sizeof(char16));
+    return true;
+  }
+
+  // Reads a count of items each of which occupies at least |min_item_size|
+  // bytes, failing if the remaining data cannot possibly hold them.
+  bool ReadCount(size_t min_item_size, uint32* count) {
+    return ReadUInt32(count) && *count <= (length_ - offset_) / min_item_size;
+  }
+
+  bool AtEnd() const { return offset_ == length_; }
+
+ private:
+  template<typename T>
+  bool ReadValue(T* value) {
+    const uint8* bytes;
+    if (!ReadBytes(sizeof(T), &bytes))
+      return false;
+    memcpy(value, bytes, sizeof(T));
+    return true;
+  }
+
+  const uint8* data_;
+  size_t length_;
+  size_t offset_;
+
+  DISALLOW_COPY_AND_ASSIGN(FlatCacheReader);
+};
+
+// Returns true if |data| starts with the header of a flat cache file.
+bool IsFlatCacheFile(const uint8* data, size_t length) {
+  FlatCacheReader reader(data, length);
+  uint32 magic;
+  return reader.ReadUInt32(&magic) && magic == kFlatCacheFileMagic;
+}
+
+}  // namespace
+
 // Algorithm Functions ---------------------------------------------------------
 
 // Comparison function for sorting search terms by descending length.
@@ -69,6 +199,7 @@ bool LengthGreater(const string16& string_a, const string16& string_b) {
 
 URLIndexPrivateData::URLIndexPrivateData()
     : restored_cache_version_(0),
+      history_id_word_map_is_stale_(false),
       saved_cache_version_(kCurrentCacheFileVersion),
       pre_filter_item_count_(0),
       post_filter_item_count_(0),
@@ -107,34 +238,29 @@ ScoredHistoryMatches URLIndexPrivateData::HistoryItemsForTerms(
   // approach.
   ResetSearchTermCache();
 
-  HistoryIDSet history_id_set = HistoryIDSetFromWords(lower_words);
+  HistoryIDVector history_ids = HistoryIDsFromWords(lower_words);
 
   // Trim the candidate pool if it is large. Note that we do not filter out
   // items that do not contain the search terms as proper substrings -- doing
   // so is the performance-costly operation we are trying to avoid in order
   // to maintain omnibox responsiveness.
   const size_t kItemsToScoreLimit = 500;
-  pre_filter_item_count_ = history_id_set.size();
+  pre_filter_item_count_ = history_ids.size();
   // If we trim the results set we do not want to cache the results for next
   // time as the user's ultimately desired result could easily be eliminated
   // in this early rough filter.
   bool was_trimmed = (pre_filter_item_count_ > kItemsToScoreLimit);
   if (was_trimmed) {
-    HistoryIDVector history_ids;
-    std::copy(history_id_set.begin(), history_id_set.end(),
-              std::back_inserter(history_ids));
-    // Trim down the set by sorting by typed-count, visit-count, and last
-    // visit.
+    // Trim down the candidates by sorting by typed-count, visit-count, and
+    // last visit.
     HistoryItemFactorGreater
         item_factor_functor(history_info_map_);
     std::partial_sort(history_ids.begin(),
                       history_ids.begin() + kItemsToScoreLimit,
                       history_ids.end(),
                       item_factor_functor);
-    history_id_set.clear();
-    std::copy(history_ids.begin(), history_ids.begin() + kItemsToScoreLimit,
-              std::inserter(history_id_set, history_id_set.end()));
-    post_filter_item_count_ = history_id_set.size();
+    history_ids.resize(kItemsToScoreLimit);
+    post_filter_item_count_ = history_ids.size();
   }
 
   // Pass over all of the candidates filtering out any without a proper
@@ -150,9 +276,11 @@ ScoredHistoryMatches URLIndexPrivateData::HistoryItemsForTerms(
   // get two 'terms': "colspec=id%20mstone" and "release".
   history::String16Vector lower_raw_terms;
   Tokenize(lower_raw_string, kWhitespaceUTF16, &lower_raw_terms);
-  scored_items = std::for_each(history_id_set.begin(), history_id_set.end(),
+  // Only the best kMaxMatches are kept while scoring.
+  scored_items = std::for_each(history_ids.begin(), history_ids.end(),
       AddHistoryMatch(*this, bookmark_service, lower_raw_string,
-                      lower_raw_terms, base::Time::Now())).ScoredMatches();
+                      lower_raw_terms, base::Time::Now(),
+                      AutocompleteProvider::kMaxMatches)).ScoredMatches();
 
   // Select and sort only the top kMaxMatches results.
   if (scored_items.size() > AutocompleteProvider::kMaxMatches) {
@@ -188,6 +316,7 @@ bool URLIndexPrivateData::UpdateURL(
     const URLRow& row,
     const std::string& languages,
     const std::set<std::string>& scheme_whitelist) {
+  BuildHistoryIDWordMapIfStale();
   // The row may or may not already be in our index. If it is not already
   // indexed and it qualifies then it gets indexed. If it is already
   // indexed and still qualifies then it gets updated, otherwise it
@@ -258,17 +387,17 @@ bool URLIndexPrivateData::DeleteURL(const GURL& url) {
       HistoryInfoMapItemHasURL(url));
   if (pos == history_info_map_.end())
     return false;
+  BuildHistoryIDWordMapIfStale();
   RemoveRowFromIndex(pos->second);
   search_term_cache_.clear();  // This invalidates the cache.
   return true;
 }
 
 // static
-void URLIndexPrivateData::RestoreFromFileTask(
+scoped_refptr<URLIndexPrivateData> URLIndexPrivateData::RestoreFromFileTask(
     const FilePath& file_path,
-    scoped_refptr<URLIndexPrivateData> private_data,
     const std::string& languages) {
-  private_data = URLIndexPrivateData::RestoreFromFile(file_path, languages);
+  return URLIndexPrivateData::RestoreFromFile(file_path, languages);
 }
 
 // static
@@ -310,6 +439,8 @@ bool URLIndexPrivateData::WritePrivateDataToCacheFileTask(
 }
 
 scoped_refptr<URLIndexPrivateData> URLIndexPrivateData::Duplicate() const {
+  // Note that the posting lists in word_id_history_map_ are flat buffers so
+  // copying them does not require rebuilding a tree for every word.
   scoped_refptr<URLIndexPrivateData> data_copy = new URLIndexPrivateData;
   data_copy->word_list_ = word_list_;
   data_copy->available_words_ = available_words_;
@@ -317,8 +448,11 @@ scoped_refptr<URLIndexPrivateData> URLIndexPrivateData::Duplicate() const {
   data_copy->char_word_map_ = char_word_map_;
   data_copy->word_id_history_map_ = word_id_history_map_;
   data_copy->history_id_word_map_ = history_id_word_map_;
+  data_copy->history_id_word_map_is_stale_ = history_id_word_map_is_stale_;
   data_copy->history_info_map_ = history_info_map_;
   data_copy->word_starts_map_ = word_starts_map_;
+  // Posting lists may still refer into the block restored from the cache.
+  data_copy->posting_data_ = posting_data_;
   return data_copy;
   // Not copied:
   //    search_term_cache_
@@ -338,8 +472,10 @@ void URLIndexPrivateData::Clear() {
   char_word_map_.clear();
   word_id_history_map_.clear();
   history_id_word_map_.clear();
+  history_id_word_map_is_stale_ = false;
   history_info_map_.clear();
   word_starts_map_.clear();
+  posting_data_ = NULL;
 }
 
 // Private ---------------------------------------------------------------------
@@ -350,9 +486,9 @@ URLIndexPrivateData::~URLIndexPrivateData() {}
 
 URLIndexPrivateData::SearchTermCacheItem::SearchTermCacheItem(
     const WordIDSet& word_id_set,
-    const HistoryIDSet& history_id_set)
+    const HistoryIDVector& history_ids)
     : word_id_set_(word_id_set),
-      history_id_set_(history_id_set),
+      history_ids_(history_ids),
       used_(true) {}
 
 URLIndexPrivateData::SearchTermCacheItem::SearchTermCacheItem()
@@ -367,12 +503,14 @@ URLIndexPrivateData::AddHistoryMatch::AddHistoryMatch(
     BookmarkService* bookmark_service,
     const string16& lower_string,
     const String16Vector& lower_terms,
-    const base::Time now)
+    const base::Time now,
+    size_t max_matches)
   : private_data_(private_data),
     bookmark_service_(bookmark_service),
     lower_string_(lower_string),
     lower_terms_(lower_terms),
-    now_(now) {}
+    now_(now),
+    max_matches_(max_matches) {}
 
 URLIndexPrivateData::AddHistoryMatch::~AddHistoryMatch() {}
 
@@ -387,8 +525,21 @@ void URLIndexPrivateData::AddHistoryMatch::operator()(
     DCHECK(starts_pos != private_data_.word_starts_map_.end());
     ScoredHistoryMatch match(hist_item, lower_string_, lower_terms_,
                              starts_pos->second, now_, bookmark_service_);
-    if (match.raw_score > 0)
+    if (match.raw_score <= 0)
+      return;
+    // Keep the best |max_matches_| in a heap whose front is the worst of them.
+    if (scored_matches_.size() < max_matches_) {
       scored_matches_.push_back(match);
+      std::push_heap(scored_matches_.begin(), scored_matches_.end(),
+                     ScoredHistoryMatch::MatchScoreGreater);
+    } else if (ScoredHistoryMatch::MatchScoreGreater(match,
+                                                     scored_matches_.front())) {
+      std::pop_heap(scored_matches_.begin(), scored_matches_.end(),
+                    ScoredHistoryMatch::MatchScoreGreater);
+      scored_matches_.back() = match;
+      std::push_heap(scored_matches_.begin(), scored_matches_.end(),
+                     ScoredHistoryMatch::MatchScoreGreater);
+    }
   }
 }
 
@@ -425,14 +576,14 @@ bool URLIndexPrivateData::HistoryItemFactorGreater::operator()(
 
 // Index Searching -------------------------------------------------------------
 
-HistoryIDSet URLIndexPrivateData::HistoryIDSetFromWords(
+HistoryIDVector URLIndexPrivateData::HistoryIDsFromWords(
     const String16Vector& unsorted_words) {
   // Break the terms down into individual terms (words), get the candidate
   // set for each term, and intersect each to get a final candidate list.
   // Note that a single 'term' from the user's perspective might be
   // a string like "http://www.somewebsite.com" which, from our perspective,
   // is four words: 'http', 'www', 'somewebsite', and 'com'.
-  HistoryIDSet history_id_set;
+  HistoryIDVector history_ids;
   String16Vector words(unsorted_words);
   // Sort the words into the longest first as such are likely to narrow down
   // the results quicker. Also, single character words are the most expensive
@@ -441,29 +592,26 @@ HistoryIDSet URLIndexPrivateData::HistoryIDSetFromWords(
   for (String16Vector::iterator iter = words.begin(); iter != words.end();
        ++iter) {
     string16 uni_word = *iter;
-    HistoryIDSet term_history_set = HistoryIDsForTerm(uni_word);
-    if (term_history_set.empty()) {
-      history_id_set.clear();
+    HistoryIDVector term_history_ids = HistoryIDsForTerm(uni_word);
+    if (term_history_ids.empty()) {
+      history_ids.clear();
       break;
     }
     if (iter == words.begin()) {
-      history_id_set.swap(term_history_set);
+      history_ids.swap(term_history_ids);
     } else {
-      HistoryIDSet new_history_id_set;
-      std::set_intersection(history_id_set.begin(), history_id_set.end(),
-                            term_history_set.begin(), term_history_set.end(),
-                            std::inserter(new_history_id_set,
-                                          new_history_id_set.begin()));
-      history_id_set.swap(new_history_id_set);
+      HistoryIDVector new_history_ids;
+      IntersectHistoryIDs(history_ids, term_history_ids, &new_history_ids);
+      history_ids.swap(new_history_ids);
     }
   }
-  return history_id_set;
+  return history_ids;
 }
 
-HistoryIDSet URLIndexPrivateData::HistoryIDsForTerm(
+HistoryIDVector URLIndexPrivateData::HistoryIDsForTerm(
     const string16& term) {
   if (term.empty())
-    return HistoryIDSet();
+    return HistoryIDVector();
 
   // TODO(mrossetti): Consider optimizing for very common terms such as
   // 'http[s]', 'www', 'com', etc. Or collect the top 100 more frequently
@@ -492,15 +640,15 @@ HistoryIDSet URLIndexPrivateData::HistoryIDsForTerm(
       size_t prefix_length = best_prefix->first.length();
       if (prefix_length == term_length) {
         best_prefix->second.used_ = true;
-        return best_prefix->second.history_id_set_;
+        return best_prefix->second.history_ids_;
       }
 
       // Otherwise we have a handy starting point.
       // If there are no history results for this prefix then we can bail early
       // as there will be no history results for the full term.
-      if (best_prefix->second.history_id_set_.empty()) {
+      if (best_prefix->second.history_ids_.empty()) {
         search_term_cache_[term] = SearchTermCacheItem();
-        return HistoryIDSet();
+        return HistoryIDVector();
       }
       word_id_set = best_prefix->second.word_id_set_;
       prefix_chars = Char16SetFromString16(best_prefix->first);
@@ -520,7 +668,7 @@ HistoryIDSet URLIndexPrivateData::HistoryIDsForTerm(
       // We might come up empty on the leftovers.
       if (leftover_set.empty()) {
         search_term_cache_[term] = SearchTermCacheItem();
-        return HistoryIDSet();
+        return HistoryIDVector();
       }
       // Or there may not have been a prefix from which to start.
       if (prefix_chars.empty()) {
@@ -548,28 +696,30 @@ HistoryIDSet URLIndexPrivateData::HistoryIDsForTerm(
     word_id_set = WordIDSetForTermChars(Char16SetFromString16(term));
   }
 
-  // If any words resulted then we can compose a set of history IDs by unioning
-  // the sets from each word.
-  HistoryIDSet history_id_set;
+  // If any words resulted then we can compose a sorted vector of history IDs
+  // by unioning the posting lists from each word.
+  HistoryIDVector history_ids;
   if (!word_id_set.empty()) {
     for (WordIDSet::iterator word_id_iter = word_id_set.begin();
          word_id_iter != word_id_set.end(); ++word_id_iter) {
       WordID word_id = *word_id_iter;
       WordIDHistoryMap::iterator word_iter = word_id_history_map_.find(word_id);
-      if (word_iter != word_id_history_map_.end()) {
-        HistoryIDSet& word_history_id_set(word_iter->second);
-        history_id_set.insert(word_history_id_set.begin(),
-                              word_history_id_set.end());
-      }
+      if (word_iter != word_id_history_map_.end())
+        word_iter->second.AppendTo(&history_ids);
+    }
+    if (word_id_set.size() > 1) {
+      std::sort(history_ids.begin(), history_ids.end());
+      history_ids.erase(std::unique(history_ids.begin(), history_ids.end()),
+                        history_ids.end());
     }
   }
 
   // Record a new cache entry for this word if the term is longer than
   // a single character.
   if (term_length > 1)
-    search_term_cache_[term] = SearchTermCacheItem(word_id_set, history_id_set);
+    search_term_cache_[term] = SearchTermCacheItem(word_id_set, history_ids);
 
-  return history_id_set;
+  return history_ids;
 }
 
 WordIDSet URLIndexPrivateData::WordIDSetForTermChars(
@@ -691,9 +841,7 @@ void URLIndexPrivateData::AddWordHistory(const string16& term,
   }
   word_map_[term] = word_id;
 
-  HistoryIDSet history_id_set;
-  history_id_set.insert(history_id);
-  word_id_history_map_[word_id] = history_id_set;
+  word_id_history_map_[word_id].insert(history_id);
   AddToHistoryIDWordMap(history_id, word_id);
 
   // For each character in the newly added word (i.e. a word that is not
@@ -720,8 +868,7 @@ void URLIndexPrivateData::UpdateWordHistory(WordID word_id,
                                             HistoryID history_id) {
   WordIDHistoryMap::iterator history_pos = word_id_history_map_.find(word_id);
   DCHECK(history_pos != word_id_history_map_.end());
-  HistoryIDSet& history_id_set(history_pos->second);
-  history_id_set.insert(history_id);
+  history_pos->second.insert(history_id);
   AddToHistoryIDWordMap(history_id, word_id);
 }
 
@@ -779,6 +926,19 @@ void URLIndexPrivateData::RemoveRowWordsFromIndex(const URLRow& row) {
   }
 }
 
+void URLIndexPrivateData::BuildHistoryIDWordMapIfStale() {
+  if (!history_id_word_map_is_stale_)
+    return;
+  history_id_word_map_.clear();
+  for (WordIDHistoryMap::const_iterator iter = word_id_history_map_.begin();
+       iter != word_id_history_map_.end(); ++iter) {
+    for (HistoryIDPostingList::const_iterator list_iter = iter->second.begin();
+         list_iter != iter->second.end(); ++list_iter)
+      AddToHistoryIDWordMap(*list_iter, iter->first);
+  }
+  history_id_word_map_is_stale_ = false;
+}
+
 void URLIndexPrivateData::ResetSearchTermCache() {
   for (SearchTermCacheMap::iterator iter = search_term_cache_.begin();
        iter != search_term_cache_.end(); ++iter)
@@ -789,16 +949,22 @@ void URLIndexPrivateData::ResetSearchTermCache() {
 
 bool URLIndexPrivateData::SaveToFile(const FilePath& file_path) {
   base::TimeTicks beginning_time = base::TimeTicks::Now();
-  InMemoryURLIndexCacheItem index_cache;
-  SavePrivateData(&index_cache);
   std::string data;
-  if (!index_cache.SerializeToString(&data)) {
-    LOG(WARNING) << "Failed to serialize the InMemoryURLIndex cache.";
-    return false;
+  if (saved_cache_version_ >= kFlatCacheFileVersion) {
+    SaveFlatPrivateData(&data);
+  } else {
+    // For unit testing: older versions of the cache are protobufs.
+    InMemoryURLIndexCacheItem index_cache;
+    SavePrivateData(&index_cache);
+    if (!index_cache.SerializeToString(&data)) {
+      LOG(WARNING) << "Failed to serialize the InMemoryURLIndex cache.";
+      return false;
+    }
   }
 
-  int size = data.size();
-  if (file_util::WriteFile(file_path, data.c_str(), size) != size) {
+  // Write to a temporary file and rename it into place so that a crash part
+  // way through never leaves a truncated cache behind.
+  if (!base::ImportantFileWriter::WriteFileAtomically(file_path, data)) {
     LOG(WARNING) << "Failed to write " << file_path.value();
     return false;
   }
@@ -807,6 +973,80 @@ bool URLIndexPrivateData::SaveToFile(const FilePath& file_path) {
   return true;
 }
 
+void URLIndexPrivateData::SaveFlatPrivateData(std::string* data) const {
+  DCHECK(data);
+  data->clear();
+  AppendUInt32(kFlatCacheFileMagic, data);
+  AppendUInt32(saved_cache_version_, data);
+  AppendInt64(base::Time::Now().ToInternalValue(), data);
+
+  AppendUInt32(word_list_.size(), data);
+  for (String16Vector::const_iterator iter = word_list_.begin();
+       iter != word_list_.end(); ++iter)
+    AppendString16(*iter, data);
+
+  AppendUInt32(char_word_map_.size(), data);
+  for (CharWordIDMap::const_iterator iter = char_word_map_.begin();
+       iter != char_word_map_.end(); ++iter) {
+    AppendUInt32(iter->first, data);
+    const WordIDSet& word_id_set(iter->second);
+    AppendUInt32(word_id_set.size(), data);
+    for (WordIDSet::const_iterator set_iter = word_id_set.begin();
+         set_iter != word_id_set.end(); ++set_iter)
+      AppendUInt32(*set_iter, data);
+  }
+
+  // The posting list descriptors come first so that the encoded lists
+  // themselves form one contiguous block which is never touched on restore.
+  size_t posting_bytes = 0;
+  AppendUInt32(word_id_history_map_.size(), data);
+  for (WordIDHistoryMap::const_iterator iter = word_id_history_map_.begin();
+       iter != word_id_history_map_.end(); ++iter) {
+    const HistoryIDPostingList& history_ids(iter->second);
+    AppendUInt32(iter->first, data);
+    AppendUInt32(history_ids.size(), data);
+    AppendInt64(history_ids.empty() ? 0 : history_ids.last_history_id(), data);
+    AppendUInt32(history_ids.ByteSize(), data);
+    posting_bytes += history_ids.ByteSize();
+  }
+  AppendUInt32(posting_bytes, data);
+  for (WordIDHistoryMap::const_iterator iter = word_id_history_map_.begin();
+       iter != word_id_history_map_.end(); ++iter) {
+    const HistoryIDPostingList& history_ids(iter->second);
+    data->append(reinterpret_cast<const char*>(history_ids.encoded_data()),
+                 history_ids.ByteSize());
+  }
+
+  AppendUInt32(history_info_map_.size(), data);
+  for (HistoryInfoMap::const_iterator iter = history_info_map_.begin();
+       iter != history_info_map_.end(); ++iter) {
+    const URLRow& url_row(iter->second);
+    AppendInt64(iter->first, data);
+    AppendUInt32(url_row.visit_count(), data);
+    AppendUInt32(url_row.typed_count(), data);
+    AppendInt64(url_row.last_visit().ToInternalValue(), data);
+    AppendString(url_row.url().spec(), data);
+    AppendString16(url_row.title(), data);
+  }
+
+  AppendUInt32(word_starts_map_.size(), data);
+  for (WordStartsMap::const_iterator iter = word_starts_map_.begin();
+       iter != word_starts_map_.end(); ++iter) {
+    const RowWordStarts& word_starts(iter->second);
+    AppendInt64(iter->first, data);
+    AppendUInt32(word_starts.url_word_starts_.size(), data);
+    for (WordStarts::const_iterator i = word_starts.url_word_starts_.begin();
+         i != word_starts.url_word_starts_.end(); ++i)
+      AppendUInt32(*i, data);
+    AppendUInt32(word_starts.title_word_starts_.size(), data);
+    for (WordStarts::const_iterator i = word_starts.title_word_starts_.begin();
+         i != word_starts.title_word_starts_.end(); ++i)
+      AppendUInt32(*i, data);
+  }
+
+  AppendUInt32(kFlatCacheFileMagic, data);
+}
+
 void URLIndexPrivateData::SavePrivateData(
     InMemoryURLIndexCacheItem* cache) const {
   DCHECK(cache);
@@ -875,11 +1115,11 @@ void URLIndexPrivateData::SaveWordIDHistoryMap(
     WordIDHistoryMapEntry* map_entry =
         map_item->add_word_id_history_map_entry();
     map_entry->set_word_id(iter->first);
-    const HistoryIDSet& history_id_set(iter->second);
-    map_entry->set_item_count(history_id_set.size());
-    for (HistoryIDSet::const_iterator set_iter = history_id_set.begin();
-         set_iter != history_id_set.end(); ++set_iter)
-      map_entry->add_history_id(*set_iter);
+    const HistoryIDPostingList& history_ids(iter->second);
+    map_entry->set_item_count(history_ids.size());
+    for (HistoryIDPostingList::const_iterator list_iter = history_ids.begin();
+         list_iter != history_ids.end(); ++list_iter)
+      map_entry->add_history_id(*list_iter);
   }
 }
 
@@ -939,30 +1179,43 @@ scoped_refptr<URLIndexPrivateData> URLIndexPrivateData::RestoreFromFile(
     const FilePath& file_path,
     const std::string& languages) {
   base::TimeTicks beginning_time = base::TimeTicks::Now();
-  if (!file_util::PathExists(file_path))
-    return NULL;
-  std::string data;
   // If there is no cache file then simply give up. This will cause us to
   // attempt to rebuild from the history database.
-  if (!file_util::ReadFileToString(file_path, &data))
+  if (!file_util::PathExists(file_path))
+    return NULL;
+  // The mapping is released on return, so that the file can be replaced or
+  // deleted (which Windows refuses while it is mapped) during the session.
+  file_util::MemoryMappedFile mapped_file;
+  if (!mapped_file.Initialize(file_path))
     return NULL;
 
   scoped_refptr<URLIndexPrivateData> restored_data(new URLIndexPrivateData);
-  InMemoryURLIndexCacheItem index_cache;
-  if (!index_cache.ParseFromArray(data.c_str(), data.size())) {
-    LOG(WARNING) << "Failed to parse URLIndexPrivateData cache data read from "
-                 << file_path.value();
-    return restored_data;
+  if (IsFlatCacheFile(mapped_file.data(), mapped_file.length())) {
+    if (!restored_data->RestoreFlatPrivateData(mapped_file.data(),
+                                               mapped_file.length(),
+                                               languages)) {
+      LOG(WARNING) << "Failed to restore URLIndexPrivateData cache data read "
+                   << "from " << file_path.value();
+      return NULL;
+    }
+  } else {
+    // An older protobuf cache, which is upgraded when next saved.
+    InMemoryURLIndexCacheItem index_cache;
+    if (!index_cache.ParseFromArray(mapped_file.data(),
+                                    mapped_file.length())) {
+      LOG(WARNING) << "Failed to parse URLIndexPrivateData cache data read "
+                   << "from " << file_path.value();
+      return NULL;
+    }
+    if (!restored_data->RestorePrivateData(index_cache, languages))
+      return NULL;
   }
 
-  if (!restored_data->RestorePrivateData(index_cache, languages))
-    return NULL;
-
   UMA_HISTOGRAM_TIMES("History.InMemoryURLIndexRestoreCacheTime",
                       base::TimeTicks::Now() - beginning_time);
   UMA_HISTOGRAM_COUNTS("History.InMemoryURLHistoryItems",
-                       restored_data->history_id_word_map_.size());
-  UMA_HISTOGRAM_COUNTS("History.InMemoryURLCacheSize", data.size());
+                       restored_data->history_info_map_.size());
+  UMA_HISTOGRAM_COUNTS("History.InMemoryURLCacheSize", mapped_file.length());
   UMA_HISTOGRAM_COUNTS_10000("History.InMemoryURLWords",
                              restored_data->word_map_.size());
   UMA_HISTOGRAM_COUNTS_10000("History.InMemoryURLChars",
@@ -972,6 +1225,162 @@ scoped_refptr<URLIndexPrivateData> URLIndexPrivateData::RestoreFromFile(
   return restored_data;
 }
 
+bool URLIndexPrivateData::RestoreFlatPrivateData(
+    const uint8* data,
+    size_t length,
+    const std::string& languages) {
+  FlatCacheReader reader(data, length);
+  uint32 magic;
+  uint32 version;
+  int64 timestamp;
+  if (!reader.ReadUInt32(&magic) || magic != kFlatCacheFileMagic ||
+      !reader.ReadUInt32(&version) || version < kFlatCacheFileVersion ||
+      !reader.ReadInt64(&timestamp))
+    return false;
+  restored_cache_version_ = version;
+
+  // The word list. Empty slots are available for reuse.
+  uint32 count;
+  if (!reader.ReadCount(sizeof(uint32), &count) || count == 0)
+    return false;
+  word_list_.resize(count);
+  for (WordID word_id = 0; word_id < count; ++word_id) {
+    string16& word(word_list_[word_id]);
+    if (!reader.ReadString16(&word))
+      return false;
+    if (word.empty())
+      available_words_.insert(word_id);
+    else
+      word_map_[word] = word_id;
+  }
+
+  if (!reader.ReadCount(2 * sizeof(uint32), &count))
+    return false;
+  for (uint32 i = 0; i < count; ++i) {
+    uint32 uni_char;
+    uint32 word_count;
+    if (!reader.ReadUInt32(&uni_char) ||
+        !reader.ReadCount(sizeof(uint32), &word_count))
+      return false;
+    WordIDSet& word_id_set(char_word_map_[static_cast<char16>(uni_char)]);
+    for (uint32 j = 0; j < word_count; ++j) {
+      uint32 word_id;
+      if (!reader.ReadUInt32(&word_id) || word_id >= word_list_.size())
+        return false;
+      word_id_set.insert(word_id_set.end(), word_id);
+    }
+  }
+
+  // Read the posting list descriptors, then point each list at its slice of
+  // a copy of the encoded block which follows them. Copying the block is a
+  // single memcpy, and lets the cache file be closed once restored.
+  struct PostingListDescriptor {
+    uint32 word_id;
+    uint32 id_count;
+    int64 last_history_id;
+    uint32 byte_length;
+  };
+  const size_t kDescriptorSize = 3 * sizeof(uint32) + sizeof(int64);
+  if (!reader.ReadCount(kDescriptorSize, &count))
+    return false;
+  std::vector<PostingListDescriptor> descriptors(count);
+  size_t expected_posting_bytes = 0;
+  for (uint32 i = 0; i < count; ++i) {
+    PostingListDescriptor& descriptor(descriptors[i]);
+    if (!reader.ReadUInt32(&descriptor.word_id) ||
+        descriptor.word_id >= word_list_.size() ||
+        !reader.ReadUInt32(&descriptor.id_count) ||
+        !reader.ReadInt64(&descriptor.last_history_id) ||
+        !reader.ReadUInt32(&descriptor.byte_length) ||
+        descriptor.byte_length < descriptor.id_count)
+      return false;
+    expected_posting_bytes += descriptor.byte_length;
+  }
+  uint32 posting_bytes;
+  const uint8* posting_data;
+  if (!reader.ReadUInt32(&posting_bytes) ||
+      posting_bytes != expected_posting_bytes ||
+      !reader.ReadBytes(posting_bytes, &posting_data))
+    return false;
+  std::vector<unsigned char> posting_copy(posting_data,
+                                          posting_data + posting_bytes);
+  posting_data_ = base::RefCountedBytes::TakeVector(&posting_copy);
+  posting_data = posting_bytes ? &posting_data_->data()[0] : NULL;
+  for (std::vector<PostingListDescriptor>::const_iterator iter =
+       descriptors.begin(); iter != descriptors.end(); ++iter) {
+    // The iterators trust the encoding, so a list which is garbled rather
+    // than merely truncated must be caught here.
+    if (!HistoryIDPostingList::IsValidEncoding(posting_data,
+                                               iter->byte_length,
+                                               iter->id_count,
+                                               iter->last_history_id))
+      return false;
+    word_id_history_map_[iter->word_id] =
+        HistoryIDPostingList(posting_data, iter->byte_length, iter->id_count,
+                             iter->last_history_id);
+    posting_data += iter->byte_length;
+  }
+
+  if (!reader.ReadCount(2 * sizeof(int64), &count) || count == 0)
+    return false;
+  for (uint32 i = 0; i < count; ++i) {
+    int64 history_id;
+    int32 visit_count;
+    int32 typed_count;
+    int64 last_visit;
+    std::string url;
+    string16 title;
+    if (!reader.ReadInt64(&history_id) || !reader.ReadInt32(&visit_count) ||
+        !reader.ReadInt32(&typed_count) || !reader.ReadInt64(&last_visit) ||
+        !reader.ReadString(&url) || !reader.ReadString16(&title))
+      return false;
+    URLRow url_row(GURL(url), history_id);
+    url_row.set_visit_count(visit_count);
+    url_row.set_typed_count(typed_count);
+    url_row.set_last_visit(base::Time::FromInternalValue(last_visit));
+    url_row.set_title(title);
+    history_info_map_[history_id] = url_row;
+  }
+
+  if (!reader.ReadCount(sizeof(int64), &count))
+    return false;
+  for (uint32 i = 0; i < count; ++i) {
+    int64 history_id;
+    if (!reader.ReadInt64(&history_id))
+      return false;
+    RowWordStarts& word_starts(word_starts_map_[history_id]);
+    uint32 start_count;
+    if (!reader.ReadCount(sizeof(uint32), &start_count))
+      return false;
+    for (uint32 j = 0; j < start_count; ++j) {
+      uint32 start;
+      if (!reader.ReadUInt32(&start))
+        return false;
+      word_starts.url_word_starts_.push_back(start);
+    }
+    if (!reader.ReadCount(sizeof(uint32), &start_count))
+      return false;
+    for (uint32 j = 0; j < start_count; ++j) {
+      uint32 start;
+      if (!reader.ReadUInt32(&start))
+        return false;
+      word_starts.title_word_starts_.push_back(start);
+    }
+  }
+  if (word_starts_map_.empty())
+    RebuildWordStartsMap(languages);
+
+  if (!reader.ReadUInt32(&magic) || magic != kFlatCacheFileMagic ||
+      !reader.AtEnd())
+    return false;
+
+  // The history/word map is the inverse of the word/history map and is only
+  // consulted when rows are updated or deleted. Building it would touch every
+  // posting list so put that off until the first update.
+  history_id_word_map_is_stale_ = true;
+  return true;
+}
+
 bool URLIndexPrivateData::RestorePrivateData(
     const InMemoryURLIndexCacheItem& cache,
     const std::string& languages) {
@@ -1060,14 +1469,18 @@ bool URLIndexPrivateData::RestoreWordIDHistoryMap(
     if (actual_item_count == 0 || actual_item_count != expected_item_count)
       return false;
     WordID word_id = iter->word_id();
-    HistoryIDSet history_id_set;
+    HistoryIDVector sorted_ids;
     const RepeatedField<int64>& history_ids(iter->history_id());
     for (RepeatedField<int64>::const_iterator jiter = history_ids.begin();
          jiter != history_ids.end(); ++jiter) {
-      history_id_set.insert(*jiter);
+      sorted_ids.push_back(*jiter);
       AddToHistoryIDWordMap(*jiter, word_id);
     }
-    word_id_history_map_[word_id] = history_id_set;
+    // The cache is written in ascending order but do not rely on it.
+    std::sort(sorted_ids.begin(), sorted_ids.end());
+    sorted_ids.erase(std::unique(sorted_ids.begin(), sorted_ids.end()),
+                     sorted_ids.end());
+    word_id_history_map_[word_id] = HistoryIDPostingList(sorted_ids);
   }
   return true;
 }
@@ -1133,24 +1546,28 @@ bool URLIndexPrivateData::RestoreWordStartsMap(
   } else {
     // Since the cache did not contain any word starts we must rebuild then from
     // the URL and page titles.
-    for (HistoryInfoMap::const_iterator iter = history_info_map_.begin();
-         iter != history_info_map_.end(); ++iter) {
-      RowWordStarts word_starts;
-      const URLRow& row(iter->second);
-      string16 url(net::FormatUrl(row.url(), languages,
-          net::kFormatUrlOmitUsernamePassword,
-          net::UnescapeRule::SPACES | net::UnescapeRule::URL_SPECIAL_CHARS,
-          NULL, NULL, NULL));
-      url = base::i18n::ToLower(url);
-      String16VectorFromString16(url, false, &word_starts.url_word_starts_);
-      String16VectorFromString16(
-          row.title(), false, &word_starts.title_word_starts_);
-      word_starts_map_[iter->first] = word_starts;
-    }
+    RebuildWordStartsMap(languages);
   }
   return true;
 }
 
+void URLIndexPrivateData::RebuildWordStartsMap(const std::string& languages) {
+  for (HistoryInfoMap::const_iterator iter = history_info_map_.begin();
+       iter != history_info_map_.end(); ++iter) {
+    RowWordStarts word_starts;
+    const URLRow& row(iter->second);
+    string16 url(net::FormatUrl(row.url(), languages,
+        net::kFormatUrlOmitUsernamePassword,
+        net::UnescapeRule::SPACES | net::UnescapeRule::URL_SPECIAL_CHARS,
+        NULL, NULL, NULL));
+    url = base::i18n::ToLower(url);
+    String16VectorFromString16(url, false, &word_starts.url_word_starts_);
+    String16VectorFromString16(
+        row.title(), false, &word_starts.title_word_starts_);
+    word_starts_map_[iter->first] = word_starts;
+  }
+}
+
 // static
 bool URLIndexPrivateData::URLSchemeIsWhitelisted(
     const GURL& gurl,
@@ -11,6 +11,7 @@
 #include "base/file_path.h"
 #include "base/gtest_prod_util.h"
 #include "base/memory/ref_counted.h"
+#include "base/memory/ref_counted_memory.h"
 #include "chrome/browser/history/in_memory_url_index_types.h"
 #include "chrome/browser/history/in_memory_url_index_cache.pb.h"
 #include "chrome/browser/history/scored_history_match.h"
@@ -31,8 +32,11 @@ class HistoryDatabase;
 class InMemoryURLIndex;
 class RefCountedBool;
 
-// Current version of the cache file.
-static const int kCurrentCacheFileVersion = 1;
+// Current version of the cache file. Versions 0 and 1 are protobufs (version 0
+// lacks the word starts). Version 2 and later use the flat layout described in
+// url_index_private_data.cc.
+static const int kCurrentCacheFileVersion = 2;
+static const int kFlatCacheFileVersion = 2;
 
 // A structure private to InMemoryURLIndex describing its internal data and
 // providing for restoring, rebuilding and updating that internal data. As
@@ -83,11 +87,12 @@ class URLIndexPrivateData
   bool DeleteURL(const GURL& url);
 
   // Creates a new URLIndexPrivateData object, populates it from the contents
-  // of the cache file stored in |file_path|, and assigns it to |private_data|.
-  // |languages| will be used to break URLs and page titles into words.
-  static void RestoreFromFileTask(
+  // of the cache file stored in |file_path|, and returns it. Returns NULL if
+  // the file is missing or corrupt, in which case the index should be rebuilt
+  // from the history database. |languages| will be used to break URLs and page
+  // titles into words.
+  static scoped_refptr<URLIndexPrivateData> RestoreFromFileTask(
       const FilePath& file_path,
-      scoped_refptr<URLIndexPrivateData> private_data,
       const std::string& languages);
 
   // Constructs a new object by rebuilding its contents from the history
@@ -123,6 +128,8 @@ class URLIndexPrivateData
   friend class ::HistoryQuickProviderTest;
   friend class InMemoryURLIndexTest;
   FRIEND_TEST_ALL_PREFIXES(InMemoryURLIndexTest, CacheSaveRestore);
+  FRIEND_TEST_ALL_PREFIXES(InMemoryURLIndexTest, CorruptCacheFile);
+  FRIEND_TEST_ALL_PREFIXES(InMemoryURLIndexTest, ProtobufCacheUpgrade);
   FRIEND_TEST_ALL_PREFIXES(InMemoryURLIndexTest, HugeResultSet);
   FRIEND_TEST_ALL_PREFIXES(InMemoryURLIndexTest, Scoring);
   FRIEND_TEST_ALL_PREFIXES(InMemoryURLIndexTest, TitleSearch);
@@ -141,7 +148,7 @@ class URLIndexPrivateData
   // no longer needed.
   //
   // Items stored in the search term cache. If a search term exactly matches one
-  // in the cache then we can quickly supply the proper |history_id_set_| (and
+  // in the cache then we can quickly supply the proper |history_ids_| (and
   // marking the cache item as being |used_|. If we find a prefix for a search
   // term in the cache (which is very likely to occur as the user types each
   // term into the omnibox) then we can short-circuit the index search for those
@@ -149,27 +156,29 @@ class URLIndexPrivateData
   // not mark the item as being |used_|.
   struct SearchTermCacheItem {
     SearchTermCacheItem(const WordIDSet& word_id_set,
-                        const HistoryIDSet& history_id_set);
+                        const HistoryIDVector& history_ids);
     // Creates a cache item for a term which has no results.
     SearchTermCacheItem();
 
     ~SearchTermCacheItem();
 
     WordIDSet word_id_set_;
-    HistoryIDSet history_id_set_;
+    HistoryIDVector history_ids_;  // Sorted in ascending order.
     bool used_;  // True if this item has been used for the current term search.
   };
   typedef std::map<string16, SearchTermCacheItem> SearchTermCacheMap;
 
   // A helper class which performs the final filter on each candidate
   // history URL match, inserting accepted matches into |scored_matches_|.
+  // Only the best |max_matches| matches are retained.
   class AddHistoryMatch : public std::unary_function<HistoryID, void> {
    public:
     AddHistoryMatch(const URLIndexPrivateData& private_data,
                     BookmarkService* bookmark_service,
                     const string16& lower_string,
                     const String16Vector& lower_terms,
-                    const base::Time now);
+                    const base::Time now,
+                    size_t max_matches);
     ~AddHistoryMatch();
 
     void operator()(const HistoryID history_id);
@@ -183,6 +192,7 @@ class URLIndexPrivateData
     const string16& lower_string_;
     const String16Vector& lower_terms_;
     const base::Time now_;
+    const size_t max_matches_;
   };
 
   // A helper predicate class used to filter excess history items when the
@@ -201,13 +211,13 @@ class URLIndexPrivateData
 
   // URL History indexing support functions.
 
-  // Composes a set of history item IDs by intersecting the set for each word
-  // in |unsorted_words|.
-  HistoryIDSet HistoryIDSetFromWords(const String16Vector& unsorted_words);
+  // Composes a sorted vector of history item IDs by intersecting the IDs for
+  // each word in |unsorted_words|.
+  HistoryIDVector HistoryIDsFromWords(const String16Vector& unsorted_words);
 
-  // Helper function to HistoryIDSetFromWords which composes a set of history
-  // ids for the given term given in |term|.
-  HistoryIDSet HistoryIDsForTerm(const string16& term);
+  // Helper function to HistoryIDsFromWords which composes a sorted vector of
+  // history ids for the given term given in |term|.
+  HistoryIDVector HistoryIDsForTerm(const string16& term);
 
   // Given a set of Char16s, finds words containing those characters.
   WordIDSet WordIDSetForTermChars(const Char16Set& term_chars);
@@ -233,11 +243,12 @@ class URLIndexPrivateData
   void AddWordToIndex(const string16& uni_word, HistoryID history_id);
 
   // Creates a new entry in the word/history map for |word_id| and add
-  // |history_id| as the initial element of the word's set.
+  // |history_id| as the initial element of the word's posting list.
   void AddWordHistory(const string16& uni_word, HistoryID history_id);
 
   // Updates an existing entry in the word/history index by adding the
-  // |history_id| to set for |word_id| in the word_id_history_map_.
+  // |history_id| to the posting list for |word_id| in the
+  // word_id_history_map_.
   void UpdateWordHistory(WordID word_id, HistoryID history_id);
 
   // Adds |word_id| to |history_id|'s entry in the history/word map,
@@ -250,13 +261,21 @@ class URLIndexPrivateData
   // Removes all words and characters associated with |row| from the index.
   void RemoveRowWordsFromIndex(const URLRow& row);
 
+  // Derives |history_id_word_map_| from |word_id_history_map_| if it has not
+  // been built since the index was restored from a flat cache file.
+  void BuildHistoryIDWordMapIfStale();
+
   // Clears |used_| for each item in the search term cache.
   void ResetSearchTermCache();
 
   // Caches the index private data and writes the cache file to the profile
-  // directory.  Called by WritePrivateDataToCacheFileTask.
+  // directory.  Called by WritePrivateDataToCacheFileTask. The file is
+  // written atomically.
   bool SaveToFile(const FilePath& file_path);
 
+  // Encodes the private data into |data| using the flat cache file layout.
+  void SaveFlatPrivateData(std::string* data) const;
+
   // Encode a data structure into the protobuf |cache|.
   void SavePrivateData(imui::InMemoryURLIndexCacheItem* cache) const;
   void SaveWordList(imui::InMemoryURLIndexCacheItem* cache) const;
@@ -274,6 +293,18 @@ class URLIndexPrivateData
       const FilePath& path,
       const std::string& languages);
 
+  // Restores the private data from the |length| bytes of a flat cache file at
+  // |data|, which need only stay valid for the duration of the call. Returns
+  // false if the file is malformed. |languages| will be used to break URLs and
+  // page titles into words should the file lack word starts.
+  bool RestoreFlatPrivateData(const uint8* data,
+                              size_t length,
+                              const std::string& languages);
+
+  // Recalculates |word_starts_map_| from the URLs and page titles in
+  // |history_info_map_|.
+  void RebuildWordStartsMap(const std::string& languages);
+
   // Decode a data structure from the protobuf |cache|. Return false if there
   // is any kind of failure. |languages| will be used to break URLs and page
   // titles into words
@@ -326,6 +357,7 @@ class URLIndexPrivateData
 
   // A one-to-many mapping from a WordID to all HistoryIDs (the row_id as
   // used in the history database) of history items in which the word occurs.
+  // Each word's HistoryIDs are held in a compact HistoryIDPostingList.
   WordIDHistoryMap word_id_history_map_;
 
   // A one-to-many mapping from a HistoryID to all WordIDs of words that occur
@@ -343,6 +375,14 @@ class URLIndexPrivateData
 
   // End of data members that are cached ---------------------------------------
 
+  // True if |history_id_word_map_| has yet to be derived from the posting
+  // lists restored from a flat cache file.
+  bool history_id_word_map_is_stale_;
+
+  // The block of encoded posting lists restored from a flat cache file, if
+  // any. Restored lists refer into it until they are first modified.
+  scoped_refptr<base::RefCountedBytes> posting_data_;
+
   // For unit testing only. Specifies the version of the cache file to be saved.
   // Used only for testing upgrading of an older version of the cache upon
   // restore.
@@ -0,0 +1,171 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <set>
+#include <string>
+
+#include "base/memory/scoped_ptr.h"
+#include "base/perftimer.h"
+#include "base/process_util.h"
+#include "base/stringprintf.h"
+#include "base/time.h"
+#include "base/utf_string_conversions.h"
+#include "chrome/browser/history/history_types.h"
+#include "chrome/browser/history/url_index_private_data.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace history {
+
+namespace {
+
+// The number of synthetic history rows to index.
+const int kRowCount = 500000;
+
+// The number of rows whose titles are changed, and the number then deleted.
+// DeleteURL() looks rows up by URL with a linear scan, so fewer are deleted.
+const int kRetitledRowCount = 10000;
+const int kDeletedRowCount = 1000;
+
+// Words used to compose synthetic hosts, paths and page titles.
+const char* const kWords[] = {
+  "news", "mail", "search", "video", "shopping", "weather", "sports",
+  "finance", "travel", "recipes", "photos", "maps", "music", "books",
+  "games", "health", "science", "tech", "blog", "forum", "wiki", "docs",
+  "calendar", "drive", "code", "review", "issues", "release", "build",
+  "chromium", "omnibox", "history", "bookmark", "download", "settings",
+};
+
+// Queries typed one keystroke at a time when measuring latency.
+const char* const kQueries[] = {
+  "chromium code review",
+  "news weather",
+  "mail",
+  "news1234",
+  "recipes blog",
+};
+
+const char* Word(int i) {
+  return kWords[i % arraysize(kWords)];
+}
+
+URLRow MakeRow(int i) {
+  GURL url(base::StringPrintf("http://www.%s%d.com/%s/%s/page%d.html",
+                              Word(i), i % 5000, Word(i / 7), Word(i / 13),
+                              i));
+  URLRow row(url, i + 1);
+  row.set_title(ASCIIToUTF16(base::StringPrintf(
+      "%s %s %s - %s", Word(i / 3), Word(i / 11), Word(i / 17), Word(i))));
+  row.set_visit_count(1 + i % 20);
+  row.set_typed_count(i % 3);
+  row.set_last_visit(base::Time::Now() - base::TimeDelta::FromDays(i % 30));
+  return row;
+}
+
+size_t GetWorkingSetSize() {
+  base::ProcessHandle handle = base::Process::Current().handle();
+  scoped_ptr<base::ProcessMetrics> metrics(
+#if !defined(OS_MACOSX)
+      base::ProcessMetrics::CreateProcessMetrics(handle)
+#else
+      base::ProcessMetrics::CreateProcessMetrics(handle, NULL)
+#endif
+  );
+  return metrics->GetWorkingSetSize();
+}
+
+// Simulates typing each query one character at a time and logs the mean and
+// maximum latency of a keystroke under |name|.
+void TimeKeystrokes(URLIndexPrivateData* private_data,
+                    const std::string& name) {
+  double total_ms = 0.0;
+  double max_ms = 0.0;
+  int keystrokes = 0;
+  for (size_t q = 0; q < arraysize(kQueries); ++q) {
+    string16 query(ASCIIToUTF16(kQueries[q]));
+    for (size_t length = 1; length <= query.length(); ++length) {
+      PerfTimer timer;
+      private_data->HistoryItemsForTerms(query.substr(0, length), NULL);
+      double elapsed_ms = timer.Elapsed().InMillisecondsF();
+      total_ms += elapsed_ms;
+      max_ms = std::max(max_ms, elapsed_ms);
+      ++keystrokes;
+    }
+  }
+  LogPerfResult((name + "_mean").c_str(), total_ms / keystrokes, "ms");
+  LogPerfResult((name + "_max").c_str(), max_ms, "ms");
+}
+
+}  // namespace
+
+class URLIndexPrivateDataPerfTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    scheme_whitelist_.insert("http");
+    scheme_whitelist_.insert("https");
+  }
+
+  std::set<std::string> scheme_whitelist_;
+};
+
+// Builds an index over a large synthetic history and reports its memory cost,
+// the cost of duplicating it, the latency of each omnibox keystroke, and the
+// cost of removing rows from the posting lists of their words, some of which
+// hold most of the rows.
+TEST_F(URLIndexPrivateDataPerfTest, LargeHistory) {
+  size_t working_set_before = GetWorkingSetSize();
+  scoped_refptr<URLIndexPrivateData> private_data(new URLIndexPrivateData);
+  {
+    PerfTimeLogger timer("InMemoryURLIndex_build_500k");
+    for (int i = 0; i < kRowCount; ++i)
+      private_data->UpdateURL(MakeRow(i), std::string(), scheme_whitelist_);
+  }
+  size_t working_set_after = GetWorkingSetSize();
+  LogPerfResult("InMemoryURLIndex_rss_500k",
+                static_cast<double>(working_set_after - working_set_before) /
+                    1024.0,
+                "KB");
+
+  {
+    PerfTimeLogger timer("InMemoryURLIndex_duplicate_500k");
+    scoped_refptr<URLIndexPrivateData> copy(private_data->Duplicate());
+    EXPECT_FALSE(copy->Empty());
+  }
+
+  TimeKeystrokes(private_data.get(), "InMemoryURLIndex_keystroke");
+
+  // A title change removes the row from its old words' posting lists. Change
+  // rows spread across the history, so that the removals are not appends.
+  {
+    PerfTimer timer;
+    for (int i = 0; i < kRetitledRowCount; ++i) {
+      URLRow row(MakeRow(i * (kRowCount / kRetitledRowCount)));
+      row.set_title(ASCIIToUTF16(base::StringPrintf("retitled %d", i)));
+      private_data->UpdateURL(row, std::string(), scheme_whitelist_);
+    }
+    LogPerfResult("InMemoryURLIndex_retitle_500k",
+                  timer.Elapsed().InMicroseconds() /
+                      static_cast<double>(kRetitledRowCount),
+                  "us/row");
+  }
+
+  {
+    PerfTimer timer;
+    for (int i = 0; i < kDeletedRowCount; ++i) {
+      private_data->DeleteURL(
+          MakeRow(i * (kRowCount / kDeletedRowCount) + 1).url());
+    }
+    LogPerfResult("InMemoryURLIndex_delete_500k",
+                  timer.Elapsed().InMicroseconds() /
+                      static_cast<double>(kDeletedRowCount),
+                  "us/row");
+  }
+
+  // The first query after the changes merges them into the posting lists.
+  TimeKeystrokes(private_data.get(),
+                 "InMemoryURLIndex_keystroke_after_changes");
+}
+
+}  // namespace history
@@ -6,15 +6,28 @@
 
 #include <stdio.h>
 
+#include "base/bind.h"
 #include "base/file_util.h"
 #include "base/json/json_writer.h"
 #include "base/logging.h"
 #include "base/memory/scoped_ptr.h"
+#include "base/message_loop.h"
 #include "base/threading/thread_restrictions.h"
 #include "base/values.h"
 #include "chrome/browser/ui/webui/net_internals/net_internals_ui.h"
 
-NetLogLogger::NetLogLogger(const FilePath &log_path) {
+namespace {
+
+// The maximum number of entries waiting to be written. Each is a Value of a
+// few hundred bytes.
+const size_t kMaxQueuedEntries = 10000;
+
+}  // namespace
+
+NetLogLogger::NetLogLogger(const FilePath &log_path)
+    : writer_thread_("NetLogLogger"),
+      write_pending_(false),
+      dropped_entry_count_(0) {
   if (!log_path.empty()) {
     base::ThreadRestrictions::ScopedAllowIO allow_io;
     FILE* fp = file_util::OpenFile(log_path, "w");
@@ -33,10 +46,18 @@ NetLogLogger::NetLogLogger(const FilePath &log_path) {
     base::JSONWriter::Write(value.get(), &json);
     fprintf(file_.get(), "{\"constants\": %s,\n", json.c_str());
     fprintf(file_.get(), "\"events\": [\n");
+
+    if (!writer_thread_.Start())
+      LOG(ERROR) << "Could not start the net logging thread";
   }
 }
 
 NetLogLogger::~NetLogLogger() {
+  // Stopping the thread runs the pending write, so only entries added after
+  // it are left.
+  writer_thread_.Stop();
+  if (file_.get())
+    WriteQueuedEntries();
 }
 
 void NetLogLogger::StartObserving(net::NetLog* net_log) {
@@ -44,16 +65,58 @@ void NetLogLogger::StartObserving(net::NetLog* net_log) {
 }
 
 void NetLogLogger::OnAddEntry(const net::NetLog::Entry& entry) {
+  // The parameters of |entry| are only valid during this call, so the Value
+  // has to be created here.
   scoped_ptr<Value> value(entry.ToValue());
-  // Don't pretty print, so each JSON value occupies a single line, with no
-  // breaks (Line breaks in any text field will be escaped).  Using strings
-  // instead of integer identifiers allows logs from older versions to be
-  // loaded, though a little extra parsing has to be done when loading a log.
+  if (!file_.get() || !writer_thread_.IsRunning()) {
+    // Don't pretty print, so each JSON value occupies a single line, with no
+    // breaks (Line breaks in any text field will be escaped).  Using strings
+    // instead of integer identifiers allows logs from older versions to be
+    // loaded, though a little extra parsing has to be done when loading a
+    // log.
+    std::string json;
+    base::JSONWriter::Write(value.get(), &json);
+    if (!file_.get())
+      VLOG(1) << json;
+    else
+      fprintf(file_.get(), "%s,\n", json.c_str());
+    return;
+  }
+
+  base::AutoLock lock(lock_);
+  if (queued_entries_.size() >= kMaxQueuedEntries) {
+    ++dropped_entry_count_;
+    return;
+  }
+  queued_entries_.push_back(value.release());
+  if (!write_pending_) {
+    write_pending_ = true;
+    writer_thread_.message_loop()->PostTask(
+        FROM_HERE,
+        base::Bind(&NetLogLogger::WriteQueuedEntries, base::Unretained(this)));
+  }
+}
+
+void NetLogLogger::WriteQueuedEntries() {
+  ScopedVector<Value> entries;
+  size_t dropped_entry_count;
+  {
+    base::AutoLock lock(lock_);
+    entries.swap(queued_entries_);
+    dropped_entry_count = dropped_entry_count_;
+    dropped_entry_count_ = 0;
+    write_pending_ = false;
+  }
+
+  if (dropped_entry_count > 0) {
+    LOG(WARNING) << "Net log writer fell behind, dropped "
+                 << dropped_entry_count << " entries";
+  }
   std::string json;
-  base::JSONWriter::Write(value.get(), &json);
-  if (!file_.get()) {
-    VLOG(1) << json;
-  } else {
+  for (size_t i = 0; i < entries.size(); ++i) {
+    // See OnAddEntry() for the format.
+    json.clear();
+    base::JSONWriter::Write(entries[i], &json);
     fprintf(file_.get(), "%s,\n", json.c_str());
   }
 }
@@ -6,6 +6,9 @@
 #define CHROME_BROWSER_NET_NET_LOG_LOGGER_H_
 
 #include "base/memory/scoped_handle.h"
+#include "base/memory/scoped_vector.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/thread.h"
 #include "net/base/net_log.h"
 
 class FilePath;
@@ -18,6 +21,12 @@ class FilePath;
 // contain a single JSON object, with an extra comma on the end and missing
 // a terminal "]}".
 //
+// When writing to a file, entries are converted to Values on the thread that
+// adds them, but written by a thread of the logger's own, so that logging
+// changes the timing of the network stack as little as possible. If the
+// writer falls behind by more than kMaxQueuedEntries entries, new entries are
+// dropped and counted rather than blocking the network stack.
+//
 // Relies on ChromeNetLog only calling an Observer once at a time for
 // thread-safety.
 class NetLogLogger : public net::NetLog::ThreadSafeObserver {
@@ -36,8 +45,26 @@ class NetLogLogger : public net::NetLog::ThreadSafeObserver {
   virtual void OnAddEntry(const net::NetLog::Entry& entry) OVERRIDE;
 
  private:
+  // Writes the entries in |queued_entries_| to |file_|. Runs on
+  // |writer_thread_|, or on the destroying thread once it has stopped.
+  void WriteQueuedEntries();
+
   ScopedStdioHandle file_;
 
+  base::Thread writer_thread_;
+
+  // Protects the members below.
+  base::Lock lock_;
+
+  // Entries waiting to be written.
+  ScopedVector<base::Value> queued_entries_;
+
+  // Whether a WriteQueuedEntries() task is pending on |writer_thread_|.
+  bool write_pending_;
+
+  // Entries dropped because the queue was full, since the last write.
+  size_t dropped_entry_count_;
+
   DISALLOW_COPY_AND_ASSIGN(NetLogLogger);
 };
 
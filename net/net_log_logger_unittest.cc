@@ -0,0 +1,65 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/net/net_log_logger.h"
+
+#include <string>
+
+#include "base/file_util.h"
+#include "base/files/scoped_temp_dir.h"
+#include "base/json/json_reader.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/values.h"
+#include "chrome/browser/net/chrome_net_log.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace {
+
+const int kEvents = 1000;
+
+}  // namespace
+
+// Makes sure every entry added before the logger is destroyed ends up in the
+// file, in order, even though a separate thread writes them.
+TEST(NetLogLoggerTest, WritesEntriesToFile) {
+  base::ScopedTempDir temp_dir;
+  ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
+  FilePath log_path = temp_dir.path().AppendASCII("net_log.json");
+
+  ChromeNetLog net_log;
+  {
+    NetLogLogger logger(log_path);
+    logger.StartObserving(&net_log);
+    for (int i = 0; i < kEvents; ++i)
+      net_log.AddGlobalEntry(net::NetLog::TYPE_CANCELLED);
+    net_log.RemoveThreadSafeObserver(&logger);
+  }
+
+  std::string contents;
+  ASSERT_TRUE(file_util::ReadFileToString(log_path, &contents));
+  // The log has a comma after the last event, and is missing the terminal
+  // "]}".
+  const std::string kEnd = ",\n";
+  ASSERT_GT(contents.size(), kEnd.size());
+  ASSERT_EQ(kEnd, contents.substr(contents.size() - kEnd.size()));
+  contents.replace(contents.size() - kEnd.size(), kEnd.size(), "]}");
+
+  scoped_ptr<Value> root(base::JSONReader::Read(contents));
+  ASSERT_TRUE(root.get());
+  DictionaryValue* dict = NULL;
+  ASSERT_TRUE(root->GetAsDictionary(&dict));
+  ListValue* events = NULL;
+  ASSERT_TRUE(dict->GetList("events", &events));
+  ASSERT_EQ(static_cast<size_t>(kEvents), events->GetSize());
+
+  int last_id = 0;
+  for (size_t i = 0; i < events->GetSize(); ++i) {
+    DictionaryValue* event = NULL;
+    ASSERT_TRUE(events->GetDictionary(i, &event));
+    int id = 0;
+    ASSERT_TRUE(event->GetInteger("source.id", &id));
+    EXPECT_LT(last_id, id);
+    last_id = id;
+  }
+}
@@ -63,19 +63,26 @@ const int64 Predictor::kDurationBetweenTrimmingsHours = 1;
 const int64 Predictor::kDurationBetweenTrimmingIncrementsSeconds = 15;
 const size_t Predictor::kUrlsTrimmedPerIncrement = 5u;
 const size_t Predictor::kMaxSpeculativeParallelResolves = 3;
-// To control our congestion avoidance system, which discards a queue when
-// resolutions are "taking too long," we need an expected resolution time.
+// predictor_perftest.cc reports the memory the referrers take at this limit.
+const size_t Predictor::kMaxReferrers = 2000;
 // Common average is in the range of 300-500ms.
-const int kExpectedResolutionTimeMs = 500;
+const int Predictor::kExpectedResolutionTimeMs = 500;
 const int Predictor::kTypicalSpeculativeGroupSize = 8;
 const int Predictor::kMaxSpeculativeResolveQueueDelayMs =
-    (kExpectedResolutionTimeMs * Predictor::kTypicalSpeculativeGroupSize) /
+    (Predictor::kExpectedResolutionTimeMs *
+     Predictor::kTypicalSpeculativeGroupSize) /
     Predictor::kMaxSpeculativeParallelResolves;
+// A resolution that takes longer than this many times the expected resolution
+// time suggests the network is overloaded, and halves the parallel
+// resolutions.
+const int kSlowResolutionFactor = 2;
 
 static int g_max_queueing_delay_ms =
     Predictor::kMaxSpeculativeResolveQueueDelayMs;
 static size_t g_max_parallel_resolves =
     Predictor::kMaxSpeculativeParallelResolves;
+static size_t g_max_referrers = Predictor::kMaxReferrers;
+static int g_expected_resolution_time_ms = Predictor::kExpectedResolutionTimeMs;
 
 // A version number for prefs that are saved. This should be incremented when
 // we change the format so that we discard old data.
@@ -91,6 +98,8 @@ class Predictor::LookupRequest {
         resolver_(host_resolver) {
   }
 
+  base::TimeTicks start_time() const { return start_time_; }
+
   // Return underlying network resolver status.
   // net::OK ==> Host was found synchronously.
   // net:ERR_IO_PENDING ==> Network will callback later with result.
@@ -103,6 +112,7 @@ class Predictor::LookupRequest {
     // to separate it from real navigations in the observer's callback, and
     // lets the HostResolver know it can de-prioritize it.
     resolve_info.set_is_speculative(true);
+    start_time_ = base::TimeTicks::Now();
     return resolver_.Resolve(
         resolve_info, &addresses_,
         base::Bind(&LookupRequest::OnLookupFinished, base::Unretained(this)),
@@ -117,6 +127,7 @@ class Predictor::LookupRequest {
   Predictor* predictor_;  // The predictor which started us.
 
   const GURL url_;  // Hostname to resolve.
+  base::TimeTicks start_time_;  // When the lookup was sent to the resolver.
   net::SingleRequestHostResolver resolver_;
   net::AddressList addresses_;
 
@@ -130,8 +141,15 @@ Predictor::Predictor(bool preconnect_enabled)
       peak_pending_lookups_(0),
       shutdown_(false),
       max_concurrent_dns_lookups_(g_max_parallel_resolves),
+      dns_lookup_limit_(
+          std::max<size_t>(1, (g_max_parallel_resolves + 1) / 2)),
+      dns_lookup_limit_increases_(0),
+      dns_lookup_limit_decreases_(0),
+      expected_resolve_duration_(
+          TimeDelta::FromMilliseconds(g_expected_resolution_time_ms)),
       max_dns_queue_delay_(
           TimeDelta::FromMilliseconds(g_max_queueing_delay_ms)),
+      max_referrers_(g_max_referrers),
       host_resolver_(NULL),
       preconnect_enabled_(preconnect_enabled),
       consecutive_omnibox_preconnect_count_(0),
@@ -355,6 +373,17 @@ void Predictor::set_max_parallel_resolves(size_t max_parallel_resolves) {
   g_max_parallel_resolves = max_parallel_resolves;
 }
 
+void Predictor::set_expected_resolution_time(
+    int expected_resolution_time_ms) {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::UI));
+  g_expected_resolution_time_ms = expected_resolution_time_ms;
+}
+
+void Predictor::set_max_referrers(size_t max_referrers) {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::UI));
+  g_max_referrers = max_referrers;
+}
+
 void Predictor::ShutdownOnUIThread(PrefService* user_prefs) {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::UI));
 
@@ -448,6 +477,7 @@ void Predictor::LearnFromNavigation(const GURL& referring_url,
   DCHECK_NE(target_url, GURL::EmptyGURL());
 
   referrers_[referring_url].SuggestHost(target_url);
+  EvictLeastUsefulReferrers(referring_url);
   // Possibly do some referrer trimming.
   TrimReferrers();
 }
@@ -582,6 +612,15 @@ void Predictor::GetHtmlInfo(std::string* output) {
   brief = true;
 #endif  // NDEBUG
 
+  base::StringAppendF(
+      output,
+      "Speculative lookups: %d of at most %d in parallel (raised %d times, "
+      "lowered %d times), average resolution time %dms.<br><br>",
+      static_cast<int>(dns_lookup_limit_),
+      static_cast<int>(max_concurrent_dns_lookups_),
+      dns_lookup_limit_increases_, dns_lookup_limit_decreases_,
+      static_cast<int>(average_resolve_duration_.InMilliseconds()));
+
   // Call for display of each table, along with title.
   UrlInfo::GetHtmlTable(name_preresolved,
       "Preresolution DNS records performed for ", brief, output);
@@ -642,6 +681,7 @@ void Predictor::DeserializeReferrers(const base::ListValue& referral_list) {
       referrers_[GURL(motivating_url_spec)].Deserialize(*subresource_list);
     }
   }
+  EvictLeastUsefulReferrers(GURL::EmptyGURL());
 }
 
 void Predictor::DeserializeReferrersThenDelete(
@@ -906,6 +946,7 @@ void Predictor::OnLookupFinished(LookupRequest* request, const GURL& url,
 
   LookupFinished(request, url, found);
   pending_lookups_.erase(request);
+  AdjustDnsLookupLimit(base::TimeTicks::Now() - request->start_time());
   delete request;
 
   StartSomeQueuedResolutions();
@@ -968,6 +1009,8 @@ bool Predictor::CongestionControlPerformed(UrlInfo* info) {
     info = &results_[work_queue_.Pop()];
     info->SetAssignedState();
   }
+  // The lookups we already sent are not keeping up, so send fewer at once.
+  ReduceDnsLookupLimit();
   return true;
 }
 
@@ -975,7 +1018,7 @@ void Predictor::StartSomeQueuedResolutions() {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
 
   while (!work_queue_.IsEmpty() &&
-         pending_lookups_.size() < max_concurrent_dns_lookups_) {
+         pending_lookups_.size() < dns_lookup_limit_) {
     const GURL url(work_queue_.Pop());
     UrlInfo* info = &results_[url];
     DCHECK(info->HasUrl(url));
@@ -1003,6 +1046,34 @@ void Predictor::StartSomeQueuedResolutions() {
   }
 }
 
+void Predictor::AdjustDnsLookupLimit(base::TimeDelta resolve_duration) {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
+  // Weigh the latest resolution as a quarter of the average.
+  if (average_resolve_duration_ == TimeDelta())
+    average_resolve_duration_ = resolve_duration;
+  else
+    average_resolve_duration_ +=
+        (resolve_duration - average_resolve_duration_) / 4;
+
+  if (resolve_duration > expected_resolve_duration_ * kSlowResolutionFactor) {
+    ReduceDnsLookupLimit();
+  } else if (resolve_duration < expected_resolve_duration_ &&
+             !work_queue_.IsEmpty() &&
+             dns_lookup_limit_ < max_concurrent_dns_lookups_) {
+    ++dns_lookup_limit_;
+    ++dns_lookup_limit_increases_;
+    UMA_HISTOGRAM_COUNTS_100("Net.PredictorDnsLookupLimit", dns_lookup_limit_);
+  }
+}
+
+void Predictor::ReduceDnsLookupLimit() {
+  if (dns_lookup_limit_ <= 1)
+    return;
+  dns_lookup_limit_ /= 2;
+  ++dns_lookup_limit_decreases_;
+  UMA_HISTOGRAM_COUNTS_100("Net.PredictorDnsLookupLimit", dns_lookup_limit_);
+}
+
 void Predictor::TrimReferrers() {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
   if (!urls_being_trimmed_.empty())
@@ -1053,6 +1124,43 @@ void Predictor::IncrementalTrimReferrers(bool trim_all_now) {
   PostIncrementalTrimTask();
 }
 
+void Predictor::EvictLeastUsefulReferrers(const GURL& spared_url) {
+  if (referrers_.size() <= max_referrers_)
+    return;
+
+  std::vector<double> use_rates;
+  use_rates.reserve(referrers_.size());
+  for (Referrers::const_iterator it = referrers_.begin();
+       it != referrers_.end(); ++it) {
+    if (it->first != spared_url)
+      use_rates.push_back(it->second.TotalSubresourceUseRate());
+  }
+
+  // Evict a tenth of the referrers at once, so that the scan over all of them
+  // is only done every so many navigations.
+  const size_t evict_count = std::min(
+      use_rates.size(),
+      referrers_.size() - (max_referrers_ - max_referrers_ / 10));
+  if (evict_count == 0)
+    return;
+  std::nth_element(use_rates.begin(), use_rates.begin() + evict_count - 1,
+                   use_rates.end());
+  const double threshold = use_rates[evict_count - 1];
+
+  size_t evicted = 0;
+  Referrers::iterator it = referrers_.begin();
+  while (it != referrers_.end() && evicted < evict_count) {
+    if (it->first != spared_url &&
+        it->second.TotalSubresourceUseRate() <= threshold) {
+      referrers_.erase(it++);
+      ++evicted;
+    } else {
+      ++it;
+    }
+  }
+  UMA_HISTOGRAM_COUNTS("Net.PredictionReferrersEvicted", evicted);
+}
+
 // ---------------------- End IO methods. -------------------------------------
 
 //-----------------------------------------------------------------------------
@@ -1066,9 +1174,13 @@ Predictor::HostNameQueue::~HostNameQueue() {
 void Predictor::HostNameQueue::Push(const GURL& url,
     UrlInfo::ResolutionMotivation motivation) {
   switch (motivation) {
+    case UrlInfo::OMNIBOX_MOTIVATED:
+    case UrlInfo::MOUSE_OVER_MOTIVATED:
+      urgent_queue_.push(url);
+      break;
+
     case UrlInfo::STATIC_REFERAL_MOTIVATED:
     case UrlInfo::LEARNED_REFERAL_MOTIVATED:
-    case UrlInfo::MOUSE_OVER_MOTIVATED:
       rush_queue_.push(url);
       break;
 
@@ -1079,13 +1191,17 @@ void Predictor::HostNameQueue::Push(const GURL& url,
 }
 
 bool Predictor::HostNameQueue::IsEmpty() const {
-  return rush_queue_.empty() && background_queue_.empty();
+  return urgent_queue_.empty() && rush_queue_.empty() &&
+      background_queue_.empty();
 }
 
 GURL Predictor::HostNameQueue::Pop() {
   DCHECK(!IsEmpty());
-  std::queue<GURL> *queue(rush_queue_.empty() ? &background_queue_
-                                              : &rush_queue_);
+  std::queue<GURL>* queue = &background_queue_;
+  if (!urgent_queue_.empty())
+    queue = &urgent_queue_;
+  else if (!rush_queue_.empty())
+    queue = &rush_queue_;
   GURL url(queue->front());
   queue->pop();
   return url;
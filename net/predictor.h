@@ -72,6 +72,10 @@ class Predictor {
   // Given that the underlying Chromium resolver defaults to a total maximum of
   // 8 paralell resolutions, we will avoid any chance of starving navigational
   // resolutions by limiting the number of paralell speculative resolutions.
+  // This is the ceiling, which stays at the old fixed limit so that at least
+  // 5 of the resolver's slots remain for navigations.  We start at half of it
+  // (rounded up), and move the actual limit between one and the ceiling based
+  // on how quickly names resolve.
   // This is used in the field trials and testing.
   // TODO(jar): Move this limitation into the resolver.
   static const size_t kMaxSpeculativeParallelResolves;
@@ -85,12 +89,23 @@ class Predictor {
   // mistakenly assuming that the resolutions took too long.
   static const int kTypicalSpeculativeGroupSize;
 
+  // To control our congestion avoidance system, which discards a queue when
+  // resolutions are "taking too long," we need an expected resolution time.
+  // Resolutions that take more than twice as long also lower the number of
+  // parallel speculative resolutions.
+  static const int kExpectedResolutionTimeMs;
+
   // The next constant specifies an amount of queueing delay that is
   // "too large," and indicative of problems with resolutions (perhaps due to
   // an overloaded router, or such).  When we exceed this delay, congestion
   // avoidance will kick in and all speculations in the queue will be discarded.
   static const int kMaxSpeculativeResolveQueueDelayMs;
 
+  // The number of referrers we remember by default. Beyond this, the least
+  // useful referrers are discarded, which bounds the memory used by
+  // referrers_ and the size of the persisted referrer list.
+  static const size_t kMaxReferrers;
+
   // |max_concurrent| specifies how many concurrent (parallel) prefetches will
   // be performed. Host lookups will be issued through |host_resolver|.
   explicit Predictor(bool preconnect_enabled);
@@ -126,6 +141,10 @@ class Predictor {
 
   static void set_max_parallel_resolves(size_t max_parallel_resolves);
 
+  static void set_expected_resolution_time(int expected_resolution_time_ms);
+
+  static void set_max_referrers(size_t max_referrers);
+
   virtual void ShutdownOnUIThread(PrefService* user_prefs);
 
   // ------------- End UI thread methods.
@@ -265,9 +284,12 @@ class Predictor {
   FRIEND_TEST_ALL_PREFIXES(PredictorTest, SingleLookupTest);
   FRIEND_TEST_ALL_PREFIXES(PredictorTest, ConcurrentLookupTest);
   FRIEND_TEST_ALL_PREFIXES(PredictorTest, MassiveConcurrentLookupTest);
+  FRIEND_TEST_ALL_PREFIXES(PredictorTest, FastResolvesRaiseLookupLimit);
+  FRIEND_TEST_ALL_PREFIXES(PredictorTest, SlowResolvesLowerLookupLimit);
   FRIEND_TEST_ALL_PREFIXES(PredictorTest, PriorityQueuePushPopTest);
   FRIEND_TEST_ALL_PREFIXES(PredictorTest, PriorityQueueReorderTest);
   FRIEND_TEST_ALL_PREFIXES(PredictorTest, ReferrerSerializationTrimTest);
+  FRIEND_TEST_ALL_PREFIXES(PredictorPerfTest, ReplayNavigationTrace);
   friend class WaitForResolutionHelper;  // For testing.
 
   class LookupRequest;
@@ -280,6 +302,8 @@ class Predictor {
   // clicking on a link.  By tagging (with a motivation) each push we make into
   // this FIFO queue, the queue can re-order the more important names to service
   // them sooner (relative to some low priority background resolutions).
+  // Names the user is about to navigate to (typed into the omnibox, or hovered
+  // over) are the most urgent of all, and go ahead of even learned referrers.
   class HostNameQueue {
    public:
     HostNameQueue();
@@ -290,6 +314,9 @@ class Predictor {
     GURL Pop();
 
    private:
+    // The names the user is likely to navigate to next, which are serviced
+    // before any others.
+    std::queue<GURL> urgent_queue_;
     // The names in the queue that should be serviced (popped) ASAP.
     std::queue<GURL> rush_queue_;
     // The names in the queue that should only be serviced when rush_queue is
@@ -378,6 +405,9 @@ class Predictor {
   // Only for testing;
   size_t peak_pending_lookups() const { return peak_pending_lookups_; }
 
+  // Only for testing;
+  size_t dns_lookup_limit() const { return dns_lookup_limit_; }
+
   // ------------- Start IO thread methods.
 
   // Perform actual resolution or preconnection to subresources now.  This is
@@ -415,6 +445,14 @@ class Predictor {
   // asynchronously, provided we don't exceed concurrent resolution limit.
   void StartSomeQueuedResolutions();
 
+  // Adapts dns_lookup_limit_ to how long an asynchronous lookup took.  A fast
+  // resolution while names are waiting in the queue lets one more lookup run
+  // in parallel, and a slow one halves the number of parallel lookups.
+  void AdjustDnsLookupLimit(base::TimeDelta resolve_duration);
+
+  // Halves dns_lookup_limit_, down to a minimum of one lookup.
+  void ReduceDnsLookupLimit();
+
   // Performs trimming similar to TrimReferrersNow(), except it does it as a
   // series of short tasks by posting continuations again an again until done.
   void TrimReferrers();
@@ -430,6 +468,12 @@ class Predictor {
   // continue with them shortly (i.e., it yeilds and continues).
   void IncrementalTrimReferrers(bool trim_all_now);
 
+  // If there are more than max_referrers_ referrers, discards the ones with the
+  // lowest expected subresource use, down to 90% of the limit. The referrer
+  // for |spared_url|, which has just been learned and has had no chance to be
+  // used yet, is kept.
+  void EvictLeastUsefulReferrers(const GURL& spared_url);
+
   // ------------- End IO thread methods.
 
   scoped_ptr<InitialObserver> initial_observer_;
@@ -462,10 +506,27 @@ class Predictor {
   // sub-resource speculation, and retard resolutions suggested by page scans.
   const size_t max_concurrent_dns_lookups_;
 
+  // The number of concurrent speculative lookups we currently send, which
+  // AdjustDnsLookupLimit() keeps between one and max_concurrent_dns_lookups_.
+  size_t dns_lookup_limit_;
+
+  // A moving average of how long asynchronous lookups took, and how often we
+  // raised or lowered dns_lookup_limit_, for display in about:dns.
+  base::TimeDelta average_resolve_duration_;
+  int dns_lookup_limit_increases_;
+  int dns_lookup_limit_decreases_;
+
+  // How long we expect a lookup to take.  Faster lookups raise
+  // dns_lookup_limit_, and much slower ones lower it.
+  const base::TimeDelta expected_resolve_duration_;
+
   // The maximum queueing delay that is acceptable before we enter congestion
   // reduction mode, and discard all queued (but not yet assigned) resolutions.
   const base::TimeDelta max_dns_queue_delay_;
 
+  // The maximum number of referrers we keep in referrers_.
+  const size_t max_referrers_;
+
   // The host resolver we warm DNS entries for.
   net::HostResolver* host_resolver_;
 
@@ -0,0 +1,188 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/message_loop.h"
+#include "base/perftimer.h"
+#include "base/stringprintf.h"
+#include "base/time.h"
+#include "chrome/browser/net/predictor.h"
+#include "chrome/browser/net/referrer.h"
+#include "content/public/test/test_browser_thread.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+using content::BrowserThread;
+
+namespace chrome_browser_net {
+
+namespace {
+
+// The number of sites in the trace, and the number of navigations to them.
+const int kSites = 5000;
+const int kNavigations = 50000;
+
+// The number of CDN and ad hosts shared between sites.
+const int kCdnHosts = 20;
+const int kAdHosts = 50;
+
+struct Navigation {
+  GURL page;
+  std::vector<GURL> subresources;
+};
+
+// Returns a pseudo-random number in [0, range), skewed towards 0 so that a
+// few sites get most of the navigations.
+int SkewedRandom(uint32* seed, int range) {
+  *seed = *seed * 1103515245 + 12345;
+  const int a = (*seed >> 8) % range;
+  *seed = *seed * 1103515245 + 12345;
+  const int b = (*seed >> 8) % range;
+  return std::min(a, b);
+}
+
+GURL HostUrl(const std::string& host) {
+  return Predictor::CanonicalizeUrl(GURL("http://" + host + "/"));
+}
+
+// Returns a trace of navigations. Each page loads subresources from its own
+// static host and its CDN, which the predictor can learn, and from an ad host
+// that changes from one load to the next, which it can't.
+std::vector<Navigation> MakeTrace() {
+  std::vector<Navigation> trace(kNavigations);
+  uint32 seed = 1;
+  for (int i = 0; i < kNavigations; ++i) {
+    const int site = SkewedRandom(&seed, kSites);
+    Navigation& navigation = trace[i];
+    navigation.page = HostUrl(base::StringPrintf("www.site%d.com", site));
+    navigation.subresources.push_back(
+        HostUrl(base::StringPrintf("static.site%d.com", site)));
+    navigation.subresources.push_back(
+        HostUrl(base::StringPrintf("cdn%d.net", site % kCdnHosts)));
+    const int ad_host = SkewedRandom(&seed, kAdHosts);
+    navigation.subresources.push_back(
+        HostUrl(base::StringPrintf("ads%d.com", ad_host)));
+  }
+  return trace;
+}
+
+}  // namespace
+
+class PredictorPerfTest : public testing::Test {
+ public:
+  PredictorPerfTest()
+      : ui_thread_(BrowserThread::UI, &loop_),
+        io_thread_(BrowserThread::IO, &loop_) {
+  }
+
+  virtual void TearDown() OVERRIDE {
+    Predictor::set_max_referrers(Predictor::kMaxReferrers);
+  }
+
+ private:
+  MessageLoopForUI loop_;
+  content::TestBrowserThread ui_thread_;
+  content::TestBrowserThread io_thread_;
+};
+
+// Replays a trace of navigations through the predictor with a few referrer
+// limits. For each, reports the approximate memory used by the referrers, the
+// time to look up the subresources to preconnect when a page is navigated to,
+// and how many of those preconnections the page then used.
+TEST_F(PredictorPerfTest, ReplayNavigationTrace) {
+  const std::vector<Navigation> trace = MakeTrace();
+  const size_t kReferrerLimits[] = { 500, Predictor::kMaxReferrers, 10000 };
+  for (size_t l = 0; l < arraysize(kReferrerLimits); ++l) {
+    const size_t limit = kReferrerLimits[l];
+    Predictor::set_max_referrers(limit);
+    Predictor predictor(true);
+
+    int preconnects = 0;
+    int preconnect_hits = 0;
+    base::TimeDelta lookup_time;
+    base::TimeDelta learn_time;
+    for (size_t i = 0; i < trace.size(); ++i) {
+      const Navigation& navigation = trace[i];
+
+      // Do what PrepareFrameSubresources() does, short of connecting.
+      base::TimeTicks start = base::TimeTicks::Now();
+      std::vector<GURL> preconnected;
+      Predictor::Referrers::iterator it =
+          predictor.referrers_.find(navigation.page);
+      if (it != predictor.referrers_.end()) {
+        Referrer* referrer = &it->second;
+        referrer->IncrementUseCount();
+        for (Referrer::iterator future_url = referrer->begin();
+             future_url != referrer->end(); ++future_url) {
+          if (future_url->second.subresource_use_rate() >
+              Predictor::kPreconnectWorthyExpectedValue) {
+            preconnected.push_back(future_url->first);
+          }
+          future_url->second.ReferrerWasObserved();
+        }
+      }
+      lookup_time += base::TimeTicks::Now() - start;
+
+      preconnects += preconnected.size();
+      for (size_t j = 0; j < preconnected.size(); ++j) {
+        if (std::find(navigation.subresources.begin(),
+                      navigation.subresources.end(),
+                      preconnected[j]) != navigation.subresources.end()) {
+          ++preconnect_hits;
+        }
+      }
+
+      start = base::TimeTicks::Now();
+      for (size_t j = 0; j < navigation.subresources.size(); ++j) {
+        predictor.LearnFromNavigation(navigation.page,
+                                      navigation.subresources[j]);
+      }
+      learn_time += base::TimeTicks::Now() - start;
+    }
+    EXPECT_LE(predictor.referrers_.size(), limit);
+
+    // Approximate the heap used by the referrers: the map nodes, the URLs
+    // and the subresource lists.
+    size_t bytes = 0;
+    for (Predictor::Referrers::const_iterator it =
+             predictor.referrers_.begin();
+         it != predictor.referrers_.end(); ++it) {
+      bytes += sizeof(Predictor::Referrers::value_type) + 4 * sizeof(void*);
+      bytes += it->first.spec().capacity();
+      bytes += it->second.capacity() * sizeof(SubresourceList::value_type);
+      for (Referrer::const_iterator future_url = it->second.begin();
+           future_url != it->second.end(); ++future_url) {
+        bytes += future_url->first.spec().capacity();
+      }
+    }
+
+    LogPerfResult(
+        base::StringPrintf("Predictor_referrer_kb_%d",
+                           static_cast<int>(limit)).c_str(),
+        bytes / 1024.0, "kb");
+    LogPerfResult(
+        base::StringPrintf("Predictor_lookup_%d",
+                           static_cast<int>(limit)).c_str(),
+        lookup_time.InMicroseconds() / static_cast<double>(trace.size()),
+        "us/navigation");
+    LogPerfResult(
+        base::StringPrintf("Predictor_learn_%d",
+                           static_cast<int>(limit)).c_str(),
+        learn_time.InMicroseconds() / static_cast<double>(trace.size()),
+        "us/navigation");
+    LogPerfResult(
+        base::StringPrintf("Predictor_preconnect_hit_rate_%d",
+                           static_cast<int>(limit)).c_str(),
+        preconnects ? 100.0 * preconnect_hits / preconnects : 0.0, "%");
+    EXPECT_GT(preconnect_hits, 0);
+
+    predictor.Shutdown();
+  }
+}
+
+}  // namespace chrome_browser_net
@@ -11,6 +11,7 @@
 #include "base/memory/scoped_ptr.h"
 #include "base/message_loop.h"
 #include "base/string_number_conversions.h"
+#include "base/stringprintf.h"
 #include "base/timer.h"
 #include "base/values.h"
 #include "chrome/browser/net/predictor.h"
@@ -77,6 +78,9 @@ class PredictorTest : public testing::Test {
         Predictor::kMaxSpeculativeParallelResolves);
     Predictor::set_max_queueing_delay(
         Predictor::kMaxSpeculativeResolveQueueDelayMs);
+    Predictor::set_max_referrers(Predictor::kMaxReferrers);
+    Predictor::set_expected_resolution_time(
+        Predictor::kExpectedResolutionTimeMs);
     // Since we are using a caching HostResolver, the following latencies will
     // only be incurred by the first request, after which the result will be
     // cached internally by |host_resolver_|.
@@ -241,6 +245,62 @@ TEST_F(PredictorTest, MassiveConcurrentLookupTest) {
   testing_master.Shutdown();
 }
 
+TEST_F(PredictorTest, FastResolvesRaiseLookupLimit) {
+  host_resolver_->rules()->AddRuleWithLatency("*.fast", "127.0.0.1", 10);
+
+  Predictor testing_master(true);
+  testing_master.SetHostResolver(host_resolver_.get());
+  EXPECT_LT(testing_master.dns_lookup_limit(),
+            testing_master.max_concurrent_dns_lookups());
+
+  UrlList names;
+  for (int i = 0; i < 30; i++)
+    names.push_back(GURL(
+        "http://host" + base::IntToString(i) + ".fast:80"));
+  testing_master.ResolveList(names, UrlInfo::PAGE_SCAN_MOTIVATED);
+
+  WaitForResolution(&testing_master, names);
+
+  MessageLoop::current()->RunUntilIdle();
+
+  // Each lookup finished quickly while others were queued, so the predictor
+  // sent more of them at once, up to the ceiling.
+  EXPECT_EQ(testing_master.max_concurrent_dns_lookups(),
+            testing_master.dns_lookup_limit());
+  EXPECT_EQ(testing_master.max_concurrent_dns_lookups(),
+            testing_master.peak_pending_lookups());
+
+  testing_master.Shutdown();
+}
+
+TEST_F(PredictorTest, SlowResolvesLowerLookupLimit) {
+  // Take more than twice the expected resolution time.
+  Predictor::set_expected_resolution_time(20);
+  host_resolver_->rules()->AddRuleWithLatency("*.slow", "127.0.0.1", 100);
+  // Don't let congestion control discard the queue on a slow bot.
+  Predictor::set_max_queueing_delay(10000);
+
+  Predictor testing_master(true);
+  testing_master.SetHostResolver(host_resolver_.get());
+  EXPECT_GT(testing_master.dns_lookup_limit(), 1u);
+
+  UrlList names;
+  for (int i = 0; i < 5; i++)
+    names.push_back(GURL(
+        "http://host" + base::IntToString(i) + ".slow:80"));
+  testing_master.ResolveList(names, UrlInfo::PAGE_SCAN_MOTIVATED);
+
+  WaitForResolution(&testing_master, names);
+
+  MessageLoop::current()->RunUntilIdle();
+
+  for (UrlList::const_iterator it = names.begin(); it != names.end(); ++it)
+    EXPECT_TRUE(testing_master.WasFound(*it));
+  EXPECT_EQ(1u, testing_master.dns_lookup_limit());
+
+  testing_master.Shutdown();
+}
+
 //------------------------------------------------------------------------------
 // Functions to help synthesize and test serializations of subresource referrer
 // lists.
@@ -558,9 +618,9 @@ TEST_F(PredictorTest, PriorityQueuePushPopTest) {
 
   GURL first("http://first:80"), second("http://second:90");
 
-  // First check high priority queue FIFO functionality.
+  // First check urgent queue FIFO functionality.
   EXPECT_TRUE(queue.IsEmpty());
-  queue.Push(first, UrlInfo::LEARNED_REFERAL_MOTIVATED);
+  queue.Push(first, UrlInfo::OMNIBOX_MOTIVATED);
   EXPECT_FALSE(queue.IsEmpty());
   queue.Push(second, UrlInfo::MOUSE_OVER_MOTIVATED);
   EXPECT_FALSE(queue.IsEmpty());
@@ -569,10 +629,20 @@ TEST_F(PredictorTest, PriorityQueuePushPopTest) {
   EXPECT_EQ(queue.Pop(), second);
   EXPECT_TRUE(queue.IsEmpty());
 
+  // Then check high priority queue FIFO functionality.
+  queue.Push(first, UrlInfo::LEARNED_REFERAL_MOTIVATED);
+  EXPECT_FALSE(queue.IsEmpty());
+  queue.Push(second, UrlInfo::STATIC_REFERAL_MOTIVATED);
+  EXPECT_FALSE(queue.IsEmpty());
+  EXPECT_EQ(queue.Pop(), first);
+  EXPECT_FALSE(queue.IsEmpty());
+  EXPECT_EQ(queue.Pop(), second);
+  EXPECT_TRUE(queue.IsEmpty());
+
   // Then check low priority queue FIFO functionality.
   queue.Push(first, UrlInfo::PAGE_SCAN_MOTIVATED);
   EXPECT_FALSE(queue.IsEmpty());
-  queue.Push(second, UrlInfo::OMNIBOX_MOTIVATED);
+  queue.Push(second, UrlInfo::STARTUP_LIST_MOTIVATED);
   EXPECT_FALSE(queue.IsEmpty());
   EXPECT_EQ(queue.Pop(), first);
   EXPECT_FALSE(queue.IsEmpty());
@@ -591,22 +661,32 @@ TEST_F(PredictorTest, PriorityQueueReorderTest) {
       low5("http://low5:80"),
       hi1("http://hi1:80"),
       hi2("http://hi2:80"),
-      hi3("http://hi3:80");
+      hi3("http://hi3:80"),
+      urgent1("http://urgent1:80"),
+      urgent2("http://urgent2:80");
 
   EXPECT_TRUE(queue.IsEmpty());
   queue.Push(low1, UrlInfo::PAGE_SCAN_MOTIVATED);
   queue.Push(low2, UrlInfo::UNIT_TEST_MOTIVATED);
   queue.Push(low3, UrlInfo::LINKED_MAX_MOTIVATED);
-  queue.Push(low4, UrlInfo::OMNIBOX_MOTIVATED);
+  queue.Push(low4, UrlInfo::EARLY_LOAD_MOTIVATED);
   queue.Push(low5, UrlInfo::STARTUP_LIST_MOTIVATED);
-  queue.Push(low4, UrlInfo::OMNIBOX_MOTIVATED);
+  queue.Push(low4, UrlInfo::EARLY_LOAD_MOTIVATED);
 
   // Push all the high prority items
   queue.Push(hi1, UrlInfo::LEARNED_REFERAL_MOTIVATED);
   queue.Push(hi2, UrlInfo::STATIC_REFERAL_MOTIVATED);
-  queue.Push(hi3, UrlInfo::MOUSE_OVER_MOTIVATED);
+  queue.Push(hi3, UrlInfo::LEARNED_REFERAL_MOTIVATED);
+
+  // Push the urgent items last.
+  queue.Push(urgent1, UrlInfo::OMNIBOX_MOTIVATED);
+  queue.Push(urgent2, UrlInfo::MOUSE_OVER_MOTIVATED);
 
-  // Check that high priority stuff comes out first, and in FIFO order.
+  // Check that urgent stuff comes out first, and in FIFO order.
+  EXPECT_EQ(queue.Pop(), urgent1);
+  EXPECT_EQ(queue.Pop(), urgent2);
+
+  // Then the high priority stuff, also in FIFO order.
   EXPECT_EQ(queue.Pop(), hi1);
   EXPECT_EQ(queue.Pop(), hi2);
   EXPECT_EQ(queue.Pop(), hi3);
@@ -681,4 +761,68 @@ TEST_F(PredictorTest, DiscardPredictorResults) {
   predictor.Shutdown();
 }
 
+// Make sure that going over the referrer limit discards the referrers with
+// the lowest expected subresource use.
+TEST_F(PredictorTest, ReferrerEvictionTest) {
+  Predictor::set_max_referrers(10);
+  Predictor predictor(true);
+  predictor.SetHostResolver(host_resolver_.get());
+  GURL subresource_url("http://img.google.com:80");
+
+  scoped_ptr<ListValue> referral_list(NewEmptySerializationList());
+  for (int i = 0; i < 11; ++i) {
+    GURL motivation_url(base::StringPrintf("http://www.site%d.com:80", i));
+    AddToSerializedList(motivation_url, subresource_url, 0.5 + i,
+                        referral_list.get());
+  }
+  predictor.DeserializeReferrers(*referral_list.get());
+
+  // Two referrers are evicted, to leave room for a tenth of the limit.
+  ListValue recovered_referral_list;
+  predictor.SerializeReferrers(&recovered_referral_list);
+  EXPECT_EQ(10U, recovered_referral_list.GetSize());
+  double rate;
+  for (int i = 0; i < 11; ++i) {
+    GURL motivation_url(base::StringPrintf("http://www.site%d.com:80", i));
+    EXPECT_EQ(i >= 2, GetDataFromSerialization(
+        motivation_url, subresource_url, recovered_referral_list, &rate));
+  }
+
+  predictor.Shutdown();
+}
+
+// Make sure that a referrer which was just learned isn't evicted before it has
+// had a chance to be used, even though its expected subresource use is lowest.
+TEST_F(PredictorTest, ReferrerEvictionSparesNewReferrerTest) {
+  Predictor::set_max_referrers(10);
+  Predictor predictor(true);
+  predictor.SetHostResolver(host_resolver_.get());
+  GURL subresource_url("http://img.google.com:80");
+
+  scoped_ptr<ListValue> referral_list(NewEmptySerializationList());
+  for (int i = 0; i < 10; ++i) {
+    GURL motivation_url(base::StringPrintf("http://www.site%d.com:80", i));
+    AddToSerializedList(motivation_url, subresource_url, 0.5 + i,
+                        referral_list.get());
+  }
+  predictor.DeserializeReferrers(*referral_list.get());
+
+  GURL new_url("http://www.new.com:80");
+  predictor.LearnFromNavigation(new_url, subresource_url);
+
+  ListValue recovered_referral_list;
+  predictor.SerializeReferrers(&recovered_referral_list);
+  EXPECT_EQ(10U, recovered_referral_list.GetSize());
+  double rate;
+  EXPECT_TRUE(GetDataFromSerialization(
+      new_url, subresource_url, recovered_referral_list, &rate));
+  for (int i = 0; i < 10; ++i) {
+    GURL motivation_url(base::StringPrintf("http://www.site%d.com:80", i));
+    EXPECT_EQ(i >= 2, GetDataFromSerialization(
+        motivation_url, subresource_url, recovered_referral_list, &rate));
+  }
+
+  predictor.Shutdown();
+}
+
 }  // namespace chrome_browser_net
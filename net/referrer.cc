@@ -64,7 +64,7 @@ void Referrer::SuggestHost(const GURL& url) {
   if (!url.has_host())  // TODO(jar): Is this really needed????
     return;
   DCHECK(url == url.GetWithEmptyPath());
-  SubresourceMap::iterator it = find(url);
+  iterator it = Find(url);
   if (it != end()) {
     it->second.SubresourceIsNeeded();
     return;
@@ -74,43 +74,61 @@ void Referrer::SuggestHost(const GURL& url) {
     DeleteLeastUseful();
     DCHECK(kMaxSuggestions > size());
   }
-  (*this)[url].SubresourceIsNeeded();
+  push_back(std::make_pair(url, ReferrerValue()));
+  back().second.SubresourceIsNeeded();
+}
+
+Referrer::iterator Referrer::Find(const GURL& url) {
+  for (iterator it = begin(); it != end(); ++it) {
+    if (it->first == url)
+      return it;
+  }
+  return end();
 }
 
 void Referrer::DeleteLeastUseful() {
   // Find the item with the lowest value.  Most important is preconnection_rate,
   // and least is lifetime (age).
-  GURL least_useful_url;
+  iterator least_useful = end();
   double lowest_rate_seen = 0.0;
   // We use longs for durations because we will use multiplication on them.
   int64 least_useful_lifetime = 0;  // Duration in milliseconds.
 
   const base::Time kNow(base::Time::Now());  // Avoid multiple calls.
-  for (SubresourceMap::iterator it = begin(); it != end(); ++it) {
+  for (iterator it = begin(); it != end(); ++it) {
     int64 lifetime = (kNow - it->second.birth_time()).InMilliseconds();
     double rate = it->second.subresource_use_rate();
-    if (least_useful_url.has_host()) {
+    if (least_useful != end()) {
       if (rate > lowest_rate_seen)
         continue;
       if (lifetime <= least_useful_lifetime)
         continue;
     }
-    least_useful_url = it->first;
+    least_useful = it;
     lowest_rate_seen = rate;
     least_useful_lifetime = lifetime;
   }
-  if (least_useful_url.has_host())
-    erase(least_useful_url);
+  if (least_useful != end())
+    erase(least_useful);
+}
+
+double Referrer::TotalSubresourceUseRate() const {
+  double total = 0.0;
+  for (const_iterator it = begin(); it != end(); ++it)
+    total += it->second.subresource_use_rate();
+  return total;
 }
 
 bool Referrer::Trim(double reduce_rate, double threshold) {
-  std::vector<GURL> discarded_urls;
-  for (SubresourceMap::iterator it = begin(); it != end(); ++it) {
+  iterator kept = begin();
+  for (iterator it = begin(); it != end(); ++it) {
     if (!it->second.Trim(reduce_rate, threshold))
-      discarded_urls.push_back(it->first);
+      continue;
+    if (kept != it)
+      *kept = *it;
+    ++kept;
   }
-  for (size_t i = 0; i < discarded_urls.size(); ++i)
-    erase(discarded_urls[i]);
+  erase(kept, end());
   return size() > 0;
 }
 
@@ -140,7 +158,9 @@ void Referrer::Deserialize(const Value& value) {
     // level, so for now, we just suggest subresources, which leaves them all
     // with the same birth date (typically start of process).
     SuggestHost(url);
-    (*this)[url].SetSubresourceUseRate(rate);
+    iterator it = Find(url);
+    if (it != end())
+      it->second.SetSubresourceUseRate(rate);
   }
 }
 
@@ -15,7 +15,8 @@
 #ifndef CHROME_BROWSER_NET_REFERRER_H_
 #define CHROME_BROWSER_NET_REFERRER_H_
 
-#include <map>
+#include <utility>
+#include <vector>
 
 #include "base/basictypes.h"
 #include "base/time.h"
@@ -65,7 +66,8 @@ class ReferrerValue {
   bool Trim(double reduce_rate, double threshold);
 
  private:
-  const base::Time birth_time_;
+  // Not const, so that ReferrerValues can be moved around in a vector.
+  base::Time birth_time_;
 
   // The number of times this item was navigated to with the fixed referrer.
   int64 navigation_count_;
@@ -84,10 +86,10 @@ class ReferrerValue {
 };
 
 //------------------------------------------------------------------------------
-// A list of domain names to pre-resolve. The names are the keys to this map,
-// and the values indicate the amount of benefit derived from having each name
-// around.
-typedef std::map<GURL, ReferrerValue> SubresourceMap;
+// A list of domain names to pre-resolve, paired with the amount of benefit
+// derived from having each name around. A Referrer holds at most a handful of
+// names, so a flat list is both smaller and faster to search than a map.
+typedef std::vector<std::pair<GURL, ReferrerValue> > SubresourceList;
 
 //------------------------------------------------------------------------------
 // There is one Referrer instance for each hostname that has acted as an HTTP
@@ -96,9 +98,9 @@ typedef std::map<GURL, ReferrerValue> SubresourceMap;
 // was probably needed as a subresource of a page, and was not otherwise
 // predictable until the content with the reference arrived).  Most typically,
 // an outer page was a page fetched by the user, and this instance lists names
-// in SubresourceMap which are subresources and that were needed to complete the
-// rendering of the outer page.
-class Referrer : public SubresourceMap {
+// in SubresourceList which are subresources and that were needed to complete
+// the rendering of the outer page.
+class Referrer : public SubresourceList {
  public:
   Referrer();
   void IncrementUseCount() { ++use_count_; }
@@ -109,6 +111,10 @@ class Referrer : public SubresourceMap {
   // discarded to make room for this insertion.
   void SuggestHost(const GURL& url);
 
+  // Returns the sum of the expected use of all subresources, which measures
+  // how useful this Referrer is.
+  double TotalSubresourceUseRate() const;
+
   // Trim the Referrer, by first diminishing (scaling down) the subresource
   // use expectation for each ReferredValue.
   // Returns true if expected use rate is greater than the threshold.
@@ -118,6 +124,9 @@ class Referrer : public SubresourceMap {
   base::Value* Serialize() const;
   void Deserialize(const base::Value& referrers);
 
+  // Returns the entry for |url|, or end() if there is none.
+  iterator Find(const GURL& url);
+
  private:
   // Helper function for pruning list.  Metric for usefulness is "large accrued
   // value," in the form of latency_ savings associated with a host name.  We
@@ -4,10 +4,13 @@
 
 #include "chrome/browser/net/sqlite_persistent_cookie_store.h"
 
+#include <algorithm>
+#include <deque>
 #include <list>
 #include <map>
 #include <set>
 #include <utility>
+#include <vector>
 
 #include "base/basictypes.h"
 #include "base/bind.h"
@@ -37,6 +40,18 @@
 using base::Time;
 using content::BrowserThread;
 
+namespace {
+
+// Commit right away once this many operations are outstanding. While full
+// batches accumulate within |kMinBatchCommitIntervalMs| of each other, the
+// batch size doubles, up to |kMaxCommitAfterBatchSize|; it halves again when
+// a commit finds the batch less than half full.
+const size_t kMinCommitAfterBatchSize = 512;
+const size_t kMaxCommitAfterBatchSize = 4096;
+const int kMinBatchCommitIntervalMs = 1000;
+
+}  // namespace
+
 // This class is designed to be shared between any calling threads and the
 // database thread. It batches operations and commits them on a timer.
 //
@@ -44,9 +59,9 @@ using content::BrowserThread;
 // delegates to Backend::Load, which posts a Backend::LoadAndNotifyOnDBThread
 // task to the DB thread.  This task calls Backend::ChainLoadCookies(), which
 // repeatedly posts itself to the DB thread to load each eTLD+1's cookies in
-// separate tasks.  When this is complete, Backend::CompleteLoadOnIOThread is
-// posted to the IO thread, which notifies the caller of
-// SQLitePersistentCookieStore::Load that the load is complete.
+// separate tasks, most recently used eTLD+1 first.  When this is complete,
+// Backend::CompleteLoadOnIOThread is posted to the IO thread, which notifies
+// the caller of SQLitePersistentCookieStore::Load that the load is complete.
 //
 // If a priority load request is invoked via SQLitePersistentCookieStore::
 // LoadCookiesForKey, it is delegated to Backend::LoadCookiesForKey, which posts
@@ -57,8 +72,10 @@ using content::BrowserThread;
 //
 // Subsequent to loading, mutations may be queued by any thread using
 // AddCookie, UpdateCookieAccessTime, and DeleteCookie. These are flushed to
-// disk on the DB thread every 30 seconds, 512 operations, or call to Flush(),
-// whichever occurs first.
+// disk on the DB thread every 30 seconds, after a batch of operations, or on
+// a call to Flush(), whichever occurs first. The batch size starts at 512
+// operations and grows while batches fill up quickly, so that a burst of
+// writes is committed in fewer transactions.
 class SQLitePersistentCookieStore::Backend
     : public base::RefCountedThreadSafe<SQLitePersistentCookieStore::Backend> {
  public:
@@ -68,6 +85,7 @@ class SQLitePersistentCookieStore::Backend
       : path_(path),
         db_(NULL),
         num_pending_(0),
+        commit_after_batch_size_(kMinCommitAfterBatchSize),
         force_keep_session_state_(false),
         initialized_(false),
         corruption_detected_(false),
@@ -193,9 +211,9 @@ class SQLitePersistentCookieStore::Backend
   // Initialize the data base.
   bool InitializeDatabase();
 
-  // Loads cookies for the next domain key from the DB, then either reschedules
-  // itself or schedules the provided callback to run on the IO thread (if all
-  // domains are loaded).
+  // Loads cookies for the next domain key in |keys_in_load_order_| from the
+  // DB, then either reschedules itself or schedules the provided callback to
+  // run on the IO thread (if all domains are loaded).
   void ChainLoadCookies(const LoadedCallback& loaded_callback);
 
   // Load all cookies for a set of domains/hosts
@@ -223,11 +241,17 @@ class SQLitePersistentCookieStore::Backend
   typedef std::list<PendingOperation*> PendingOperationsList;
   PendingOperationsList pending_;
   PendingOperationsList::size_type num_pending_;
+  // The number of pending operations that triggers a commit right away.
+  PendingOperationsList::size_type commit_after_batch_size_;
   // True if the persistent store should skip delete on exit rules.
   bool force_keep_session_state_;
-  // Guard |cookies_|, |pending_|, |num_pending_|, |force_keep_session_state_|
+  // Guard |cookies_|, |pending_|, |num_pending_|, |commit_after_batch_size_|,
+  // |force_keep_session_state_|
   base::Lock lock_;
 
+  // When the last non-empty batch was committed. Only used on the DB thread.
+  base::TimeTicks last_commit_time_;
+
   // Temporary buffer for cookies loaded from DB. Accumulates cookies to reduce
   // the number of messages sent to the IO thread. Sent back in response to
   // individual load requests for domain keys or when all loading completes.
@@ -236,6 +260,12 @@ class SQLitePersistentCookieStore::Backend
   // Map of domain keys(eTLD+1) to domains/hosts that are to be loaded from DB.
   std::map<std::string, std::set<std::string> > keys_to_load_;
 
+  // The domain keys in the order ChainLoadCookies() loads them: most recently
+  // used first, as those are the most likely to be asked for by the first
+  // requests, e.g. for tabs restored from the last session. Keys that were
+  // already loaded by a priority load are skipped.
+  std::deque<std::string> keys_in_load_order_;
+
   // Map of (domain keys(eTLD+1), is secure cookie) to number of cookies in the
   // database.
   typedef std::pair<std::string, bool> CookieOrigin;
@@ -570,9 +600,9 @@ bool SQLitePersistentCookieStore::Backend::InitializeDatabase() {
 
   start = base::Time::Now();
 
-  // Retrieve all the domains
+  // Retrieve all the domains, and when their cookies were last used.
   sql::Statement smt(db_->GetUniqueStatement(
-    "SELECT DISTINCT host_key FROM cookies"));
+    "SELECT host_key, MAX(last_access_utc) FROM cookies GROUP BY host_key"));
 
   if (!smt.is_valid()) {
     if (corruption_detected_)
@@ -583,6 +613,7 @@ bool SQLitePersistentCookieStore::Backend::InitializeDatabase() {
   }
 
   // Build a map of domain keys (always eTLD+1) to domains.
+  std::map<std::string, int64> key_last_access;
   while (smt.Step()) {
     std::string domain = smt.ColumnString(0);
     std::string key =
@@ -594,8 +625,22 @@ bool SQLitePersistentCookieStore::Backend::InitializeDatabase() {
       it = keys_to_load_.insert(std::make_pair
                                 (key, std::set<std::string>())).first;
     it->second.insert(domain);
+
+    int64& last_access = key_last_access[key];
+    last_access = std::max(last_access, smt.ColumnInt64(1));
   }
 
+  // Order the keys by when they were last used, most recent first.
+  std::vector<std::pair<int64, std::string> > keys_by_access;
+  keys_by_access.reserve(key_last_access.size());
+  for (std::map<std::string, int64>::const_iterator it =
+           key_last_access.begin(); it != key_last_access.end(); ++it) {
+    keys_by_access.push_back(std::make_pair(it->second, it->first));
+  }
+  std::sort(keys_by_access.rbegin(), keys_by_access.rend());
+  for (size_t i = 0; i < keys_by_access.size(); ++i)
+    keys_in_load_order_.push_back(keys_by_access[i].second);
+
   UMA_HISTOGRAM_CUSTOM_TIMES(
     "Cookie.TimeInitializeDomainMap",
     base::Time::Now() - start,
@@ -616,12 +661,19 @@ void SQLitePersistentCookieStore::Backend::ChainLoadCookies(
   if (!db_.get()) {
     // Close() has been called on this store.
     load_success = false;
-  } else if (keys_to_load_.size() > 0) {
-    // Load cookies for the first domain key.
-    std::map<std::string, std::set<std::string> >::iterator
-      it = keys_to_load_.begin();
-    load_success = LoadCookiesForDomains(it->second);
-    keys_to_load_.erase(it);
+  } else {
+    // Load cookies for the next domain key that a priority load hasn't
+    // already loaded.
+    while (!keys_in_load_order_.empty()) {
+      std::map<std::string, std::set<std::string> >::iterator
+        it = keys_to_load_.find(keys_in_load_order_.front());
+      keys_in_load_order_.pop_front();
+      if (it != keys_to_load_.end()) {
+        load_success = LoadCookiesForDomains(it->second);
+        keys_to_load_.erase(it);
+        break;
+      }
+    }
   }
 
   // If load is successful and there are more domain keys to be loaded,
@@ -828,18 +880,18 @@ void SQLitePersistentCookieStore::Backend::BatchOperation(
     const net::CanonicalCookie& cc) {
   // Commit every 30 seconds.
   static const int kCommitIntervalMs = 30 * 1000;
-  // Commit right away if we have more than 512 outstanding operations.
-  static const size_t kCommitAfterBatchSize = 512;
   DCHECK(!BrowserThread::CurrentlyOn(BrowserThread::DB));
 
   // We do a full copy of the cookie here, and hopefully just here.
   scoped_ptr<PendingOperation> po(new PendingOperation(op, cc));
 
   PendingOperationsList::size_type num_pending;
+  PendingOperationsList::size_type commit_after_batch_size;
   {
     base::AutoLock locked(lock_);
     pending_.push_back(po.release());
     num_pending = ++num_pending_;
+    commit_after_batch_size = commit_after_batch_size_;
   }
 
   if (num_pending == 1) {
@@ -848,7 +900,7 @@ void SQLitePersistentCookieStore::Backend::BatchOperation(
         BrowserThread::DB, FROM_HERE,
         base::Bind(&Backend::Commit, this),
         base::TimeDelta::FromMilliseconds(kCommitIntervalMs));
-  } else if (num_pending == kCommitAfterBatchSize) {
+  } else if (num_pending == commit_after_batch_size) {
     // We've reached a big enough batch, fire off a commit now.
     BrowserThread::PostTask(
         BrowserThread::DB, FROM_HERE,
@@ -864,12 +916,30 @@ void SQLitePersistentCookieStore::Backend::Commit() {
     base::AutoLock locked(lock_);
     pending_.swap(ops);
     num_pending_ = 0;
+
+    if (!ops.empty()) {
+      const base::TimeTicks now = base::TimeTicks::Now();
+      if (ops.size() >= commit_after_batch_size_) {
+        if (now - last_commit_time_ <
+            base::TimeDelta::FromMilliseconds(kMinBatchCommitIntervalMs)) {
+          commit_after_batch_size_ = std::min(commit_after_batch_size_ * 2,
+                                              kMaxCommitAfterBatchSize);
+        }
+      } else if (ops.size() < commit_after_batch_size_ / 2) {
+        commit_after_batch_size_ = std::max(commit_after_batch_size_ / 2,
+                                            kMinCommitAfterBatchSize);
+      }
+      last_commit_time_ = now;
+    }
   }
 
   // Maybe an old timer fired or we are already Close()'ed.
   if (!db_.get() || ops.empty())
     return;
 
+  const base::TimeTicks start = base::TimeTicks::Now();
+  UMA_HISTOGRAM_COUNTS_10000("Cookie.CommitBatchSize", ops.size());
+
   sql::Statement add_smt(db_->GetCachedStatement(SQL_FROM_HERE,
       "INSERT INTO cookies (creation_utc, host_key, name, value, path, "
       "expires_utc, secure, httponly, last_access_utc, has_expires, "
@@ -943,6 +1013,7 @@ void SQLitePersistentCookieStore::Backend::Commit() {
   bool succeeded = transaction.Commit();
   UMA_HISTOGRAM_ENUMERATION("Cookie.BackingStoreUpdateResults",
                             succeeded ? 0 : 1, 2);
+  UMA_HISTOGRAM_TIMES("Cookie.TimeCommit", base::TimeTicks::Now() - start);
 }
 
 void SQLitePersistentCookieStore::Backend::Flush(
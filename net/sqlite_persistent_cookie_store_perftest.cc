@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include "base/bind.h"
+#include "base/file_path.h"
 #include "base/files/scoped_temp_dir.h"
 #include "base/message_loop.h"
 #include "base/perftimer.h"
@@ -24,7 +25,8 @@ class SQLitePersistentCookieStorePerfTest : public testing::Test {
       : db_thread_(BrowserThread::DB),
         io_thread_(BrowserThread::IO),
         loaded_event_(false, false),
-        key_loaded_event_(false, false) {
+        key_loaded_event_(false, false),
+        first_key_loaded_event_(false, false) {
   }
 
   void OnLoaded(const std::vector<net::CanonicalCookie*>& cookies) {
@@ -37,28 +39,31 @@ class SQLitePersistentCookieStorePerfTest : public testing::Test {
     key_loaded_event_.Signal();
   }
 
+  void OnFirstKeyLoaded(const std::vector<net::CanonicalCookie*>& cookies) {
+    first_key_cookies_ = cookies;
+    first_key_loaded_event_.Signal();
+  }
+
   void Load() {
     store_->Load(base::Bind(&SQLitePersistentCookieStorePerfTest::OnLoaded,
                                 base::Unretained(this)));
     loaded_event_.Wait();
   }
 
-  virtual void SetUp() {
-    db_thread_.Start();
-    io_thread_.Start();
-    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
-    store_ = new SQLitePersistentCookieStore(
-        temp_dir_.path().Append(chrome::kCookieFilename),
-        false, NULL);
+  // Creates |num_domains| * |cookies_per_domain| cookies in the database at
+  // |path|, and opens a new store on it in |store_|.
+  void CreateCookies(const FilePath& path,
+                     int num_domains,
+                     int cookies_per_domain) {
+    store_ = new SQLitePersistentCookieStore(path, false, NULL);
     std::vector<net::CanonicalCookie*> cookies;
     Load();
     ASSERT_EQ(0u, cookies_.size());
-    // Creates 15000 cookies from 300 eTLD+1s.
     base::Time t = base::Time::Now();
-    for (int domain_num = 0; domain_num < 300; domain_num++) {
+    for (int domain_num = 0; domain_num < num_domains; domain_num++) {
       std::string domain_name(base::StringPrintf(".domain_%d.com", domain_num));
       GURL gurl("www" + domain_name);
-      for (int cookie_num = 0; cookie_num < 50; ++cookie_num) {
+      for (int cookie_num = 0; cookie_num < cookies_per_domain; ++cookie_num) {
         t += base::TimeDelta::FromInternalValue(10);
         store_->AddCookie(
             net::CanonicalCookie(gurl,
@@ -76,8 +81,15 @@ class SQLitePersistentCookieStorePerfTest : public testing::Test {
     // Make sure we wait until the destructor has run.
     ASSERT_TRUE(helper->Run());
 
-    store_ = new SQLitePersistentCookieStore(
-      temp_dir_.path().Append(chrome::kCookieFilename), false, NULL);
+    store_ = new SQLitePersistentCookieStore(path, false, NULL);
+  }
+
+  virtual void SetUp() {
+    db_thread_.Start();
+    io_thread_.Start();
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    // Creates 15000 cookies from 300 eTLD+1s.
+    CreateCookies(temp_dir_.path().Append(chrome::kCookieFilename), 300, 50);
   }
 
  protected:
@@ -85,7 +97,9 @@ class SQLitePersistentCookieStorePerfTest : public testing::Test {
   content::TestBrowserThread io_thread_;
   base::WaitableEvent loaded_event_;
   base::WaitableEvent key_loaded_event_;
+  base::WaitableEvent first_key_loaded_event_;
   std::vector<net::CanonicalCookie*> cookies_;
+  std::vector<net::CanonicalCookie*> first_key_cookies_;
   base::ScopedTempDir temp_dir_;
   scoped_refptr<SQLitePersistentCookieStore> store_;
 };
@@ -114,3 +128,33 @@ TEST_F(SQLitePersistentCookieStorePerfTest, TestLoadPerformance) {
 
   ASSERT_EQ(15000U, cookies_.size());
 }
+
+// Test the performance of load with 100k cookies from 2000 eTLD+1s.
+TEST_F(SQLitePersistentCookieStorePerfTest, TestLoadPerformance100k) {
+  CreateCookies(temp_dir_.path().AppendASCII("Cookies100k"), 2000, 50);
+
+  PerfTimeLogger timer("Load all cookies, 100k");
+  Load();
+  timer.Done();
+
+  ASSERT_EQ(100000U, cookies_.size());
+}
+
+// Test the time from a cold start to the cookies for the first request, which
+// asks for its eTLD+1 while the full load is under way.
+TEST_F(SQLitePersistentCookieStorePerfTest, TestColdStartFirstRequest) {
+  PerfTimeLogger timer("Cold start, time to first request's cookies");
+  store_->Load(base::Bind(&SQLitePersistentCookieStorePerfTest::OnLoaded,
+                          base::Unretained(this)));
+  store_->LoadCookiesForKey("domain_150.com",
+      base::Bind(&SQLitePersistentCookieStorePerfTest::OnFirstKeyLoaded,
+                 base::Unretained(this)));
+  first_key_loaded_event_.Wait();
+  timer.Done();
+  // The full load may have loaded other eTLD+1s before the priority load,
+  // and hands them out with it.
+  ASSERT_LE(50U, first_key_cookies_.size());
+
+  loaded_event_.Wait();
+  ASSERT_EQ(15000U, first_key_cookies_.size() + cookies_.size());
+}
@@ -4,14 +4,19 @@
 
 #include "chrome/browser/net/transport_security_persister.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "base/base64.h"
 #include "base/bind.h"
 #include "base/file_path.h"
 #include "base/file_util.h"
+#include "base/files/important_file_writer.h"
 #include "base/json/json_reader.h"
 #include "base/json/json_writer.h"
 #include "base/message_loop.h"
 #include "base/path_service.h"
+#include "base/string_split.h"
 #include "base/values.h"
 #include "chrome/common/chrome_paths.h"
 #include "content/public/browser/browser_thread.h"
@@ -79,20 +84,95 @@ const char kDefault[] = "default";
 const char kPinningOnly[] = "pinning-only";
 const char kCreated[] = "created";
 
+// How long to wait after a change before committing it, so that a burst of
+// changes costs one journal record per entry.
+const int kCommitDelaySeconds = 10;
+
+// The journal is compacted into the state file once it holds more records
+// than the state has entries, but never before it holds this many. Commits
+// that remove entries compact it right away.
+const size_t kMinJournalRecordsToCompact = 100;
+
+// Appends |records| to the journal at |journal_path|, creating it if needed.
+// Returns false if the records may not all have been written.
+bool AppendToJournal(const FilePath& journal_path,
+                     const std::string& records) {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::FILE));
+
+  const int size = static_cast<int>(records.size());
+  int written;
+  if (file_util::PathExists(journal_path))
+    written = file_util::AppendToFile(journal_path, records.data(), size);
+  else
+    written = file_util::WriteFile(journal_path, records.data(), size);
+  if (written != size) {
+    LOG(WARNING) << "Failed to append to " << journal_path.value();
+    return false;
+  }
+  return true;
+}
+
+// Replaces the state file at |path| with |snapshot| and deletes the journal.
+// The snapshot includes every record in the journal, so if we crash before
+// the journal is deleted, replaying it on top of the snapshot is harmless.
+// Returns false if the state file could not be written.
+bool WriteSnapshot(const FilePath& path,
+                   const FilePath& journal_path,
+                   const std::string& snapshot) {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::FILE));
+
+  if (!base::ImportantFileWriter::WriteFileAtomically(path, snapshot))
+    return false;
+  file_util::Delete(journal_path, false);
+  return true;
+}
+
 }  // namespace
 
 class TransportSecurityPersister::Loader {
  public:
   Loader(const base::WeakPtr<TransportSecurityPersister>& persister,
-         const FilePath& path)
+         const FilePath& path,
+         const FilePath& journal_path)
       : persister_(persister),
         path_(path),
+        journal_path_(journal_path),
+        entries_(new DictionaryValue),
+        journal_records_(0),
+        journal_torn_(false),
         state_valid_(false) {
   }
 
+  // Reads the state file, replays the journal over it and serializes each
+  // resulting entry, so that the IO thread only has to apply them.
   void Load() {
     DCHECK(BrowserThread::CurrentlyOn(BrowserThread::FILE));
-    state_valid_ = file_util::ReadFileToString(path_, &state_);
+
+    std::string state;
+    if (file_util::ReadFileToString(path_, &state)) {
+      state_valid_ = true;
+      scoped_ptr<Value> value(base::JSONReader::Read(state));
+      if (value.get() && value->IsType(Value::TYPE_DICTIONARY))
+        entries_.reset(static_cast<DictionaryValue*>(value.release()));
+      else
+        LOG(ERROR) << "Failed to deserialize state: " << state;
+    }
+
+    std::string journal;
+    if (file_util::ReadFileToString(journal_path_, &journal)) {
+      state_valid_ = true;
+      ReplayJournal(journal);
+      // A crash cut the last record short. Anything appended now would be
+      // joined to it and lost, so the journal must be compacted first.
+      journal_torn_ = !journal.empty() && journal[journal.size() - 1] != '\n';
+    }
+
+    for (DictionaryValue::key_iterator i = entries_->begin_keys();
+         i != entries_->end_keys(); ++i) {
+      Value* entry = NULL;
+      if (entries_->GetWithoutPathExpansion(*i, &entry))
+        base::JSONWriter::Write(entry, &persisted_[*i]);
+    }
   }
 
   void CompleteLoad() {
@@ -101,17 +181,50 @@ class TransportSecurityPersister::Loader {
     // Make sure we're deleted.
     scoped_ptr<Loader> deleter(this);
 
-    if (!persister_ || !state_valid_)
+    if (!persister_)
       return;
-    persister_->CompleteLoad(state_);
+    persister_->CompleteLoad(state_valid_ ? entries_.get() : NULL,
+                             &persisted_, journal_records_, journal_torn_);
   }
 
  private:
+  // Applies each line of |journal| to |entries_|. A line that does not
+  // parse, such as one cut short by a crash, is skipped.
+  void ReplayJournal(const std::string& journal) {
+    std::vector<std::string> lines;
+    base::SplitString(journal, '\n', &lines);
+    for (size_t i = 0; i < lines.size(); ++i) {
+      if (lines[i].empty())
+        continue;
+      scoped_ptr<Value> value(base::JSONReader::Read(lines[i]));
+      DictionaryValue* records;
+      if (!value.get() || !value->GetAsDictionary(&records)) {
+        LOG(WARNING) << "Could not parse journal record; skipping record";
+        continue;
+      }
+      for (DictionaryValue::key_iterator j = records->begin_keys();
+           j != records->end_keys(); ++j) {
+        Value* record = NULL;
+        if (!records->GetWithoutPathExpansion(*j, &record))
+          continue;
+        ++journal_records_;
+        if (record->IsType(Value::TYPE_NULL))
+          entries_->RemoveWithoutPathExpansion(*j, NULL);
+        else
+          entries_->SetWithoutPathExpansion(*j, record->DeepCopy());
+      }
+    }
+  }
+
   base::WeakPtr<TransportSecurityPersister> persister_;
 
   FilePath path_;
+  FilePath journal_path_;
 
-  std::string state_;
+  scoped_ptr<DictionaryValue> entries_;
+  std::map<std::string, std::string> persisted_;
+  size_t journal_records_;
+  bool journal_torn_;
   bool state_valid_;
 
   DISALLOW_COPY_AND_ASSIGN(Loader);
@@ -122,15 +235,19 @@ TransportSecurityPersister::TransportSecurityPersister(
     const FilePath& profile_path,
     bool readonly)
     : transport_security_state_(state),
-      writer_(profile_path.AppendASCII("TransportSecurity"),
-              BrowserThread::GetMessageLoopProxyForThread(BrowserThread::FILE)),
+      path_(profile_path.AppendASCII("TransportSecurity")),
+      journal_path_(profile_path.AppendASCII("TransportSecurity-journal")),
       readonly_(readonly),
+      loaded_(false),
+      journal_records_(0),
+      journal_needs_compaction_(false),
       weak_ptr_factory_(ALLOW_THIS_IN_INITIALIZER_LIST(this)) {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
 
   transport_security_state_->SetDelegate(this);
 
-  Loader* loader = new Loader(weak_ptr_factory_.GetWeakPtr(), writer_.path());
+  Loader* loader =
+      new Loader(weak_ptr_factory_.GetWeakPtr(), path_, journal_path_);
   BrowserThread::PostTaskAndReply(
       BrowserThread::FILE, FROM_HERE,
       base::Bind(&Loader::Load, base::Unretained(loader)),
@@ -140,8 +257,10 @@ TransportSecurityPersister::TransportSecurityPersister(
 TransportSecurityPersister::~TransportSecurityPersister() {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
 
-  if (writer_.HasPendingWrite())
-    writer_.DoScheduledWrite();
+  if (commit_timer_.IsRunning() && loaded_) {
+    commit_timer_.Stop();
+    CommitPendingWrite();
+  }
 
   transport_security_state_->SetDelegate(NULL);
 }
@@ -151,14 +270,25 @@ void TransportSecurityPersister::StateIsDirty(
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
   DCHECK_EQ(transport_security_state_, state);
 
-  if (!readonly_)
-    writer_.ScheduleWrite(this);
+  if (!readonly_ && !commit_timer_.IsRunning()) {
+    commit_timer_.Start(FROM_HERE,
+                        base::TimeDelta::FromSeconds(kCommitDelaySeconds),
+                        this, &TransportSecurityPersister::CommitPendingWrite);
+  }
 }
 
 bool TransportSecurityPersister::SerializeData(std::string* output) {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
 
   DictionaryValue toplevel;
+  SerializeEntries(&toplevel);
+  base::JSONWriter::WriteWithOptions(&toplevel,
+                                     base::JSONWriter::OPTIONS_PRETTY_PRINT,
+                                     output);
+  return true;
+}
+
+void TransportSecurityPersister::SerializeEntries(DictionaryValue* toplevel) {
   base::Time now = base::Time::Now();
   TransportSecurityState::Iterator state(*transport_security_state_);
   for (; state.HasNext(); state.Advance()) {
@@ -195,13 +325,8 @@ bool TransportSecurityPersister::SerializeData(std::string* output) {
                       SPKIHashesToListValue(domain_state.dynamic_spki_hashes));
     }
 
-    toplevel.Set(HashedDomainToExternalString(hostname), serialized);
+    toplevel->Set(HashedDomainToExternalString(hostname), serialized);
   }
-
-  base::JSONWriter::WriteWithOptions(&toplevel,
-                                     base::JSONWriter::OPTIONS_PRETTY_PRINT,
-                                     output);
-  return true;
 }
 
 bool TransportSecurityPersister::DeserializeFromCommandLine(
@@ -230,6 +355,16 @@ bool TransportSecurityPersister::Deserialize(const std::string& serialized,
   if (!value.get() || !value->GetAsDictionary(&dict_value))
     return false;
 
+  DeserializeEntries(dict_value, forced, dirty, state);
+  return true;
+}
+
+// static
+void TransportSecurityPersister::DeserializeEntries(
+    DictionaryValue* dict_value,
+    bool forced,
+    bool* dirty,
+    TransportSecurityState* state) {
   const base::Time current_time(base::Time::Now());
   bool dirtied = false;
 
@@ -315,17 +450,110 @@ bool TransportSecurityPersister::Deserialize(const std::string& serialized,
   }
 
   *dirty = dirtied;
-  return true;
 }
 
-void TransportSecurityPersister::CompleteLoad(const std::string& state) {
+void TransportSecurityPersister::CompleteLoad(
+    DictionaryValue* entries,
+    std::map<std::string, std::string>* persisted,
+    size_t journal_records,
+    bool journal_torn) {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
 
-  bool dirty = false;
-  if (!LoadEntries(state, &dirty)) {
-    LOG(ERROR) << "Failed to deserialize state: " << state;
+  loaded_ = true;
+  persisted_.swap(*persisted);
+  journal_records_ = journal_records;
+  journal_needs_compaction_ = journal_torn;
+
+  if (!entries)
     return;
-  }
+
+  bool dirty = false;
+  transport_security_state_->Clear();
+  DeserializeEntries(entries, false, &dirty, transport_security_state_);
   if (dirty)
     StateIsDirty(transport_security_state_);
 }
+
+void TransportSecurityPersister::CommitPendingWrite() {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
+
+  if (!loaded_) {
+    // Changes are computed against what is on disk, which we don't know
+    // until the Loader is done.
+    StateIsDirty(transport_security_state_);
+    return;
+  }
+
+  DictionaryValue toplevel;
+  SerializeEntries(&toplevel);
+
+  // Collect the entries that were added or changed since the last commit,
+  // and map the ones that were removed to null.
+  DictionaryValue changes;
+  bool removed = false;
+  std::map<std::string, std::string> current;
+  for (DictionaryValue::key_iterator i = toplevel.begin_keys();
+       i != toplevel.end_keys(); ++i) {
+    Value* entry = NULL;
+    if (!toplevel.GetWithoutPathExpansion(*i, &entry))
+      continue;
+    std::string& serialized = current[*i];
+    base::JSONWriter::Write(entry, &serialized);
+    std::map<std::string, std::string>::const_iterator persisted =
+        persisted_.find(*i);
+    if (persisted == persisted_.end() || persisted->second != serialized)
+      changes.SetWithoutPathExpansion(*i, entry->DeepCopy());
+  }
+  for (std::map<std::string, std::string>::const_iterator i =
+           persisted_.begin(); i != persisted_.end(); ++i) {
+    if (current.find(i->first) == current.end()) {
+      changes.SetWithoutPathExpansion(i->first, Value::CreateNullValue());
+      removed = true;
+    }
+  }
+  if (changes.empty() && !journal_needs_compaction_)
+    return;
+
+  persisted_.swap(current);
+  journal_records_ += changes.size();
+
+  // A journal whose last record is incomplete is not appended to, since the
+  // snapshot below replaces it.
+  if (!journal_needs_compaction_) {
+    std::string records;
+    base::JSONWriter::Write(&changes, &records);
+    records += '\n';
+    BrowserThread::PostTaskAndReplyWithResult(
+        BrowserThread::FILE, FROM_HERE,
+        base::Bind(&AppendToJournal, journal_path_, records),
+        base::Bind(&TransportSecurityPersister::OnJournalWritten,
+                   weak_ptr_factory_.GetWeakPtr()));
+  }
+
+  // Removed hosts are compacted away right away, so that their hashes don't
+  // linger on disk after, for example, the user clears their history.
+  if (journal_needs_compaction_ || removed ||
+      journal_records_ >
+          std::max(kMinJournalRecordsToCompact, persisted_.size())) {
+    std::string snapshot;
+    base::JSONWriter::WriteWithOptions(&toplevel,
+                                       base::JSONWriter::OPTIONS_PRETTY_PRINT,
+                                       &snapshot);
+    BrowserThread::PostTaskAndReplyWithResult(
+        BrowserThread::FILE, FROM_HERE,
+        base::Bind(&WriteSnapshot, path_, journal_path_, snapshot),
+        base::Bind(&TransportSecurityPersister::OnJournalWritten,
+                   weak_ptr_factory_.GetWeakPtr()));
+    journal_records_ = 0;
+    journal_needs_compaction_ = false;
+  }
+}
+
+void TransportSecurityPersister::OnJournalWritten(bool success) {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::IO));
+
+  // What is on disk may now be missing records, or end in a partial one, so
+  // the next commit rewrites the state file rather than appending.
+  if (!success)
+    journal_needs_compaction_ = true;
+}
@@ -26,25 +26,35 @@
 //
 // ...
 //
-// TransportSecurityPersister::SerializeState
-//   copies the current state of the TransportSecurityState, serializes
-//   and writes to disk.
+// TransportSecurityPersister::CommitPendingWrite
+//   serializes each entry of the TransportSecurityState, compares it with
+//   what was last written and appends only the changed entries to a
+//   journal file next to the state file.
+//
+// Once the journal holds more records than the state has entries, or as soon
+// as a commit removes entries, the whole state is written to the state file
+// and the journal is deleted.
+// Loading reads the state file and then replays the journal over it.
 
 #ifndef CHROME_BROWSER_NET_TRANSPORT_SECURITY_PERSISTER_H_
 #define CHROME_BROWSER_NET_TRANSPORT_SECURITY_PERSISTER_H_
 
+#include <map>
 #include <string>
 
 #include "base/file_path.h"
-#include "base/files/important_file_writer.h"
 #include "base/memory/weak_ptr.h"
+#include "base/timer.h"
 #include "net/base/transport_security_state.h"
 
+namespace base {
+class DictionaryValue;
+}
+
 // Reads and updates on-disk TransportSecurity state.
 // Must be created, used and destroyed only on the IO thread.
 class TransportSecurityPersister
-    : public net::TransportSecurityState::Delegate,
-      public base::ImportantFileWriter::DataSerializer {
+    : public net::TransportSecurityState::Delegate {
  public:
   TransportSecurityPersister(net::TransportSecurityState* state,
                              const FilePath& profile_path,
@@ -54,8 +64,6 @@ class TransportSecurityPersister
   // Called by the TransportSecurityState when it changes its state.
   virtual void StateIsDirty(net::TransportSecurityState*) OVERRIDE;
 
-  // ImportantFileWriter::DataSerializer:
-  //
   // Serializes |transport_security_state_| into |*output|. Returns true if
   // all DomainStates were serialized correctly.
   //
@@ -83,7 +91,10 @@ class TransportSecurityPersister
   // The reason for hashing them is so that the stored state does not
   // trivially reveal a user's browsing history to an attacker reading the
   // serialized state on disk.
-  virtual bool SerializeData(std::string* data) OVERRIDE;
+  //
+  // Each line of the journal is a dictionary of the same form holding the
+  // entries changed by one commit; removed entries map to null.
+  bool SerializeData(std::string* data);
 
   // Parses an array of JSON-encoded TransportSecurityState::DomainState
   // entries. For use in loading entries defined on the command line
@@ -112,16 +123,62 @@ class TransportSecurityPersister
                           bool* dirty,
                           net::TransportSecurityState* state);
 
-  void CompleteLoad(const std::string& state);
+  // Like Deserialize(), for a dictionary that has already been parsed.
+  static void DeserializeEntries(base::DictionaryValue* entries,
+                                 bool forced,
+                                 bool* dirty,
+                                 net::TransportSecurityState* state);
+
+  // Fills |toplevel| with the serialized entries of
+  // |transport_security_state_|, keyed as described above.
+  void SerializeEntries(base::DictionaryValue* toplevel);
+
+  // Called on the IO thread with the entries read by the Loader, or NULL if
+  // there was nothing on disk. |persisted| maps the key of each entry on
+  // disk to its serialized form and |journal_records| is the number of
+  // records in the journal. |journal_torn| is true if the journal ends in a
+  // partial record.
+  void CompleteLoad(base::DictionaryValue* entries,
+                    std::map<std::string, std::string>* persisted,
+                    size_t journal_records,
+                    bool journal_torn);
+
+  // Writes the entries that changed since the last commit to the journal,
+  // or compacts the journal into the state file.
+  void CommitPendingWrite();
+
+  // Called on the IO thread once a commit's journal append or snapshot has
+  // been written, with |success| false if it failed.
+  void OnJournalWritten(bool success);
 
   net::TransportSecurityState* transport_security_state_;
 
-  // Helper for safely writing the data.
-  base::ImportantFileWriter writer_;
+  // The state file and the journal of changes made since it was written.
+  const FilePath path_;
+  const FilePath journal_path_;
 
   // Whether or not we're in read-only mode.
   const bool readonly_;
 
+  // Whether the Loader has finished. Commits wait for it, so that they are
+  // computed against what is on disk.
+  bool loaded_;
+
+  // Maps the key of each entry on disk to its serialized form, as of the
+  // last commit.
+  std::map<std::string, std::string> persisted_;
+
+  // The number of records appended to the journal since it was last
+  // compacted.
+  size_t journal_records_;
+
+  // Set if the journal may be missing records or end in a partial one, so
+  // that the next commit compacts it rather than appending to it.
+  bool journal_needs_compaction_;
+
+  // Coalesces the changes made within a short interval into one commit.
+  base::OneShotTimer<TransportSecurityPersister> commit_timer_;
+
   base::WeakPtrFactory<TransportSecurityPersister> weak_ptr_factory_;
 
   DISALLOW_COPY_AND_ASSIGN(TransportSecurityPersister);
@@ -12,6 +12,7 @@
 #include "base/file_util.h"
 #include "base/files/scoped_temp_dir.h"
 #include "base/message_loop.h"
+#include "base/stringprintf.h"
 #include "content/public/test/test_browser_thread.h"
 #include "net/base/transport_security_state.h"
 #include "testing/gtest/include/gtest/gtest.h"
@@ -37,11 +38,30 @@ class TransportSecurityPersisterTest : public testing::Test {
   }
 
  protected:
+  // Destroys the persister, which commits any pending changes, and then
+  // loads what it wrote into an empty |state_|.
+  void Reload() {
+    persister_.reset();
+    message_loop_.RunUntilIdle();
+    state_.Clear();
+    persister_.reset(
+        new TransportSecurityPersister(&state_, temp_dir_.path(), false));
+    message_loop_.RunUntilIdle();
+  }
+
+  FilePath StatePath() const {
+    return temp_dir_.path().AppendASCII("TransportSecurity");
+  }
+
+  FilePath JournalPath() const {
+    return temp_dir_.path().AppendASCII("TransportSecurity-journal");
+  }
+
   // Ordering is important here. If member variables are not destroyed in the
   // right order, then DCHECKs will fail all over the place.
   MessageLoop message_loop_;
 
-  // Needed for ImportantFileWriter, which TransportSecurityPersister uses.
+  // TransportSecurityPersister loads and writes its files on the FILE thread.
   content::TestBrowserThread test_file_thread_;
 
   // TransportSecurityPersister runs on the IO thread.
@@ -135,9 +155,9 @@ TEST_F(TransportSecurityPersisterTest, SerializeData3) {
   EXPECT_TRUE(persister_->SerializeData(&serialized));
 
   // Persist the data to the file. For the test to be fast and not flaky, we
-  // just do it directly rather than call persister_->StateIsDirty. (That uses
-  // ImportantFileWriter, which has an asynchronous commit interval rather
-  // than block.) Use a different basename just for cleanliness.
+  // just do it directly rather than call persister_->StateIsDirty. (That
+  // waits for an asynchronous commit interval rather than block.) Use a
+  // different basename just for cleanliness.
   FilePath path =
       temp_dir_.path().AppendASCII("TransportSecurityPersisterTest");
   EXPECT_TRUE(file_util::WriteFile(path, serialized.c_str(),
@@ -233,3 +253,117 @@ TEST_F(TransportSecurityPersisterTest, ForcePreloads) {
   EXPECT_FALSE(domain_state.HasPins());
   EXPECT_FALSE(domain_state.ShouldRedirectHTTPToHTTPS());
 }
+
+TEST_F(TransportSecurityPersisterTest, JournalChanges) {
+  message_loop_.RunUntilIdle();
+
+  TransportSecurityState::DomainState domain_state;
+  domain_state.upgrade_mode =
+      TransportSecurityState::DomainState::MODE_FORCE_HTTPS;
+  domain_state.upgrade_expiry =
+      base::Time::Now() + base::TimeDelta::FromSeconds(1000);
+  state_.EnableHost("example.com", domain_state);
+  state_.EnableHost("example.net", domain_state);
+
+  // The changes are appended to the journal; the state file isn't written.
+  Reload();
+  EXPECT_FALSE(file_util::PathExists(StatePath()));
+  std::string journal;
+  EXPECT_TRUE(file_util::ReadFileToString(JournalPath(), &journal));
+  EXPECT_TRUE(state_.GetDomainState("example.com", false, &domain_state));
+  EXPECT_TRUE(state_.GetDomainState("example.net", false, &domain_state));
+
+  // Loading didn't change anything, so nothing more is written.
+  Reload();
+  std::string unchanged_journal;
+  EXPECT_TRUE(file_util::ReadFileToString(JournalPath(), &unchanged_journal));
+  EXPECT_EQ(journal, unchanged_journal);
+
+  // Deleting a host compacts the journal, so that no file holds the host.
+  EXPECT_TRUE(state_.DeleteHost("example.com"));
+  Reload();
+  EXPECT_TRUE(file_util::PathExists(StatePath()));
+  EXPECT_FALSE(file_util::PathExists(JournalPath()));
+  EXPECT_FALSE(state_.GetDomainState("example.com", false, &domain_state));
+  EXPECT_TRUE(state_.GetDomainState("example.net", false, &domain_state));
+
+  // Likewise when the state becomes empty.
+  EXPECT_TRUE(state_.DeleteHost("example.net"));
+  Reload();
+  EXPECT_FALSE(file_util::PathExists(JournalPath()));
+  std::string serialized;
+  EXPECT_TRUE(file_util::ReadFileToString(StatePath(), &serialized));
+  std::string empty;
+  EXPECT_TRUE(persister_->SerializeData(&empty));
+  EXPECT_EQ(empty, serialized);
+}
+
+TEST_F(TransportSecurityPersisterTest, CompactJournal) {
+  message_loop_.RunUntilIdle();
+
+  const int kHosts = 150;
+  TransportSecurityState::DomainState domain_state;
+  domain_state.upgrade_mode =
+      TransportSecurityState::DomainState::MODE_FORCE_HTTPS;
+  domain_state.upgrade_expiry =
+      base::Time::Now() + base::TimeDelta::FromSeconds(1000);
+  for (int i = 0; i < kHosts; ++i)
+    state_.EnableHost(base::StringPrintf("host%d.com", i), domain_state);
+  Reload();
+  EXPECT_FALSE(file_util::PathExists(StatePath()));
+
+  // Once the journal holds more records than there are entries, it is
+  // replaced by the state file.
+  domain_state.upgrade_expiry += base::TimeDelta::FromSeconds(1000);
+  state_.EnableHost("host0.com", domain_state);
+  Reload();
+  EXPECT_TRUE(file_util::PathExists(StatePath()));
+  EXPECT_FALSE(file_util::PathExists(JournalPath()));
+  for (int i = 0; i < kHosts; ++i) {
+    EXPECT_TRUE(state_.GetDomainState(base::StringPrintf("host%d.com", i),
+                                      false, &domain_state));
+  }
+}
+
+TEST_F(TransportSecurityPersisterTest, TornJournal) {
+  message_loop_.RunUntilIdle();
+
+  TransportSecurityState::DomainState domain_state;
+  domain_state.upgrade_mode =
+      TransportSecurityState::DomainState::MODE_FORCE_HTTPS;
+  domain_state.upgrade_expiry =
+      base::Time::Now() + base::TimeDelta::FromSeconds(1000);
+  state_.EnableHost("example.com", domain_state);
+  Reload();
+  state_.EnableHost("example.net", domain_state);
+  Reload();
+
+  // Cut the last record short, as a crash while appending it would.
+  std::string journal;
+  ASSERT_TRUE(file_util::ReadFileToString(JournalPath(), &journal));
+  ASSERT_GT(journal.size(), 2U);
+  ASSERT_EQ('\n', journal[journal.size() - 1]);
+  journal.resize(journal.size() - 2);
+  ASSERT_EQ(static_cast<int>(journal.size()),
+            file_util::WriteFile(JournalPath(), journal.data(),
+                                 journal.size()));
+  Reload();
+  EXPECT_TRUE(state_.GetDomainState("example.com", false, &domain_state));
+  EXPECT_FALSE(state_.GetDomainState("example.net", false, &domain_state));
+
+  // The next commit must not be joined to the partial record.
+  state_.EnableHost("example.org", domain_state);
+  Reload();
+  EXPECT_TRUE(file_util::PathExists(StatePath()));
+  EXPECT_FALSE(file_util::PathExists(JournalPath()));
+  EXPECT_TRUE(state_.GetDomainState("example.com", false, &domain_state));
+  EXPECT_TRUE(state_.GetDomainState("example.org", false, &domain_state));
+
+  // Later commits go to a fresh journal.
+  state_.EnableHost("example.net", domain_state);
+  Reload();
+  EXPECT_TRUE(file_util::PathExists(JournalPath()));
+  EXPECT_TRUE(state_.GetDomainState("example.com", false, &domain_state));
+  EXPECT_TRUE(state_.GetDomainState("example.net", false, &domain_state));
+  EXPECT_TRUE(state_.GetDomainState("example.org", false, &domain_state));
+}
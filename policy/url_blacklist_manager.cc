@@ -4,6 +4,8 @@
 
 #include "chrome/browser/policy/url_blacklist_manager.h"
 
+#include <algorithm>
+
 #include "base/bind.h"
 #include "base/message_loop.h"
 #include "base/stl_util.h"
@@ -19,7 +21,6 @@
 #include "googleurl/src/gurl.h"
 
 using content::BrowserThread;
-using extensions::URLMatcher;
 using extensions::URLMatcherCondition;
 using extensions::URLMatcherConditionFactory;
 using extensions::URLMatcherConditionSet;
@@ -64,20 +65,12 @@ scoped_ptr<URLBlacklist> BuildBlacklist(scoped_ptr<base::ListValue> block,
 
 }  // namespace
 
-struct URLBlacklist::FilterComponents {
-  FilterComponents() : port(0), match_subdomains(true), allow(true) {}
-  ~FilterComponents() {}
+URLBlacklist::FilterComponents::FilterComponents()
+    : port(0), match_subdomains(true), allow(true) {}
 
-  std::string scheme;
-  std::string host;
-  uint16 port;
-  std::string path;
-  bool match_subdomains;
-  bool allow;
-};
+URLBlacklist::FilterComponents::~FilterComponents() {}
 
-URLBlacklist::URLBlacklist() : id_(0),
-                               url_matcher_(new URLMatcher) {
+URLBlacklist::URLBlacklist() {
 }
 
 URLBlacklist::~URLBlacklist() {
@@ -85,7 +78,6 @@ URLBlacklist::~URLBlacklist() {
 
 void URLBlacklist::AddFilters(bool allow,
                               const base::ListValue* list) {
-  URLMatcherConditionSet::Vector all_conditions;
   size_t size = std::min(kMaxFiltersPerPolicy, list->GetSize());
   for (size_t i = 0; i < size; ++i) {
     std::string pattern;
@@ -100,13 +92,12 @@ void URLBlacklist::AddFilters(bool allow,
       continue;
     }
 
-    all_conditions.push_back(
-        CreateConditionSet(url_matcher_.get(), ++id_, components.scheme,
-                           components.host, components.match_subdomains,
-                           components.port, components.path));
-    filters_[id_] = components;
+    FilterList& filters = components.match_subdomains ?
+        host_suffixes_[components.host] : exact_hosts_[components.host];
+    filters.insert(std::upper_bound(filters.begin(), filters.end(),
+                                    components, FilterTakesPrecedence),
+                   components);
   }
-  url_matcher_->AddConditionSets(all_conditions);
 }
 
 void URLBlacklist::Block(const base::ListValue* filters) {
@@ -121,24 +112,38 @@ bool URLBlacklist::IsURLBlocked(const GURL& url) const {
   if (!HasStandardScheme(url))
     return false;
 
-  std::set<URLMatcherConditionSet::ID> matching_ids =
-      url_matcher_->MatchURL(url);
-
-  const FilterComponents* max = NULL;
-  for (std::set<URLMatcherConditionSet::ID>::iterator id = matching_ids.begin();
-       id != matching_ids.end(); ++id) {
-    std::map<int, FilterComponents>::const_iterator it = filters_.find(*id);
-    DCHECK(it != filters_.end());
-    const FilterComponents& filter = it->second;
-    if (!max || FilterTakesPrecedence(filter, *max))
-      max = &filter;
+  // Filters for the exact host take precedence over any filter that matches
+  // subdomains, and those for longer hosts take precedence over shorter ones.
+  // Within each list the filters are sorted by precedence, so the first match
+  // found is the most specific one.
+  const std::string& host = url.host();
+  HostMap::const_iterator it = exact_hosts_.find(host);
+  if (it != exact_hosts_.end()) {
+    const FilterComponents* filter = FindMatch(it->second, url);
+    if (filter)
+      return !filter->allow;
   }
 
-  // Default to allow.
-  if (!max)
-    return false;
+  // Try ".a.b.c", ".b.c", ".c" and then the "match all hosts" filters.
+  const std::string dotted_host = "." + host;
+  for (size_t pos = 0; pos != std::string::npos;
+       pos = dotted_host.find('.', pos + 1)) {
+    it = host_suffixes_.find(dotted_host.substr(pos));
+    if (it != host_suffixes_.end()) {
+      const FilterComponents* filter = FindMatch(it->second, url);
+      if (filter)
+        return !filter->allow;
+    }
+  }
+  it = host_suffixes_.find(std::string());
+  if (it != host_suffixes_.end()) {
+    const FilterComponents* filter = FindMatch(it->second, url);
+    if (filter)
+      return !filter->allow;
+  }
 
-  return !max->allow;
+  // Default to allow.
+  return false;
 }
 
 // static
@@ -270,6 +275,24 @@ bool URLBlacklist::FilterTakesPrecedence(const FilterComponents& lhs,
   return false;
 }
 
+// static
+const URLBlacklist::FilterComponents* URLBlacklist::FindMatch(
+    const FilterList& filters,
+    const GURL& url) {
+  const std::string& path = url.path();
+  for (FilterList::const_iterator filter = filters.begin();
+       filter != filters.end(); ++filter) {
+    if (!filter->scheme.empty() && filter->scheme != url.scheme())
+      continue;
+    if (filter->port != 0 && filter->port != url.EffectiveIntPort())
+      continue;
+    if (path.compare(0, filter->path.length(), filter->path) != 0)
+      continue;
+    return &*filter;
+  }
+  return NULL;
+}
+
 URLBlacklistManager::URLBlacklistManager(PrefService* pref_service)
     : ALLOW_THIS_IN_INITIALIZER_LIST(ui_weak_ptr_factory_(this)),
       pref_service_(pref_service),
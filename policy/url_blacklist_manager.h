@@ -5,8 +5,8 @@
 #ifndef CHROME_BROWSER_POLICY_URL_BLACKLIST_MANAGER_H_
 #define CHROME_BROWSER_POLICY_URL_BLACKLIST_MANAGER_H_
 
-#include <map>
 #include <string>
+#include <vector>
 
 #include "base/basictypes.h"
 #include "base/callback_forward.h"
@@ -28,7 +28,9 @@ class ListValue;
 namespace policy {
 
 // Contains a set of filters to block and allow certain URLs, and matches GURLs
-// against this set. The filters are currently kept in memory.
+// against this set. The filters are currently kept in memory, indexed by the
+// host they apply to, so that matching a URL only looks at the filters for
+// the URL's host and its parent domains.
 class URLBlacklist {
  public:
   URLBlacklist();
@@ -83,15 +85,42 @@ class URLBlacklist {
       const std::string& path);
 
  private:
-  struct FilterComponents;
+  struct FilterComponents {
+    FilterComponents();
+    ~FilterComponents();
+
+    std::string scheme;
+    std::string host;
+    uint16 port;
+    std::string path;
+    bool match_subdomains;
+    bool allow;
+  };
+
+  typedef std::vector<FilterComponents> FilterList;
+  typedef base::hash_map<std::string, FilterList> HostMap;
 
   // Returns true if |lhs| takes precedence over |rhs|.
   static bool FilterTakesPrecedence(const FilterComponents& lhs,
                                     const FilterComponents& rhs);
 
-  extensions::URLMatcherConditionSet::ID id_;
-  std::map<extensions::URLMatcherConditionSet::ID, FilterComponents> filters_;
-  scoped_ptr<extensions::URLMatcher> url_matcher_;
+  // Returns the first filter in |filters| whose scheme, port and path match
+  // |url|, or NULL if there is none.
+  static const FilterComponents* FindMatch(const FilterList& filters,
+                                           const GURL& url);
+
+  // Filters which match only their exact host, keyed by that host.
+  HostMap exact_hosts_;
+
+  // Filters which also match subdomains, keyed by their host. The keys start
+  // with a '.' so that they only match at domain component boundaries, or
+  // are empty for filters that match every host.
+  HostMap host_suffixes_;
+
+  // Each FilterList above is kept sorted so that a filter comes before the
+  // filters it takes precedence over. The first match in a list is therefore
+  // the most specific, and lists are consulted from the most to the least
+  // specific host.
 
   DISALLOW_COPY_AND_ASSIGN(URLBlacklist);
 };
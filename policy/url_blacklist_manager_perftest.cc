@@ -0,0 +1,199 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/policy/url_blacklist_manager.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/memory/scoped_ptr.h"
+#include "base/perftimer.h"
+#include "base/stringprintf.h"
+#include "base/values.h"
+#include "chrome/common/extensions/matcher/url_matcher.h"
+#include "googleurl/src/gurl.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace policy {
+
+namespace {
+
+// The number of filters in each synthetic blacklist. Each policy is capped
+// at 1000 entries, so large lists are added in several batches.
+const int kFilterCount = 50000;
+const int kFiltersPerBatch = 1000;
+
+// The number of URLs checked against each blacklist.
+const int kLookupCount = 100000;
+
+// Returns the |i|th synthetic filter. The mix covers subdomain, exact-host,
+// scheme, port and path filters.
+std::string MakeFilter(int i) {
+  switch (i % 5) {
+    case 0:
+      return base::StringPrintf("site%d.com", i);
+    case 1:
+      return base::StringPrintf(".www.site%d.org", i);
+    case 2:
+      return base::StringPrintf("https://secure%d.net", i);
+    case 3:
+      return base::StringPrintf("site%d.com/path/%d", i - 3, i % 7);
+    default:
+      return base::StringPrintf("http://host%d.example.com:8080/", i);
+  }
+}
+
+// Returns the |i|th URL to check, about half of which hit a filter.
+GURL MakeURL(int i) {
+  const int site = (i * 7919) % (2 * kFilterCount);
+  switch (i % 4) {
+    case 0:
+      return GURL(base::StringPrintf("http://a.b.site%d.com/", site));
+    case 1:
+      return GURL(base::StringPrintf("http://www.site%d.org/x", site + 1));
+    case 2:
+      return GURL(base::StringPrintf("https://site%d.com/path/%d/more",
+                                     site, (site + 3) % 7));
+    default:
+      return GURL(base::StringPrintf("http://host%d.example.com:8080/y",
+                                     site + 4));
+  }
+}
+
+// Matches URLs the way URLBlacklist did before it indexed its filters by
+// host: one URLMatcherConditionSet per filter, then a linear pass over the
+// matches to pick the one that takes precedence. Kept to compare against.
+class URLMatcherBlacklist {
+ public:
+  URLMatcherBlacklist() : id_(0), url_matcher_(new extensions::URLMatcher) {}
+
+  void AddFilters(bool allow, const base::ListValue* list) {
+    extensions::URLMatcherConditionSet::Vector all_conditions;
+    for (size_t i = 0; i < list->GetSize(); ++i) {
+      std::string pattern;
+      list->GetString(i, &pattern);
+      Filter filter;
+      filter.allow = allow;
+      if (!URLBlacklist::FilterToComponents(pattern, &filter.scheme,
+                                            &filter.host,
+                                            &filter.match_subdomains,
+                                            &filter.port, &filter.path)) {
+        continue;
+      }
+      all_conditions.push_back(URLBlacklist::CreateConditionSet(
+          url_matcher_.get(), ++id_, filter.scheme, filter.host,
+          filter.match_subdomains, filter.port, filter.path));
+      filters_[id_] = filter;
+    }
+    url_matcher_->AddConditionSets(all_conditions);
+  }
+
+  bool IsURLBlocked(const GURL& url) const {
+    std::set<extensions::URLMatcherConditionSet::ID> matching_ids =
+        url_matcher_->MatchURL(url);
+    const Filter* max = NULL;
+    for (std::set<extensions::URLMatcherConditionSet::ID>::iterator id =
+             matching_ids.begin(); id != matching_ids.end(); ++id) {
+      const Filter& filter = filters_.find(*id)->second;
+      if (!max || TakesPrecedence(filter, *max))
+        max = &filter;
+    }
+    return max && !max->allow;
+  }
+
+ private:
+  struct Filter {
+    std::string scheme;
+    std::string host;
+    uint16 port;
+    std::string path;
+    bool match_subdomains;
+    bool allow;
+  };
+
+  static bool TakesPrecedence(const Filter& lhs, const Filter& rhs) {
+    if (lhs.match_subdomains != rhs.match_subdomains)
+      return !lhs.match_subdomains;
+    if (lhs.host.length() != rhs.host.length())
+      return lhs.host.length() > rhs.host.length();
+    if (lhs.path.length() != rhs.path.length())
+      return lhs.path.length() > rhs.path.length();
+    return lhs.allow && !rhs.allow;
+  }
+
+  extensions::URLMatcherConditionSet::ID id_;
+  std::map<extensions::URLMatcherConditionSet::ID, Filter> filters_;
+  scoped_ptr<extensions::URLMatcher> url_matcher_;
+};
+
+// Adds the synthetic filters to |blacklist| in policy-sized batches, with
+// every tenth filter allowed rather than blocked, and logs the time taken
+// under |name|.
+template <class Blacklist>
+void BuildBlacklist(Blacklist* blacklist, const std::string& name) {
+  PerfTimeLogger timer(name.c_str());
+  for (int batch = 0; batch < kFilterCount; batch += kFiltersPerBatch) {
+    base::ListValue blocked;
+    base::ListValue allowed;
+    for (int i = batch; i < batch + kFiltersPerBatch; ++i) {
+      if (i % 10 == 9)
+        allowed.Append(new base::StringValue(MakeFilter(i)));
+      else
+        blocked.Append(new base::StringValue(MakeFilter(i)));
+    }
+    blacklist->AddFilters(false, &blocked);
+    blacklist->AddFilters(true, &allowed);
+  }
+}
+
+// Checks every URL in |urls| against |blacklist|, logs the rate under |name|
+// and returns the verdicts.
+template <class Blacklist>
+std::vector<bool> CheckURLs(const Blacklist& blacklist,
+                            const std::vector<GURL>& urls,
+                            const std::string& name) {
+  std::vector<bool> blocked;
+  blocked.reserve(urls.size());
+  PerfTimer timer;
+  for (size_t i = 0; i < urls.size(); ++i)
+    blocked.push_back(blacklist.IsURLBlocked(urls[i]));
+  LogPerfResult(name.c_str(),
+                urls.size() / timer.Elapsed().InSecondsF(), "urls/s");
+  return blocked;
+}
+
+}  // namespace
+
+// Compares building and matching a large blacklist with URLBlacklist's host
+// index against the per-filter URLMatcher approach, and checks that both
+// reach the same verdicts.
+TEST(URLBlacklistPerfTest, LargeBlacklist) {
+  std::vector<GURL> urls;
+  urls.reserve(kLookupCount);
+  for (int i = 0; i < kLookupCount; ++i)
+    urls.push_back(MakeURL(i));
+
+  URLMatcherBlacklist url_matcher_blacklist;
+  BuildBlacklist(&url_matcher_blacklist, "URLBlacklist_build_urlmatcher");
+  URLBlacklist blacklist;
+  BuildBlacklist(&blacklist, "URLBlacklist_build_host_index");
+
+  std::vector<bool> expected =
+      CheckURLs(url_matcher_blacklist, urls, "URLBlacklist_match_urlmatcher");
+  std::vector<bool> actual =
+      CheckURLs(blacklist, urls, "URLBlacklist_match_host_index");
+
+  size_t blocked_count = 0;
+  for (int i = 0; i < kLookupCount; ++i) {
+    EXPECT_EQ(expected[i], actual[i]) << urls[i].spec();
+    if (actual[i])
+      ++blocked_count;
+  }
+  EXPECT_GT(blocked_count, 0u);
+  EXPECT_LT(blocked_count, urls.size());
+}
+
+}  // namespace policy
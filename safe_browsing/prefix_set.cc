@@ -11,6 +11,16 @@
 #include "base/logging.h"
 #include "base/md5.h"
 #include "base/metrics/histogram.h"
+#include "build/build_config.h"
+
+// SSE2 is always available on x86-64.  32-bit x86 builds use it only
+// when the compiler has been told to target it.
+#if defined(ARCH_CPU_X86_64) || \
+    (defined(ARCH_CPU_X86) && (defined(__SSE2__) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2)))
+#define PREFIX_SET_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace {
 
@@ -19,8 +29,10 @@ namespace {
 // md5 -qs chrome/browser/safe_browsing/prefix_set.cc | colrm 9
 static uint32 kMagic = 0x864088dd;
 
-// Current version the code writes out.
-static uint32 kVersion = 0x1;
+// Current version the code writes out.  Sets without a source digest
+// are still written as |kVersionWithoutSourceDigest|.
+static uint32 kVersion = 0x2;
+static uint32 kVersionWithoutSourceDigest = 0x1;
 
 typedef struct {
   uint32 magic;
@@ -29,29 +41,70 @@ typedef struct {
   uint32 deltas_size;
 } FileHeader;
 
-// For |std::upper_bound()| to find a prefix w/in a vector of pairs.
-bool PrefixLess(const std::pair<SBPrefix,size_t>& a,
-                const std::pair<SBPrefix,size_t>& b) {
-  return a.first < b.first;
+// Returns |true| if accumulating some leading run of the |count|
+// deltas at |deltas| onto |current| yields exactly |prefix|.  Callers
+// have already checked |current| itself.
+bool DeltasReachPrefix(SBPrefix current,
+                       SBPrefix prefix,
+                       const uint16* deltas,
+                       size_t count) {
+  size_t i = 0;
+#if defined(PREFIX_SET_USE_SSE2)
+  // Compute the running sums of eight deltas at a time in two vectors
+  // of four 32-bit lanes.  Sums can't wrap, because they never pass
+  // the next prefix in the set.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i target = _mm_set1_epi32(static_cast<int>(prefix));
+  for (; i + 8 <= count; i += 8) {
+    const __m128i packed =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas + i));
+    __m128i lo = _mm_unpacklo_epi16(packed, zero);
+    __m128i hi = _mm_unpackhi_epi16(packed, zero);
+    lo = _mm_add_epi32(lo, _mm_slli_si128(lo, 4));
+    lo = _mm_add_epi32(lo, _mm_slli_si128(lo, 8));
+    hi = _mm_add_epi32(hi, _mm_slli_si128(hi, 4));
+    hi = _mm_add_epi32(hi, _mm_slli_si128(hi, 8));
+    lo = _mm_add_epi32(lo, _mm_set1_epi32(static_cast<int>(current)));
+    hi = _mm_add_epi32(hi, _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 3, 3)));
+
+    const __m128i matches = _mm_or_si128(_mm_cmpeq_epi32(lo, target),
+                                         _mm_cmpeq_epi32(hi, target));
+    if (_mm_movemask_epi8(matches))
+      return true;
+
+    current = static_cast<SBPrefix>(_mm_cvtsi128_si32(
+        _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 3, 3))));
+    if (current > prefix)
+      return false;
+  }
+#endif
+
+  // Scan forward accumulating deltas while a match is possible.
+  for (; i < count && current < prefix; ++i)
+    current += deltas[i];
+  return current == prefix;
 }
 
 }  // namespace
 
 namespace safe_browsing {
 
-PrefixSet::PrefixSet(const std::vector<SBPrefix>& sorted_prefixes) {
+PrefixSet::PrefixSet(const std::vector<SBPrefix>& sorted_prefixes)
+    : has_source_digest_(false) {
   if (sorted_prefixes.size()) {
     // Estimate the resulting vector sizes.  There will be strictly
     // more than |min_runs| entries in |index_|, but there generally
     // aren't many forced breaks.
     const size_t min_runs = sorted_prefixes.size() / kMaxRun;
-    index_.reserve(min_runs);
+    index_prefixes_.reserve(min_runs);
+    index_offsets_.reserve(min_runs);
     deltas_.reserve(sorted_prefixes.size() - min_runs);
 
     // Lead with the first prefix.
     SBPrefix prev_prefix = sorted_prefixes[0];
     size_t run_length = 0;
-    index_.push_back(std::make_pair(prev_prefix, deltas_.size()));
+    index_prefixes_.push_back(prev_prefix);
+    index_offsets_.push_back(static_cast<uint32>(deltas_.size()));
 
     for (size_t i = 1; i < sorted_prefixes.size(); ++i) {
       // Skip duplicates.
@@ -67,7 +120,8 @@ PrefixSet::PrefixSet(const std::vector<SBPrefix>& sorted_prefixes) {
       // New index ref if the delta doesn't fit, or if too many
       // consecutive deltas have been encoded.
       if (delta != static_cast<unsigned>(delta16) || run_length >= kMaxRun) {
-        index_.push_back(std::make_pair(sorted_prefixes[i], deltas_.size()));
+        index_prefixes_.push_back(sorted_prefixes[i]);
+        index_offsets_.push_back(static_cast<uint32>(deltas_.size()));
         run_length = 0;
       } else {
         // Continue the run of deltas.
@@ -81,9 +135,8 @@ PrefixSet::PrefixSet(const std::vector<SBPrefix>& sorted_prefixes) {
 
     // Send up some memory-usage stats.  Bits because fractional bytes
     // are weird.
-    const size_t bits_used = index_.size() * sizeof(index_[0]) * CHAR_BIT +
-        deltas_.size() * sizeof(deltas_[0]) * CHAR_BIT;
-    const size_t unique_prefixes = index_.size() + deltas_.size();
+    const size_t bits_used = GetMemoryUsage() * CHAR_BIT;
+    const size_t unique_prefixes = index_prefixes_.size() + deltas_.size();
     static const size_t kMaxBitsPerPrefix = sizeof(SBPrefix) * CHAR_BIT;
     UMA_HISTOGRAM_ENUMERATION("SB2.PrefixSetBitsPerPrefix",
                               bits_used / unique_prefixes,
@@ -91,66 +144,87 @@ PrefixSet::PrefixSet(const std::vector<SBPrefix>& sorted_prefixes) {
   }
 }
 
-PrefixSet::PrefixSet(std::vector<std::pair<SBPrefix,size_t> > *index,
-                     std::vector<uint16> *deltas) {
-  DCHECK(index && deltas);
-  index_.swap(*index);
+PrefixSet::PrefixSet(const std::vector<IndexPair>& index,
+                     std::vector<uint16> *deltas)
+    : has_source_digest_(false) {
+  DCHECK(deltas);
+  index_prefixes_.reserve(index.size());
+  index_offsets_.reserve(index.size());
+  for (size_t i = 0; i < index.size(); ++i) {
+    index_prefixes_.push_back(index[i].first);
+    index_offsets_.push_back(static_cast<uint32>(index[i].second));
+  }
   deltas_.swap(*deltas);
 }
 
 PrefixSet::~PrefixSet() {}
 
+void PrefixSet::SetSourceDigest(const base::MD5Digest& digest) {
+  has_source_digest_ = true;
+  source_digest_ = digest;
+}
+
+bool PrefixSet::GetSourceDigest(base::MD5Digest* digest) const {
+  if (!has_source_digest_)
+    return false;
+  *digest = source_digest_;
+  return true;
+}
+
 bool PrefixSet::Exists(SBPrefix prefix) const {
-  if (index_.empty())
+  if (index_prefixes_.empty())
     return false;
 
-  // Find the first position after |prefix| in |index_|.
-  std::vector<std::pair<SBPrefix,size_t> >::const_iterator
-      iter = std::upper_bound(index_.begin(), index_.end(),
-                              std::pair<SBPrefix,size_t>(prefix, 0),
-                              PrefixLess);
+  // Find the first position after |prefix| in |index_prefixes_|.
+  std::vector<SBPrefix>::const_iterator iter =
+      std::upper_bound(index_prefixes_.begin(), index_prefixes_.end(),
+                       prefix);
 
   // |prefix| comes before anything that's in the set.
-  if (iter == index_.begin())
+  if (iter == index_prefixes_.begin())
     return false;
 
-  // Capture the upper bound of our target entry's deltas.
-  const size_t bound = (iter == index_.end() ? deltas_.size() : iter->second);
-
   // Back up to the entry our target is in.
-  --iter;
+  const size_t index = iter - index_prefixes_.begin() - 1;
 
-  // All prefixes in |index_| are in the set.
-  SBPrefix current = iter->first;
+  // All prefixes in the index are in the set.
+  const SBPrefix current = index_prefixes_[index];
   if (current == prefix)
     return true;
 
-  // Scan forward accumulating deltas while a match is possible.
-  for (size_t di = iter->second; di < bound && current < prefix; ++di) {
-    current += deltas_[di];
-  }
-
-  return current == prefix;
+  // The target entry's deltas run to the next entry's, or to the end.
+  const size_t begin = index_offsets_[index];
+  const size_t bound = (index + 1 < index_offsets_.size() ?
+                        index_offsets_[index + 1] : deltas_.size());
+  if (begin == bound)
+    return false;
+  return DeltasReachPrefix(current, prefix, &deltas_[begin], bound - begin);
 }
 
 void PrefixSet::GetPrefixes(std::vector<SBPrefix>* prefixes) const {
-  prefixes->reserve(index_.size() + deltas_.size());
+  prefixes->reserve(index_prefixes_.size() + deltas_.size());
 
-  for (size_t ii = 0; ii < index_.size(); ++ii) {
-    // The deltas for this |index_| entry run to the next index entry,
-    // or the end of the deltas.
-    const size_t deltas_end =
-        (ii + 1 < index_.size()) ? index_[ii + 1].second : deltas_.size();
+  for (size_t ii = 0; ii < index_prefixes_.size(); ++ii) {
+    // The deltas for this index entry run to the next index entry, or
+    // the end of the deltas.
+    const size_t deltas_end = (ii + 1 < index_offsets_.size()) ?
+        index_offsets_[ii + 1] : deltas_.size();
 
-    SBPrefix current = index_[ii].first;
+    SBPrefix current = index_prefixes_[ii];
     prefixes->push_back(current);
-    for (size_t di = index_[ii].second; di < deltas_end; ++di) {
+    for (size_t di = index_offsets_[ii]; di < deltas_end; ++di) {
       current += deltas_[di];
       prefixes->push_back(current);
     }
   }
 }
 
+size_t PrefixSet::GetMemoryUsage() const {
+  return index_prefixes_.size() * sizeof(index_prefixes_[0]) +
+      index_offsets_.size() * sizeof(index_offsets_[0]) +
+      deltas_.size() * sizeof(deltas_[0]);
+}
+
 // static
 PrefixSet* PrefixSet::LoadFile(const FilePath& filter_name) {
   int64 size_64;
@@ -169,18 +243,24 @@ PrefixSet* PrefixSet::LoadFile(const FilePath& filter_name) {
   if (read != 1)
     return NULL;
 
-  if (header.magic != kMagic || header.version != kVersion)
+  if (header.magic != kMagic ||
+      (header.version != kVersion &&
+       header.version != kVersionWithoutSourceDigest)) {
     return NULL;
+  }
+  const bool has_source_digest = header.version == kVersion;
+  const size_t source_digest_bytes =
+      has_source_digest ? sizeof(MD5Digest) : 0;
 
-  std::vector<std::pair<SBPrefix,size_t> > index;
+  std::vector<IndexPair> index;
   const size_t index_bytes = sizeof(index[0]) * header.index_size;
 
   std::vector<uint16> deltas;
   const size_t deltas_bytes = sizeof(deltas[0]) * header.deltas_size;
 
   // Check for bogus sizes before allocating any space.
-  const size_t expected_bytes =
-      sizeof(header) + index_bytes + deltas_bytes + sizeof(MD5Digest);
+  const size_t expected_bytes = sizeof(header) + source_digest_bytes +
+      index_bytes + deltas_bytes + sizeof(MD5Digest);
   if (static_cast<int64>(expected_bytes) != size_64)
     return NULL;
 
@@ -190,6 +270,16 @@ PrefixSet* PrefixSet::LoadFile(const FilePath& filter_name) {
   base::MD5Update(&context, base::StringPiece(reinterpret_cast<char*>(&header),
                                               sizeof(header)));
 
+  MD5Digest source_digest;
+  if (has_source_digest) {
+    read = fread(&source_digest, sizeof(source_digest), 1, file.get());
+    if (read != 1)
+      return NULL;
+    base::MD5Update(&context,
+                    base::StringPiece(reinterpret_cast<char*>(&source_digest),
+                                      sizeof(source_digest)));
+  }
+
   // Read the index vector.  Herb Sutter indicates that vectors are
   // guaranteed to be contiuguous, so reading to where element 0 lives
   // is valid.
@@ -225,19 +315,22 @@ PrefixSet* PrefixSet::LoadFile(const FilePath& filter_name) {
   if (0 != memcmp(&file_digest, &calculated_digest, sizeof(file_digest)))
     return NULL;
 
-  // Steals contents of |index| and |deltas| via swap().
-  return new PrefixSet(&index, &deltas);
+  // Steals contents of |deltas| via swap().
+  PrefixSet* prefix_set = new PrefixSet(index, &deltas);
+  if (has_source_digest)
+    prefix_set->SetSourceDigest(source_digest);
+  return prefix_set;
 }
 
 bool PrefixSet::WriteFile(const FilePath& filter_name) const {
   FileHeader header;
   header.magic = kMagic;
-  header.version = kVersion;
-  header.index_size = static_cast<uint32>(index_.size());
+  header.version = has_source_digest_ ? kVersion : kVersionWithoutSourceDigest;
+  header.index_size = static_cast<uint32>(index_prefixes_.size());
   header.deltas_size = static_cast<uint32>(deltas_.size());
 
   // Sanity check that the 32-bit values never mess things up.
-  if (static_cast<size_t>(header.index_size) != index_.size() ||
+  if (static_cast<size_t>(header.index_size) != index_prefixes_.size() ||
       static_cast<size_t>(header.deltas_size) != deltas_.size()) {
     NOTREACHED();
     return false;
@@ -258,17 +351,31 @@ bool PrefixSet::WriteFile(const FilePath& filter_name) const {
   base::MD5Update(&context, base::StringPiece(reinterpret_cast<char*>(&header),
                                               sizeof(header)));
 
+  if (has_source_digest_) {
+    written = fwrite(&source_digest_, sizeof(source_digest_), 1, file.get());
+    if (written != 1)
+      return false;
+    base::MD5Update(&context,
+                    base::StringPiece(
+                        reinterpret_cast<const char*>(&source_digest_),
+                        sizeof(source_digest_)));
+  }
+
   // As for reads, the standard guarantees the ability to access the
-  // contents of the vector by a pointer to an element.
-  if (index_.size()) {
-    const size_t index_bytes = sizeof(index_[0]) * index_.size();
-    written = fwrite(&(index_[0]), sizeof(index_[0]), index_.size(),
-                     file.get());
-    if (written != index_.size())
+  // contents of the vector by a pointer to an element.  The index is
+  // written as pairs to keep the original file format.
+  if (index_prefixes_.size()) {
+    std::vector<IndexPair> index;
+    index.reserve(index_prefixes_.size());
+    for (size_t i = 0; i < index_prefixes_.size(); ++i)
+      index.push_back(IndexPair(index_prefixes_[i], index_offsets_[i]));
+    const size_t index_bytes = sizeof(index[0]) * index.size();
+    written = fwrite(&(index[0]), sizeof(index[0]), index.size(), file.get());
+    if (written != index.size())
       return false;
     base::MD5Update(&context,
                     base::StringPiece(
-                        reinterpret_cast<const char*>(&(index_[0])),
+                        reinterpret_cast<const char*>(&(index[0])),
                         index_bytes));
   }
 
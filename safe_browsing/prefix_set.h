@@ -9,11 +9,16 @@
 //
 // For example, the sequence {20, 25, 41, 65432, 150000, 160000} would
 // be stored as:
-//  A pair {20, 0} in |index_|.
+//  20 in |index_prefixes_| and 0 in |index_offsets_|.
 //  5, 16, 65391 in |deltas_|.
-//  A pair {150000, 3} in |index_|.
+//  150000 in |index_prefixes_| and 3 in |index_offsets_|.
 //  10000 in |deltas_|.
-// |index_.size()| will be 2, |deltas_.size()| will be 4.
+// |index_prefixes_.size()| will be 2, |deltas_.size()| will be 4.
+//
+// The index is kept as two parallel arrays so that the binary search in
+// |Exists()| only touches the densely packed prefixes, sixteen to a
+// cache line.  Where SSE2 is available, the deltas of a run are summed
+// and compared eight at a time.
 //
 // This structure is intended for storage of sparse uniform sets of
 // prefixes of a certain size.  As of this writing, my safe-browsing
@@ -40,17 +45,25 @@
 // The on-disk format looks like:
 //         4 byte magic number
 //         4 byte version number
-//         4 byte |index_.size()|
+//         4 byte |index_prefixes_.size()|
 //         4 byte |deltas_.size()|
-//     n * 8 byte |&index_[0]..&index_[n]|
+//        16 byte source digest (version 2 only)
+//     n * 8 byte std::pair<SBPrefix,size_t> of prefix and offset
 //     m * 2 byte |&deltas_[0]..&deltas_[m]|
 //        16 byte digest
+// The index pairs are the layout the index had in memory when the format
+// was defined, so their size is sizeof(std::pair<SBPrefix,size_t>).
+// Version 2 is written when the set has a source digest, version 1
+// otherwise.
 
 #ifndef CHROME_BROWSER_SAFE_BROWSING_PREFIX_SET_H_
 #define CHROME_BROWSER_SAFE_BROWSING_PREFIX_SET_H_
 
+#include <utility>
 #include <vector>
 
+#include "base/gtest_prod_util.h"
+#include "base/md5.h"
 #include "chrome/browser/safe_browsing/safe_browsing_util.h"
 
 class FilePath;
@@ -73,28 +86,49 @@ class PrefixSet {
   // |prefixes|.  Prefixes will be added in sorted order.
   void GetPrefixes(std::vector<SBPrefix>* prefixes) const;
 
+  // An opaque digest of the data the set was built from, which is
+  // persisted with the set so that callers can tell whether a loaded
+  // set is stale.  |GetSourceDigest()| returns |false| if there is
+  // none.
+  void SetSourceDigest(const base::MD5Digest& digest);
+  bool GetSourceDigest(base::MD5Digest* digest) const;
+
  private:
+  FRIEND_TEST_ALL_PREFIXES(PrefixSetPerfTest, Lookup);
+
   // Maximum number of consecutive deltas to encode before generating
   // a new index entry.  This helps keep the worst-case performance
   // for |Exists()| under control.
   static const size_t kMaxRun = 100;
 
-  // Helper for |LoadFile()|.  Steals the contents of |index| and
-  // |deltas| using |swap()|.
-  PrefixSet(std::vector<std::pair<SBPrefix,size_t> > *index,
+  // The on-disk representation of an index entry.
+  typedef std::pair<SBPrefix,size_t> IndexPair;
+
+  // Helper for |LoadFile()|.  Splits |index| into the index arrays
+  // and steals the contents of |deltas| using |swap()|.
+  PrefixSet(const std::vector<IndexPair>& index,
             std::vector<uint16> *deltas);
 
-  // Top-level index of prefix to offset in |deltas_|.  Each pair
-  // indicates a base prefix and where the deltas from that prefix
-  // begin in |deltas_|.  The deltas for a pair end at the next pair's
-  // index into |deltas_|.
-  std::vector<std::pair<SBPrefix,size_t> > index_;
+  // Returns the number of bytes used to hold the set in memory.
+  size_t GetMemoryUsage() const;
+
+  // Top-level index of prefix to offset in |deltas_|.  Each entry in
+  // |index_prefixes_| is a base prefix, and the same entry in
+  // |index_offsets_| is where the deltas from that prefix begin in
+  // |deltas_|.  The deltas for an entry end at the next entry's
+  // offset.
+  std::vector<SBPrefix> index_prefixes_;
+  std::vector<uint32> index_offsets_;
 
   // Deltas which are added to the prefix in |index_| to generate
   // prefixes.  Deltas are only valid between consecutive items from
   // |index_|, or the end of |deltas_| for the last |index_| pair.
   std::vector<uint16> deltas_;
 
+  // See |SetSourceDigest()|.
+  bool has_source_digest_;
+  base::MD5Digest source_digest_;
+
   DISALLOW_COPY_AND_ASSIGN(PrefixSet);
 };
 
@@ -0,0 +1,137 @@
+// Copyright (c) 2012 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "chrome/browser/safe_browsing/prefix_set.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "base/perftimer.h"
+#include "base/rand_util.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace safe_browsing {
+
+namespace {
+
+// Roughly the number of add prefixes in a browse database.
+const size_t kPrefixCount = 650000;
+
+// The number of lookups timed for each of hits and misses.
+const size_t kLookupCount = 2000000;
+
+// The layout |PrefixSet| had before its index was split into parallel
+// arrays, kept to compare against.
+class PairIndexPrefixSet {
+ public:
+  explicit PairIndexPrefixSet(const std::vector<SBPrefix>& sorted_prefixes) {
+    SBPrefix prev_prefix = sorted_prefixes[0];
+    size_t run_length = 0;
+    index_.push_back(std::make_pair(prev_prefix, deltas_.size()));
+    for (size_t i = 1; i < sorted_prefixes.size(); ++i) {
+      if (sorted_prefixes[i] == prev_prefix)
+        continue;
+      const unsigned delta = sorted_prefixes[i] - prev_prefix;
+      const uint16 delta16 = static_cast<uint16>(delta);
+      if (delta != static_cast<unsigned>(delta16) || run_length >= 100) {
+        index_.push_back(std::make_pair(sorted_prefixes[i], deltas_.size()));
+        run_length = 0;
+      } else {
+        deltas_.push_back(delta16);
+        ++run_length;
+      }
+      prev_prefix = sorted_prefixes[i];
+    }
+  }
+
+  bool Exists(SBPrefix prefix) const {
+    std::vector<std::pair<SBPrefix,size_t> >::const_iterator iter =
+        std::upper_bound(index_.begin(), index_.end(),
+                         std::pair<SBPrefix,size_t>(prefix, 0), PrefixLess);
+    if (iter == index_.begin())
+      return false;
+    const size_t bound = (iter == index_.end() ? deltas_.size() : iter->second);
+    --iter;
+    SBPrefix current = iter->first;
+    for (size_t di = iter->second; di < bound && current < prefix; ++di)
+      current += deltas_[di];
+    return current == prefix;
+  }
+
+  size_t GetMemoryUsage() const {
+    return index_.size() * sizeof(index_[0]) +
+        deltas_.size() * sizeof(deltas_[0]);
+  }
+
+ private:
+  static bool PrefixLess(const std::pair<SBPrefix,size_t>& a,
+                         const std::pair<SBPrefix,size_t>& b) {
+    return a.first < b.first;
+  }
+
+  std::vector<std::pair<SBPrefix,size_t> > index_;
+  std::vector<uint16> deltas_;
+};
+
+// Looks up every prefix in |lookups| in |set| and logs the rate under
+// |name|.  Returns the number found.
+template <class Set>
+size_t TimeLookups(const Set& set,
+                   const std::vector<SBPrefix>& lookups,
+                   const char* name) {
+  size_t found = 0;
+  PerfTimer timer;
+  for (size_t i = 0; i < lookups.size(); ++i) {
+    if (set.Exists(lookups[i]))
+      ++found;
+  }
+  const double seconds = timer.Elapsed().InSecondsF();
+  LogPerfResult(name, lookups.size() / seconds, "lookups/s");
+  return found;
+}
+
+}  // namespace
+
+class PrefixSetPerfTest : public testing::Test {
+};
+
+// Compares the memory used by and the lookup rate of the current and
+// the previous layouts on a browse-sized set of random prefixes.
+TEST_F(PrefixSetPerfTest, Lookup) {
+  std::vector<SBPrefix> prefixes;
+  for (size_t i = 0; i < kPrefixCount; ++i)
+    prefixes.push_back(static_cast<SBPrefix>(base::RandUint64()));
+  std::sort(prefixes.begin(), prefixes.end());
+  prefixes.erase(std::unique(prefixes.begin(), prefixes.end()),
+                 prefixes.end());
+
+  std::vector<SBPrefix> hits;
+  std::vector<SBPrefix> misses;
+  for (size_t i = 0; i < kLookupCount; ++i) {
+    hits.push_back(prefixes[base::RandGenerator(prefixes.size())]);
+    misses.push_back(static_cast<SBPrefix>(base::RandUint64()));
+  }
+
+  PrefixSet prefix_set(prefixes);
+  PairIndexPrefixSet pair_index_set(prefixes);
+  LogPerfResult("PrefixSet_bytes_per_prefix",
+                static_cast<double>(prefix_set.GetMemoryUsage()) /
+                    prefixes.size(),
+                "bytes");
+  LogPerfResult("PrefixSet_pair_index_bytes_per_prefix",
+                static_cast<double>(pair_index_set.GetMemoryUsage()) /
+                    prefixes.size(),
+                "bytes");
+
+  EXPECT_EQ(hits.size(),
+            TimeLookups(prefix_set, hits, "PrefixSet_hits"));
+  EXPECT_EQ(hits.size(),
+            TimeLookups(pair_index_set, hits, "PrefixSet_pair_index_hits"));
+  EXPECT_EQ(TimeLookups(pair_index_set, misses,
+                        "PrefixSet_pair_index_misses"),
+            TimeLookups(prefix_set, misses, "PrefixSet_misses"));
+}
+
+}  // namespace safe_browsing
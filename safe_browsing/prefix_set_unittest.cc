@@ -306,6 +306,34 @@ TEST_F(PrefixSetTest, EdgeCases) {
   }
 }
 
+// Runs whose lengths aren't a multiple of the eight deltas checked at
+// a time, with small deltas so that neighbors of each prefix fall
+// inside the run, and runs ending right at the top of the range.
+TEST_F(PrefixSetTest, ShortDeltaRuns) {
+  std::vector<SBPrefix> prefixes;
+  SBPrefix prefix = 1000;
+  for (int run_length = 1; run_length < 40; ++run_length) {
+    for (int i = 0; i < run_length; ++i) {
+      prefix += 2 + i % 3;
+      prefixes.push_back(prefix);
+    }
+    // Break the run with a delta that doesn't fit in 16 bits.
+    prefix += 1 << 17;
+  }
+  prefix = kint32max - 20;
+  for (int i = 0; i < 10; ++i) {
+    prefixes.push_back(prefix);
+    prefix += 2;
+  }
+
+  safe_browsing::PrefixSet prefix_set(prefixes);
+  for (size_t i = 0; i < prefixes.size(); ++i) {
+    EXPECT_TRUE(prefix_set.Exists(prefixes[i]));
+    EXPECT_FALSE(prefix_set.Exists(prefixes[i] + 1));
+  }
+  EXPECT_FALSE(prefix_set.Exists(kint32max));
+}
+
 // Test writing a prefix set to disk and reading it back in.
 TEST_F(PrefixSetTest, ReadWrite) {
   FilePath filename;
@@ -349,6 +377,38 @@ TEST_F(PrefixSetTest, ReadWrite) {
   }
 }
 
+// Test that the source digest is written out and read back in, and
+// that a set without one still round-trips.
+TEST_F(PrefixSetTest, SourceDigest) {
+  FilePath filename;
+  ASSERT_TRUE(GetPrefixSetFile(&filename));
+
+  scoped_ptr<safe_browsing::PrefixSet>
+      prefix_set(safe_browsing::PrefixSet::LoadFile(filename));
+  ASSERT_TRUE(prefix_set.get());
+  base::MD5Digest digest;
+  EXPECT_FALSE(prefix_set->GetSourceDigest(&digest));
+
+  base::MD5Digest source_digest;
+  base::MD5Sum("source", 6, &source_digest);
+  safe_browsing::PrefixSet prefix_set_to_write(shared_prefixes_);
+  prefix_set_to_write.SetSourceDigest(source_digest);
+  ASSERT_TRUE(prefix_set_to_write.WriteFile(filename));
+
+  prefix_set.reset(safe_browsing::PrefixSet::LoadFile(filename));
+  ASSERT_TRUE(prefix_set.get());
+  CheckPrefixes(*prefix_set, shared_prefixes_);
+  ASSERT_TRUE(prefix_set->GetSourceDigest(&digest));
+  EXPECT_EQ(0, memcmp(&digest, &source_digest, sizeof(digest)));
+
+  // A change to the digest is caught by the checksum.
+  file_util::ScopedFILE file(file_util::OpenFile(filename, "r+b"));
+  IncrementIntAt(file.get(), kPayloadOffset, 1);
+  file.reset();
+  prefix_set.reset(safe_browsing::PrefixSet::LoadFile(filename));
+  EXPECT_FALSE(prefix_set.get());
+}
+
 // Check that |CleanChecksum()| makes an acceptable checksum.
 TEST_F(PrefixSetTest, CorruptionHelpers) {
   FilePath filename;
@@ -11,6 +11,7 @@
 #include "base/file_util.h"
 #include "base/message_loop.h"
 #include "base/metrics/histogram.h"
+#include "base/md5.h"
 #include "base/metrics/stats_counters.h"
 #include "base/process_util.h"
 #include "base/time.h"
@@ -1112,28 +1113,72 @@ void SafeBrowsingDatabaseNew::UpdateBrowseStore() {
 
   const base::TimeTicks before = base::TimeTicks::Now();
 
+  // The current prefix set can only be extended if it was built from
+  // exactly the data in the store.  It may have been loaded from a
+  // file written before a crash lost a later update's prefix set.
+  // Since only this thread changes |prefix_set_|, there is no need to
+  // lock.
+  bool prefix_set_current = false;
+  base::MD5Digest prefix_set_digest, store_digest;
+  if (prefix_set_.get() &&
+      prefix_set_->GetSourceDigest(&prefix_set_digest) &&
+      browse_store_->GetStateDigest(&store_digest)) {
+    prefix_set_current = !memcmp(&prefix_set_digest, &store_digest,
+                                 sizeof(store_digest));
+  }
+
   SBAddPrefixes add_prefixes;
   std::vector<SBAddFullHash> add_full_hashes;
-  if (!browse_store_->FinishUpdate(pending_add_hashes, prefix_miss_cache_,
-                                   &add_prefixes, &add_full_hashes)) {
+  bool is_delta = false;
+  if (!browse_store_->FinishUpdateWithDelta(pending_add_hashes,
+                                            prefix_miss_cache_,
+                                            &add_prefixes, &add_full_hashes,
+                                            &is_delta)) {
     RecordFailure(FAILURE_BROWSE_DATABASE_UPDATE_FINISH);
     return;
   }
 
+  // If the store only returned the new adds, extend the current prefix
+  // set with them rather than reading back every prefix in the store.
+  // The full hashes are few, so those are simply re-read.  The store
+  // already holds the new adds, so anything re-read replaces them
+  // rather than adding to them.
+  std::vector<SBPrefix> prefixes;
+  if (is_delta) {
+    if (prefix_set_current) {
+      prefix_set_->GetPrefixes(&prefixes);
+    } else {
+      add_prefixes.clear();
+      if (!browse_store_->GetAddPrefixes(&add_prefixes)) {
+        RecordFailure(FAILURE_BROWSE_DATABASE_DELTA_READ);
+        return;
+      }
+    }
+    add_full_hashes.clear();
+    if (!browse_store_->GetAddFullHashes(&add_full_hashes)) {
+      RecordFailure(FAILURE_BROWSE_DATABASE_DELTA_READ);
+      return;
+    }
+  }
+  const size_t sorted_count = prefixes.size();
+
   // TODO(shess): If |add_prefixes| were sorted by the prefix, it
   // could be passed directly to |PrefixSet()|, removing the need for
   // |prefixes|.  For now, |prefixes| is useful while debugging
   // things.
-  std::vector<SBPrefix> prefixes;
-  prefixes.reserve(add_prefixes.size());
+  prefixes.reserve(sorted_count + add_prefixes.size());
   for (SBAddPrefixes::const_iterator iter = add_prefixes.begin();
        iter != add_prefixes.end(); ++iter) {
     prefixes.push_back(iter->prefix);
   }
 
-  std::sort(prefixes.begin(), prefixes.end());
+  std::sort(prefixes.begin() + sorted_count, prefixes.end());
+  std::inplace_merge(prefixes.begin(), prefixes.begin() + sorted_count,
+                     prefixes.end());
   scoped_ptr<safe_browsing::PrefixSet>
       prefix_set(new safe_browsing::PrefixSet(prefixes));
+  if (browse_store_->GetStateDigest(&store_digest))
+    prefix_set->SetSourceDigest(store_digest);
 
   // This needs to be in sorted order by prefix for efficient access.
   std::sort(add_full_hashes.begin(), add_full_hashes.end(),
@@ -1156,8 +1201,15 @@ void SafeBrowsingDatabaseNew::UpdateBrowseStore() {
 
   DVLOG(1) << "SafeBrowsingDatabaseImpl built prefix set in "
            << (base::TimeTicks::Now() - before).InMilliseconds()
-           << " ms total.  prefix count: " << add_prefixes.size();
-  UMA_HISTOGRAM_LONG_TIMES("SB2.BuildFilter", base::TimeTicks::Now() - before);
+           << " ms total.  prefix count: " << prefixes.size()
+           << (is_delta ? " (delta)" : "");
+  if (is_delta) {
+    UMA_HISTOGRAM_LONG_TIMES("SB2.BuildFilterDelta",
+                             base::TimeTicks::Now() - before);
+  } else {
+    UMA_HISTOGRAM_LONG_TIMES("SB2.BuildFilter",
+                             base::TimeTicks::Now() - before);
+  }
 
   // Persist the prefix set to disk.  Since only this thread changes
   // |prefix_set_|, there is no need to lock.
@@ -196,6 +196,7 @@ class SafeBrowsingDatabase {
     FAILURE_DATABASE_PREFIX_SET_READ,
     FAILURE_DATABASE_PREFIX_SET_WRITE,
     FAILURE_DATABASE_PREFIX_SET_DELETE,
+    FAILURE_BROWSE_DATABASE_DELTA_READ,
 
     // Memory space for histograms is determined by the max.  ALWAYS
     // ADD NEW VALUES BEFORE THIS ONE.
@@ -257,6 +258,7 @@ class SafeBrowsingDatabaseNew : public SafeBrowsingDatabase {
  private:
   friend class SafeBrowsingDatabaseTest;
   FRIEND_TEST_ALL_PREFIXES(SafeBrowsingDatabaseTest, HashCaching);
+  FRIEND_TEST_ALL_PREFIXES(SafeBrowsingDatabaseTest, DeltaUpdateFullHashes);
 
   // A SafeBrowsing whitelist contains a list of whitelisted full-hashes (stored
   // in a sorted vector) as well as a boolean flag indicating whether all
@@ -64,6 +64,18 @@ void InsertAddChunkHostPrefixUrl(SBChunk* chunk,
                                 Sha256Prefix(url));
 }
 
+// Appends |count| AddChunkHosts with arbitrary distinct prefixes to
+// chunk, to give the browse store a base which is large relative to
+// later updates.
+void InsertAddChunkFillerPrefixes(SBChunk* chunk,
+                                  int chunk_number,
+                                  size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    const SBPrefix prefix = static_cast<SBPrefix>(0x10000 + i);
+    InsertAddChunkHostPrefixValue(chunk, chunk_number, prefix, prefix);
+  }
+}
+
 // Same as InsertAddChunkHostPrefixUrl, but with full hashes.
 void InsertAddChunkHostFullHashes(SBChunk* chunk,
                                   int chunk_number,
@@ -1645,3 +1657,120 @@ TEST_F(SafeBrowsingDatabaseTest, FilterFile) {
       GURL("http://www.good.com/goodware.html"),
       &matching_list, &prefix_hits, &full_hashes, now));
 }
+
+// Add-only updates are committed as deltas to the browse store.  Each full
+// hash they add must be held, and returned by lookups, only once.
+TEST_F(SafeBrowsingDatabaseTest, DeltaUpdateFullHashes) {
+  std::vector<SBListChunkRanges> lists;
+  SBChunkList chunks;
+  SBChunk chunk;
+
+  // Prime the database with a full update.  The delta is merged into
+  // the main file once it is large relative to it, so the base must be
+  // much larger than the updates below.
+  EXPECT_TRUE(database_->UpdateStarted(&lists));
+  InsertAddChunkHostPrefixUrl(&chunk, 1, "www.evil.com/",
+                              "www.evil.com/malware.html");
+  InsertAddChunkFillerPrefixes(&chunk, 1, 32);
+  chunks.push_back(chunk);
+  database_->InsertChunks(safe_browsing_util::kMalwareList, chunks);
+  database_->UpdateFinished(true);
+  EXPECT_TRUE(database_->full_browse_hashes_.empty());
+
+  const FilePath delta_filename = SafeBrowsingStoreFile::DeltaFileForFilename(
+      database_->BrowseDBFilename(database_filename_));
+  EXPECT_FALSE(file_util::PathExists(delta_filename));
+  int64 delta_size = 0;
+
+  const char* const kUrls[] = {
+    "www.evil.com/phishing.html",
+    "www.evil.com/badware.html",
+  };
+  for (size_t i = 0; i < arraysize(kUrls); ++i) {
+    SBChunk full_hash_chunk;
+    InsertAddChunkHostFullHashes(&full_hash_chunk, 2 + i, "www.evil.com/",
+                                 kUrls[i]);
+    chunks.clear();
+    chunks.push_back(full_hash_chunk);
+    EXPECT_TRUE(database_->UpdateStarted(&lists));
+    database_->InsertChunks(safe_browsing_util::kMalwareList, chunks);
+    database_->UpdateFinished(true);
+
+    // Each update was appended to the delta file.
+    const int64 previous_size = delta_size;
+    ASSERT_TRUE(file_util::GetFileSize(delta_filename, &delta_size));
+    EXPECT_GT(delta_size, previous_size);
+
+    EXPECT_EQ(i + 1, database_->full_browse_hashes_.size());
+  }
+
+  for (size_t i = 0; i < arraysize(kUrls); ++i) {
+    std::string listname;
+    std::vector<SBPrefix> prefixes;
+    std::vector<SBFullHashResult> full_hashes;
+    EXPECT_TRUE(database_->ContainsBrowseUrl(
+        GURL(std::string("http://") + kUrls[i]),
+        &listname, &prefixes, &full_hashes, Time::Now()));
+    ASSERT_EQ(1U, full_hashes.size());
+    EXPECT_TRUE(SBFullHashEq(full_hashes[0].hash, Sha256Hash(kUrls[i])));
+  }
+}
+
+// A delta update must not extend a prefix set which was built before
+// the last update, as is left on disk if a crash comes between
+// committing an update and writing out its prefix set.
+TEST_F(SafeBrowsingDatabaseTest, DeltaUpdateStalePrefixSet) {
+  std::vector<SBListChunkRanges> lists;
+  SBChunkList chunks;
+  SBChunk chunk;
+
+  EXPECT_TRUE(database_->UpdateStarted(&lists));
+  InsertAddChunkHostPrefixUrl(&chunk, 1, "www.evil.com/",
+                              "www.evil.com/malware.html");
+  InsertAddChunkFillerPrefixes(&chunk, 1, 32);
+  chunks.push_back(chunk);
+  database_->InsertChunks(safe_browsing_util::kMalwareList, chunks);
+  database_->UpdateFinished(true);
+
+  const FilePath browse_filename =
+      database_->BrowseDBFilename(database_filename_);
+  const FilePath filter_file =
+      database_->PrefixSetForFilename(browse_filename);
+  const FilePath stale_filter_file =
+      temp_dir_.path().AppendASCII("StalePrefixSet");
+  ASSERT_TRUE(file_util::CopyFile(filter_file, stale_filter_file));
+
+  const char* const kUrls[] = {
+    "www.evil.com/phishing.html",
+    "www.evil.com/badware.html",
+  };
+  for (size_t i = 0; i < arraysize(kUrls); ++i) {
+    SBChunk delta_chunk;
+    InsertAddChunkHostPrefixUrl(&delta_chunk, 2 + i, "www.evil.com/",
+                                kUrls[i]);
+    chunks.clear();
+    chunks.push_back(delta_chunk);
+    EXPECT_TRUE(database_->UpdateStarted(&lists));
+    database_->InsertChunks(safe_browsing_util::kMalwareList, chunks);
+    database_->UpdateFinished(true);
+    ASSERT_TRUE(file_util::PathExists(
+        SafeBrowsingStoreFile::DeltaFileForFilename(browse_filename)));
+
+    // Lose the prefix set written by the first update.
+    if (i == 0) {
+      database_.reset();
+      ASSERT_TRUE(file_util::CopyFile(stale_filter_file, filter_file));
+      database_.reset(new SafeBrowsingDatabaseNew);
+      database_->Init(database_filename_);
+    }
+  }
+
+  for (size_t i = 0; i < arraysize(kUrls); ++i) {
+    std::string listname;
+    std::vector<SBPrefix> prefixes;
+    std::vector<SBFullHashResult> full_hashes;
+    EXPECT_TRUE(database_->ContainsBrowseUrl(
+        GURL(std::string("http://") + kUrls[i]),
+        &listname, &prefixes, &full_hashes, Time::Now()));
+  }
+}
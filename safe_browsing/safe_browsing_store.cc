@@ -214,3 +214,19 @@ void SBProcessSubs(SBAddPrefixes* add_prefixes,
   RemoveDeleted(add_full_hashes, add_chunks_deleted);
   RemoveDeleted(sub_full_hashes, sub_chunks_deleted);
 }
+
+bool SafeBrowsingStore::GetStateDigest(base::MD5Digest* digest) {
+  return false;
+}
+
+bool SafeBrowsingStore::FinishUpdateWithDelta(
+    const std::vector<SBAddFullHash>& pending_adds,
+    const std::set<SBPrefix>& prefix_misses,
+    SBAddPrefixes* add_prefixes_result,
+    std::vector<SBAddFullHash>* add_full_hashes_result,
+    bool* is_delta) {
+  DCHECK(is_delta);
+  *is_delta = false;
+  return FinishUpdate(pending_adds, prefix_misses,
+                      add_prefixes_result, add_full_hashes_result);
+}
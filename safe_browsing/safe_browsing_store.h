@@ -16,6 +16,10 @@
 
 class FilePath;
 
+namespace base {
+struct MD5Digest;
+}
+
 // SafeBrowsingStore provides a storage abstraction for the
 // safe-browsing data used to build the bloom filter.  The items
 // stored are:
@@ -177,6 +181,12 @@ class SafeBrowsingStore {
   virtual bool GetAddFullHashes(
       std::vector<SBAddFullHash>* add_full_hashes) = 0;
 
+  // Get a digest which changes whenever the committed data changes, so
+  // that data derived from the store can be checked against it.
+  // Returns false if the store cannot provide one, which the default
+  // implementation never does.
+  virtual bool GetStateDigest(base::MD5Digest* digest);
+
   // Start an update.  None of the following methods should be called
   // unless this returns true.  If this returns true, the update
   // should be terminated by FinishUpdate() or CancelUpdate().
@@ -239,6 +249,21 @@ class SafeBrowsingStore {
       SBAddPrefixes* add_prefixes_result,
       std::vector<SBAddFullHash>* add_full_hashes_result) = 0;
 
+  // Like FinishUpdate(), but allows a store which can do so to commit
+  // an update which only adds data as a delta against its existing
+  // data, without rewriting all of it.  In that case |*is_delta| is
+  // set to true and |add_prefixes_result| and |add_full_hashes_result|
+  // contain only the items added by this update, which the caller
+  // must merge into whatever it built from earlier results.
+  // Otherwise |*is_delta| is false and the results are as for
+  // FinishUpdate().  The default implementation never uses deltas.
+  virtual bool FinishUpdateWithDelta(
+      const std::vector<SBAddFullHash>& pending_adds,
+      const std::set<SBPrefix>& prefix_misses,
+      SBAddPrefixes* add_prefixes_result,
+      std::vector<SBAddFullHash>* add_full_hashes_result,
+      bool* is_delta);
+
   // Cancel the update in process and remove any temporary disk
   // storage, leaving the original data unmodified.
   virtual bool CancelUpdate() = 0;
@@ -28,6 +28,25 @@ struct ChunkHeader {
   uint32 add_hash_count, sub_hash_count;
 };
 
+const int32 kDeltaMagic = 0x600D71FD;
+const int32 kDeltaVersion = 1;
+
+// Updates are only committed as deltas while the delta file holds
+// fewer than 1/kDeltaCompactionRatio as many add prefixes as the main
+// file.  Past that the next update folds the delta back in.
+const size_t kDeltaCompactionRatio = 8;
+
+// Header at the front of the delta file.
+struct DeltaHeader {
+  int32 magic, version;
+  base::MD5Digest main_digest;
+};
+
+// Header for each segment in the delta file.
+struct DeltaSegmentHeader {
+  uint32 add_chunk_count, add_prefix_count, add_hash_count;
+};
+
 // Rewind the file.  Using fseek(2) because rewind(3) errors are
 // weird.
 bool FileRewind(FILE* fp) {
@@ -167,6 +186,89 @@ bool ReadAndVerifyHeader(const FilePath& filename,
   return true;
 }
 
+// Read the checksum at the end of the main file |fp| into |digest|.
+bool ReadMainDigest(FILE* fp, base::MD5Digest* digest) {
+  const long offset = static_cast<long>(sizeof(*digest));
+  if (fseek(fp, -offset, SEEK_END) != 0)
+    return false;
+  return ReadItem(digest, fp, NULL);
+}
+
+// Read the segments of the delta file |filename| which extend the main
+// file with checksum |main_digest|, appending their data to the
+// non-NULL outputs.  Reading stops at the first segment which is
+// truncated or fails its checksum.  Returns the size of the valid part
+// of the file, or 0 if there is no usable delta.
+int64 ReadDeltaFile(const FilePath& filename,
+                    const base::MD5Digest& main_digest,
+                    std::set<int32>* add_chunks,
+                    SBAddPrefixes* add_prefixes,
+                    std::vector<SBAddFullHash>* add_full_hashes) {
+  file_util::ScopedFILE file(file_util::OpenFile(filename, "rb"));
+  if (file.get() == NULL)
+    return 0;
+
+  int64 size = 0;
+  if (!file_util::GetFileSize(filename, &size))
+    return 0;
+
+  DeltaHeader header;
+  if (!ReadItem(&header, file.get(), NULL) ||
+      header.magic != kDeltaMagic || header.version != kDeltaVersion ||
+      0 != memcmp(&header.main_digest, &main_digest, sizeof(main_digest)))
+    return 0;
+
+  int64 valid_size = sizeof(header);
+  while (true) {
+    base::MD5Context context;
+    base::MD5Init(&context);
+
+    DeltaSegmentHeader segment;
+    if (!ReadItem(&segment, file.get(), &context))
+      break;
+
+    int64 expected_size = valid_size + sizeof(segment);
+    expected_size += segment.add_chunk_count * sizeof(int32);
+    expected_size += segment.add_prefix_count * sizeof(SBAddPrefix);
+    expected_size += segment.add_hash_count * sizeof(SBAddFullHash);
+    expected_size += sizeof(base::MD5Digest);
+    if (expected_size > size)
+      break;
+
+    std::vector<int32> segment_chunks;
+    SBAddPrefixes segment_prefixes;
+    std::vector<SBAddFullHash> segment_hashes;
+    if (!ReadToContainer(&segment_chunks, segment.add_chunk_count,
+                         file.get(), &context) ||
+        !ReadToContainer(&segment_prefixes, segment.add_prefix_count,
+                         file.get(), &context) ||
+        !ReadToContainer(&segment_hashes, segment.add_hash_count,
+                         file.get(), &context))
+      break;
+
+    base::MD5Digest calculated_digest;
+    base::MD5Final(&calculated_digest, &context);
+    base::MD5Digest file_digest;
+    if (!ReadItem(&file_digest, file.get(), NULL) ||
+        0 != memcmp(&file_digest, &calculated_digest, sizeof(file_digest)))
+      break;
+
+    if (add_chunks)
+      add_chunks->insert(segment_chunks.begin(), segment_chunks.end());
+    if (add_prefixes) {
+      add_prefixes->insert(add_prefixes->end(),
+                           segment_prefixes.begin(), segment_prefixes.end());
+    }
+    if (add_full_hashes) {
+      add_full_hashes->insert(add_full_hashes->end(),
+                              segment_hashes.begin(), segment_hashes.end());
+    }
+    valid_size = expected_size;
+  }
+
+  return valid_size;
+}
+
 }  // namespace
 
 // static
@@ -204,6 +306,9 @@ SafeBrowsingStoreFile::SafeBrowsingStoreFile()
     : chunks_written_(0),
       file_(NULL),
       empty_(false),
+      sub_chunks_changed_(false),
+      chunks_have_subs_(false),
+      delta_size_(0),
       corruption_seen_(false) {
 }
 
@@ -232,6 +337,13 @@ bool SafeBrowsingStoreFile::Delete() {
     return false;
   }
 
+  const FilePath delta_filename = DeltaFileForFilename(filename_);
+  if (!file_util::Delete(delta_filename, false) &&
+      file_util::PathExists(delta_filename)) {
+    NOTREACHED();
+    return false;
+  }
+
   // With SQLite support gone, one way to get to this code is if the
   // existing file is a SQLite file.  Make sure the journal file is
   // also removed.
@@ -332,6 +444,11 @@ bool SafeBrowsingStoreFile::GetAddPrefixes(SBAddPrefixes* add_prefixes) {
   if (!ReadToContainer(add_prefixes, header.add_prefix_count, file.get(), NULL))
     return false;
 
+  base::MD5Digest main_digest;
+  if (!ReadMainDigest(file.get(), &main_digest))
+    return false;
+  ReadDeltaFile(DeltaFileForFilename(filename_), main_digest,
+                NULL, add_prefixes, NULL);
   return true;
 }
 
@@ -354,10 +471,43 @@ bool SafeBrowsingStoreFile::GetAddFullHashes(
   if (!FileSkip(offset, file.get()))
     return false;
 
-  return ReadToContainer(add_full_hashes,
-                         header.add_hash_count,
-                         file.get(),
-                         NULL);
+  if (!ReadToContainer(add_full_hashes,
+                       header.add_hash_count,
+                       file.get(),
+                       NULL))
+    return false;
+
+  base::MD5Digest main_digest;
+  if (!ReadMainDigest(file.get(), &main_digest))
+    return false;
+  ReadDeltaFile(DeltaFileForFilename(filename_), main_digest,
+                NULL, NULL, add_full_hashes);
+  return true;
+}
+
+bool SafeBrowsingStoreFile::GetStateDigest(base::MD5Digest* digest) {
+  file_util::ScopedFILE file(file_util::OpenFile(filename_, "rb"));
+  if (file.get() == NULL)
+    return false;
+
+  base::MD5Digest main_digest;
+  if (!ReadMainDigest(file.get(), &main_digest))
+    return false;
+
+  int64 delta_size = 0;
+  const FilePath delta_filename = DeltaFileForFilename(filename_);
+  if (file_util::PathExists(delta_filename) &&
+      !file_util::GetFileSize(delta_filename, &delta_size))
+    return false;
+
+  base::MD5Context context;
+  base::MD5Init(&context);
+  base::MD5Update(&context, base::StringPiece(
+      reinterpret_cast<const char*>(&main_digest), sizeof(main_digest)));
+  base::MD5Update(&context, base::StringPiece(
+      reinterpret_cast<const char*>(&delta_size), sizeof(delta_size)));
+  base::MD5Final(digest, &context);
+  return true;
 }
 
 bool SafeBrowsingStoreFile::WriteAddHash(int32 chunk_id,
@@ -434,6 +584,9 @@ bool SafeBrowsingStoreFile::BeginUpdate() {
     if (file_util::PathExists(filename_))
       return OnCorruptDatabase();
 
+    // Any delta left behind cannot apply to a new main file.
+    file_util::Delete(DeltaFileForFilename(filename_), false);
+
     new_file_.swap(new_file);
     return true;
   }
@@ -469,6 +622,15 @@ bool SafeBrowsingStoreFile::BeginUpdate() {
                        file.get(), NULL))
     return OnCorruptDatabase();
 
+  // Pick up the data committed to the delta file since the main file
+  // was last written.  The chunks it holds have been seen, too.
+  base::MD5Digest main_digest;
+  if (!ReadMainDigest(file.get(), &main_digest))
+    return OnCorruptDatabase();
+  delta_size_ = ReadDeltaFile(DeltaFileForFilename(filename_), main_digest,
+                              &add_chunks_cache_, &delta_add_prefixes_,
+                              &delta_add_hashes_);
+
   file_.swap(file);
   new_file_.swap(new_file);
   return true;
@@ -479,6 +641,9 @@ bool SafeBrowsingStoreFile::FinishChunk() {
       !add_hashes_.size() && !sub_hashes_.size())
     return true;
 
+  if (!sub_prefixes_.empty() || !sub_hashes_.empty())
+    chunks_have_subs_ = true;
+
   ChunkHeader header;
   header.add_prefix_count = add_prefixes_.size();
   header.sub_prefix_count = sub_prefixes_.size();
@@ -499,16 +664,226 @@ bool SafeBrowsingStoreFile::FinishChunk() {
   return ClearChunkBuffers();
 }
 
+bool SafeBrowsingStoreFile::ReadPendingChunks(
+    int64 size,
+    SBAddPrefixes* add_prefixes,
+    std::vector<SBSubPrefix>* sub_prefixes,
+    std::vector<SBAddFullHash>* add_full_hashes,
+    std::vector<SBSubFullHash>* sub_full_hashes) {
+  // Rewind the temporary storage.
+  if (!FileRewind(new_file_.get()))
+    return false;
+
+  for (int i = 0; i < chunks_written_; ++i) {
+    ChunkHeader header;
+
+    int64 ofs = ftell(new_file_.get());
+    if (ofs == -1)
+      return false;
+
+    if (!ReadItem(&header, new_file_.get(), NULL))
+      return false;
+
+    // As a safety measure, make sure that the header describes a sane
+    // chunk, given the remaining file size.
+    int64 expected_size = ofs + sizeof(ChunkHeader);
+    expected_size += header.add_prefix_count * sizeof(SBAddPrefix);
+    expected_size += header.sub_prefix_count * sizeof(SBSubPrefix);
+    expected_size += header.add_hash_count * sizeof(SBAddFullHash);
+    expected_size += header.sub_hash_count * sizeof(SBSubFullHash);
+    if (expected_size > size)
+      return false;
+
+    // TODO(shess): If the vectors were kept sorted, then this code
+    // could use std::inplace_merge() to merge everything together in
+    // sorted order.  That might still be slower than just sorting at
+    // the end if there were a large number of chunks.  In that case
+    // some sort of recursive binary merge might be in order (merge
+    // chunks pairwise, merge those chunks pairwise, and so on, then
+    // merge the result with the main list).
+    if (!ReadToContainer(add_prefixes, header.add_prefix_count,
+                         new_file_.get(), NULL) ||
+        !ReadToContainer(sub_prefixes, header.sub_prefix_count,
+                         new_file_.get(), NULL) ||
+        !ReadToContainer(add_full_hashes, header.add_hash_count,
+                         new_file_.get(), NULL) ||
+        !ReadToContainer(sub_full_hashes, header.sub_hash_count,
+                         new_file_.get(), NULL))
+      return false;
+  }
+
+  return true;
+}
+
+bool SafeBrowsingStoreFile::WriteDeltaSegment(
+    const base::MD5Digest& main_digest,
+    const SBAddPrefixes& add_prefixes,
+    const std::vector<SBAddFullHash>& add_full_hashes) {
+  const FilePath delta_filename = DeltaFileForFilename(filename_);
+
+  // Append after the valid segments, overwriting any torn segment.
+  file_util::ScopedFILE file;
+  if (delta_size_ > 0) {
+    file.reset(file_util::OpenFile(delta_filename, "rb+"));
+    if (file.get() == NULL ||
+        fseek(file.get(), static_cast<long>(delta_size_), SEEK_SET) != 0)
+      return false;
+  } else {
+    file.reset(file_util::OpenFile(delta_filename, "wb"));
+    if (file.get() == NULL)
+      return false;
+
+    DeltaHeader header;
+    header.magic = kDeltaMagic;
+    header.version = kDeltaVersion;
+    header.main_digest = main_digest;
+    if (!WriteItem(header, file.get(), NULL))
+      return false;
+  }
+
+  base::MD5Context context;
+  base::MD5Init(&context);
+
+  DeltaSegmentHeader segment;
+  segment.add_chunk_count = new_add_chunks_.size();
+  segment.add_prefix_count = add_prefixes.size();
+  segment.add_hash_count = add_full_hashes.size();
+  if (!WriteItem(segment, file.get(), &context) ||
+      !WriteContainer(new_add_chunks_, file.get(), &context) ||
+      !WriteContainer(add_prefixes, file.get(), &context) ||
+      !WriteContainer(add_full_hashes, file.get(), &context))
+    return false;
+
+  base::MD5Digest digest;
+  base::MD5Final(&digest, &context);
+  if (!WriteItem(digest, file.get(), NULL))
+    return false;
+
+  return file_util::TruncateFile(file.get());
+}
+
+bool SafeBrowsingStoreFile::DoDeltaUpdate(
+    const std::vector<SBAddFullHash>& pending_adds,
+    int64 update_size,
+    SBAddPrefixes* add_prefixes_result,
+    std::vector<SBAddFullHash>* add_full_hashes_result,
+    bool* is_delta) {
+  DCHECK(file_.get());
+  DCHECK(!*is_delta);
+
+  // The main file's checksum is only verified when it is rewritten,
+  // but make sure the header describes the file.
+  if (!FileRewind(file_.get()))
+    return OnCorruptDatabase();
+  FileHeader header;
+  if (!ReadAndVerifyHeader(filename_, file_.get(), &header, NULL))
+    return OnCorruptDatabase();
+
+  SBAddPrefixes add_prefixes;
+  std::vector<SBSubPrefix> sub_prefixes;
+  std::vector<SBAddFullHash> add_full_hashes;
+  std::vector<SBSubFullHash> sub_full_hashes;
+  if (!ReadPendingChunks(update_size, &add_prefixes, &sub_prefixes,
+                         &add_full_hashes, &sub_full_hashes))
+    return false;
+  DCHECK(sub_prefixes.empty());
+  DCHECK(sub_full_hashes.empty());
+
+  add_full_hashes.insert(add_full_hashes.end(),
+                         pending_adds.begin(), pending_adds.end());
+
+  // Once the delta is large relative to the main file, merge it in.
+  if (delta_add_prefixes_.size() + add_prefixes.size() >
+      header.add_prefix_count / kDeltaCompactionRatio)
+    return true;
+
+  // Read the main file's subs, skipping the much larger add data.
+  // The subs are for adds which have not been seen yet, which may be
+  // among the new adds.
+  const size_t sub_prefix_offset =
+      header.add_chunk_count * sizeof(int32) +
+      header.sub_chunk_count * sizeof(int32) +
+      header.add_prefix_count * sizeof(SBAddPrefix);
+  if (!FileSkip(sub_prefix_offset, file_.get()) ||
+      !ReadToContainer(&sub_prefixes, header.sub_prefix_count,
+                       file_.get(), NULL) ||
+      !FileSkip(header.add_hash_count * sizeof(SBAddFullHash), file_.get()) ||
+      !ReadToContainer(&sub_full_hashes, header.sub_hash_count,
+                       file_.get(), NULL))
+    return OnCorruptDatabase();
+
+  base::MD5Digest main_digest;
+  if (!ReadItem(&main_digest, file_.get(), NULL))
+    return OnCorruptDatabase();
+
+  // A sub which knocks out one of the new adds is consumed, which
+  // changes the main file.
+  const size_t sub_prefix_count = sub_prefixes.size();
+  const size_t sub_hash_count = sub_full_hashes.size();
+  SBProcessSubs(&add_prefixes, &sub_prefixes,
+                &add_full_hashes, &sub_full_hashes,
+                add_del_cache_, sub_del_cache_);
+  if (sub_prefixes.size() != sub_prefix_count ||
+      sub_full_hashes.size() != sub_hash_count)
+    return true;
+
+  if (!new_add_chunks_.empty() || !add_prefixes.empty() ||
+      !add_full_hashes.empty()) {
+    if (!WriteDeltaSegment(main_digest, add_prefixes, add_full_hashes))
+      return false;
+  }
+
+  // The main file is unchanged, drop the temporary file.
+  file_.reset();
+  new_file_.reset();
+  file_util::Delete(TemporaryFileForFilename(filename_), false);
+
+  UMA_HISTOGRAM_COUNTS("SB2.DeltaAddPrefixes",
+                       delta_add_prefixes_.size() + add_prefixes.size());
+
+  add_prefixes_result->swap(add_prefixes);
+  add_full_hashes_result->swap(add_full_hashes);
+  *is_delta = true;
+  return true;
+}
+
 bool SafeBrowsingStoreFile::DoUpdate(
     const std::vector<SBAddFullHash>& pending_adds,
     const std::set<SBPrefix>& prefix_misses,
     SBAddPrefixes* add_prefixes_result,
-    std::vector<SBAddFullHash>* add_full_hashes_result) {
+    std::vector<SBAddFullHash>* add_full_hashes_result,
+    bool* is_delta) {
   DCHECK(file_.get() || empty_);
   DCHECK(new_file_.get());
   CHECK(add_prefixes_result);
   CHECK(add_full_hashes_result);
 
+  // Get chunk file's size for validating counts.
+  int64 size = 0;
+  if (!file_util::GetFileSize(TemporaryFileForFilename(filename_), &size))
+    return OnCorruptDatabase();
+
+  // Track update size to answer questions at http://crbug.com/72216 .
+  // Log small updates as 1k so that the 0 (underflow) bucket can be
+  // used for "empty" in SafeBrowsingDatabase.
+  UMA_HISTOGRAM_COUNTS("SB2.DatabaseUpdateKilobytes",
+                       std::max(static_cast<int>(size / 1024), 1));
+
+  // Updates which only add data can be appended to the delta file.
+  // |prefix_misses| needs the complete add list, so it is only
+  // checked when the main file is rewritten.
+  if (is_delta) {
+    *is_delta = false;
+    if (!empty_ && add_del_cache_.empty() && sub_del_cache_.empty() &&
+        !sub_chunks_changed_ && !chunks_have_subs_) {
+      if (!DoDeltaUpdate(pending_adds, size, add_prefixes_result,
+                         add_full_hashes_result, is_delta))
+        return false;
+      if (*is_delta)
+        return true;
+    }
+  }
+
   SBAddPrefixes add_prefixes;
   std::vector<SBSubPrefix> sub_prefixes;
   std::vector<SBAddFullHash> add_full_hashes;
@@ -567,59 +942,17 @@ bool SafeBrowsingStoreFile::DoUpdate(
   }
   DCHECK(!file_.get());
 
-  // Rewind the temporary storage.
-  if (!FileRewind(new_file_.get()))
-    return false;
-
-  // Get chunk file's size for validating counts.
-  int64 size = 0;
-  if (!file_util::GetFileSize(TemporaryFileForFilename(filename_), &size))
-    return OnCorruptDatabase();
-
-  // Track update size to answer questions at http://crbug.com/72216 .
-  // Log small updates as 1k so that the 0 (underflow) bucket can be
-  // used for "empty" in SafeBrowsingDatabase.
-  UMA_HISTOGRAM_COUNTS("SB2.DatabaseUpdateKilobytes",
-                       std::max(static_cast<int>(size / 1024), 1));
+  // Fold in the adds committed as deltas since the main file was
+  // written.
+  add_prefixes.insert(add_prefixes.end(),
+                      delta_add_prefixes_.begin(), delta_add_prefixes_.end());
+  add_full_hashes.insert(add_full_hashes.end(),
+                         delta_add_hashes_.begin(), delta_add_hashes_.end());
 
   // Append the accumulated chunks onto the vectors read from |file_|.
-  for (int i = 0; i < chunks_written_; ++i) {
-    ChunkHeader header;
-
-    int64 ofs = ftell(new_file_.get());
-    if (ofs == -1)
-      return false;
-
-    if (!ReadItem(&header, new_file_.get(), NULL))
-      return false;
-
-    // As a safety measure, make sure that the header describes a sane
-    // chunk, given the remaining file size.
-    int64 expected_size = ofs + sizeof(ChunkHeader);
-    expected_size += header.add_prefix_count * sizeof(SBAddPrefix);
-    expected_size += header.sub_prefix_count * sizeof(SBSubPrefix);
-    expected_size += header.add_hash_count * sizeof(SBAddFullHash);
-    expected_size += header.sub_hash_count * sizeof(SBSubFullHash);
-    if (expected_size > size)
-      return false;
-
-    // TODO(shess): If the vectors were kept sorted, then this code
-    // could use std::inplace_merge() to merge everything together in
-    // sorted order.  That might still be slower than just sorting at
-    // the end if there were a large number of chunks.  In that case
-    // some sort of recursive binary merge might be in order (merge
-    // chunks pairwise, merge those chunks pairwise, and so on, then
-    // merge the result with the main list).
-    if (!ReadToContainer(&add_prefixes, header.add_prefix_count,
-                         new_file_.get(), NULL) ||
-        !ReadToContainer(&sub_prefixes, header.sub_prefix_count,
-                         new_file_.get(), NULL) ||
-        !ReadToContainer(&add_full_hashes, header.add_hash_count,
-                         new_file_.get(), NULL) ||
-        !ReadToContainer(&sub_full_hashes, header.sub_hash_count,
-                         new_file_.get(), NULL))
-      return false;
-  }
+  if (!ReadPendingChunks(size, &add_prefixes, &sub_prefixes,
+                         &add_full_hashes, &sub_full_hashes))
+    return false;
 
   // Append items from |pending_adds|.
   add_full_hashes.insert(add_full_hashes.end(),
@@ -687,6 +1020,10 @@ bool SafeBrowsingStoreFile::DoUpdate(
   if (!file_util::Move(new_filename, filename_))
     return false;
 
+  // The delta has been folded in.  If it cannot be deleted, its
+  // checksum no longer matches the main file so it will be ignored.
+  file_util::Delete(DeltaFileForFilename(filename_), false);
+
   // Record counts before swapping to caller.
   UMA_HISTOGRAM_COUNTS("SB2.AddPrefixes", add_prefixes.size());
   UMA_HISTOGRAM_COUNTS("SB2.SubPrefixes", sub_prefixes.size());
@@ -707,7 +1044,31 @@ bool SafeBrowsingStoreFile::FinishUpdate(
   DCHECK(add_full_hashes_result);
 
   bool ret = DoUpdate(pending_adds, prefix_misses,
-                      add_prefixes_result, add_full_hashes_result);
+                      add_prefixes_result, add_full_hashes_result, NULL);
+
+  if (!ret) {
+    CancelUpdate();
+    return false;
+  }
+
+  DCHECK(!new_file_.get());
+  DCHECK(!file_.get());
+
+  return Close();
+}
+
+bool SafeBrowsingStoreFile::FinishUpdateWithDelta(
+    const std::vector<SBAddFullHash>& pending_adds,
+    const std::set<SBPrefix>& prefix_misses,
+    SBAddPrefixes* add_prefixes_result,
+    std::vector<SBAddFullHash>* add_full_hashes_result,
+    bool* is_delta) {
+  DCHECK(add_prefixes_result);
+  DCHECK(add_full_hashes_result);
+  DCHECK(is_delta);
+
+  bool ret = DoUpdate(pending_adds, prefix_misses,
+                      add_prefixes_result, add_full_hashes_result, is_delta);
 
   if (!ret) {
     CancelUpdate();
@@ -725,7 +1086,8 @@ bool SafeBrowsingStoreFile::CancelUpdate() {
 }
 
 void SafeBrowsingStoreFile::SetAddChunk(int32 chunk_id) {
-  add_chunks_cache_.insert(chunk_id);
+  if (add_chunks_cache_.insert(chunk_id).second)
+    new_add_chunks_.insert(chunk_id);
 }
 
 bool SafeBrowsingStoreFile::CheckAddChunk(int32 chunk_id) {
@@ -738,7 +1100,8 @@ void SafeBrowsingStoreFile::GetAddChunks(std::vector<int32>* out) {
 }
 
 void SafeBrowsingStoreFile::SetSubChunk(int32 chunk_id) {
-  sub_chunks_cache_.insert(chunk_id);
+  if (sub_chunks_cache_.insert(chunk_id).second)
+    sub_chunks_changed_ = true;
 }
 
 bool SafeBrowsingStoreFile::CheckSubChunk(int32 chunk_id) {
@@ -12,6 +12,7 @@
 
 #include "base/callback.h"
 #include "base/file_util.h"
+#include "base/md5.h"
 
 // Implement SafeBrowsingStore in terms of a flat file.  The file
 // format is pretty literal:
@@ -96,6 +97,40 @@
 //   - Rewind and write the buffers out to temp file.
 //   - Delete original file.
 //   - Rename temp file to original filename.
+//
+// Rewriting everything costs time proportional to the size of the
+// database, though most updates only add a few chunks.  Updates made
+// through FinishUpdateWithDelta() which only add data (no subs, no
+// deleted chunks, and no adds knocked out by existing subs) are instead
+// appended to a delta file, in segments like:
+//
+// int32 magic;             // kDeltaMagic
+// int32 version;           // kDeltaVersion
+// MD5Digest main_checksum; // Checksum of the main file the delta extends.
+// array[] {
+//   uint32 add_chunk_count;
+//   uint32 add_prefix_count;
+//   uint32 add_hash_count;
+//   array[add_chunk_count] {
+//     int32 chunk_id;
+//   }
+//   array[add_prefix_count] {
+//     int32 chunk_id;
+//     int32 prefix;
+//   }
+//   array[add_hash_count] {
+//     int32 chunk_id;
+//     int32 received_time;     // From base::Time::ToTimeT().
+//     char[32] full_hash;
+//   }
+//   MD5Digest checksum;      // Checksum over the segment.
+// }
+//
+// The delta is folded back into the main file by the next full update,
+// which happens once the delta grows past a fraction of the main file.
+// Since a segment carries the chunk ids along with their data, a torn
+// or stale segment is simply dropped and its chunks are downloaded
+// again.
 
 // TODO(shess): By using a checksum, this code can avoid doing an
 // fsync(), at the possible cost of more frequently retrieving the
@@ -120,6 +155,11 @@ class SafeBrowsingStoreFile : public SafeBrowsingStore {
   virtual bool GetAddFullHashes(
       std::vector<SBAddFullHash>* add_full_hashes) OVERRIDE;
 
+  // The digest covers the main file's checksum and the delta file's
+  // size.  Deltas are only ever appended for a given main file, so
+  // this changes with every commit.
+  virtual bool GetStateDigest(base::MD5Digest* digest) OVERRIDE;
+
   virtual bool BeginChunk() OVERRIDE;
 
   virtual bool WriteAddPrefix(int32 chunk_id, SBPrefix prefix) OVERRIDE;
@@ -140,6 +180,12 @@ class SafeBrowsingStoreFile : public SafeBrowsingStore {
       const std::set<SBPrefix>& prefix_misses,
       SBAddPrefixes* add_prefixes_result,
       std::vector<SBAddFullHash>* add_full_hashes_result) OVERRIDE;
+  virtual bool FinishUpdateWithDelta(
+      const std::vector<SBAddFullHash>& pending_adds,
+      const std::set<SBPrefix>& prefix_misses,
+      SBAddPrefixes* add_prefixes_result,
+      std::vector<SBAddFullHash>* add_full_hashes_result,
+      bool* is_delta) OVERRIDE;
   virtual bool CancelUpdate() OVERRIDE;
 
   virtual void SetAddChunk(int32 chunk_id) OVERRIDE;
@@ -162,12 +208,47 @@ class SafeBrowsingStoreFile : public SafeBrowsingStore {
     return FilePath(filename.value() + FILE_PATH_LITERAL("_new"));
   }
 
+  // Returns the name of the file holding delta updates for |filename|.
+  // Exported for unit tests.
+  static const FilePath DeltaFileForFilename(const FilePath& filename) {
+    return FilePath(filename.value() + FILE_PATH_LITERAL("_delta"));
+  }
+
  private:
-  // Update store file with pending full hashes.
+  // Update store file with pending full hashes.  If |is_delta| is
+  // non-NULL the update may be committed as a delta, see
+  // FinishUpdateWithDelta().
   virtual bool DoUpdate(const std::vector<SBAddFullHash>& pending_adds,
                         const std::set<SBPrefix>& prefix_misses,
                         SBAddPrefixes* add_prefixes_result,
-                        std::vector<SBAddFullHash>* add_full_hashes_result);
+                        std::vector<SBAddFullHash>* add_full_hashes_result,
+                        bool* is_delta);
+
+  // Try to append the update to the delta file rather than rewriting
+  // the main file.  Sets |*is_delta| if that worked, and leaves it
+  // false if the update must be merged into the main file instead.
+  // |update_size| is the size of |new_file_|.  Returns false on
+  // error.
+  bool DoDeltaUpdate(const std::vector<SBAddFullHash>& pending_adds,
+                     int64 update_size,
+                     SBAddPrefixes* add_prefixes_result,
+                     std::vector<SBAddFullHash>* add_full_hashes_result,
+                     bool* is_delta);
+
+  // Read the chunks accumulated in |new_file_|, of size |size|, onto
+  // the end of the passed vectors.
+  bool ReadPendingChunks(int64 size,
+                         SBAddPrefixes* add_prefixes,
+                         std::vector<SBSubPrefix>* sub_prefixes,
+                         std::vector<SBAddFullHash>* add_full_hashes,
+                         std::vector<SBSubFullHash>* sub_full_hashes);
+
+  // Append a segment holding |new_add_chunks_|, |add_prefixes| and
+  // |add_full_hashes| to the delta file for the main file with
+  // checksum |main_digest|.
+  bool WriteDeltaSegment(const base::MD5Digest& main_digest,
+                         const SBAddPrefixes& add_prefixes,
+                         const std::vector<SBAddFullHash>& add_full_hashes);
 
   // Enumerate different format-change events for histogramming
   // purposes.  DO NOT CHANGE THE ORDERING OF THESE VALUES.
@@ -247,6 +328,12 @@ class SafeBrowsingStoreFile : public SafeBrowsingStore {
     std::set<int32>().swap(sub_chunks_cache_);
     base::hash_set<int32>().swap(add_del_cache_);
     base::hash_set<int32>().swap(sub_del_cache_);
+    std::set<int32>().swap(new_add_chunks_);
+    SBAddPrefixes().swap(delta_add_prefixes_);
+    std::vector<SBAddFullHash>().swap(delta_add_hashes_);
+    delta_size_ = 0;
+    sub_chunks_changed_ = false;
+    chunks_have_subs_ = false;
   }
 
   // Buffers for collecting data between BeginChunk() and
@@ -281,6 +368,22 @@ class SafeBrowsingStoreFile : public SafeBrowsingStore {
   base::hash_set<int32> add_del_cache_;
   base::hash_set<int32> sub_del_cache_;
 
+  // Add chunks first seen in this transaction, which are recorded in
+  // the delta segment if the update is committed as a delta.
+  std::set<int32> new_add_chunks_;
+
+  // Whether this transaction has seen new sub chunks, or sub data in
+  // any chunk.  Either forces the update to rewrite the main file.
+  bool sub_chunks_changed_;
+  bool chunks_have_subs_;
+
+  // Data from the delta file, loaded on BeginUpdate() and folded into
+  // the main file if the update rewrites it.  |delta_size_| is the
+  // size of the valid part of the delta file, or 0 if there is none.
+  SBAddPrefixes delta_add_prefixes_;
+  std::vector<SBAddFullHash> delta_add_hashes_;
+  int64 delta_size_;
+
   base::Closure corruption_callback_;
 
   // Tracks whether corruption has already been seen in the current
@@ -193,4 +193,104 @@ TEST_F(SafeBrowsingStoreFileTest, CheckValidityChecksum) {
   EXPECT_TRUE(store_->CancelUpdate());
 }
 
+// Test that updates which only add data are committed to the delta
+// file, and that the delta is folded back into the main file.
+TEST_F(SafeBrowsingStoreFileTest, DeltaUpdate) {
+  const FilePath delta_file =
+      SafeBrowsingStoreFile::DeltaFileForFilename(filename_);
+  const int32 kAddChunk1 = 1;
+  const int32 kSubChunk1 = 2;
+  const int32 kAddChunk2 = 3;
+  const int32 kAddChunk3 = 5;
+  const int32 kAddChunk4 = 7;
+  const SBPrefix kSubbedPrefix = 1000;
+  const SBPrefix kBasePrefixCount = 16;
+
+  std::vector<SBAddFullHash> pending_adds;
+  std::set<SBPrefix> prefix_misses;
+  SBAddPrefixes add_prefixes;
+  std::vector<SBAddFullHash> add_hashes;
+  bool is_delta = true;
+
+  // Seed the main file, including a sub for an add not yet seen.
+  EXPECT_TRUE(store_->BeginUpdate());
+  EXPECT_TRUE(store_->BeginChunk());
+  store_->SetAddChunk(kAddChunk1);
+  for (SBPrefix prefix = 0; prefix < kBasePrefixCount; ++prefix)
+    EXPECT_TRUE(store_->WriteAddPrefix(kAddChunk1, prefix));
+  store_->SetSubChunk(kSubChunk1);
+  EXPECT_TRUE(store_->WriteSubPrefix(kSubChunk1, kAddChunk3, kSubbedPrefix));
+  EXPECT_TRUE(store_->FinishChunk());
+  EXPECT_TRUE(store_->FinishUpdateWithDelta(pending_adds, prefix_misses,
+                                            &add_prefixes, &add_hashes,
+                                            &is_delta));
+  EXPECT_FALSE(is_delta);
+  EXPECT_EQ(static_cast<size_t>(kBasePrefixCount), add_prefixes.size());
+  EXPECT_FALSE(file_util::PathExists(delta_file));
+
+  // A small add-only update is returned and stored as a delta.
+  add_prefixes.clear();
+  EXPECT_TRUE(store_->BeginUpdate());
+  EXPECT_TRUE(store_->BeginChunk());
+  store_->SetAddChunk(kAddChunk2);
+  EXPECT_TRUE(store_->WriteAddPrefix(kAddChunk2, 500));
+  EXPECT_TRUE(store_->FinishChunk());
+  EXPECT_TRUE(store_->FinishUpdateWithDelta(pending_adds, prefix_misses,
+                                            &add_prefixes, &add_hashes,
+                                            &is_delta));
+  EXPECT_TRUE(is_delta);
+  ASSERT_EQ(1U, add_prefixes.size());
+  EXPECT_EQ(kAddChunk2, add_prefixes[0].chunk_id);
+  EXPECT_EQ(500, add_prefixes[0].prefix);
+  EXPECT_TRUE(file_util::PathExists(delta_file));
+  EXPECT_FALSE(file_util::PathExists(
+      SafeBrowsingStoreFile::TemporaryFileForFilename(filename_)));
+
+  // The delta is visible to readers and to the next update.
+  EXPECT_TRUE(store_->GetAddPrefixes(&add_prefixes));
+  EXPECT_EQ(static_cast<size_t>(kBasePrefixCount + 1), add_prefixes.size());
+  EXPECT_TRUE(store_->BeginUpdate());
+  EXPECT_TRUE(store_->CheckAddChunk(kAddChunk1));
+  EXPECT_TRUE(store_->CheckAddChunk(kAddChunk2));
+
+  // An add knocked out by an existing sub forces a full update, which
+  // folds in the delta.
+  add_prefixes.clear();
+  EXPECT_TRUE(store_->BeginChunk());
+  store_->SetAddChunk(kAddChunk3);
+  EXPECT_TRUE(store_->WriteAddPrefix(kAddChunk3, kSubbedPrefix));
+  EXPECT_TRUE(store_->FinishChunk());
+  EXPECT_TRUE(store_->FinishUpdateWithDelta(pending_adds, prefix_misses,
+                                            &add_prefixes, &add_hashes,
+                                            &is_delta));
+  EXPECT_FALSE(is_delta);
+  EXPECT_EQ(static_cast<size_t>(kBasePrefixCount + 1), add_prefixes.size());
+  EXPECT_FALSE(file_util::PathExists(delta_file));
+
+  // A torn delta segment is dropped, along with its chunks.
+  add_prefixes.clear();
+  EXPECT_TRUE(store_->BeginUpdate());
+  EXPECT_TRUE(store_->BeginChunk());
+  store_->SetAddChunk(kAddChunk4);
+  EXPECT_TRUE(store_->WriteAddPrefix(kAddChunk4, 600));
+  EXPECT_TRUE(store_->FinishChunk());
+  EXPECT_TRUE(store_->FinishUpdateWithDelta(pending_adds, prefix_misses,
+                                            &add_prefixes, &add_hashes,
+                                            &is_delta));
+  EXPECT_TRUE(is_delta);
+  int64 size = 0;
+  ASSERT_TRUE(file_util::GetFileSize(delta_file, &size));
+  file_util::ScopedFILE file(file_util::OpenFile(delta_file, "rb+"));
+  ASSERT_TRUE(file.get());
+  EXPECT_EQ(0, fseek(file.get(), static_cast<long>(size) - 1, SEEK_SET));
+  EXPECT_TRUE(file_util::TruncateFile(file.get()));
+  file.reset();
+
+  EXPECT_TRUE(store_->BeginUpdate());
+  EXPECT_TRUE(store_->CheckAddChunk(kAddChunk3));
+  EXPECT_FALSE(store_->CheckAddChunk(kAddChunk4));
+  EXPECT_TRUE(store_->CancelUpdate());
+  EXPECT_FALSE(corruption_detected_);
+}
+
 }  // namespace
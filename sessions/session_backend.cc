@@ -4,6 +4,7 @@
 
 #include "chrome/browser/sessions/session_backend.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "base/file_util.h"
@@ -23,6 +24,10 @@ static const int32 kFileSignature = 0x53534E53;
 
 namespace {
 
+// The largest chunk SessionFileReader reads at once. Large session files are
+// read in chunks of this size rather than kFileReadBufferSize.
+const int64 kMaxFileReadChunkSize = 64 * 1024;
+
 // The file header is the first bytes written to the file,
 // and is used to identify the file as one written by us.
 struct FileHeader {
@@ -47,9 +52,14 @@ class SessionFileReader {
         buffer_position_(0),
         available_count_(0) {
     file_.reset(new net::FileStream(NULL));
-    if (file_util::PathExists(path))
+    int64 file_size;
+    if (file_util::GetFileSize(path, &file_size)) {
       file_->OpenSync(path,
                       base::PLATFORM_FILE_OPEN | base::PLATFORM_FILE_READ);
+      // Read large files in few chunks instead of many small reads.
+      if (file_size > static_cast<int64>(buffer_.size()))
+        buffer_.resize(std::min(file_size, kMaxFileReadChunkSize), 0);
+    }
   }
   // Reads the contents of the file specified in the constructor, returning
   // true on success. It is up to the caller to free all SessionCommands
@@ -307,36 +317,41 @@ bool SessionBackend::ReadCurrentSessionCommandsImpl(
 
 bool SessionBackend::AppendCommandsToFile(net::FileStream* file,
     const std::vector<SessionCommand*>& commands) {
+  // Serialize all commands first and write them at once. When the file is
+  // reset it is rewritten with the commands of all open windows, and writing
+  // each field of each command separately made that slow.
+  size_t buffer_size = 0;
+  for (std::vector<SessionCommand*>::const_iterator i = commands.begin();
+       i != commands.end(); ++i) {
+    buffer_size += sizeof(size_type) + sizeof(id_type) + (*i)->size();
+  }
+  std::string buffer;
+  buffer.reserve(buffer_size);
   for (std::vector<SessionCommand*>::const_iterator i = commands.begin();
        i != commands.end(); ++i) {
-    int wrote;
     const size_type content_size = static_cast<size_type>((*i)->size());
     const size_type total_size =  content_size + sizeof(id_type);
     if (type_ == BaseSessionService::TAB_RESTORE)
       UMA_HISTOGRAM_COUNTS("TabRestore.command_size", total_size);
     else
       UMA_HISTOGRAM_COUNTS("SessionRestore.command_size", total_size);
-    wrote = file->WriteSync(reinterpret_cast<const char*>(&total_size),
-                            sizeof(total_size));
-    if (wrote != sizeof(total_size)) {
-      NOTREACHED() << "error writing";
-      return false;
-    }
-    id_type command_id = (*i)->id();
-    wrote = file->WriteSync(reinterpret_cast<char*>(&command_id),
-                            sizeof(command_id));
-    if (wrote != sizeof(command_id)) {
+    buffer.append(reinterpret_cast<const char*>(&total_size),
+                  sizeof(total_size));
+    const id_type command_id = (*i)->id();
+    buffer.append(reinterpret_cast<const char*>(&command_id),
+                  sizeof(command_id));
+    if (content_size > 0)
+      buffer.append(reinterpret_cast<char*>((*i)->contents()), content_size);
+  }
+  DCHECK_EQ(buffer_size, buffer.size());
+
+  if (!buffer.empty()) {
+    int wrote = file->WriteSync(buffer.data(),
+                                static_cast<int>(buffer.size()));
+    if (wrote != static_cast<int>(buffer.size())) {
       NOTREACHED() << "error writing";
       return false;
     }
-    if (content_size > 0) {
-      wrote = file->WriteSync(reinterpret_cast<char*>((*i)->contents()),
-                              content_size);
-      if (wrote != content_size) {
-        NOTREACHED() << "error writing";
-        return false;
-      }
-    }
   }
   file->FlushSync();
   return true;
@@ -155,6 +155,42 @@ TEST_F(SessionBackendTest, BigData) {
   STLDeleteElements(&commands);
 }
 
+// Writes enough commands that the file is read back in several chunks, and
+// checks that no command is lost or split at the chunk boundaries.
+TEST_F(SessionBackendTest, ManyCommands) {
+  scoped_refptr<SessionBackend> backend(
+      new SessionBackend(BaseSessionService::SESSION_RESTORE, path_));
+  std::vector<SessionCommand*> commands;
+  const int kCommandCount = 5000;
+  for (int i = 0; i < kCommandCount; ++i) {
+    SessionCommand* command = new SessionCommand(
+        static_cast<SessionCommand::id_type>(i % 200), i % 97);
+    if (command->size() > 0) {
+      memset(command->contents(), 'a' + i % 26, command->size());
+      reinterpret_cast<char*>(command->contents())[0] = static_cast<char>(i);
+    }
+    commands.push_back(command);
+  }
+  backend->AppendCommands(new SessionCommands(commands), false);
+  commands.clear();
+
+  backend = NULL;
+  backend = new SessionBackend(BaseSessionService::SESSION_RESTORE, path_);
+  backend->ReadLastSessionCommandsImpl(&commands);
+  ASSERT_EQ(static_cast<size_t>(kCommandCount), commands.size());
+  for (int i = 0; i < kCommandCount; ++i) {
+    EXPECT_EQ(i % 200, commands[i]->id());
+    ASSERT_EQ(static_cast<size_t>(i % 97), commands[i]->size());
+    if (commands[i]->size() > 0) {
+      const char* contents = reinterpret_cast<char*>(commands[i]->contents());
+      EXPECT_EQ(static_cast<char>(i), contents[0]);
+      if (commands[i]->size() > 1)
+        EXPECT_EQ('a' + i % 26, contents[commands[i]->size() - 1]);
+    }
+  }
+  STLDeleteElements(&commands);
+}
+
 // Bug 132037: This test causes an assertion error on Windows.
 #if defined(OS_WIN) && !defined(NDEBUG)
 #define MAYBE_EmptyCommand DISABLED_EmptyCommand
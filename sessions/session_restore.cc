@@ -5,7 +5,9 @@
 #include "chrome/browser/sessions/session_restore.h"
 
 #include <algorithm>
+#include <cstdlib>
 #include <list>
+#include <map>
 #include <set>
 #include <string>
 
@@ -19,6 +21,7 @@
 #include "base/platform_file.h"
 #include "base/stl_util.h"
 #include "base/stringprintf.h"
+#include "base/sys_info.h"
 #include "chrome/browser/browser_process.h"
 #include "chrome/browser/extensions/extension_service.h"
 #include "chrome/browser/performance_monitor/startup_timer.h"
@@ -76,16 +79,41 @@ TabLoader* shared_tab_loader = NULL;
 // Pointers to SessionRestoreImpls which are currently restoring the session.
 std::set<SessionRestoreImpl*>* active_session_restorers = NULL;
 
+// Overrides of the TabLoader limits set by SetTabLoaderLimitsForTesting(), or
+// zero to use the defaults.
+size_t g_max_parallel_tab_loads_for_testing = 0;
+size_t g_max_tabs_to_load_for_testing = 0;
+int g_force_load_delay_ms_for_testing = 0;
+
 // TabLoader ------------------------------------------------------------------
 
 // Initial delay (see class decription for details).
 static const int kInitialDelayTimerMS = 100;
 
+// The maximum number of tabs that are loading at the same time. The selected
+// tabs of the restored windows count too, so they are loaded before any
+// background tab if there are many windows.
+static const size_t kMaxParallelTabLoads = 4;
+
+// TabLoader loads background tabs while their estimated memory use stays
+// within this share of the physical memory, and at least kMinTabsToLoad of
+// them. The remaining tabs are loaded when they are selected.
+static const int kTabLoadMemoryBudgetPercent = 25;
+static const int kEstimatedTabMemoryMB = 40;
+static const size_t kMinTabsToLoad = 10;
+
+// Added to the load priority of the tabs of minimized windows, so that they
+// are loaded after the tabs of all visible windows.
+static const int kMinimizedWindowLoadPriority = 1000;
+
 // TabLoader is responsible for loading tabs after session restore creates
 // tabs. New tabs are loaded after the current tab finishes loading, or a delay
 // is reached (initially kInitialDelayTimerMS). If the delay is reached before
 // a tab finishes loading a new tab is loaded and the time of the delay
-// doubled.
+// doubled. At most kMaxParallelTabLoads tabs load at a time, in order of their
+// load priority, and tabs beyond the memory budget are not loaded until they
+// are selected. The delay still starts another tab when that many are loading,
+// so that tabs which never finish loading can't stall the rest.
 //
 // TabLoader keeps a reference to itself when it's loading. When it has finished
 // loading, it drops the reference. If another profile is restored while the
@@ -103,8 +131,9 @@ class TabLoader : public content::NotificationObserver,
   // starting timestamp is set to |restore_started|.
   static TabLoader* GetTabLoader(base::TimeTicks restore_started);
 
-  // Schedules a tab for loading.
-  void ScheduleLoad(NavigationController* controller);
+  // Schedules a tab for loading. Tabs with a lower |priority| are loaded
+  // first, tabs of the same priority in the order they were scheduled.
+  void ScheduleLoad(NavigationController* controller, int priority);
 
   // Notifies the loader that a tab has been scheduled for loading through
   // some other mechanism.
@@ -121,13 +150,15 @@ class TabLoader : public content::NotificationObserver,
   typedef std::set<NavigationController*> TabsLoading;
   typedef std::list<NavigationController*> TabsToLoad;
   typedef std::set<RenderWidgetHost*> RenderWidgetHostSet;
+  typedef std::map<NavigationController*, int> LoadPriorities;
 
   explicit TabLoader(base::TimeTicks restore_started);
   virtual ~TabLoader();
 
-  // Loads the next tab. If there are no more tabs to load this deletes itself,
-  // otherwise |force_load_timer_| is restarted.
-  void LoadNextTab();
+  // Loads the next tab, unless |parallel_tab_load_limit_| tabs are loading
+  // already and |force| is false. If there are more tabs to load
+  // |force_load_timer_| is restarted.
+  void LoadNextTab(bool force);
 
   // NotificationObserver method. Removes the specified tab and loads the next
   // tab.
@@ -145,7 +176,7 @@ class TabLoader : public content::NotificationObserver,
   void RemoveTab(NavigationController* tab);
 
   // Invoked from |force_load_timer_|. Doubles |force_load_delay_| and invokes
-  // |LoadNextTab| to load the next tab
+  // |LoadNextTab| to load the next tab, however many tabs are loading.
   void ForceLoadTimerFired();
 
   // Returns the RenderWidgetHost associated with a tab if there is one,
@@ -174,8 +205,10 @@ class TabLoader : public content::NotificationObserver,
   // selected tabs.
   TabsLoading tabs_loading_;
 
-  // The tabs we need to load.
+  // The tabs we need to load, ordered by their priorities in
+  // |load_priorities_|.
   TabsToLoad tabs_to_load_;
+  LoadPriorities load_priorities_;
 
   // The renderers we have started loading into.
   RenderWidgetHostSet render_widget_hosts_loading_;
@@ -191,9 +224,21 @@ class TabLoader : public content::NotificationObserver,
   // The time the restore process started.
   base::TimeTicks restore_started_;
 
+  // The time from |restore_started_| to the first paint of a restored tab,
+  // or zero if it wasn't recorded.
+  base::TimeDelta time_to_first_paint_;
+
   // Max number of tabs that were loaded in parallel (for metrics).
   size_t max_parallel_tab_loads_;
 
+  // The number of tabs LoadNextTab() lets load at once, unless forced.
+  size_t parallel_tab_load_limit_;
+
+  // The number of tabs LoadNextTab() has loaded, and the number of tabs that
+  // fit in the memory budget.
+  size_t tabs_loaded_;
+  size_t max_tabs_to_load_;
+
   // For keeping TabLoader alive while it's loading even if no
   // SessionRestoreImpls reference it.
   scoped_refptr<TabLoader> this_retainer_;
@@ -208,11 +253,23 @@ TabLoader* TabLoader::GetTabLoader(base::TimeTicks restore_started) {
   return shared_tab_loader;
 }
 
-void TabLoader::ScheduleLoad(NavigationController* controller) {
+void TabLoader::ScheduleLoad(NavigationController* controller,
+                             int priority) {
   DCHECK(controller);
   DCHECK(find(tabs_to_load_.begin(), tabs_to_load_.end(), controller) ==
          tabs_to_load_.end());
-  tabs_to_load_.push_back(controller);
+  // Tabs are mostly scheduled in increasing order of priority, so search for
+  // the position from the end.
+  TabsToLoad::iterator position = tabs_to_load_.end();
+  while (position != tabs_to_load_.begin()) {
+    TabsToLoad::iterator previous = position;
+    --previous;
+    if (load_priorities_[*previous] <= priority)
+      break;
+    position = previous;
+  }
+  tabs_to_load_.insert(position, controller);
+  load_priorities_[controller] = priority;
   RegisterForNotifications(controller);
 }
 
@@ -242,23 +299,36 @@ void TabLoader::StartLoading() {
 #if defined(OS_CHROMEOS)
   if (!net::NetworkChangeNotifier::IsOffline()) {
     loading_ = true;
-    LoadNextTab();
+    LoadNextTab(false);
   } else {
     net::NetworkChangeNotifier::AddConnectionTypeObserver(this);
   }
 #else
   loading_ = true;
-  LoadNextTab();
+  LoadNextTab(false);
 #endif
 }
 
 TabLoader::TabLoader(base::TimeTicks restore_started)
-    : force_load_delay_(kInitialDelayTimerMS),
+    : force_load_delay_(g_force_load_delay_ms_for_testing ?
+                        g_force_load_delay_ms_for_testing :
+                        kInitialDelayTimerMS),
       loading_(false),
       got_first_paint_(false),
       tab_count_(0),
       restore_started_(restore_started),
-      max_parallel_tab_loads_(0) {
+      max_parallel_tab_loads_(0),
+      parallel_tab_load_limit_(g_max_parallel_tab_loads_for_testing ?
+                               g_max_parallel_tab_loads_for_testing :
+                               kMaxParallelTabLoads),
+      tabs_loaded_(0),
+      max_tabs_to_load_(std::max(
+          kMinTabsToLoad,
+          static_cast<size_t>(base::SysInfo::AmountOfPhysicalMemoryMB() /
+                              100 * kTabLoadMemoryBudgetPercent /
+                              kEstimatedTabMemoryMB))) {
+  if (g_max_tabs_to_load_for_testing)
+    max_tabs_to_load_ = g_max_tabs_to_load_for_testing;
 }
 
 TabLoader::~TabLoader() {
@@ -268,14 +338,17 @@ TabLoader::~TabLoader() {
   shared_tab_loader = NULL;
 }
 
-void TabLoader::LoadNextTab() {
-  if (!tabs_to_load_.empty()) {
+void TabLoader::LoadNextTab(bool force) {
+  if (!tabs_to_load_.empty() &&
+      (force || tabs_loading_.size() < parallel_tab_load_limit_)) {
     NavigationController* tab = tabs_to_load_.front();
     DCHECK(tab);
     tabs_loading_.insert(tab);
     if (tabs_loading_.size() > max_parallel_tab_loads_)
       max_parallel_tab_loads_ = tabs_loading_.size();
     tabs_to_load_.pop_front();
+    load_priorities_.erase(tab);
+    ++tabs_loaded_;
     tab->LoadIfNecessary();
     content::WebContents* contents = tab->GetWebContents();
     if (contents) {
@@ -292,6 +365,15 @@ void TabLoader::LoadNextTab() {
         contents->WasHidden();
       }
     }
+
+    if (tabs_loaded_ >= max_tabs_to_load_ && !tabs_to_load_.empty()) {
+      // The remaining tabs don't fit in the memory budget. They are loaded
+      // when the user selects them.
+      UMA_HISTOGRAM_COUNTS_1000("SessionRestore.TabsNotLoaded",
+                                tabs_to_load_.size());
+      while (!tabs_to_load_.empty())
+        RemoveTab(tabs_to_load_.front());
+    }
   }
 
   if (!tabs_to_load_.empty()) {
@@ -347,6 +429,7 @@ void TabLoader::Observe(int type,
           got_first_paint_ = true;
           base::TimeDelta time_to_paint =
               base::TimeTicks::Now() - restore_started_;
+          time_to_first_paint_ = time_to_paint;
           UMA_HISTOGRAM_CUSTOM_TIMES(
               "SessionRestore.FirstTabPainted",
               time_to_paint,
@@ -394,7 +477,7 @@ void TabLoader::OnConnectionTypeChanged(
   if (type != net::NetworkChangeNotifier::CONNECTION_NONE) {
     if (!loading_) {
       loading_ = true;
-      LoadNextTab();
+      LoadNextTab(false);
     }
   } else {
     loading_ = false;
@@ -417,11 +500,14 @@ void TabLoader::RemoveTab(NavigationController* tab) {
       find(tabs_to_load_.begin(), tabs_to_load_.end(), tab);
   if (j != tabs_to_load_.end())
     tabs_to_load_.erase(j);
+  load_priorities_.erase(tab);
 }
 
 void TabLoader::ForceLoadTimerFired() {
   force_load_delay_ *= 2;
-  LoadNextTab();
+  // The tabs that are loading have taken too long, and may never finish.
+  // Start the next tab anyway, or they could stall the rest of the restore.
+  LoadNextTab(true);
 }
 
 RenderWidgetHost* TabLoader::GetRenderWidgetHost(NavigationController* tab) {
@@ -448,7 +534,7 @@ void TabLoader::RegisterForNotifications(NavigationController* controller) {
 void TabLoader::HandleTabClosedOrLoaded(NavigationController* tab) {
   RemoveTab(tab);
   if (loading_)
-    LoadNextTab();
+    LoadNextTab(false);
   if (tabs_loading_.empty() && tabs_to_load_.empty()) {
     base::TimeDelta time_to_load =
         base::TimeTicks::Now() - restore_started_;
@@ -474,6 +560,15 @@ void TabLoader::HandleTabClosedOrLoaded(NavigationController* tab) {
 
     UMA_HISTOGRAM_COUNTS_100("SessionRestore.ParallelTabLoads",
                              max_parallel_tab_loads_);
+
+    // How early in the restore the user saw the selected tab.
+    if (time_to_first_paint_ > base::TimeDelta() &&
+        time_to_first_paint_ <= time_to_load) {
+      UMA_HISTOGRAM_PERCENTAGE(
+          "SessionRestore.FirstTabPaintedPercentOfAllTabsLoaded",
+          static_cast<int>(100 * time_to_first_paint_.InMillisecondsF() /
+                           std::max(time_to_load.InMillisecondsF(), 1.0)));
+    }
   }
 }
 
@@ -930,15 +1025,22 @@ class SessionRestoreImpl : public content::NotificationObserver {
     // If browser already has tabs, we want to restore the new ones after the
     // existing ones. E.g., this happens in Win8 Metro where we merge windows.
     int tab_index_offset = browser->tab_strip_model()->count();
+    // Background tabs next to the selected tab are the likeliest to be
+    // selected next, so load them first, and the tabs of minimized windows
+    // last.
+    const int load_priority_offset =
+        window.show_state == ui::SHOW_STATE_MINIMIZED ?
+            kMinimizedWindowLoadPriority : 0;
     for (int i = 0; i < static_cast<int>(window.tabs.size()); ++i) {
       const SessionTab& tab = *(window.tabs[i]);
       // Don't schedule a load for the selected tab, as ShowBrowser() will do
       // that.
       if (i == selected_tab_index) {
         selected_web_contents = RestoreTab(
-            tab, tab_index_offset + i, browser, false);
+            tab, tab_index_offset + i, browser, false, 0);
       } else {
-        RestoreTab(tab, tab_index_offset + i, browser, true);
+        RestoreTab(tab, tab_index_offset + i, browser, true,
+                   load_priority_offset + std::abs(i - selected_tab_index));
       }
     }
     if (selected_web_contents) {
@@ -951,7 +1053,8 @@ class SessionRestoreImpl : public content::NotificationObserver {
   WebContents* RestoreTab(const SessionTab& tab,
                           const int tab_index,
                           Browser* browser,
-                          bool schedule_load) {
+                          bool schedule_load,
+                          int load_priority) {
     // It's possible (particularly for foreign sessions) to receive a tab
     // without valid navigations. In that case, just skip it.
     // See crbug.com/154129.
@@ -1007,7 +1110,7 @@ class SessionRestoreImpl : public content::NotificationObserver {
     }
 
     if (schedule_load)
-      tab_loader_->ScheduleLoad(&web_contents->GetController());
+      tab_loader_->ScheduleLoad(&web_contents->GetController(), load_priority);
     return web_contents;
   }
 
@@ -1187,6 +1290,16 @@ void SessionRestore::RestoreForeignSessionTab(
   restorer.RestoreForeignTab(tab, disposition);
 }
 
+// static
+void SessionRestore::SetTabLoaderLimitsForTesting(
+    size_t max_parallel_tab_loads,
+    size_t max_tabs_to_load,
+    int force_load_delay_ms) {
+  g_max_parallel_tab_loads_for_testing = max_parallel_tab_loads;
+  g_max_tabs_to_load_for_testing = max_tabs_to_load;
+  g_force_load_delay_ms_for_testing = force_load_delay_ms;
+}
+
 // static
 bool SessionRestore::IsRestoring(const Profile* profile) {
   if (active_session_restorers == NULL)
@@ -65,6 +65,14 @@ class SessionRestore {
   // Returns true if we're in the process of restoring |profile|.
   static bool IsRestoring(const Profile* profile);
 
+  // Overrides, for the restores that follow, the number of tabs loaded at
+  // once, the number of background tabs loaded before the rest are left for
+  // the user to select, and the initial delay before another tab is started
+  // regardless. Zero keeps the default. Used by tests.
+  static void SetTabLoaderLimitsForTesting(size_t max_parallel_tab_loads,
+                                           size_t max_tabs_to_load,
+                                           int force_load_delay_ms);
+
   // The max number of non-selected tabs SessionRestore loads when restoring
   // a session. A value of 0 indicates all tabs are loaded at once.
   static size_t num_tabs_to_load_;
@@ -140,6 +140,41 @@ class SessionRestoreTest : public InProcessBrowserTest {
     observer.Wait();
   }
 
+  // Restores a window with a tab for each of |urls| as a foreign session, so
+  // that the tabs need not have loaded before, and returns its browser. The
+  // first tab is selected.
+  Browser* RestoreWindowWithTabs(const std::vector<GURL>& urls) {
+    SessionWindow window;
+    for (size_t i = 0; i < urls.size(); ++i) {
+      TabNavigation navigation =
+          SessionTypesTestHelper::CreateNavigation(urls[i].spec(), "title");
+      sync_pb::SessionTab sync_data;
+      sync_data.set_tab_visual_index(i);
+      sync_data.set_current_navigation_index(0);
+      sync_data.add_navigation()->CopyFrom(navigation.ToSyncData());
+      SessionTab* tab = new SessionTab;
+      tab->SetFromSyncData(sync_data, base::Time::Now());
+      window.tabs.push_back(tab);  // Deleted by |window|.
+    }
+    std::vector<const SessionWindow*> session;
+    session.push_back(&window);
+    ui_test_utils::BrowserAddedObserver window_observer;
+    SessionRestore::RestoreForeignSessionWindows(
+        browser()->profile(), session.begin(), session.end());
+    return window_observer.WaitForSingleNewBrowser();
+  }
+
+  // Returns the number of tabs of |browser| which have started loading.
+  int StartedTabCount(Browser* browser) {
+    int count = 0;
+    for (int i = 0; i < browser->tab_strip_model()->count(); ++i) {
+      if (!browser->tab_strip_model()->GetWebContentsAt(i)->
+              GetController().NeedsReload())
+        ++count;
+    }
+    return count;
+  }
+
   void AssertOneWindowWithOneTab(Browser* browser) {
     ASSERT_EQ(1u, BrowserList::size());
     ASSERT_EQ(1, browser->tab_strip_model()->count());
@@ -933,3 +968,74 @@ IN_PROC_BROWSER_TEST_F(SessionRestoreTest, SessionStorageAfterTabReplace) {
   ASSERT_EQ(1u, BrowserList::size());
   EXPECT_EQ(1, new_browser->tab_strip_model()->count());
 }
+
+// Tabs beyond the limit on parallel loads wait for a loading tab to finish.
+IN_PROC_BROWSER_TEST_F(SessionRestoreTest, ParallelTabLoadsAreCapped) {
+  ASSERT_TRUE(test_server()->Start());
+  // Tabs that take a minute to load, and a delay long enough that the force
+  // load timer won't start any more of them during the test.
+  SessionRestore::SetTabLoaderLimitsForTesting(2, 0, 60000);
+  std::vector<GURL> urls(5, test_server()->GetURL("slow?60"));
+  Browser* new_browser = RestoreWindowWithTabs(urls);
+  ASSERT_EQ(5, new_browser->tab_strip_model()->count());
+
+  // The selected tab counts toward the limit.
+  EXPECT_EQ(2, StartedTabCount(new_browser));
+  SessionRestore::SetTabLoaderLimitsForTesting(0, 0, 0);
+}
+
+// Tabs which never finish loading must not stall the rest of the restore.
+IN_PROC_BROWSER_TEST_F(SessionRestoreTest, HungTabsDontStallRestore) {
+  ASSERT_TRUE(test_server()->Start());
+  SessionRestore::SetTabLoaderLimitsForTesting(2, 0, 0);
+  std::vector<GURL> urls(3, test_server()->GetURL("slow?60"));
+  urls.push_back(url1_);
+  Browser* new_browser = RestoreWindowWithTabs(urls);
+  ASSERT_EQ(4, new_browser->tab_strip_model()->count());
+
+  // The last tab loads once the force load timer has given up waiting on the
+  // others, long before they finish.
+  content::NavigationController* last_tab =
+      &new_browser->tab_strip_model()->GetWebContentsAt(3)->GetController();
+  content::WindowedNotificationObserver observer(
+      content::NOTIFICATION_LOAD_STOP,
+      content::Source<content::NavigationController>(last_tab));
+  observer.Wait();
+  EXPECT_EQ(4, StartedTabCount(new_browser));
+  SessionRestore::SetTabLoaderLimitsForTesting(0, 0, 0);
+}
+
+// Background tabs beyond the memory budget are only loaded when selected.
+IN_PROC_BROWSER_TEST_F(SessionRestoreTest, TabsBeyondBudgetLoadWhenSelected) {
+  SessionRestore::SetTabLoaderLimitsForTesting(0, 1, 0);
+  std::vector<GURL> urls;
+  urls.push_back(url1_);
+  urls.push_back(url2_);
+  urls.push_back(url3_);
+  urls.push_back(url1_);
+  Browser* new_browser = RestoreWindowWithTabs(urls);
+  TabStripModel* tab_strip_model = new_browser->tab_strip_model();
+  ASSERT_EQ(4, tab_strip_model->count());
+
+  // The selected tab and one background tab are loaded.
+  EXPECT_FALSE(tab_strip_model->GetWebContentsAt(0)->
+                   GetController().NeedsReload());
+  EXPECT_FALSE(tab_strip_model->GetWebContentsAt(1)->
+                   GetController().NeedsReload());
+  EXPECT_TRUE(tab_strip_model->GetWebContentsAt(2)->
+                  GetController().NeedsReload());
+  EXPECT_TRUE(tab_strip_model->GetWebContentsAt(3)->
+                  GetController().NeedsReload());
+
+  // Selecting a tab that wasn't loaded loads it.
+  content::WindowedNotificationObserver observer(
+      content::NOTIFICATION_LOAD_STOP,
+      content::Source<content::NavigationController>(
+          &tab_strip_model->GetWebContentsAt(2)->GetController()));
+  tab_strip_model->ActivateTabAt(2, true);
+  observer.Wait();
+  EXPECT_EQ(url3_, tab_strip_model->GetWebContentsAt(2)->GetURL());
+  EXPECT_TRUE(tab_strip_model->GetWebContentsAt(3)->
+                  GetController().NeedsReload());
+  SessionRestore::SetTabLoaderLimitsForTesting(0, 0, 0);
+}
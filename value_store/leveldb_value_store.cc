@@ -21,6 +21,14 @@ namespace {
 
 const char* kInvalidJson = "Invalid JSON";
 
+// How long writes are buffered before they are committed to the database.
+// Extensions often set items one at a time in a loop; this lets the writes of
+// such a loop go to the database together.
+const int kCommitDelayMS = 50;
+
+// The number of decoded values kept in memory.
+const size_t kValueCacheSize = 64;
+
 ValueStore::ReadResult ReadFailure(const std::string& action,
                                    const std::string& reason) {
   CHECK_NE("", reason);
@@ -77,7 +85,9 @@ class ScopedSnapshot {
 }  // namespace
 
 LeveldbValueStore::LeveldbValueStore(const FilePath& db_path)
-    : db_path_(db_path) {
+    : db_path_(db_path),
+      commit_failed_(false),
+      value_cache_(kValueCacheSize) {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::FILE));
 
   std::string error = EnsureDbIsOpen();
@@ -88,6 +98,12 @@ LeveldbValueStore::LeveldbValueStore(const FilePath& db_path)
 LeveldbValueStore::~LeveldbValueStore() {
   DCHECK(BrowserThread::CurrentlyOn(BrowserThread::FILE));
 
+  if (db_) {
+    std::string error = CommitPendingWrites();
+    if (!error.empty())
+      LOG(WARNING) << "Failed to commit LeveldbValueStore writes: " << error;
+  }
+
   // Delete the database from disk if it's empty (but only if we managed to
   // open it!). This is safe on destruction, assuming that we have exclusive
   // access to the database.
@@ -128,7 +144,7 @@ ValueStore::ReadResult LeveldbValueStore::Get(const std::string& key) {
     return ValueStore::MakeReadResult(error);
 
   scoped_ptr<Value> setting;
-  error = ReadFromDb(leveldb::ReadOptions(), key, &setting);
+  error = ReadValue(leveldb::ReadOptions(), key, &setting);
   if (!error.empty())
     return ReadFailureForKey("get", key, error);
 
@@ -156,7 +172,7 @@ ValueStore::ReadResult LeveldbValueStore::Get(
   for (std::vector<std::string>::const_iterator it = keys.begin();
       it != keys.end(); ++it) {
     scoped_ptr<Value> setting;
-    error = ReadFromDb(options, *it, &setting);
+    error = ReadValue(options, *it, &setting);
     if (!error.empty())
       return ReadFailureForKey("get multiple items", *it, error);
     if (setting.get())
@@ -173,6 +189,10 @@ ValueStore::ReadResult LeveldbValueStore::Get() {
   if (!error.empty())
     return ValueStore::MakeReadResult(error);
 
+  error = CommitPendingWrites();
+  if (!error.empty())
+    return ReadFailure("get all items", error);
+
   base::JSONReader json_reader;
   leveldb::ReadOptions options = leveldb::ReadOptions();
   // All interaction with the db is done on the same thread, so snapshotting
@@ -211,15 +231,20 @@ ValueStore::WriteResult LeveldbValueStore::Set(
   if (!error.empty())
     return ValueStore::MakeWriteResult(error);
 
-  leveldb::WriteBatch batch;
+  error = RetryFailedCommit();
+  if (!error.empty())
+    return WriteFailureForKey("set", key, error);
+
+  PendingWrites writes;
   scoped_ptr<ValueStoreChangeList> changes(new ValueStoreChangeList());
-  error = AddToBatch(options, key, value, &batch, changes.get());
+  error = AddToBatch(options, key, value, &writes, changes.get());
   if (!error.empty())
     return WriteFailureForKey("find changes to set", key, error);
 
-  error = WriteToDb(&batch);
-  if (!error.empty())
-    return WriteFailureForKey("set", key, error);
+  if (!writes.empty()) {
+    AddPendingWrites(writes);
+    CacheValue(key, &value);
+  }
   return MakeWriteResult(changes.release());
 }
 
@@ -231,11 +256,15 @@ ValueStore::WriteResult LeveldbValueStore::Set(
   if (!error.empty())
     return ValueStore::MakeWriteResult(error);
 
-  leveldb::WriteBatch batch;
+  error = RetryFailedCommit();
+  if (!error.empty())
+    return WriteFailure("set multiple items", error);
+
+  PendingWrites writes;
   scoped_ptr<ValueStoreChangeList> changes(new ValueStoreChangeList());
 
   for (DictionaryValue::Iterator it(settings); it.HasNext(); it.Advance()) {
-    error = AddToBatch(options, it.key(), it.value(), &batch, changes.get());
+    error = AddToBatch(options, it.key(), it.value(), &writes, changes.get());
     if (!error.empty()) {
       return WriteFailureForKey("find changes to set multiple items",
                                 it.key(),
@@ -243,9 +272,11 @@ ValueStore::WriteResult LeveldbValueStore::Set(
     }
   }
 
-  error = WriteToDb(&batch);
-  if (!error.empty())
-    return WriteFailure("set multiple items", error);
+  AddPendingWrites(writes);
+  for (DictionaryValue::Iterator it(settings); it.HasNext(); it.Advance()) {
+    if (writes.count(it.key()))
+      CacheValue(it.key(), &it.value());
+  }
   return MakeWriteResult(changes.release());
 }
 
@@ -262,13 +293,17 @@ ValueStore::WriteResult LeveldbValueStore::Remove(
   if (!error.empty())
     return ValueStore::MakeWriteResult(error);
 
-  leveldb::WriteBatch batch;
+  error = RetryFailedCommit();
+  if (!error.empty())
+    return WriteFailure("remove multiple items", error);
+
+  PendingWrites writes;
   scoped_ptr<ValueStoreChangeList> changes(new ValueStoreChangeList());
 
   for (std::vector<std::string>::const_iterator it = keys.begin();
       it != keys.end(); ++it) {
     scoped_ptr<Value> old_value;
-    error = ReadFromDb(leveldb::ReadOptions(), *it, &old_value);
+    error = ReadValue(leveldb::ReadOptions(), *it, &old_value);
     if (!error.empty()) {
       return WriteFailureForKey("find changes to remove multiple items",
                                 *it,
@@ -277,13 +312,15 @@ ValueStore::WriteResult LeveldbValueStore::Remove(
 
     if (old_value.get()) {
       changes->push_back(ValueStoreChange(*it, old_value.release(), NULL));
-      batch.Delete(*it);
+      writes[*it] = linked_ptr<std::string>();
     }
   }
 
-  leveldb::Status status = db_->Write(leveldb::WriteOptions(), &batch);
-  if (!status.ok() && !status.IsNotFound())
-    return WriteFailure("remove multiple items", status.ToString());
+  AddPendingWrites(writes);
+  for (PendingWrites::const_iterator it = writes.begin(); it != writes.end();
+       ++it) {
+    CacheValue(it->first, NULL);
+  }
   return MakeWriteResult(changes.release());
 }
 
@@ -294,6 +331,11 @@ ValueStore::WriteResult LeveldbValueStore::Clear() {
   if (!error.empty())
     return ValueStore::MakeWriteResult(error);
 
+  error = CommitPendingWrites();
+  if (!error.empty())
+    return WriteFailure("clear", error);
+  value_cache_.Clear();
+
   leveldb::ReadOptions read_options;
   // All interaction with the db is done on the same thread, so snapshotting
   // isn't strictly necessary.  This is just defensive.
@@ -387,15 +429,48 @@ std::string LeveldbValueStore::ReadFromDb(
   return "";
 }
 
+std::string LeveldbValueStore::ReadValue(
+    leveldb::ReadOptions options,
+    const std::string& key,
+    scoped_ptr<Value>* setting) {
+  DCHECK(setting != NULL);
+  ValueCache::iterator cached = value_cache_.Get(key);
+  if (cached != value_cache_.end()) {
+    setting->reset(cached->second ? cached->second->DeepCopy() : NULL);
+    return "";
+  }
+
+  PendingWrites::const_iterator pending = pending_writes_.find(key);
+  if (pending != pending_writes_.end()) {
+    setting->reset();
+    if (pending->second.get()) {
+      setting->reset(base::JSONReader().ReadToValue(*pending->second));
+      if (!setting->get())
+        return kInvalidJson;
+    }
+  } else {
+    std::string error = ReadFromDb(options, key, setting);
+    if (!error.empty())
+      return error;
+  }
+
+  CacheValue(key, setting->get());
+  return "";
+}
+
+void LeveldbValueStore::CacheValue(const std::string& key, const Value* value) {
+  value_cache_.Put(key, value ? value->DeepCopy() : NULL);
+}
+
 std::string LeveldbValueStore::AddToBatch(
     ValueStore::WriteOptions options,
     const std::string& key,
     const base::Value& value,
-    leveldb::WriteBatch* batch,
+    PendingWrites* writes,
     ValueStoreChangeList* changes) {
   scoped_ptr<Value> old_value;
   if (!(options & NO_CHECK_OLD_VALUE)) {
-    std::string error = ReadFromDb(leveldb::ReadOptions(), key, &old_value);
+    std::string error = ReadValue(leveldb::ReadOptions(), key, &old_value);
     if (!error.empty())
       return error;
   }
@@ -405,14 +480,62 @@ std::string LeveldbValueStore::AddToBatch(
       changes->push_back(
           ValueStoreChange(key, old_value.release(), value.DeepCopy()));
     }
-    std::string value_as_json;
-    base::JSONWriter::Write(&value, &value_as_json);
-    batch->Put(key, value_as_json);
+    linked_ptr<std::string> value_as_json(new std::string());
+    base::JSONWriter::Write(&value, value_as_json.get());
+    (*writes)[key] = value_as_json;
   }
 
   return "";
 }
 
+void LeveldbValueStore::AddPendingWrites(const PendingWrites& writes) {
+  if (writes.empty())
+    return;
+  for (PendingWrites::const_iterator it = writes.begin(); it != writes.end();
+       ++it) {
+    pending_writes_[it->first] = it->second;
+  }
+  if (!commit_timer_.IsRunning()) {
+    commit_timer_.Start(FROM_HERE,
+                        base::TimeDelta::FromMilliseconds(kCommitDelayMS),
+                        this, &LeveldbValueStore::OnCommitTimerFired);
+  }
+}
+
+std::string LeveldbValueStore::CommitPendingWrites() {
+  DCHECK(BrowserThread::CurrentlyOn(BrowserThread::FILE));
+  commit_timer_.Stop();
+  if (pending_writes_.empty())
+    return "";
+
+  leveldb::WriteBatch batch;
+  for (PendingWrites::const_iterator it = pending_writes_.begin();
+       it != pending_writes_.end(); ++it) {
+    if (it->second.get())
+      batch.Put(it->first, *it->second);
+    else
+      batch.Delete(it->first);
+  }
+
+  std::string error = WriteToDb(&batch);
+  // Keep the writes for the next write to retry, so that neither they nor
+  // their changes to the quota are lost. The cache still matches them.
+  commit_failed_ = !error.empty();
+  if (!commit_failed_)
+    pending_writes_.clear();
+  return error;
+}
+
+std::string LeveldbValueStore::RetryFailedCommit() {
+  return commit_failed_ ? CommitPendingWrites() : "";
+}
+
+void LeveldbValueStore::OnCommitTimerFired() {
+  std::string error = CommitPendingWrites();
+  if (!error.empty())
+    LOG(WARNING) << "Failed to commit LeveldbValueStore writes: " << error;
+}
+
 std::string LeveldbValueStore::WriteToDb(leveldb::WriteBatch* batch) {
   leveldb::Status status = db_->Write(leveldb::WriteOptions(), batch);
   if (status.IsNotFound()) {
@@ -5,17 +5,28 @@
 #ifndef CHROME_BROWSER_VALUE_STORE_LEVELDB_VALUE_STORE_H_
 #define CHROME_BROWSER_VALUE_STORE_LEVELDB_VALUE_STORE_H_
 
+#include <map>
 #include <string>
 #include <vector>
 
 #include "base/compiler_specific.h"
+#include "base/containers/mru_cache.h"
 #include "base/file_path.h"
+#include "base/memory/linked_ptr.h"
 #include "base/memory/scoped_ptr.h"
+#include "base/timer.h"
 #include "chrome/browser/value_store/value_store.h"
 #include "third_party/leveldatabase/src/include/leveldb/db.h"
 
 // Value store area, backed by a leveldb database.
 // All methods must be run on the FILE thread.
+//
+// Writes are buffered and committed to the database together, shortly after
+// the first of them or before the database is iterated. If a commit fails the
+// writes are kept, and the next write retries the commit and fails with its
+// error if it fails again. The most recently used values are kept decoded, so
+// that reading them and finding the changes a write makes don't have to go to
+// the database.
 class LeveldbValueStore : public ValueStore {
  public:
   // Creates a database bound to |path|. The underlying database won't be
@@ -47,6 +58,13 @@ class LeveldbValueStore : public ValueStore {
   virtual WriteResult Clear() OVERRIDE;
 
  private:
+  // The JSON of values written since the last commit, or NULL for removed
+  // values, by key.
+  typedef std::map<std::string, linked_ptr<std::string> > PendingWrites;
+
+  // Decoded values by key. A NULL value means there is no value for the key.
+  typedef base::OwningMRUCache<std::string, Value*> ValueCache;
+
   // Tries to open the database if it hasn't been opened already.  Returns the
   // error message on failure, or "" on success (guaranteeding that |db_| is
   // non-NULL),
@@ -61,15 +79,40 @@ class LeveldbValueStore : public ValueStore {
       // Will be reset() with the result, if any.
       scoped_ptr<Value>* setting);
 
-  // Adds a setting to a WriteBatch, and logs the change in |changes|. For use
-  // with WriteToDb. Returns the error message on failure, or "" on success.
+  // Reads a setting like ReadFromDb, but from the pending writes or the cache
+  // if they have it.
+  std::string ReadValue(
+      leveldb::ReadOptions options,
+      const std::string& key,
+      scoped_ptr<Value>* setting);
+
+  // Stores a copy of |value|, which may be NULL, in |value_cache_|.
+  void CacheValue(const std::string& key, const Value* value);
+
+  // Adds a setting to |writes|, and logs the change in |changes|. For use
+  // with AddPendingWrites. Returns the error message on failure, or "" on
+  // success.
   std::string AddToBatch(
       ValueStore::WriteOptions options,
       const std::string& key,
       const base::Value& value,
-      leveldb::WriteBatch* batch,
+      PendingWrites* writes,
       ValueStoreChangeList* changes);
 
+  // Adds |writes| to |pending_writes_| and schedules a commit.
+  void AddPendingWrites(const PendingWrites& writes);
+
+  // Commits |pending_writes_| to the database, returning the error message
+  // on failure or "" on success. On failure |pending_writes_| are kept.
+  std::string CommitPendingWrites();
+
+  // Retries the commit of |pending_writes_| if the last one failed. Returns
+  // the error message on failure or "" on success.
+  std::string RetryFailedCommit();
+
+  // Commits |pending_writes_| when |commit_timer_| fires.
+  void OnCommitTimerFired();
+
   // Commits the changes in |batch| to the database, returning the error message
   // on failure or "" on success.
   std::string WriteToDb(leveldb::WriteBatch* batch);
@@ -83,6 +126,15 @@ class LeveldbValueStore : public ValueStore {
   // leveldb backend.
   scoped_ptr<leveldb::DB> db_;
 
+  // Writes not yet committed to |db_|.
+  PendingWrites pending_writes_;
+  base::OneShotTimer<LeveldbValueStore> commit_timer_;
+
+  // Whether the last commit of |pending_writes_| failed.
+  bool commit_failed_;
+
+  ValueCache value_cache_;
+
   DISALLOW_COPY_AND_ASSIGN(LeveldbValueStore);
 };
 
@@ -4,8 +4,12 @@
 
 #include "chrome/browser/value_store/value_store_unittest.h"
 
+#include "base/files/scoped_temp_dir.h"
 #include "base/memory/ref_counted.h"
+#include "base/message_loop.h"
+#include "base/values.h"
 #include "chrome/browser/value_store/leveldb_value_store.h"
+#include "content/public/test/test_browser_thread.h"
 
 namespace {
 
@@ -19,3 +23,56 @@ INSTANTIATE_TEST_CASE_P(
     LeveldbValueStore,
     ValueStoreTest,
     testing::Values(&Param));
+
+namespace {
+
+class LeveldbValueStoreTest : public testing::Test {
+ public:
+  LeveldbValueStoreTest()
+      : file_thread_(content::BrowserThread::FILE, &message_loop_) {}
+
+  virtual void SetUp() OVERRIDE {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    db_path_ = temp_dir_.path().AppendASCII("dbName");
+  }
+
+ protected:
+  base::ScopedTempDir temp_dir_;
+  FilePath db_path_;
+
+ private:
+  MessageLoop message_loop_;
+  content::TestBrowserThread file_thread_;
+};
+
+}  // namespace
+
+// Buffered writes must be readable right away, and be in the database once
+// the store is closed.
+TEST_F(LeveldbValueStoreTest, BufferedWrites) {
+  scoped_ptr<ValueStore> store(new LeveldbValueStore(db_path_));
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_FALSE(store->Set(ValueStore::DEFAULTS, "counter",
+                            base::FundamentalValue(i))->HasError());
+  }
+  ASSERT_FALSE(store->Set(ValueStore::DEFAULTS, "removed",
+                          base::StringValue("value"))->HasError());
+  ValueStore::WriteResult remove_result = store->Remove("removed");
+  ASSERT_FALSE(remove_result->HasError());
+  EXPECT_EQ(1u, remove_result->changes().size());
+
+  ValueStore::ReadResult result = store->Get("counter");
+  ASSERT_FALSE(result->HasError());
+  int counter = 0;
+  EXPECT_TRUE(result->settings()->GetInteger("counter", &counter));
+  EXPECT_EQ(99, counter);
+
+  // Close the store before reopening the database, which it holds locked.
+  store.reset();
+  store.reset(new LeveldbValueStore(db_path_));
+  result = store->Get();
+  ASSERT_FALSE(result->HasError());
+  EXPECT_EQ(1u, result->settings()->size());
+  EXPECT_TRUE(result->settings()->GetInteger("counter", &counter));
+  EXPECT_EQ(99, counter);
+}
@@ -18,7 +18,9 @@
 #include "base/containers/stack_container.h"
 #include "base/file_util.h"
 #include "base/logging.h"
+#include "base/memory/scoped_ptr.h"
 #include "base/message_loop.h"
+#include "base/metrics/histogram.h"
 #include "base/path_service.h"
 #include "base/process_util.h"
 #include "base/rand_util.h"
@@ -54,8 +56,32 @@ const unsigned VisitedLinkMaster::kDefaultTableSize = 16381;
 
 const size_t VisitedLinkMaster::kBigDeleteThreshold = 64;
 
+// 256K entries take 2MB, which is about the most we want to rehash in one go.
+const int32 VisitedLinkMaster::kIncrementalResizeThreshold = 262127;
+
+const int32 VisitedLinkMaster::kIncrementalResizeStepSize = 16384;
+
+const int32 VisitedLinkMaster::kFileWritePageSize = 4096;
+
+const size_t VisitedLinkMaster::kMaxDirtyPages = 64;
+
+const int VisitedLinkMaster::kFileWriteBatchDelayMs = 5000;
+
 namespace {
 
+// The journal starts with a header holding this signature ("VLnJ"), the
+// version below and the salt of the table it applies to. It's followed by
+// records made of an operation and a fingerprint.
+const int32 kJournalSignature = 0x4a6e4c56;
+const int32 kJournalVersion = 1;
+const size_t kJournalHeaderSize = 2 * sizeof(int32) + LINK_SALT_LENGTH;
+const size_t kJournalRecordSize =
+    sizeof(int32) + sizeof(VisitedLinkCommon::Fingerprint);
+
+// Operations recorded in the journal.
+const int32 kJournalAdd = 1;
+const int32 kJournalDelete = 2;
+
 // Fills the given salt structure with some quasi-random values
 // It is not necessary to generate a cryptographically strong random string,
 // only that it be reasonably different for different users.
@@ -177,12 +203,21 @@ class VisitedLinkMaster::TableBuilder
 
 // VisitedLinkMaster ----------------------------------------------------------
 
+VisitedLinkMaster::WriteStats::WriteStats()
+    : bytes_dirtied(0),
+      table_bytes_written(0),
+      table_writes(0),
+      journal_bytes_written(0),
+      batch_flushes(0) {
+}
+
 VisitedLinkMaster::VisitedLinkMaster(content::BrowserContext* browser_context,
                                      VisitedLinkDelegate* delegate)
     : browser_context_(browser_context),
       delegate_(delegate),
       listener_(new VisitedLinkEventListener(
-          ALLOW_THIS_IN_INITIALIZER_LIST(this), browser_context)) {
+          ALLOW_THIS_IN_INITIALIZER_LIST(this), browser_context)),
+      ALLOW_THIS_IN_INITIALIZER_LIST(weak_ptr_factory_(this)) {
   InitMembers();
 }
 
@@ -192,7 +227,8 @@ VisitedLinkMaster::VisitedLinkMaster(Listener* listener,
                                      const FilePath& filename,
                                      int32 default_table_size)
     : browser_context_(NULL),
-      delegate_(delegate) {
+      delegate_(delegate),
+      ALLOW_THIS_IN_INITIALIZER_LIST(weak_ptr_factory_(this)) {
   listener_.reset(listener);
   DCHECK(listener_.get());
   InitMembers();
@@ -220,7 +256,16 @@ void VisitedLinkMaster::InitMembers() {
   shared_memory_ = NULL;
   shared_memory_serial_ = 0;
   used_items_ = 0;
+  pending_shared_memory_ = NULL;
+  pending_hash_table_ = NULL;
+  pending_table_length_ = 0;
+  resize_position_ = 0;
+  resize_task_posted_ = false;
+  flush_task_posted_ = false;
+  journal_file_ = NULL;
+  journal_length_ = 0;
   table_size_override_ = 0;
+  incremental_resize_threshold_ = kIncrementalResizeThreshold;
   suppress_rebuild_ = false;
   sequence_token_ = BrowserThread::GetBlockingPool()->GetSequenceToken();
 
@@ -236,6 +281,12 @@ bool VisitedLinkMaster::Init() {
   base::ThreadRestrictions::ScopedAllowIO allow_io;
   if (!InitFromFile())
     return InitFromScratch(suppress_rebuild_);
+
+  // Pick up any changes we didn't get to write to the table last time.
+  if (ReplayJournal())
+    WriteFullTable();  // This also empties the journal.
+  else
+    ResetJournal();
   return true;
 }
 
@@ -286,9 +337,12 @@ void VisitedLinkMaster::AddURL(const GURL& url) {
   Hash index = TryToAddURL(url);
   if (!table_builder_ && index != null_hash_) {
     // Not rebuilding, so we want to keep the file on disk up-to-date.
+    AppendToJournal(kJournalAdd, hash_table_[index]);
     WriteUsedItemCountToFile();
     WriteHashRangeToFile(index, index);
     ResizeTableIfNecessary();
+    if (dirty_pages_.size() >= kMaxDirtyPages)
+      FlushDirtyPages();
   }
 }
 
@@ -309,6 +363,7 @@ void VisitedLinkMaster::DeleteAllURLs() {
   // Any pending modifications are invalid.
   added_since_rebuild_.clear();
   deleted_since_rebuild_.clear();
+  AbandonIncrementalResize();
 
   // Clear the hash table.
   used_items_ = 0;
@@ -332,6 +387,9 @@ void VisitedLinkMaster::DeleteURLs(URLIterator* urls) {
 
   listener_->Reset();
 
+  // Deleting shuffles entries around, which would confuse the migration.
+  FinishIncrementalResize();
+
   if (table_builder_) {
     // A rebuild is in progress, save this deletion in the temporary list so
     // it can be added once rebuild is complete.
@@ -368,6 +426,8 @@ void VisitedLinkMaster::DeleteURLs(URLIterator* urls) {
         ComputeURLFingerprint(url.spec().data(), url.spec().size(), salt_));
   }
   DeleteFingerprintsFromCurrentTable(deleted_fingerprints);
+  if (dirty_pages_.size() >= kMaxDirtyPages)
+    FlushDirtyPages();
 }
 
 // See VisitedLinkCommon::IsVisited which should be in sync with this algorithm
@@ -390,6 +450,8 @@ VisitedLinkMaster::Hash VisitedLinkMaster::AddFingerprint(
       // End of probe sequence found, insert here.
       hash_table_[cur_hash] = fingerprint;
       used_items_++;
+      if (pending_hash_table_)
+        AddFingerprintToPendingTable(fingerprint);
       // If allowed, notify listener that a new visited link was added.
       if (send_notifications)
         listener_->Add(fingerprint);
@@ -437,8 +499,10 @@ bool VisitedLinkMaster::DeleteFingerprint(Fingerprint fingerprint,
 
   // First update the header used count.
   used_items_--;
-  if (update_file)
+  if (update_file) {
+    AppendToJournal(kJournalDelete, fingerprint);
     WriteUsedItemCountToFile();
+  }
 
   Hash deleted_hash = HashFingerprint(fingerprint);
 
@@ -508,13 +572,7 @@ void VisitedLinkMaster::WriteFullTable() {
   }
 
   // Write the new header.
-  int32 header[4];
-  header[0] = kFileSignature;
-  header[1] = kFileCurrentVersion;
-  header[2] = table_length_;
-  header[3] = used_items_;
-  WriteToFile(file_, 0, header, sizeof(header));
-  WriteToFile(file_, sizeof(header), salt_, LINK_SALT_LENGTH);
+  WriteFileHeader();
 
   // Write the hash data.
   WriteToFile(file_, kFileHeaderSize,
@@ -522,6 +580,20 @@ void VisitedLinkMaster::WriteFullTable() {
 
   // The hash table may have shrunk, so make sure this is the end.
   PostIOTask(FROM_HERE, base::Bind(&AsyncTruncate, file_));
+
+  // Everything is on disk now, nothing needs replaying.
+  dirty_pages_.clear();
+  ResetJournal();
+}
+
+void VisitedLinkMaster::WriteFileHeader() {
+  int32 header[4];
+  header[0] = kFileSignature;
+  header[1] = kFileCurrentVersion;
+  header[2] = table_length_;
+  header[3] = used_items_;
+  WriteToFile(file_, 0, header, sizeof(header));
+  WriteToFile(file_, sizeof(header), salt_, LINK_SALT_LENGTH);
 }
 
 bool VisitedLinkMaster::InitFromFile() {
@@ -651,38 +723,195 @@ bool VisitedLinkMaster::GetDatabaseFileName(FilePath* filename) {
   return true;
 }
 
+bool VisitedLinkMaster::GetJournalFileName(FilePath* filename) {
+  FilePath database_name;
+  if (!GetDatabaseFileName(&database_name))
+    return false;
+  *filename = FilePath(database_name.value() + FILE_PATH_LITERAL("-journal"));
+  return true;
+}
+
+bool VisitedLinkMaster::ReplayJournal() {
+  FilePath journal_name;
+  std::string journal;
+  if (!GetJournalFileName(&journal_name) ||
+      !file_util::ReadFileToString(journal_name, &journal) ||
+      journal.size() < kJournalHeaderSize)
+    return false;
+
+  int32 signature;
+  int32 version;
+  memcpy(&signature, journal.data(), sizeof(signature));
+  memcpy(&version, journal.data() + sizeof(signature), sizeof(version));
+  if (signature != kJournalSignature || version != kJournalVersion ||
+      memcmp(journal.data() + 2 * sizeof(int32), salt_, LINK_SALT_LENGTH))
+    return false;  // Not a journal for this table.
+
+  bool changed = false;
+  for (size_t offset = kJournalHeaderSize;
+       offset + kJournalRecordSize <= journal.size();
+       offset += kJournalRecordSize) {
+    int32 operation;
+    Fingerprint fingerprint;
+    memcpy(&operation, journal.data() + offset, sizeof(operation));
+    memcpy(&fingerprint, journal.data() + offset + sizeof(operation),
+           sizeof(fingerprint));
+    if (operation == kJournalAdd) {
+      // Same sanity check as TryToAddURL. The journal is emptied long before
+      // it could get anywhere near this, so the table is resized below.
+      if (used_items_ / 8 > table_length_ / 10)
+        break;
+      changed |= AddFingerprint(fingerprint, false) != null_hash_;
+    } else if (operation == kJournalDelete) {
+      changed |= DeleteFingerprint(fingerprint, false);
+    } else {
+      break;  // The rest of the journal is corrupt.
+    }
+  }
+
+  if (changed) {
+    ResizeTableIfNecessary();
+    FinishIncrementalResize();
+  }
+  return changed;
+}
+
+void VisitedLinkMaster::ResetJournal() {
+  if (!journal_file_) {
+    FilePath journal_name;
+    if (!GetJournalFileName(&journal_name))
+      return;
+    journal_file_ = static_cast<FILE**>(calloc(1, sizeof(*journal_file_)));
+    // Opening the file truncates it.
+    PostIOTask(FROM_HERE, base::Bind(&AsyncOpen, journal_file_, journal_name));
+  }
+
+  char header[kJournalHeaderSize];
+  memcpy(header, &kJournalSignature, sizeof(kJournalSignature));
+  memcpy(header + sizeof(int32), &kJournalVersion, sizeof(kJournalVersion));
+  memcpy(header + 2 * sizeof(int32), salt_, LINK_SALT_LENGTH);
+  WriteToFile(journal_file_, 0, header, kJournalHeaderSize);
+  PostIOTask(FROM_HERE, base::Bind(&AsyncTruncate, journal_file_));
+  journal_length_ = kJournalHeaderSize;
+}
+
+void VisitedLinkMaster::AppendToJournal(int32 operation,
+                                        Fingerprint fingerprint) {
+  if (!journal_file_)
+    return;  // Nothing has been written yet, so there's nothing to replay on.
+  char record[kJournalRecordSize];
+  memcpy(record, &operation, sizeof(operation));
+  memcpy(record + sizeof(operation), &fingerprint, sizeof(fingerprint));
+  WriteToFile(journal_file_, journal_length_, record, kJournalRecordSize);
+  journal_length_ += kJournalRecordSize;
+}
+
+void VisitedLinkMaster::MarkFileRangeDirty(int64 begin, int64 end) {
+  write_stats_.bytes_dirtied += end - begin;
+  for (int64 page = begin / kFileWritePageSize;
+       page * kFileWritePageSize < end; page++)
+    dirty_pages_.insert(static_cast<int32>(page));
+
+  // Big batches are flushed by AddURL and DeleteURLs once the table is
+  // consistent again.
+  if (!flush_task_posted_) {
+    // This fails when there is no UI thread, as in the perf tests, in which
+    // case pages are flushed when there are enough of them or on shutdown.
+    flush_task_posted_ = BrowserThread::PostDelayedTask(
+        BrowserThread::UI, FROM_HERE,
+        base::Bind(&VisitedLinkMaster::OnFlushTask,
+                   weak_ptr_factory_.GetWeakPtr()),
+        base::TimeDelta::FromMilliseconds(kFileWriteBatchDelayMs));
+  }
+}
+
+void VisitedLinkMaster::FlushDirtyPages() {
+  if (dirty_pages_.empty())
+    return;
+  if (!file_) {
+    dirty_pages_.clear();
+    return;
+  }
+
+  // Write each run of contiguous dirty pages with a single write.
+  const int64 file_size = kFileHeaderSize + table_length_ * sizeof(Fingerprint);
+  std::set<int32>::const_iterator page = dirty_pages_.begin();
+  while (page != dirty_pages_.end()) {
+    int32 first_page = *page;
+    int32 last_page = first_page;
+    for (++page; page != dirty_pages_.end() && *page == last_page + 1; ++page)
+      last_page = *page;
+
+    int64 begin = static_cast<int64>(first_page) * kFileWritePageSize;
+    int64 end = std::min(
+        file_size, static_cast<int64>(last_page + 1) * kFileWritePageSize);
+    if (begin < static_cast<int64>(kFileHeaderSize)) {
+      WriteFileHeader();
+      begin = kFileHeaderSize;
+    }
+    if (begin < end) {
+      WriteToFile(file_, begin,
+                  reinterpret_cast<char*>(hash_table_) + begin -
+                      kFileHeaderSize,
+                  static_cast<int32>(end - begin));
+    }
+  }
+  UMA_HISTOGRAM_COUNTS_100("History.VisitedLinkPagesPerWriteBatch",
+                           dirty_pages_.size());
+  dirty_pages_.clear();
+  write_stats_.batch_flushes++;
+
+  // The journal is written on the same sequence as the table, so by the time
+  // it's emptied the pages above are on disk.
+  ResetJournal();
+}
+
+void VisitedLinkMaster::OnFlushTask() {
+  flush_task_posted_ = false;
+  FlushDirtyPages();
+}
+
 // Initializes the shared memory structure. The salt should already be filled
 // in so that it can be written to the shared memory
-bool VisitedLinkMaster::CreateURLTable(int32 num_entries, bool init_to_empty) {
+bool VisitedLinkMaster::CreateSharedTable(int32 num_entries,
+                                          bool init_to_empty,
+                                          base::SharedMemory** shared_memory,
+                                          Fingerprint** hash_table) {
   // The table is the size of the table followed by the entries.
   uint32 alloc_size = num_entries * sizeof(Fingerprint) + sizeof(SharedHeader);
 
   // Create the shared memory object.
-  shared_memory_ = new base::SharedMemory();
-  if (!shared_memory_)
-    return false;
-
-  if (!shared_memory_->CreateAndMapAnonymous(alloc_size)) {
-    delete shared_memory_;
-    shared_memory_ = NULL;
+  scoped_ptr<base::SharedMemory> memory(new base::SharedMemory());
+  if (!memory->CreateAndMapAnonymous(alloc_size))
     return false;
-  }
 
-  if (init_to_empty) {
-    memset(shared_memory_->memory(), 0, alloc_size);
-    used_items_ = 0;
-  }
-  table_length_ = num_entries;
+  if (init_to_empty)
+    memset(memory->memory(), 0, alloc_size);
 
   // Save the header for other processes to read.
-  SharedHeader* header = static_cast<SharedHeader*>(shared_memory_->memory());
-  header->length = table_length_;
+  SharedHeader* header = static_cast<SharedHeader*>(memory->memory());
+  header->length = num_entries;
   memcpy(header->salt, salt_, LINK_SALT_LENGTH);
 
   // Our table pointer is just the data immediately following the size.
-  hash_table_ = reinterpret_cast<Fingerprint*>(
-      static_cast<char*>(shared_memory_->memory()) + sizeof(SharedHeader));
+  *hash_table = reinterpret_cast<Fingerprint*>(
+      static_cast<char*>(memory->memory()) + sizeof(SharedHeader));
+  *shared_memory = memory.release();
+  return true;
+}
+
+bool VisitedLinkMaster::CreateURLTable(int32 num_entries, bool init_to_empty) {
+  base::SharedMemory* shared_memory = NULL;
+  Fingerprint* hash_table = NULL;
+  if (!CreateSharedTable(num_entries, init_to_empty, &shared_memory,
+                         &hash_table))
+    return false;
 
+  shared_memory_ = shared_memory;
+  hash_table_ = hash_table;
+  table_length_ = num_entries;
+  if (init_to_empty)
+    used_items_ = 0;
   return true;
 }
 
@@ -706,10 +935,16 @@ bool VisitedLinkMaster::BeginReplaceURLTable(int32 num_entries) {
 }
 
 void VisitedLinkMaster::FreeURLTable() {
+  AbandonIncrementalResize();
+  FlushDirtyPages();
   if (shared_memory_) {
     delete shared_memory_;
     shared_memory_ = NULL;
   }
+  if (journal_file_) {
+    PostIOTask(FROM_HERE, base::Bind(&AsyncClose, journal_file_));
+    journal_file_ = NULL;
+  }
   if (!file_)
     return;
   PostIOTask(FROM_HERE, base::Bind(&AsyncClose, file_));
@@ -720,6 +955,12 @@ void VisitedLinkMaster::FreeURLTable() {
 bool VisitedLinkMaster::ResizeTableIfNecessary() {
   DCHECK(table_length_ > 0) << "Must have a table";
 
+  // Move a resize that is already under way along instead of starting a new
+  // one. The pending table was sized for the load at the time it was started,
+  // and anything added since is checked again once it is swapped in.
+  if (pending_hash_table_)
+    return ContinueIncrementalResize();
+
   // Load limits for good performance/space. We are pretty conservative about
   // keeping the table not very full. This is because we use linear probing
   // which increases the likelihood of clumps of entries which will reduce
@@ -737,6 +978,11 @@ bool VisitedLinkMaster::ResizeTableIfNecessary() {
   int new_size = NewTableSizeForCount(used_items_);
   DCHECK(new_size > used_items_);
   DCHECK(load <= min_table_load || new_size > table_length_);
+  if (new_size > table_length_ &&
+      table_length_ >= incremental_resize_threshold_) {
+    BeginIncrementalResize(new_size);
+    return false;
+  }
   ResizeTable(new_size);
   return true;
 }
@@ -779,6 +1025,101 @@ void VisitedLinkMaster::ResizeTable(int32 new_size) {
   WriteFullTable();
 }
 
+void VisitedLinkMaster::BeginIncrementalResize(int32 new_size) {
+  DCHECK(!pending_hash_table_);
+  if (!CreateSharedTable(new_size, true, &pending_shared_memory_,
+                         &pending_hash_table_))
+    return;  // We'll try again on the next add.
+  pending_table_length_ = new_size;
+  resize_position_ = 0;
+
+  // Leave the first step to the posted task so that the add which triggered
+  // the resize stays cheap.
+  ScheduleIncrementalResizeTask();
+}
+
+bool VisitedLinkMaster::ContinueIncrementalResize() {
+  DCHECK(pending_hash_table_);
+  int32 step_end = std::min(table_length_,
+                            resize_position_ + kIncrementalResizeStepSize);
+  for (; resize_position_ < step_end; resize_position_++) {
+    Fingerprint cur = hash_table_[resize_position_];
+    if (cur)
+      AddFingerprintToPendingTable(cur);
+  }
+
+  if (resize_position_ < table_length_) {
+    ScheduleIncrementalResizeTask();
+    return false;
+  }
+
+  // Everything has been migrated, swap in the new table. Renderers keep
+  // probing the old one until they receive the new table.
+  delete shared_memory_;
+  shared_memory_ = pending_shared_memory_;
+  hash_table_ = pending_hash_table_;
+  table_length_ = pending_table_length_;
+  pending_shared_memory_ = NULL;
+  pending_hash_table_ = NULL;
+  pending_table_length_ = 0;
+  resize_position_ = 0;
+  shared_memory_serial_++;
+
+#ifndef NDEBUG
+  DebugValidate();
+#endif
+
+  listener_->NewTable(shared_memory_);
+  WriteFullTable();
+  return true;
+}
+
+void VisitedLinkMaster::FinishIncrementalResize() {
+  while (pending_hash_table_)
+    ContinueIncrementalResize();
+}
+
+void VisitedLinkMaster::AbandonIncrementalResize() {
+  delete pending_shared_memory_;
+  pending_shared_memory_ = NULL;
+  pending_hash_table_ = NULL;
+  pending_table_length_ = 0;
+  resize_position_ = 0;
+}
+
+void VisitedLinkMaster::ScheduleIncrementalResizeTask() {
+  if (resize_task_posted_)
+    return;
+  // This fails when there is no UI thread, as in the perf tests, in which case
+  // the resize is only moved along by adds.
+  resize_task_posted_ = BrowserThread::PostTask(
+      BrowserThread::UI, FROM_HERE,
+      base::Bind(&VisitedLinkMaster::OnIncrementalResizeTask,
+                 weak_ptr_factory_.GetWeakPtr()));
+}
+
+void VisitedLinkMaster::OnIncrementalResizeTask() {
+  resize_task_posted_ = false;
+  if (pending_hash_table_)
+    ContinueIncrementalResize();
+}
+
+void VisitedLinkMaster::AddFingerprintToPendingTable(Fingerprint fingerprint) {
+  Hash cur_hash = HashFingerprint(fingerprint, pending_table_length_);
+  while (true) {
+    Fingerprint cur_fingerprint = pending_hash_table_[cur_hash];
+    if (cur_fingerprint == fingerprint)
+      return;  // Already migrated or added since the resize began.
+    if (cur_fingerprint == null_fingerprint_) {
+      pending_hash_table_[cur_hash] = fingerprint;
+      return;
+    }
+    // The pending table is always less full than the current one, so this
+    // can't wrap around forever.
+    cur_hash = (cur_hash >= pending_table_length_ - 1) ? 0 : cur_hash + 1;
+  }
+}
+
 uint32 VisitedLinkMaster::NewTableSizeForCount(int32 item_count) const {
   // These table sizes are selected to be the maximum prime number less than
   // a "convenient" multiple of 1K.
@@ -826,6 +1167,9 @@ void VisitedLinkMaster::OnTableRebuildComplete(
     bool success,
     const std::vector<Fingerprint>& fingerprints) {
   if (success) {
+    // The rebuilt table replaces any table we were in the middle of growing.
+    AbandonIncrementalResize();
+
     // Replace the old table with a new blank one.
     shared_memory_serial_++;
 
@@ -876,6 +1220,12 @@ void VisitedLinkMaster::WriteToFile(FILE** file,
 #ifndef NDEBUG
   posted_asynchronous_operation_ = true;
 #endif
+  if (file == journal_file_) {
+    write_stats_.journal_bytes_written += data_size;
+  } else {
+    write_stats_.table_bytes_written += data_size;
+    write_stats_.table_writes++;
+  }
   PostIOTask(FROM_HERE,
       base::Bind(&AsyncWrite, file, offset,
                  std::string(static_cast<const char*>(data), data_size)));
@@ -884,26 +1234,25 @@ void VisitedLinkMaster::WriteToFile(FILE** file,
 void VisitedLinkMaster::WriteUsedItemCountToFile() {
   if (!file_)
     return;  // See comment on the file_ variable for why this might happen.
-  WriteToFile(file_, kFileHeaderUsedOffset, &used_items_, sizeof(used_items_));
+  MarkFileRangeDirty(kFileHeaderUsedOffset,
+                     kFileHeaderUsedOffset + sizeof(used_items_));
 }
 
 void VisitedLinkMaster::WriteHashRangeToFile(Hash first_hash, Hash last_hash) {
   if (!file_)
     return;  // See comment on the file_ variable for why this might happen.
   if (last_hash < first_hash) {
-    // Handle wraparound at 0. This first write is first_hash->EOF
-    WriteToFile(file_, first_hash * sizeof(Fingerprint) + kFileHeaderSize,
-                &hash_table_[first_hash],
-                (table_length_ - first_hash + 1) * sizeof(Fingerprint));
+    // Handle wraparound at 0. This first range is first_hash->EOF
+    MarkFileRangeDirty(first_hash * sizeof(Fingerprint) + kFileHeaderSize,
+                       table_length_ * sizeof(Fingerprint) + kFileHeaderSize);
 
     // Now do 0->last_lash.
-    WriteToFile(file_, kFileHeaderSize, hash_table_,
-                (last_hash + 1) * sizeof(Fingerprint));
+    MarkFileRangeDirty(kFileHeaderSize,
+                       (last_hash + 1) * sizeof(Fingerprint) + kFileHeaderSize);
   } else {
-    // Normal case, just write the range.
-    WriteToFile(file_, first_hash * sizeof(Fingerprint) + kFileHeaderSize,
-                &hash_table_[first_hash],
-                (last_hash - first_hash + 1) * sizeof(Fingerprint));
+    // Normal case, just mark the range.
+    MarkFileRangeDirty(first_hash * sizeof(Fingerprint) + kFileHeaderSize,
+                       (last_hash + 1) * sizeof(Fingerprint) + kFileHeaderSize);
   }
 }
 
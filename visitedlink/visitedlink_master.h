@@ -15,6 +15,7 @@
 #include "base/callback_forward.h"
 #include "base/file_path.h"
 #include "base/gtest_prod_util.h"
+#include "base/memory/weak_ptr.h"
 #include "base/shared_memory.h"
 #include "base/threading/sequenced_worker_pool.h"
 #include "chrome/common/visitedlink_common.h"
@@ -58,6 +59,26 @@ class VisitedLinkMaster : public VisitedLinkCommon {
     virtual void Reset() = 0;
   };
 
+  // Counters describing how changes to the table reach the disk. Dividing
+  // the bytes written by |bytes_dirtied| gives the write amplification.
+  struct WriteStats {
+    WriteStats();
+
+    // Bytes of the table file changed by adds and deletes.
+    int64 bytes_dirtied;
+
+    // Bytes and write operations issued against the table file, including
+    // full rewrites.
+    int64 table_bytes_written;
+    int64 table_writes;
+
+    // Bytes appended to the journal.
+    int64 journal_bytes_written;
+
+    // Number of batches of dirty pages written out.
+    int64 batch_flushes;
+  };
+
   VisitedLinkMaster(content::BrowserContext* browser_context,
                     VisitedLinkDelegate* delegate);
 
@@ -121,6 +142,9 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // Returns the Delegate of this Master.
   VisitedLinkDelegate* GetDelegate();
 
+  // Returns the counters for disk writes made by this master.
+  const WriteStats& write_stats() const { return write_stats_; }
+
 #if defined(UNIT_TEST) || !defined(NDEBUG) || defined(PERF_TEST)
   // This is a debugging function that can be called to double-check internal
   // data structures. It will assert if the check fails.
@@ -144,6 +168,18 @@ class VisitedLinkMaster : public VisitedLinkCommon {
     return listener_.get();
   }
 
+  // Sets the table length at or above which growing the table is done
+  // incrementally. Used by tests to exercise incremental resizing on small
+  // tables.
+  void set_incremental_resize_threshold(int32 threshold) {
+    incremental_resize_threshold_ = threshold;
+  }
+
+  // Returns true while an incremental resize is migrating the table.
+  bool IsResizing() const {
+    return pending_hash_table_ != NULL;
+  }
+
   // Call to cause the entire database file to be re-written from scratch
   // to disk. Used by the performance tester.
   void RewriteFile() {
@@ -155,6 +191,9 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   FRIEND_TEST_ALL_PREFIXES(VisitedLinkTest, Delete);
   FRIEND_TEST_ALL_PREFIXES(VisitedLinkTest, BigDelete);
   FRIEND_TEST_ALL_PREFIXES(VisitedLinkTest, BigImport);
+  FRIEND_TEST_ALL_PREFIXES(VisitedLinkTest, IncrementalResizing);
+  FRIEND_TEST_ALL_PREFIXES(VisitedLinkTest, BatchedWrites);
+  FRIEND_TEST_ALL_PREFIXES(VisitedLinkTest, JournalReplay);
 
   // Object to rebuild the table on the history thread (see the .cc file).
   class TableBuilder;
@@ -183,6 +222,24 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // we will write the whole table to disk at once instead of individual items.
   static const size_t kBigDeleteThreshold;
 
+  // Tables at least this long are grown incrementally rather than being
+  // rehashed all at once, see BeginIncrementalResize.
+  static const int32 kIncrementalResizeThreshold;
+
+  // The number of entries of the old table migrated by each step of an
+  // incremental resize.
+  static const int32 kIncrementalResizeStepSize;
+
+  // Changes to the table file are tracked in pages of this many bytes and
+  // written out a batch of pages at a time.
+  static const int32 kFileWritePageSize;
+
+  // Dirty pages are written out once an add or delete leaves this many of
+  // them, or kFileWriteBatchDelayMs after the first one, whichever comes
+  // first.
+  static const size_t kMaxDirtyPages;
+  static const int kFileWriteBatchDelayMs;
+
   // Backend for the constructors initializing the members.
   void InitMembers();
 
@@ -219,16 +276,55 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // Fills *filename with the name of the link database filename
   bool GetDatabaseFileName(FilePath* filename);
 
+  // Writes the file header, including the salt, to the table file.
+  void WriteFileHeader();
+
+  // How writes are batched
+  // ----------------------
+  //
+  // Adds and deletes don't write to the table file directly, which would mean
+  // a small random write for each of them. Instead they mark the pages of the
+  // file they change as dirty and append a small record to a journal next to
+  // the table. Dirty pages are coalesced into contiguous writes and flushed
+  // on a timer or once enough of them build up, after which the journal is
+  // emptied. Full table writes also empty the journal.
+  //
+  // If we crash before dirty pages are flushed, Init replays the journal on
+  // top of the table it loaded.
+
+  // Fills *filename with the name of the journal file.
+  bool GetJournalFileName(FilePath* filename);
+
+  // Applies the records in the journal to the table just loaded from disk.
+  // Returns true if this changed the table.
+  bool ReplayJournal();
+
+  // Empties the journal, creating it if necessary, and writes its header.
+  void ResetJournal();
+
+  // Appends a record of an add or delete of |fingerprint| to the journal.
+  void AppendToJournal(int32 operation, Fingerprint fingerprint);
+
+  // Marks the pages of the table file overlapping [begin, end) as dirty and
+  // schedules a delayed flush.
+  void MarkFileRangeDirty(int64 begin, int64 end);
+
+  // Writes all dirty pages to the table file, then empties the journal.
+  void FlushDirtyPages();
+
+  // Task posted to the UI thread to flush dirty pages after a delay.
+  void OnFlushTask();
+
   // Wrapper around Window's WriteFile using asynchronous I/O. This will proxy
   // the write to a background thread.
   void WriteToFile(FILE** hfile, off_t offset, void* data, int32 data_size);
 
-  // Helper function to schedule and asynchronous write of the used count to
-  // disk (this is a common operation).
+  // Helper function to mark the used count in the file header as needing to
+  // be written to disk (this is a common operation).
   void WriteUsedItemCountToFile();
 
-  // Helper function to schedule an asynchronous write of the given range of
-  // hash functions to disk. The range is inclusive on both ends. The range can
+  // Helper function to mark the given range of hash functions as needing to
+  // be written to disk. The range is inclusive on both ends. The range can
   // wrap around at 0 and this function will handle it.
   void WriteHashRangeToFile(Hash first_hash, Hash last_hash);
 
@@ -264,6 +360,14 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // database and for unit tests.
   bool InitFromScratch(bool suppress_rebuild);
 
+  // Allocates and maps a shared memory table with room for |num_entries|
+  // fingerprints and fills in its header. On success, |shared_memory| and
+  // |hash_table| receive the new table, which is owned by the caller.
+  bool CreateSharedTable(int32 num_entries,
+                         bool init_to_empty,
+                         base::SharedMemory** shared_memory,
+                         Fingerprint** hash_table);
+
   // Allocates the Fingerprint structure and length. When init_to_empty is set,
   // the table will be filled with 0s and used_items_ will be set to 0 as well.
   // If the flag is not set, these things are untouched and it is the
@@ -294,6 +398,49 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // current count.
   void ResizeTable(int32 new_size);
 
+  // How incremental resizing works
+  // ------------------------------
+  //
+  // Rehashing a large table all at once stalls the UI thread. Instead, a
+  // larger pending table is allocated and the current table is migrated into
+  // it a step at a time, on each add and from tasks posted to the UI thread.
+  // The current table stays authoritative for readers: renderers keep
+  // probing it, and new fingerprints are added to both tables, so adds are
+  // never blocked. When the migration is complete the tables are swapped, the
+  // shared memory serial number is bumped and the listener is told about the
+  // new table once.
+  //
+  // Deletions shuffle entries within probe sequences, so they first finish
+  // any migration in progress.
+
+  // Starts growing the table to |new_size| incrementally.
+  void BeginIncrementalResize(int32 new_size);
+
+  // Migrates the next step of the current table into the pending table.
+  // Returns true if this completed the resize, in which case the new table
+  // has been written to disk.
+  bool ContinueIncrementalResize();
+
+  // Migrates whatever remains of the current table and swaps in the pending
+  // table. Does nothing if no incremental resize is in progress.
+  void FinishIncrementalResize();
+
+  // Frees the pending table of an incremental resize, if any. Used when the
+  // current table is about to be replaced or cleared anyway.
+  void AbandonIncrementalResize();
+
+  // Posts OnIncrementalResizeTask to the UI thread unless it's already
+  // posted.
+  void ScheduleIncrementalResizeTask();
+
+  // Task posted to the UI thread to move an incremental resize along when no
+  // URLs are being added.
+  void OnIncrementalResizeTask();
+
+  // Adds |fingerprint| to the pending table of an incremental resize. Unlike
+  // AddFingerprint, this never notifies the listener or writes to disk.
+  void AddFingerprintToPendingTable(Fingerprint fingerprint);
+
   // Returns the desired table size for |item_count| URLs.
   uint32 NewTableSizeForCount(int32 item_count) const;
 
@@ -391,6 +538,37 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // Number of non-empty items in the table, used to compute fullness.
   int32 used_items_;
 
+  // The table being filled by an incremental resize, or NULL when no resize
+  // is in progress. It contains every fingerprint in the current table that
+  // lies before |resize_position_| as well as everything added since the
+  // resize began.
+  base::SharedMemory* pending_shared_memory_;
+  Fingerprint* pending_hash_table_;
+  int32 pending_table_length_;
+
+  // The index of the next entry of the current table to migrate.
+  int32 resize_position_;
+
+  // Set while an OnIncrementalResizeTask is posted to the UI thread.
+  bool resize_task_posted_;
+
+  // Pages of the table file that have changed since they were last written,
+  // see FlushDirtyPages.
+  std::set<int32> dirty_pages_;
+
+  // Set while an OnFlushTask is posted to the UI thread.
+  bool flush_task_posted_;
+
+  // The journal of changes not yet written to the table file. Like |file_|,
+  // this is opened on the background thread, and may be NULL before the table
+  // has first been written.
+  FILE** journal_file_;
+
+  // The current length of the journal, where the next record goes.
+  int64 journal_length_;
+
+  WriteStats write_stats_;
+
   // Testing values -----------------------------------------------------------
   //
   // The following fields exist for testing purposes. They are not used in
@@ -405,6 +583,10 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // When nonzero, overrides the table size for new databases for testing
   int32 table_size_override_;
 
+  // Tables at least this long grow incrementally. Defaults to
+  // kIncrementalResizeThreshold.
+  int32 incremental_resize_threshold_;
+
   // When set, indicates the task that should be run after the next rebuild from
   // history is complete.
   base::Closure rebuild_complete_task_;
@@ -414,6 +596,8 @@ class VisitedLinkMaster : public VisitedLinkCommon {
   // will be false in production.
   bool suppress_rebuild_;
 
+  base::WeakPtrFactory<VisitedLinkMaster> weak_ptr_factory_;
+
   DISALLOW_COPY_AND_ASSIGN(VisitedLinkMaster);
 };
 
@@ -12,6 +12,7 @@
 #include "base/shared_memory.h"
 #include "base/stringprintf.h"
 #include "base/test/test_file_util.h"
+#include "base/time.h"
 #include "chrome/browser/visitedlink/visitedlink_master.h"
 #include "googleurl/src/gurl.h"
 #include "testing/gtest/include/gtest/gtest.h"
@@ -23,6 +24,7 @@ namespace {
 // how we generate URLs, note that the two strings should be the same length
 const int add_count = 10000;
 const int load_test_add_count = 250000;
+const int big_table_add_count = 1200000;
 const char added_prefix[] = "http://www.google.com/stuff/something/foo?session=85025602345625&id=1345142319023&seq=";
 const char unadded_prefix[] = "http://www.google.org/stuff/something/foo?session=39586739476365&id=2347624314402&seq=";
 
@@ -45,6 +47,19 @@ class DummyVisitedLinkEventListener : public VisitedLinkMaster::Listener {
   }
 };
 
+// Counts the tables the master hands out, which is one per completed resize.
+class CountingVisitedLinkEventListener : public VisitedLinkMaster::Listener {
+ public:
+  CountingVisitedLinkEventListener() : new_table_count_(0) {}
+  virtual void NewTable(base::SharedMemory* table) { new_table_count_++; }
+  virtual void Add(VisitedLinkCommon::Fingerprint) {}
+  virtual void Reset() {}
+
+  int new_table_count() const { return new_table_count_; }
+
+ private:
+  int new_table_count_;
+};
 
 // this checks IsVisited for the URLs starting with the given prefix and
 // within the given range
@@ -62,6 +77,53 @@ void FillTable(VisitedLinkMaster& master, const char* prefix,
     master.AddURL(TestURL(prefix, i));
 }
 
+// Adds |count| URLs one at a time to a fresh table and logs the total and
+// worst case cost of an add, the number of resizes, and the cost of querying
+// the resulting table. |test_name| distinguishes the resize strategy.
+void TimeBigTable(int32 incremental_resize_threshold,
+                  const std::string& test_name) {
+  FilePath db_path;
+  ASSERT_TRUE(file_util::CreateTemporaryFile(&db_path));
+  CountingVisitedLinkEventListener* listener =
+      new CountingVisitedLinkEventListener;
+  VisitedLinkMaster master(listener, NULL, true, db_path, 0);
+  ASSERT_TRUE(master.Init());
+  master.set_incremental_resize_threshold(incremental_resize_threshold);
+
+  TimeDelta max_add;
+  base::TimeTicks add_start = base::TimeTicks::Now();
+  for (int i = 0; i < big_table_add_count; i++) {
+    GURL url(TestURL(added_prefix, i));
+    base::TimeTicks start = base::TimeTicks::Now();
+    master.AddURL(url);
+    max_add = std::max(max_add, base::TimeTicks::Now() - start);
+  }
+  TimeDelta total_add = base::TimeTicks::Now() - add_start;
+  LogPerfResult((test_name + "_add").c_str(), total_add.InMillisecondsF(),
+                "ms");
+  LogPerfResult((test_name + "_max_add").c_str(), max_add.InMillisecondsF(),
+                "ms");
+  LogPerfResult((test_name + "_resizes").c_str(),
+                listener->new_table_count(), "count");
+
+  const VisitedLinkMaster::WriteStats& stats = master.write_stats();
+  LogPerfResult((test_name + "_table_writes").c_str(), stats.table_writes,
+                "count");
+  LogPerfResult((test_name + "_write_amplification").c_str(),
+                static_cast<double>(stats.table_bytes_written +
+                                    stats.journal_bytes_written) /
+                    std::max<int64>(stats.bytes_dirtied, 1),
+                "ratio");
+
+  PerfTimer query_timer;
+  CheckVisited(master, added_prefix, 0, big_table_add_count);
+  CheckVisited(master, unadded_prefix, 0, big_table_add_count);
+  LogPerfResult((test_name + "_query").c_str(),
+                query_timer.Elapsed().InMillisecondsF(), "ms");
+
+  file_util::Delete(db_path, false);
+}
+
 class VisitedLink : public testing::Test {
  protected:
   FilePath db_path_;
@@ -196,3 +258,11 @@ TEST_F(VisitedLink, TestLoad) {
   LogPerfResult("Visited_link_hot_load_time",
                 hot_sum / hot_load_times.size(), "ms");
 }
+
+// Measures adding and querying more than a million links, comparing tables
+// that are rehashed all at once with ones that grow incrementally. The
+// maximum add time is dominated by the largest resize.
+TEST_F(VisitedLink, TestBigTableResizing) {
+  TimeBigTable(kint32max, "Visited_link_full_resize");
+  TimeBigTable(0, "Visited_link_incremental_resize");
+}
@@ -412,6 +412,123 @@ TEST_F(VisitedLinkTest, Resizing) {
   Reload();
 }
 
+// Tests that growing the table incrementally keeps every link visible to the
+// master and its slaves, and that slaves switch to the new table only once
+// the migration is complete.
+TEST_F(VisitedLinkTest, IncrementalResizing) {
+  const int32 initial_size = 17;
+  ASSERT_TRUE(InitVisited(initial_size, true));
+  master_->set_incremental_resize_threshold(0);
+
+  VisitedLinkSlave slave;
+  base::SharedMemoryHandle new_handle = base::SharedMemory::NULLHandle();
+  master_->shared_memory()->ShareToProcess(
+      base::GetCurrentProcessHandle(), &new_handle);
+  slave.OnUpdateVisitedLinks(new_handle);
+  g_slaves.push_back(&slave);
+
+  // Add URLs until a resize starts.
+  int added = 0;
+  while (!master_->IsResizing()) {
+    ASSERT_LT(added, g_test_count);
+    master_->AddURL(TestURL(added++));
+  }
+
+  // The slave is still reading the old table, which has everything.
+  int32 child_table_size;
+  VisitedLinkCommon::Fingerprint* child_table;
+  slave.GetUsageStatistics(&child_table_size, &child_table);
+  EXPECT_EQ(initial_size, child_table_size);
+  for (int i = 0; i < added; i++) {
+    EXPECT_TRUE(master_->IsVisited(TestURL(i)));
+    EXPECT_TRUE(slave.IsVisited(TestURL(i)));
+  }
+
+  // The posted task completes the resize and hands the slave the new table.
+  MessageLoop::current()->RunUntilIdle();
+  EXPECT_FALSE(master_->IsResizing());
+  slave.GetUsageStatistics(&child_table_size, &child_table);
+  EXPECT_GT(child_table_size, initial_size);
+
+  // Keep adding through several more resizes.
+  for (int i = added; i < g_test_count; i++) {
+    master_->AddURL(TestURL(i));
+    ASSERT_EQ(i + 1, master_->GetUsedCount());
+  }
+  MessageLoop::current()->RunUntilIdle();
+  EXPECT_FALSE(master_->IsResizing());
+
+  // The slave ends up with exactly the master's table.
+  int32 table_size;
+  VisitedLinkCommon::Fingerprint* table;
+  master_->GetUsageStatistics(&table_size, &table);
+  slave.GetUsageStatistics(&child_table_size, &child_table);
+  ASSERT_EQ(table_size, child_table_size);
+  for (int32 i = 0; i < table_size; i++)
+    ASSERT_EQ(table[i], child_table[i]);
+
+  master_->DebugValidate();
+  g_slaves.clear();
+
+  // Make sure the last table was written out.
+  Reload();
+}
+
+// Tests that adds are journaled and their pages written out in one batch.
+TEST_F(VisitedLinkTest, BatchedWrites) {
+  ASSERT_TRUE(InitVisited(0, true));
+  VisitedLinkMaster::WriteStats initial_stats = master_->write_stats();
+
+  for (int i = 0; i < g_test_count; i++)
+    master_->AddURL(TestURL(i));
+
+  // Nothing has been written to the table yet, only to the journal.
+  VisitedLinkMaster::WriteStats stats = master_->write_stats();
+  EXPECT_EQ(initial_stats.table_writes, stats.table_writes);
+  EXPECT_GT(stats.journal_bytes_written, initial_stats.journal_bytes_written);
+  EXPECT_GT(stats.bytes_dirtied, initial_stats.bytes_dirtied);
+
+  // Flushing coalesces the changes into far fewer writes than there were
+  // adds, each of which used to write the used count and the new entry.
+  master_->FlushDirtyPages();
+  stats = master_->write_stats();
+  EXPECT_EQ(initial_stats.batch_flushes + 1, stats.batch_flushes);
+  EXPECT_GT(stats.table_writes, initial_stats.table_writes);
+  EXPECT_LT(stats.table_writes - initial_stats.table_writes, g_test_count);
+
+  Reload();
+}
+
+// Tests that changes which only made it to the journal are recovered.
+TEST_F(VisitedLinkTest, JournalReplay) {
+  ASSERT_TRUE(InitVisited(0, true));
+  for (int i = 0; i <= g_test_count; i++)
+    master_->AddURL(TestURL(i));
+  URLs urls_to_delete;
+  urls_to_delete.push_back(TestURL(g_test_count));
+  TestURLIterator iterator(urls_to_delete);
+  master_->DeleteURLs(&iterator);
+
+  // Let the journal reach the disk, but not the dirty table pages.
+  BrowserThread::GetBlockingPool()->FlushForTesting();
+  EXPECT_EQ(0, master_->write_stats().batch_flushes);
+
+  // Simulate a crash by putting back the files as they are now after the
+  // master has shut down cleanly.
+  FilePath journal_file(visited_file_.value() + FILE_PATH_LITERAL("-journal"));
+  FilePath saved_visited_file = history_dir_.AppendASCII("SavedVisitedLinks");
+  FilePath saved_journal_file = history_dir_.AppendASCII("SavedJournal");
+  ASSERT_TRUE(file_util::CopyFile(visited_file_, saved_visited_file));
+  ASSERT_TRUE(file_util::CopyFile(journal_file, saved_journal_file));
+  ClearDB();
+  ASSERT_TRUE(file_util::CopyFile(saved_visited_file, visited_file_));
+  ASSERT_TRUE(file_util::CopyFile(saved_journal_file, journal_file));
+
+  // All the adds should be back, but not the deleted URL.
+  Reload();
+  EXPECT_FALSE(master_->IsVisited(TestURL(g_test_count)));
+}
+
 // Tests that if the database doesn't exist, it will be rebuilt from history.
 TEST_F(VisitedLinkTest, Rebuild) {
   // Add half of our URLs to history. This needs to be done before we